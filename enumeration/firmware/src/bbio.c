@@ -1,7 +1,16 @@
+#define LOG_MODULE  LOG_MODULE_BBIO
+
 #include <stdbool.h>
 #include <string.h>
 
+#include "capture.h"
+#include "highcode.h"
+#include "link.h"
 #include "log.h"
+#include "profile.h"
+#include "progress.h"
+#include "responder.h"
+#include "stats.h"
 #include "usb20.h"
 
 #include "bbio.h"
@@ -9,7 +18,6 @@
 
 /* macros */
 #define _DESCRIPTOR_STORE_CAPACITY (4096)
-#define _DESCRIPTOR_STRING_CAPACITY (10)
 
 /* variables */
 
@@ -21,19 +29,32 @@ uint8_t *g_bbioDescriptorDevice;
 uint8_t *g_bbioDescriptorConfiguration;
 uint8_t *g_bbioDescriptorHidReport;
 uint8_t *g_bbioDescriptorHubReport;
-uint8_t *g_bbioDescriptorsString[_DESCRIPTOR_STRING_CAPACITY];
+const char *g_bbioDescriptorsString[USB20_STRINGS_CAPACITY];
+uint8_t *g_bbioDescriptorQualifier;
+uint8_t *g_bbioDescriptorOtherSpeed;
+uint8_t *g_bbioDescriptorBos;
 
 uint16_t g_bbioDescriptorDeviceSize;
 uint16_t g_bbioDescriptorConfigurationSize;
 uint16_t g_bbioDescriptorHidReportSize;
 uint16_t g_bbioDescriptorHubReportSize;
-uint16_t g_bbioDescriptorsStringSizes[_DESCRIPTOR_STRING_CAPACITY];
+uint16_t g_bbioDescriptorsStringSizes[USB20_STRINGS_CAPACITY];
+uint16_t g_bbioDescriptorOtherSpeedSize;
+
+uint8_t g_bbioReply[BBIO_REPLY_CAPACITY];
+uint16_t g_bbioReplySize = 0;
 
 /* internal variables */
 static uint8_t _command          = 0;   // 0 : If not set, else the value of the enum BbioCommand
 static uint8_t _subCommand       = 0;   // 0 : If not set, else the value of the enum BbioSubCommand
 static uint8_t _descrStringIndex = 0;
 static uint16_t _descrSize       = 0;
+static uint32_t _logMask         = 0;
+static uint32_t _profilePeriodUs = 0;
+static uint32_t _busIdleWindowUs = 0;
+static uint32_t _criterion       = 0;   // enum ProgressCriterion | window in ms << 8
+static uint32_t _capture         = 0;
+static uint8_t _speed            = BbioSpeedHigh;
 
 /* _descriptorsStore is our "free store", it is a memory pool dedicated to
  * descriptors the user will load
@@ -54,50 +75,89 @@ static uint8_t *_descriptorsStoreCursor = _descriptorsStore;
  *
  * @return  0 if Success, an error code else
  */
-uint8_t
+HIGHCODE uint8_t
 bbio_command_decode(uint8_t *command)
 {
-    // log_to_evaluator("bbio_command_decode()\r\n");
+    LOG_TRACE("bbio_command_decode()\r\n");
    /* Reminder of the structure of a bbio command :
     * command[0] = BbioCommand
     * command[1] = BbioSubCommand                   Valid only when BbioCommand = BbioSetDescr
     * command[2] = Index of the given descriptor    Valid only when BbioCommand = BbioSetDescr
     * command[3] = Size of descriptor (L)           Valid only when BbioCommand = BbioSetDescr
     * command[4] = Size of descriptor (H)           Valid only when BbioCommand = BbioSetDescr
+    * command[1..4] = Log mask (little endian)      Valid only when BbioCommand = BbioSetLogMask
+    * command[1..4] = Period in us (little endian)  Valid only when BbioCommand = BbioSetProfile
+    * command[1..4] = Window in us (little endian)  Valid only when BbioCommand = BbioGetBusIdle
+    * command[1]    = Criterion                     Valid only when BbioCommand = BbioSetCriterion
+    * command[2..4] = Window in ms (little endian)  Valid only when BbioCommand = BbioSetCriterion
+    * command[1..4] = 1 to capture, 0 to stop       Valid only when BbioCommand = BbioSetCapture
+    * command[1..4] = Speed, see enum BbioSpeed     Valid only when BbioCommand = BbioConnect
     */
     // Reset internal variables.
     _command = 0;
     _subCommand = 0;
     _descrStringIndex = 0;
     _descrSize = 0;
+    g_bbioReplySize = 0;
 
         // Safeguard
-    if (command[0] >= BbioMainMode && command[0] <= BbioResetDescr) {
+    if (command[0] >= BbioMainMode && command[0] <= BbioGetRequests) {
         _command = command[0];
     } else {
-        log_to_evaluator("ERROR: bbio_decode_command() unknown command\r\n");
+        LOG_ERROR("bbio_decode_command() unknown command\r\n");
         return 1;
     }
 
     if (_command == BbioSetDescr) {
         // Safeguard
-        if (command[1] >= BbioSubSetDescrDevice && command[1] <= BbioSubSetDescrString) {
+        if (command[1] >= BbioSubSetDescrDevice && command[1] <= BbioSubSetDescrBos) {
             _subCommand = command[1];
         } else {
-            log_to_evaluator("ERROR: bbio_decode_command() unknown sub command\r\n");
+            LOG_ERROR("bbio_decode_command() unknown sub command\r\n");
             return 2;
         }
     }
 
     if (_subCommand == BbioSubSetDescrString) {
         // Safeguard
-        if (command[2] >= _DESCRIPTOR_STRING_CAPACITY) {
-            log_to_evaluator("ERROR: bbio_decode_command() string descriptor index out of range\r\n");
+        // The index 0 (LANGID) is synthesised
+        if (command[2] == 0 || command[2] >= USB20_STRINGS_CAPACITY) {
+            LOG_ERROR("bbio_decode_command() string descriptor index out of range\r\n");
             return 3;
         }
         _descrStringIndex = command[2];
     }
 
+    if (_command == BbioSetLogMask) {
+        _logMask = command[1] | (command[2] << 8) | (command[3] << 16) | ((uint32_t)command[4] << 24);
+        return 0;
+    }
+    if (_command == BbioSetProfile) {
+        _profilePeriodUs = command[1] | (command[2] << 8) | (command[3] << 16) | ((uint32_t)command[4] << 24);
+        return 0;
+    }
+    if (_command == BbioGetBusIdle) {
+        _busIdleWindowUs = command[1] | (command[2] << 8) | (command[3] << 16) | ((uint32_t)command[4] << 24);
+        return 0;
+    }
+    if (_command == BbioSetCriterion) {
+        _criterion = command[1] | (command[2] << 8) | (command[3] << 16) | ((uint32_t)command[4] << 24);
+        return 0;
+    }
+    if (_command == BbioSetCapture) {
+        _capture = command[1] | (command[2] << 8) | (command[3] << 16) | ((uint32_t)command[4] << 24);
+        return 0;
+    }
+    if (_command == BbioConnect) {
+        // Safeguard
+        if (command[1] >= BbioSpeedCount || command[2] || command[3] || command[4]) {
+            LOG_ERROR("bbio_decode_command() unknown speed\r\n");
+            return 4;
+        }
+        _speed = command[1];
+        return 0;
+    }
+
     _descrSize = (command[4] << 8) | command[3]; // from 2 uint8_t to a uint16_t
     return 0;
 }
@@ -109,10 +169,10 @@ bbio_command_decode(uint8_t *command)
  *
  * @return  0 if Success, an error code else
  */
-uint8_t
+HIGHCODE uint8_t
 bbio_command_handle(uint8_t *bufferData)
 {
-    // log_to_evaluator("bbio_command_handle()\r\n");
+    LOG_TRACE("bbio_command_handle()\r\n");
     switch (_command) {
     case BbioMainMode:
         /* Not implemented yet */
@@ -121,14 +181,13 @@ bbio_command_handle(uint8_t *bufferData)
         /* Not implemented yet */
         return 2;
     case BbioSetDescr:
-        bbio_command_set_descriptor_handle(bufferData);
-        return 0;
+        return bbio_command_set_descriptor_handle(bufferData);
     case BbioSetEndp:
         bbio_command_set_endpoints_handle(bufferData);
         return 0;
     case BbioConnect:
         g_descriptorConfigCustomSize = g_bbioDescriptorConfigurationSize;
-        g_usb20Speed = SpeedHigh;
+        g_usb20Speed = _speed == BbioSpeedLow ? SpeedLow : _speed == BbioSpeedFull ? SpeedFull : SpeedHigh;
 
         // Filling structures "describing" our USB peripheral
         g_descriptorDevice    = g_bbioDescriptorDevice;
@@ -136,8 +195,22 @@ bbio_command_handle(uint8_t *bufferData)
         g_descriptorHidReport = g_bbioDescriptorHidReport;
         g_descriptorHubReport = g_bbioDescriptorHubReport;
         g_descriptorStrings   = g_bbioDescriptorsString;
+        g_descriptorStringsCount = USB20_STRINGS_CAPACITY;
+        g_descriptorQualifier      = g_bbioDescriptorQualifier;
+        g_descriptorOtherSpeed     = g_bbioDescriptorOtherSpeed;
+        g_descriptorOtherSpeedSize = g_bbioDescriptorOtherSpeedSize;
+        g_descriptorBos            = g_bbioDescriptorBos;
+        if (usb20_descriptors_check(g_usb20Speed)) {
+            LOG_ERROR("bbio_command_handle() descriptors invalid at this speed\r\n");
+            return BBIO_CONNECT_INVALID;
+        }
+        g_usb20Ep0MaxSize = g_descriptorDevice[7];
+        usb20_descriptors_derive(g_usb20Speed);
+        // The placeholders of the strings read differently at each connection
+        usb20_serial_next();
 
         g_doesToeSupportCurrentDevice = false;  // Reset the value
+        progress_reset();
         usb20_registers_init(g_usb20Speed);
         return 0;
     case BbioGetStatus:
@@ -145,23 +218,94 @@ bbio_command_handle(uint8_t *bufferData)
     case BbioDisconnect:
         g_doesToeSupportCurrentDevice = false;
         usb20_registers_deinit();
+        progress_disconnect();
         return 0;
     case BbioResetDescr:
         g_descriptorDevice  = NULL;
         g_descriptorConfig  = NULL;
         g_descriptorStrings = NULL;
+        g_descriptorQualifier  = NULL;
+        g_descriptorOtherSpeed = NULL;
+        g_descriptorBos        = NULL;
 
         g_bbioDescriptorDevice = NULL;
         g_bbioDescriptorConfiguration = NULL;
-        for (uint8_t i = 0; i < _DESCRIPTOR_STRING_CAPACITY; ++i) {
+        g_bbioDescriptorQualifier  = NULL;
+        g_bbioDescriptorOtherSpeed = NULL;
+        g_bbioDescriptorBos        = NULL;
+        for (uint8_t i = 0; i < USB20_STRINGS_CAPACITY; ++i) {
             g_bbioDescriptorsString[i] = NULL;
         }
 
         memset(_descriptorsStore, 0, _DESCRIPTOR_STORE_CAPACITY);
         _descriptorsStoreCursor = _descriptorsStore;
+        // The responses of the rules were in the store
+        responder_reset();
+        return 0;
+    case BbioGetLinkHealth:
+        // The top board appends its own block, see SERDES_IRQHandler()
+        g_bbioReply[1] = StatsKindLinkHealth;
+        g_bbioReplySize = 2 + stats_block_fill(StatsKindLinkHealth, StatsBoardBottom, g_bbioReply + 2, BBIO_REPLY_CAPACITY - 2);
+        return 0;
+    case BbioLinkRetrain:
+        // Done from the main loop once the return code is sent, the top board
+        // is notified by link_poll()
+        link_retrain_request(LinkRetrainReasonHost);
+        return 0;
+    case BbioSetLogMask:
+        // The top board applies the mask of the bottom board block, then
+        // appends its own block, see SERDES_IRQHandler()
+        g_logMask = _logMask;
+        g_bbioReply[1] = StatsKindLogMask;
+        g_bbioReplySize = 2 + stats_block_fill(StatsKindLogMask, StatsBoardBottom, g_bbioReply + 2, BBIO_REPLY_CAPACITY - 2);
+        return 0;
+    case BbioGetTrace:
+        // The top board appends its own block, see SERDES_IRQHandler(), the
+        // host sends the command until no event is pending
+        g_bbioReply[1] = StatsKindTrace;
+        g_bbioReplySize = 2 + stats_block_fill(StatsKindTrace, StatsBoardBottom, g_bbioReply + 2, BBIO_REPLY_CAPACITY - 2);
+        return 0;
+    case BbioGetIrqStats:
+        // The top board appends its own block, see SERDES_IRQHandler(), the
+        // statistics restart from zero
+        g_bbioReply[1] = StatsKindIrq;
+        g_bbioReplySize = 2 + stats_block_fill(StatsKindIrq, StatsBoardBottom, g_bbioReply + 2, BBIO_REPLY_CAPACITY - 2);
+        return 0;
+    case BbioSetProfile:
+        // The top board applies the period of the bottom board block, then
+        // appends its own block, see SERDES_IRQHandler()
+        profile_period_set(_profilePeriodUs);
+        g_bbioReply[1] = StatsKindProfile;
+        g_bbioReplySize = 2 + stats_block_fill(StatsKindProfile, StatsBoardBottom, g_bbioReply + 2, BBIO_REPLY_CAPACITY - 2);
+        return 0;
+    case BbioGetStack:
+        // The top board appends its own block, see SERDES_IRQHandler(), the
+        // worst cases are kept since boot
+        g_bbioReply[1] = StatsKindStack;
+        g_bbioReplySize = 2 + stats_block_fill(StatsKindStack, StatsBoardBottom, g_bbioReply + 2, BBIO_REPLY_CAPACITY - 2);
+        return 0;
+    case BbioGetProgress:
+        // Only the block of this board is meaningful, the top board does not
+        // emulate the device
+        g_bbioReply[1] = StatsKindProgress;
+        g_bbioReplySize = 2 + stats_block_fill(StatsKindProgress, StatsBoardBottom, g_bbioReply + 2, BBIO_REPLY_CAPACITY - 2);
+        return 0;
+    case BbioGetBusIdle:
+        // Like BbioGetStatus, the state is the return code
+        return progress_bus_is_idle(_busIdleWindowUs);
+    case BbioSetCriterion:
+        return progress_criterion_set(_criterion & 0xFF, _criterion >> 8);
+    case BbioSetCapture:
+        // Only the bottom board sees the ToE
+        capture_enable(_capture != 0);
+        return 0;
+    case BbioGetRequests:
+        // Only the block of this board is meaningful, see BbioGetProgress
+        g_bbioReply[1] = StatsKindRequests;
+        g_bbioReplySize = 2 + stats_block_fill(StatsKindRequests, StatsBoardBottom, g_bbioReply + 2, BBIO_REPLY_CAPACITY - 2);
         return 0;
     default:
-        log_to_evaluator("ERROR: bbio_command_handle() unknown command\r\n");
+        LOG_ERROR("bbio_command_handle() unknown command\r\n");
         return 3;
     }
 }
@@ -175,14 +319,15 @@ bbio_command_handle(uint8_t *bufferData)
 uint8_t
 bbio_command_set_descriptor_handle(uint8_t *bufferData)
 {
-    // log_to_evaluator("bbio_command_set_descriptor_handle()\r\n");
+    LOG_TRACE("bbio_command_set_descriptor_handle()\r\n");
     // Safeguards
-    if (_descriptorsStoreCursor + _descrSize > _descriptorsStore + _DESCRIPTOR_STORE_CAPACITY) {
-        log_to_evaluator("ERROR: bbio_handle_command() No space left in the descriptor store\r\n");
+    // A string is stored NUL-terminated
+    if (_descriptorsStoreCursor + _descrSize + (_subCommand == BbioSubSetDescrString) > _descriptorsStore + _DESCRIPTOR_STORE_CAPACITY) {
+        LOG_ERROR("bbio_handle_command() No space left in the descriptor store\r\n");
         return 1;
     }
-    if (_descrStringIndex >= _DESCRIPTOR_STRING_CAPACITY) {
-        log_to_evaluator("ERROR: bbio_handle_command() string descriptor index out of range\r\n");
+    if (_descrStringIndex >= USB20_STRINGS_CAPACITY) {
+        LOG_ERROR("bbio_handle_command() string descriptor index out of range\r\n");
         return 2;
     }
 
@@ -207,16 +352,33 @@ bbio_command_set_descriptor_handle(uint8_t *bufferData)
         g_bbioDescriptorHubReportSize = _descrSize;
     }
     else if (_subCommand == BbioSubSetDescrString) { 
-        // String descriptor
-        g_bbioDescriptorsString[_descrStringIndex]      = _descriptorsStoreCursor;
+        // String descriptor, its UTF-8 text
+        g_bbioDescriptorsString[_descrStringIndex]      = (const char *)_descriptorsStoreCursor;
         g_bbioDescriptorsStringSizes[_descrStringIndex] = _descrSize;
+    } else if (_subCommand == BbioSubSetDescrQualifier) {
+        g_bbioDescriptorQualifier = _descriptorsStoreCursor;
+    } else if (_subCommand == BbioSubSetDescrOtherSpeed) {
+        g_bbioDescriptorOtherSpeed     = _descriptorsStoreCursor;
+        g_bbioDescriptorOtherSpeedSize = _descrSize;
+    } else if (_subCommand == BbioSubSetDescrBos) {
+        g_bbioDescriptorBos = _descriptorsStoreCursor;
+    } else if (_subCommand == BbioSubSetDescrResponder) {
+        // A rule of the class and vendor requests, its response stays in the
+        // store
+        if (responder_rule_add(bufferData, _descrSize, _descriptorsStoreCursor + RESPONDER_RULE_HEADER_SIZE)) {
+            LOG_ERROR("bbio_handle_command() responder rule rejected\r\n");
+            return BBIO_RESPONDER_REJECTED;
+        }
     } else {
-        log_to_evaluator("ERROR: bbio_handle_command() unknown sub command\r\n");
+        LOG_ERROR("bbio_handle_command() unknown sub command\r\n");
         return 3;
     }
 
     memcpy(_descriptorsStoreCursor, bufferData, _descrSize);
     _descriptorsStoreCursor += _descrSize;
+    if (_subCommand == BbioSubSetDescrString) {
+        *_descriptorsStoreCursor++ = '\0';
+    }
 
     return 0;
 }
@@ -230,7 +392,7 @@ bbio_command_set_descriptor_handle(uint8_t *bufferData)
 uint8_t
 bbio_command_set_endpoints_handle(uint8_t *bufferEndpoints)
 {
-    // log_to_evaluator("bbio_command_set_endpoints_handle()\r\n");
+    LOG_TRACE("bbio_command_set_endpoints_handle()\r\n");
     // This function will enable endpoints with the right mode
     // (isochronous/bulk/interrupt)
     // The data is encoded in 1 byte :
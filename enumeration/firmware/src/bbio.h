@@ -7,7 +7,15 @@
 #include "usb20.h"
 
 /* macros */
-
+/* A reply is at most one USB2.0 HS bulk packet on endpoint 1, it is completed
+ * by the top board, see SERDES_IRQHandler() */
+#define BBIO_REPLY_CAPACITY (512)
+/* Second return code of BbioConnect when the descriptors are not valid at the
+ * speed requested, see usb20_descriptors_check() */
+#define BBIO_CONNECT_INVALID (2)
+/* Second return code of BbioSubSetDescrResponder when the rule is rejected,
+ * see responder_rule_add() */
+#define BBIO_RESPONDER_REJECTED (4)
 
 /* enums */
 enum BbioCommand {
@@ -19,6 +27,26 @@ enum BbioCommand {
     BbioGetStatus     = 0b00000110,
     BbioDisconnect    = 0b00000111,
     BbioResetDescr    = 0b00001000,
+    BbioGetLinkHealth = 0b00001001,
+    BbioLinkRetrain   = 0b00001010,
+    BbioSetLogMask    = 0b00001011,
+    BbioGetTrace      = 0b00001100,
+    BbioGetIrqStats   = 0b00001101,
+    BbioSetProfile    = 0b00001110,
+    BbioGetStack      = 0b00001111,
+    BbioGetProgress   = 0b00010000,
+    BbioGetBusIdle    = 0b00010001,
+    BbioSetCriterion  = 0b00010010,
+    BbioSetCapture    = 0b00010011,
+    BbioGetRequests   = 0b00010100,
+};
+
+/* Speed of BbioConnect */
+enum BbioSpeed {
+    BbioSpeedHigh = 0,
+    BbioSpeedFull = 1,
+    BbioSpeedLow  = 2,
+    BbioSpeedCount,
 };
 
 enum BbioSubCommand {
@@ -29,6 +57,10 @@ enum BbioSubCommand {
     BbioSubSetDescrHubReport   = 0b00000101,
     BbioSubSetDescrEndpoint    = 0b00000110,
     BbioSubSetDescrString      = 0b00000111,
+    BbioSubSetDescrResponder   = 0b00001000,
+    BbioSubSetDescrQualifier   = 0b00001001,
+    BbioSubSetDescrOtherSpeed  = 0b00001010,
+    BbioSubSetDescrBos         = 0b00001011,
 };
 
 /* variables */
@@ -43,13 +75,27 @@ extern uint8_t *g_bbioDescriptorDevice;
 extern uint8_t *g_bbioDescriptorConfiguration;
 extern uint8_t *g_bbioDescriptorHidReport;
 extern uint8_t *g_bbioDescriptorHubReport;
-extern uint8_t *g_bbioDescriptorsString[];
+extern const char *g_bbioDescriptorsString[];
+/* NULL if not uploaded, usb20_descriptors_derive() then builds them */
+extern uint8_t *g_bbioDescriptorQualifier;
+extern uint8_t *g_bbioDescriptorOtherSpeed;
+extern uint8_t *g_bbioDescriptorBos;
 
 extern uint16_t g_bbioDescriptorDeviceSize;
 extern uint16_t g_bbioDescriptorConfigurationSize;
 extern uint16_t g_bbioDescriptorHidReportSize;
 extern uint16_t g_bbioDescriptorHubReportSize;
 extern uint16_t g_bbioDescriptorsStringSizes[];
+extern uint16_t g_bbioDescriptorOtherSpeedSize;
+
+/* Reply of the commands returning more than a return code (statistics...)
+ * g_bbioReply[0] is the return code, g_bbioReply[1] the kind of statistics,
+ * then the blocks, see src/stats.h
+ * When g_bbioReplySize is not 0 the reply is sent on SerdesChannelStats instead
+ * of the return code alone
+ */
+extern uint8_t g_bbioReply[BBIO_REPLY_CAPACITY];
+extern uint16_t g_bbioReplySize;
 
 
 /* functions declaration */
@@ -0,0 +1,179 @@
+#include <string.h>
+
+#include "CH56xSFR.h"
+#include "CH56x_common.h"
+
+#include "highcode.h"
+#include "log.h"
+
+#include "capture.h"
+
+
+/* internal variables */
+/* Set by a link interrupt, read by the USB interrupt */
+static volatile bool _isEnabled = false;
+
+
+/* functions implementation */
+
+/* @fn      capture_enable
+ *
+ * @brief   Start or stop capturing the transactions of the ToE
+ *
+ * @return  None
+ */
+void
+capture_enable(bool isEnabled)
+{
+    _isEnabled = isEnabled;
+}
+
+/* @fn      capture_setup
+ *
+ * @brief   Record a SETUP packet
+ *
+ * @return  None
+ */
+HIGHCODE void
+capture_setup(const void *setup)
+{
+    uint32_t words[2];
+
+    if (!_isEnabled) {
+        return;
+    }
+
+    memcpy(words, setup, sizeof(words));
+    // Not masked by g_logMask, the host-controller collects them
+    LOG_BIN(CAPTURE_SETUP_FORMAT, words[0], words[1]);
+}
+
+/* @fn      capture_bus_reset
+ *
+ * @brief   Record a bus reset
+ *
+ * @return  None
+ */
+HIGHCODE void
+capture_bus_reset(void)
+{
+    if (!_isEnabled) {
+        return;
+    }
+
+    LOG_BIN(CAPTURE_RESET_FORMAT);
+}
+
+/* @fn      _capture_in_state
+ *
+ * @brief   Get the length sent and the handshake of an IN endpoint
+ *          Only used internally
+ *
+ * @return  The length, the TX_CTRL register through txCtrl
+ */
+static HIGHCODE uint16_t
+_capture_in_state(uint8_t endpoint, uint8_t *txCtrl)
+{
+    switch (endpoint) {
+    case 0:
+        *txCtrl = R8_UEP0_TX_CTRL;
+        return R16_UEP0_T_LEN;
+    case 1:
+        *txCtrl = R8_UEP1_TX_CTRL;
+        return R16_UEP1_T_LEN;
+    case 2:
+        *txCtrl = R8_UEP2_TX_CTRL;
+        return R16_UEP2_T_LEN;
+    case 3:
+        *txCtrl = R8_UEP3_TX_CTRL;
+        return R16_UEP3_T_LEN;
+    case 4:
+        *txCtrl = R8_UEP4_TX_CTRL;
+        return R16_UEP4_T_LEN;
+    case 5:
+        *txCtrl = R8_UEP5_TX_CTRL;
+        return R16_UEP5_T_LEN;
+    case 6:
+        *txCtrl = R8_UEP6_TX_CTRL;
+        return R16_UEP6_T_LEN;
+    case 7:
+        *txCtrl = R8_UEP7_TX_CTRL;
+        return R16_UEP7_T_LEN;
+    default:
+        *txCtrl = 0;
+        return 0;
+    }
+}
+
+/* @fn      _capture_out_ctrl
+ *
+ * @brief   Get the RX_CTRL register of an OUT endpoint
+ *          Only used internally
+ *
+ * @return  The register
+ */
+static HIGHCODE uint8_t
+_capture_out_ctrl(uint8_t endpoint)
+{
+    switch (endpoint) {
+    case 0:
+        return R8_UEP0_RX_CTRL;
+    case 1:
+        return R8_UEP1_RX_CTRL;
+    case 2:
+        return R8_UEP2_RX_CTRL;
+    case 3:
+        return R8_UEP3_RX_CTRL;
+    case 4:
+        return R8_UEP4_RX_CTRL;
+    case 5:
+        return R8_UEP5_RX_CTRL;
+    case 6:
+        return R8_UEP6_RX_CTRL;
+    case 7:
+        return R8_UEP7_RX_CTRL;
+    default:
+        return 0;
+    }
+}
+
+/* @fn      capture_transaction
+ *
+ * @brief   Record the transaction which raised the USB interrupt
+ *
+ * @return  None
+ */
+HIGHCODE void
+capture_transaction(uint8_t endpoint, uint8_t token)
+{
+    uint32_t transaction = endpoint & CAPTURE_TRANSACTION_ENDPOINT_MASK;
+    enum CaptureResponse response = CaptureResponseAck;
+    uint16_t length;
+    uint8_t ctrl;
+
+    if (!_isEnabled) {
+        return;
+    }
+
+    if (token == UIS_TOKEN_IN) {
+        length = _capture_in_state(endpoint, &ctrl);
+        if ((ctrl & RB_UEP_TRES_MASK) == UEP_T_RES_STALL) {
+            response = CaptureResponseStall;
+        } else if ((ctrl & RB_UEP_TRES_MASK) == UEP_T_RES_NAK) {
+            response = CaptureResponseNak;
+        }
+        transaction |= CAPTURE_TRANSACTION_IN;
+    } else {
+        length = R16_USB_RX_LEN;
+        ctrl = _capture_out_ctrl(endpoint);
+        if ((ctrl & RB_UEP_RRES_MASK) == UEP_R_RES_STALL) {
+            response = CaptureResponseStall;
+        } else if ((ctrl & RB_UEP_RRES_MASK) == UEP_R_RES_NAK) {
+            response = CaptureResponseNak;
+        }
+    }
+    transaction |= response << CAPTURE_TRANSACTION_RESPONSE_SHIFT;
+    transaction |= (uint32_t)length << CAPTURE_TRANSACTION_LENGTH_SHIFT;
+
+    LOG_BIN(CAPTURE_TRANSACTION_FORMAT, transaction);
+}
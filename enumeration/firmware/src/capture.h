@@ -0,0 +1,77 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* macros */
+/* The transactions of the ToE with the emulated device are sent with the logs,
+ * as binary records of these formats (see LOG_BIN()). Must match
+ * host-controller/log_decoder.h
+ * - Setup: the 8 bytes of the SETUP packet, as 2 little endian words
+ * - Transaction: CAPTURE_TRANSACTION_*, one per transaction completed on an
+ *   endpoint
+ * - Bus reset: no argument, the device is back to the address 0
+ * The timestamp of the record is the time of the transaction */
+#define CAPTURE_SETUP_FORMAT        "USB setup %08x %08x\r\n"
+#define CAPTURE_TRANSACTION_FORMAT  "USB transaction %08x\r\n"
+#define CAPTURE_RESET_FORMAT        "USB bus reset\r\n"
+
+/* Fields of the argument of a transaction record */
+#define CAPTURE_TRANSACTION_ENDPOINT_MASK   (0x0F)
+#define CAPTURE_TRANSACTION_IN              (0x80)
+#define CAPTURE_TRANSACTION_RESPONSE_SHIFT  (8)     // enum CaptureResponse
+#define CAPTURE_TRANSACTION_LENGTH_SHIFT    (16)
+
+/* enums */
+/* The handshake the endpoint was set to answer, must match
+ * host-controller/capture.h */
+enum CaptureResponse {
+    CaptureResponseAck      = 0,
+    CaptureResponseNak      = 1,
+    CaptureResponseStall    = 2,
+};
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : capture_enable
+ * Description    : Start or stop capturing the transactions of the ToE
+ *                  (BbioSetCapture). Disabled at boot
+ * Input          : true to capture, false else
+ * Return         : None
+ *******************************************************************************/
+void capture_enable(bool isEnabled);
+
+/*******************************************************************************
+ * Function Name  : capture_setup
+ * Description    : Record a SETUP packet, if capturing. Must only be called
+ *                  from the USB interrupt
+ * Input          : The 8 bytes of the SETUP packet
+ * Return         : None
+ *******************************************************************************/
+void capture_setup(const void *setup);
+
+/*******************************************************************************
+ * Function Name  : capture_bus_reset
+ * Description    : Record a bus reset, if capturing. Must only be called from
+ *                  the USB interrupt
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void capture_bus_reset(void);
+
+/*******************************************************************************
+ * Function Name  : capture_transaction
+ * Description    : Record the transaction which raised the USB interrupt, if
+ *                  capturing: its length and the handshake of the endpoint are
+ *                  read from the registers, before the handler updates them.
+ *                  Must only be called from the USB interrupt
+ * Input          : - endpoint: The endpoint number
+ *                  - token: UIS_TOKEN_IN or UIS_TOKEN_OUT
+ * Return         : None
+ *******************************************************************************/
+void capture_transaction(uint8_t endpoint, uint8_t token);
+
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,30 @@
+#include "highcode.h"
+
+
+/* functions implementation */
+
+/* @fn      highcode_init
+ *
+ * @brief   Copy the .highcode section from its load address (flash) to its
+ *          run address (RAMX), then zero the .ramxbss section. Word copy,
+ *          both ends of the sections are aligned on 4 bytes by the linker
+ *          script
+ *
+ * @return  None
+ */
+void
+highcode_init(void)
+{
+    uint32_t *src = _highcode_lma;
+    uint32_t *dst = _highcode_vma_start;
+
+    while (dst < _highcode_vma_end) {
+        *dst++ = *src++;
+    }
+    for (dst = _ramxbss_start; dst < _ramxbss_end; ++dst) {
+        *dst = 0;
+    }
+
+    // Make sure the copy is complete before the first instruction fetch
+    __asm__ volatile ("fence" ::: "memory");
+}
@@ -0,0 +1,51 @@
+#ifndef HIGHCODE_H
+#define HIGHCODE_H
+
+#include "CH56xSFR.h"
+#include "CH56x_common.h"
+
+/* macros */
+/* Place a function in the .highcode section : it is linked in RAMX and copied
+ * from the flash by highcode_init(), so it is fetched without wait states.
+ * Reserved to the interrupt handlers and the functions they call on every
+ * transfer, RAMX is shared with the DMA buffers (see .ld).
+ * The placement is printed by the build, see $(PROJECT).highcode in the
+ * Makefile. HIGHCODE_FLASH=1 leaves these functions in the flash, to compare
+ * the durations of the handlers (BbioGetIrqStats) with both placements */
+#ifndef HIGHCODE_FLASH
+#define HIGHCODE_FLASH  (0)
+#endif
+
+#if HIGHCODE_FLASH
+#define HIGHCODE
+#else
+#define HIGHCODE    __attribute__((section(".highcode")))
+#endif
+/* Place a variable in the .ramxbss section : it is linked in RAMX and zeroed
+ * by highcode_init(), like .bss. For the state which does not fit in RAM and
+ * is not accessed by DMA (the DMA buffers are in .DMADATA) */
+#define RAMX_BSS    __attribute__((section(".ramxbss")))
+
+/* variables */
+/* Defined by the linker script */
+extern uint32_t _highcode_lma[];
+extern uint32_t _highcode_vma_start[];
+extern uint32_t _highcode_vma_end[];
+extern uint32_t _ramxbss_start[];
+extern uint32_t _ramxbss_end[];
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : highcode_init
+ * Description    : Copy the .highcode section from the flash to RAMX and zero
+ *                  the .ramxbss section. Must be called first in main(),
+ *                  before any HIGHCODE function is called or RAMX_BSS
+ *                  variable is used, and before the interrupts are enabled
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void highcode_init(void);
+
+
+#endif /* HIGHCODE_H */
@@ -1,3 +1,7 @@
+#define LOG_MODULE  LOG_MODULE_LINK
+
+#include "highcode.h"
+
 #include "hspi.h"
 
 /* variables */
@@ -31,7 +35,7 @@ hspi_wait_for_tx(uint16_t sizeTransmission)
  *
  * @return  Return 0b0010 if CRC_ERR, 0b0100 if NUM_MIS, 0 else
  */
-uint8_t
+HIGHCODE uint8_t
 hspi_get_rtx_status(void)
 {
     return R8_HSPI_RTX_STATUS & (RB_HSPI_CRC_ERR | RB_HSPI_NUM_MIS);
@@ -45,7 +49,7 @@ hspi_get_rtx_status(void)
  * @return  Return the buffer that will be used for the next transmission over
  *          HSPI
  */
-uint8_t *
+HIGHCODE uint8_t *
 hspi_get_buffer_next_tx(void)
 {
     uint8_t *bufferTx = hspiDmaAddr0;
@@ -64,7 +68,7 @@ hspi_get_buffer_next_tx(void)
  * @return  Return the buffer that was used for the previous transmission over
  *          HSPI
  */
-uint8_t *
+HIGHCODE uint8_t *
 hspi_get_buffer_tx(void)
 {
     // R8_HSPI_TX_SC stores the buffer that will be used for the next
@@ -84,7 +88,7 @@ hspi_get_buffer_tx(void)
  * @return  Return the buffer that will be used for the next reception over
  *          HSPI
  */
-uint8_t *
+HIGHCODE uint8_t *
 hspi_get_buffer_next_rx(void)
 {
     uint8_t *bufferRx = hspiDmaAddr0;
@@ -102,7 +106,7 @@ hspi_get_buffer_next_rx(void)
  * @return  Return the buffer that was used for the previous reception over
  *          HSPI
  */
-uint8_t *
+HIGHCODE uint8_t *
 hspi_get_buffer_rx(void)
 {
     // R8_HSPI_RX_SC stores the buffer that will be used for the next
@@ -0,0 +1,335 @@
+#include "highcode.h"
+#include "stack.h"
+#include "timebase.h"
+
+#include "irq.h"
+
+
+/* structs */
+struct IrqStats_t {
+    volatile uint32_t latency[IRQ_STATS_BUCKETS];
+    volatile uint32_t duration[IRQ_STATS_BUCKETS];
+    volatile uint32_t latencyMax;
+    volatile uint32_t durationMax;
+    // Since boot, not reset by irq_stats_fill()
+    volatile uint32_t durationWorst;
+    volatile uint32_t stackWorst;
+};
+
+/* internal variables */
+static const IRQn_Type _irqNumbers[IrqHandlerCount] = {
+    [IrqHandlerUsb]     = USBHS_IRQn,
+    [IrqHandlerHspi]    = HSPI_IRQn,
+    [IrqHandlerSerdes]  = SERDES_IRQn,
+};
+
+/* The counters are only incremented by their own handler, which the reader
+ * (irq_stats_fill() from a link interrupt) can not preempt */
+static struct IrqStats_t _stats[IrqHandlerCount] RAMX_BSS;
+static volatile uint32_t _setupCounters[IRQ_STATS_SETUP_COUNTERS] RAMX_BSS;
+
+static uint32_t _nesting = 0;                           // Instrumented handlers running
+static uint32_t _outermostEntry = 0;                    // Entry of the first of them
+static volatile uint32_t _heldOff = 0;                  // 1 << enum IrqHandler, pending when a handler returned
+static volatile uint32_t _heldOffSince[IrqHandlerCount];
+#if STACK_STATS
+static uint32_t _running = 0;                           // 1 << enum IrqHandler, restored as _nesting
+static uint32_t _stackEntry[IrqHandlerCount];           // Stack pointer in irq_stats_enter()
+#endif
+
+
+/* functions implementation */
+
+/* @fn      irq_init
+ *
+ * @brief   Set the priority of the interrupts used by the firmware and enable
+ *          the nesting
+ *
+ * @return  None
+ */
+void
+irq_init(void)
+{
+    PFIC_SetPriority(USBHS_IRQn, IRQ_PRIORITY_USB);
+    PFIC_SetPriority(HSPI_IRQn, IRQ_PRIORITY_LINK);
+    PFIC_SetPriority(SERDES_IRQn, IRQ_PRIORITY_LINK);
+    PFIC_SetPriority(TMR0_IRQn, IRQ_PRIORITY_PROFILE);
+
+    // Only two preemption levels are used, thus an interrupt is interrupted at
+    // most once (the hardware stack holds the nested context)
+    __asm__ volatile ("csrs %0, %1" : : "i"(IRQ_INTSYSCR), "r"(IRQ_INTSYSCR_HWSTKEN | IRQ_INTSYSCR_INESTEN));
+}
+
+/* @fn      irq_threshold_raise
+ *
+ * @brief   Mask the interrupts whose priority is lower or equal to the given
+ *          one
+ *
+ * @return  The previous threshold
+ */
+HIGHCODE uint32_t
+irq_threshold_raise(uint8_t priority)
+{
+    uint32_t threshold = PFIC->ITHRESDR;
+
+    // A threshold of 0 masks nothing, only raise it
+    if (threshold == 0 || priority < threshold) {
+        PFIC->ITHRESDR = priority;
+    }
+
+    return threshold;
+}
+
+/* @fn      irq_threshold_restore
+ *
+ * @brief   Restore the threshold saved by irq_threshold_raise()
+ *
+ * @return  None
+ */
+HIGHCODE void
+irq_threshold_restore(uint32_t threshold)
+{
+    PFIC->ITHRESDR = threshold;
+}
+
+/* @fn      irq_nesting_get
+ *
+ * @brief   Get the nesting level of the running code
+ *
+ * @return  0 in the main loop, else the level of the interrupt running
+ */
+HIGHCODE uint8_t
+irq_nesting_get(void)
+{
+    uint32_t neststa = PFIC->GISR;
+
+    if (neststa & IRQ_GISR_NESTSTA_LEVEL2) {
+        return 2;
+    }
+    return neststa & IRQ_GISR_NESTSTA_LEVEL1 ? 1 : 0;
+}
+
+/* @fn      _irq_stats_bucket
+ *
+ * @brief   Get the histogram bucket of a time, see IRQ_STATS_BUCKETS
+ *          Only used internally
+ *
+ * @return  The bucket
+ */
+static HIGHCODE uint8_t
+_irq_stats_bucket(uint32_t ticks)
+{
+    uint8_t bucket = 0;
+
+    // No clz instruction, the loop is at most IRQ_STATS_BUCKETS long
+    for (ticks >>= IRQ_STATS_BUCKET_SHIFT; ticks && bucket < IRQ_STATS_BUCKETS - 1; ticks >>= 1) {
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+/* @fn      irq_stats_enter
+ *
+ * @brief   Record the entry latency of an interrupt handler
+ *
+ * @return  The entry time
+ */
+HIGHCODE uint32_t
+irq_stats_enter(enum IrqHandler handler)
+{
+    uint32_t ticks = timebase_get_ticks();
+    uint32_t latency = 0;
+    struct IrqStats_t *stats = &_stats[handler];
+
+    // A nested handler restores _nesting before returning, the increment does
+    // not need to be atomic
+    if (_nesting++ == 0) {
+        _outermostEntry = ticks;
+    }
+
+#if STACK_STATS
+    // The stack written below the running handlers is theirs (or the main
+    // loop's), count it before it is repainted
+    uint32_t lowest = stack_lowest();
+
+    for (uint8_t i = 0; i < IrqHandlerCount; ++i) {
+        if ((_running & (1u << i)) && _stackEntry[i] > lowest && _stackEntry[i] - lowest > _stats[i].stackWorst) {
+            _stats[i].stackWorst = _stackEntry[i] - lowest;
+        }
+    }
+    stack_repaint(lowest);
+    _stackEntry[handler] = stack_pointer_get();
+    _running |= 1u << handler;
+#endif
+
+    if (__atomic_fetch_and(&_heldOff, ~(1u << handler), __ATOMIC_ACQUIRE) & (1u << handler)) {
+        latency = ticks - _heldOffSince[handler];
+    }
+    ++stats->latency[_irq_stats_bucket(latency)];
+    if (latency > stats->latencyMax) {
+        stats->latencyMax = latency;
+    }
+
+    return ticks;
+}
+
+/* @fn      irq_stats_exit
+ *
+ * @brief   Record the duration of an interrupt handler and note the
+ *          instrumented interrupts it held off
+ *
+ * @return  None
+ */
+HIGHCODE void
+irq_stats_exit(enum IrqHandler handler, uint32_t entry)
+{
+    uint32_t ticks = timebase_get_ticks();
+    uint32_t duration = ticks - entry;
+    uint32_t pending = 0;
+    struct IrqStats_t *stats = &_stats[handler];
+
+    ++stats->duration[_irq_stats_bucket(duration)];
+    if (duration > stats->durationMax) {
+        stats->durationMax = duration;
+    }
+    if (duration > stats->durationWorst) {
+        stats->durationWorst = duration;
+    }
+
+#if STACK_STATS
+    // Everything below _stackEntry was painted on entry, the handlers it
+    // preempted repainted their own usage
+    uint32_t lowest = stack_lowest();
+
+    if (_stackEntry[handler] > lowest && _stackEntry[handler] - lowest > stats->stackWorst) {
+        stats->stackWorst = _stackEntry[handler] - lowest;
+    }
+    stack_repaint(lowest);
+    _running &= ~(1u << handler);
+#endif
+
+    // Pending at most since the outermost handler entered, the earliest
+    // estimate is kept until the handler is entered
+    for (uint8_t i = 0; i < IrqHandlerCount; ++i) {
+        if (PFIC_GetPendingIRQ(_irqNumbers[i]) && !(_heldOff & (1u << i))) {
+            _heldOffSince[i] = _outermostEntry;
+            pending |= 1u << i;
+        }
+    }
+    __atomic_fetch_or(&_heldOff, pending, __ATOMIC_RELEASE);
+
+    --_nesting;
+}
+
+/* @fn      irq_stats_setup_count
+ *
+ * @brief   Count a SETUP packet
+ *
+ * @return  None
+ */
+HIGHCODE void
+irq_stats_setup_count(uint8_t requestType, uint8_t request)
+{
+    switch (requestType & USB_REQ_TYP_MASK) {
+    case USB_REQ_TYP_STANDARD:
+        ++_setupCounters[request < IRQ_STATS_SETUP_STANDARD_COUNT ? request : IRQ_STATS_SETUP_OTHER];
+        break;
+    case USB_REQ_TYP_CLASS:
+        ++_setupCounters[IRQ_STATS_SETUP_CLASS];
+        break;
+    default:
+        ++_setupCounters[IRQ_STATS_SETUP_VENDOR];
+        break;
+    }
+}
+
+/* @fn      _irq_stats_counter_take
+ *
+ * @brief   Read and reset a counter, saturated to 16 bits. The USB interrupt
+ *          may preempt the caller, the exchange does not lose its updates
+ *          Only used internally
+ *
+ * @return  The counter
+ */
+static uint16_t
+_irq_stats_counter_take(volatile uint32_t *counter)
+{
+    uint32_t value = __atomic_exchange_n(counter, 0, __ATOMIC_RELAXED);
+
+    return value > UINT16_MAX ? UINT16_MAX : value;
+}
+
+/* @fn      _irq_stats_put
+ *
+ * @brief   Write a little endian value
+ *          Only used internally
+ *
+ * @return  The position after the value
+ */
+static uint8_t *
+_irq_stats_put(uint8_t *cursor, uint32_t value, uint8_t size)
+{
+    for (uint8_t i = 0; i < size; ++i) {
+        cursor[i] = value >> (8 * i);
+    }
+
+    return cursor + size;
+}
+
+/* @fn      irq_stats_fill
+ *
+ * @brief   Serialize the interrupt statistics and reset them
+ *
+ * @return  The number of bytes written, 0 if it does not fit
+ */
+uint16_t
+irq_stats_fill(uint8_t *buffer, uint16_t capacity)
+{
+    uint8_t *cursor = buffer;
+
+    if (IRQ_STATS_SIZE > capacity) {
+        return 0;
+    }
+
+    for (uint8_t handler = 0; handler < IrqHandlerCount; ++handler) {
+        struct IrqStats_t *stats = &_stats[handler];
+
+        cursor = _irq_stats_put(cursor, __atomic_exchange_n(&stats->latencyMax, 0, __ATOMIC_RELAXED), 4);
+        cursor = _irq_stats_put(cursor, __atomic_exchange_n(&stats->durationMax, 0, __ATOMIC_RELAXED), 4);
+        for (uint8_t i = 0; i < IRQ_STATS_BUCKETS; ++i) {
+            cursor = _irq_stats_put(cursor, _irq_stats_counter_take(&stats->latency[i]), 2);
+        }
+        for (uint8_t i = 0; i < IRQ_STATS_BUCKETS; ++i) {
+            cursor = _irq_stats_put(cursor, _irq_stats_counter_take(&stats->duration[i]), 2);
+        }
+    }
+    for (uint8_t i = 0; i < IRQ_STATS_SETUP_COUNTERS; ++i) {
+        cursor = _irq_stats_put(cursor, _irq_stats_counter_take(&_setupCounters[i]), 2);
+    }
+
+    return cursor - buffer;
+}
+
+/* @fn      irq_worst_fill
+ *
+ * @brief   Serialize the worst cases of the interrupt handlers since boot
+ *
+ * @return  The number of bytes written, 0 if it does not fit
+ */
+uint16_t
+irq_worst_fill(uint8_t *buffer, uint16_t capacity)
+{
+    uint8_t *cursor = buffer;
+
+    if (IRQ_WORST_SIZE > capacity) {
+        return 0;
+    }
+
+    for (uint8_t handler = 0; handler < IrqHandlerCount; ++handler) {
+        cursor = _irq_stats_put(cursor, _stats[handler].stackWorst, 4);
+        cursor = _irq_stats_put(cursor, _stats[handler].durationWorst, 4);
+    }
+
+    return cursor - buffer;
+}
@@ -0,0 +1,180 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+
+#include "CH56xSFR.h"
+#include "CH56x_common.h"
+
+/* macros */
+/* PFIC priorities, the lower the value the higher the priority. With the
+ * nesting enabled the bit 7 is the preemption bit : an interrupt in
+ * [0x00, 0x7F] preempts an interrupt in [0x80, 0xFF], otherwise interrupts do
+ * not preempt each other.
+ * - USB (Evaluator Host on the top board, ToE on the bottom board) first, the
+ *   response latency of the emulated device must not depend on the links
+ * - Inter-board links (HSPI, SerDes) then
+ * The profiler samples in the preemption level of USB, after it : it
+ * preempts the links and the main loop, not the USB interrupt. Its own level
+ * would let the links preempt USB, thus a sample held off by USB is credited
+ * to it instead, see profile_usb_exit()
+ */
+#define IRQ_PRIORITY_USB        (0x00)
+#define IRQ_PRIORITY_PROFILE    (0x40)
+#define IRQ_PRIORITY_LINK       (0x80)
+
+/* With two preemption levels, the main loop is preempted by at most two
+ * nested interrupts, see irq_nesting_get() */
+#define IRQ_NESTING_MAX         (2)
+#define IRQ_GISR_NESTSTA_LEVEL1 (1 << 0)    // PFIC GISR, a level 1 interrupt runs
+#define IRQ_GISR_NESTSTA_LEVEL2 (1 << 1)    // PFIC GISR, a level 2 interrupt runs
+
+/* QingKe V3A INTSYSCR (CSR 0x804) */
+#define IRQ_INTSYSCR            (0x804)
+#define IRQ_INTSYSCR_HWSTKEN    (1 << 0)    // Hardware stack (WCH-Interrupt-fast)
+#define IRQ_INTSYSCR_INESTEN    (1 << 1)    // Interrupt nesting
+
+/* Interrupt statistics, see irq_stats_enter(). The entry latencies and the
+ * durations are in timebase ticks, counted in log2 histograms :
+ * - bucket 0 : below 2^IRQ_STATS_BUCKET_SHIFT ticks
+ * - bucket b : [2^(b + IRQ_STATS_BUCKET_SHIFT - 1), 2^(b + IRQ_STATS_BUCKET_SHIFT))
+ * - the last bucket also counts everything above
+ */
+#define IRQ_STATS_BUCKETS       (16)
+#define IRQ_STATS_BUCKET_SHIFT  (5)
+
+/* SETUP counters : the standard requests by bRequest (USB_GET_STATUS to
+ * USB_SYNCH_FRAME), then the other standard, class and vendor requests */
+#define IRQ_STATS_SETUP_STANDARD_COUNT  (13)
+#define IRQ_STATS_SETUP_OTHER           (13)
+#define IRQ_STATS_SETUP_CLASS           (14)
+#define IRQ_STATS_SETUP_VENDOR          (15)
+#define IRQ_STATS_SETUP_COUNTERS        (16)
+
+/* Serialized statistics (StatsKindIrq), little endian, for each enum
+ * IrqHandler :
+ * - 4 bytes : max latency
+ * - 4 bytes : max duration
+ * - IRQ_STATS_BUCKETS * 2 bytes : latency histogram
+ * - IRQ_STATS_BUCKETS * 2 bytes : duration histogram
+ * then IRQ_STATS_SETUP_COUNTERS * 2 bytes of SETUP counters. The counts
+ * saturate at UINT16_MAX
+ */
+#define IRQ_STATS_HANDLER_SIZE  (8 + 2 * IRQ_STATS_BUCKETS * 2)
+#define IRQ_STATS_SIZE          (IrqHandlerCount * IRQ_STATS_HANDLER_SIZE + IRQ_STATS_SETUP_COUNTERS * 2)
+
+/* Serialized worst cases since boot, little endian, for each enum IrqHandler :
+ * - 4 bytes : max stack depth in bytes, from irq_stats_enter(), including the
+ *   uninstrumented interrupts it was preempted by (TMR0). 0 unless
+ *   STACK_STATS=1, see stack.h
+ * - 4 bytes : max duration in ticks
+ */
+#define IRQ_WORST_SIZE          (IrqHandlerCount * 8)
+
+/* enums */
+/* The instrumented interrupt handlers, must match host-controller/stats.h */
+enum IrqHandler {
+    IrqHandlerUsb       = 0,
+    IrqHandlerHspi      = 1,
+    IrqHandlerSerdes    = 2,
+    IrqHandlerCount,
+};
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : irq_init
+ * Description    : Set the priority of the interrupts used by the firmware and
+ *                  enable the nesting, see IRQ_PRIORITY_*
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void irq_init(void);
+
+/*******************************************************************************
+ * Function Name  : irq_threshold_raise
+ * Description    : Mask the interrupts whose priority is lower or equal to the
+ *                  given one, the higher priority interrupts are still served.
+ *                  Used instead of bsp_disable_interrupt() to protect a section
+ *                  only against the lower priority interrupts
+ * Input          : The priority to mask from (e.g. IRQ_PRIORITY_LINK)
+ * Return         : The previous threshold, to give to irq_threshold_restore()
+ *******************************************************************************/
+uint32_t irq_threshold_raise(uint8_t priority);
+
+/*******************************************************************************
+ * Function Name  : irq_threshold_restore
+ * Description    : Restore the threshold saved by irq_threshold_raise()
+ * Input          : The previous threshold
+ * Return         : None
+ *******************************************************************************/
+void irq_threshold_restore(uint32_t threshold);
+
+/*******************************************************************************
+ * Function Name  : irq_nesting_get
+ * Description    : Get the nesting level of the running code. Code running at
+ *                  a level is only preempted by the deeper levels, thus a
+ *                  buffer per level is not shared between the contexts
+ * Input          : None
+ * Return         : 0 in the main loop, else the level of the interrupt running
+ *                  (1 to IRQ_NESTING_MAX)
+ *******************************************************************************/
+uint8_t irq_nesting_get(void);
+
+/*******************************************************************************
+ * Function Name  : irq_stats_enter
+ * Description    : Record the entry latency of an interrupt handler, to call
+ *                  first in the handler. The latency is known only when the
+ *                  interrupt was held off by another instrumented handler (or
+ *                  by itself) : it is then counted from the entry of the
+ *                  outermost handler running, an upper bound. Otherwise it is
+ *                  counted as 0. With STACK_STATS=1 the stack written below
+ *                  is attributed to the preempted handlers and repainted
+ * Input          : The handler
+ * Return         : The entry time, to give to irq_stats_exit()
+ *******************************************************************************/
+uint32_t irq_stats_enter(enum IrqHandler handler);
+
+/*******************************************************************************
+ * Function Name  : irq_stats_exit
+ * Description    : Record the duration of an interrupt handler, to call last in
+ *                  the handler, and note the instrumented interrupts it held
+ *                  off. With STACK_STATS=1 also record its stack depth
+ * Input          : - handler: The handler
+ *                  - entry: The value returned by irq_stats_enter()
+ * Return         : None
+ *******************************************************************************/
+void irq_stats_exit(enum IrqHandler handler, uint32_t entry);
+
+/*******************************************************************************
+ * Function Name  : irq_stats_setup_count
+ * Description    : Count a SETUP packet, see IRQ_STATS_SETUP_*. Must only be
+ *                  called from the USB interrupt
+ * Input          : - requestType: bmRequestType
+ *                  - request: bRequest
+ * Return         : None
+ *******************************************************************************/
+void irq_stats_setup_count(uint8_t requestType, uint8_t request);
+
+/*******************************************************************************
+ * Function Name  : irq_stats_fill
+ * Description    : Serialize the interrupt statistics, see IRQ_STATS_SIZE, and
+ *                  reset them
+ * Input          : - buffer: Where to write the statistics
+ *                  - capacity: The capacity of buffer
+ * Return         : The number of bytes written, 0 if it does not fit
+ *******************************************************************************/
+uint16_t irq_stats_fill(uint8_t *buffer, uint16_t capacity);
+
+/*******************************************************************************
+ * Function Name  : irq_worst_fill
+ * Description    : Serialize the worst cases of the interrupt handlers since
+ *                  boot, see IRQ_WORST_SIZE. They are not reset
+ * Input          : - buffer: Where to write the worst cases
+ *                  - capacity: The capacity of buffer
+ * Return         : The number of bytes written, 0 if it does not fit
+ *******************************************************************************/
+uint16_t irq_worst_fill(uint8_t *buffer, uint16_t capacity);
+
+
+#endif /* IRQ_H */
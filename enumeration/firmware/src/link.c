@@ -0,0 +1,802 @@
+#define LOG_MODULE  LOG_MODULE_LINK
+
+#include <string.h>
+
+#include "highcode.h"
+#include "hspi.h"
+#include "log.h"
+#include "serdes.h"
+#include "timebase.h"
+
+#include "link.h"
+
+
+/* macros */
+#define _PRBS31_SEED            (0x5EED1234)
+#define _VERDICT_MAGIC          (0x4C4E4B56)  /* "LNKV" */
+#define _VERDICT_SIZE           (8)
+
+/* variables */
+volatile struct LinkHealth_t g_linkHealth;
+
+/* Fastest first, the index 0 is the setting used before the calibration */
+const uint8_t g_linkHspiWidths[LINK_HSPI_SETTINGS_COUNT] = {
+    RB_HSPI_DAT32_MOD,
+    RB_HSPI_DAT16_MOD,
+    RB_HSPI_DAT8_MOD,
+};
+const uint8_t g_linkSerdesFreqs[LINK_SERDES_SETTINGS_COUNT] = {
+    SDS_PLL_FREQ_1_20G,
+    SDS_PLL_FREQ_1_08G,
+    SDS_PLL_FREQ_0_96G,
+    SDS_PLL_FREQ_0_72G,
+    SDS_PLL_FREQ_0_60G,
+};
+
+uint8_t g_linkHspiSetting   = 0;
+uint8_t g_linkSerdesSetting = 0;
+bool g_linkCalibrated       = false;
+
+struct LinkCalibrationResult_t g_linkCalibrationHspi[LINK_HSPI_SETTINGS_COUNT];
+struct LinkCalibrationResult_t g_linkCalibrationSerdes[LINK_SERDES_SETTINGS_COUNT];
+
+/* internal variables */
+static const uint16_t _serdesMbps[LINK_SERDES_SETTINGS_COUNT] = {
+    1200, 1080, 960, 720, 600,
+};
+
+static const char *_hspiNames[LINK_HSPI_SETTINGS_COUNT] = {
+    "32 bits", "16 bits", "8 bits",
+};
+
+static const char *_retrainReasonNames[] = {
+    [LinkRetrainReasonNone]  = "none",
+    [LinkRetrainReasonHost]  = "host",
+    [LinkRetrainReasonFault] = "fault",
+    [LinkRetrainReasonPeer]  = "peer",
+};
+
+/* A BBIO command never starts with 0xF0, and the odds of a payload starting
+ * with this whole pattern are negligible */
+static const uint8_t _retrainFrame[LINK_RETRAIN_FRAME_SIZE] = {
+    0xF0, 'R', 'E', 'T', 'R', 'A', 'I', 'N',
+};
+
+static volatile uint8_t _retrainReason = LinkRetrainReasonNone;
+static volatile uint32_t _retrainRequestTick = 0;
+static volatile uint8_t _consecutiveFaults = 0;
+static uint8_t _retrainAttempts = 0;
+// Level of the sync input when the boards were last synchronised
+static uint32_t _syncInLevel = 0;
+
+
+/* functions implementation */
+
+/* @fn      _link_prbs31_next
+ *
+ * @brief   Get the next 32 bits of the PRBS31 sequence (x^31 + x^28 + 1)
+ *          Only used internally
+ *
+ * @return  The next 32 bits of the sequence
+ */
+static uint32_t
+_link_prbs31_next(uint32_t *state)
+{
+    uint32_t word = 0;
+    uint32_t bit;
+
+    for (uint8_t i = 0; i < 32; ++i) {
+        bit = ((*state >> 30) ^ (*state >> 27)) & 1;
+        *state = ((*state << 1) | bit) & 0x7FFFFFFF;
+        word = (word << 1) | bit;
+    }
+
+    return word;
+}
+
+/* @fn      _link_prbs_fill
+ *
+ * @brief   Fill a calibration frame : its index followed by PRBS31 words
+ *          seeded by the index, thus the receiver does not depend on the
+ *          previous frames
+ *          Only used internally
+ *
+ * @return  None
+ */
+static void
+_link_prbs_fill(uint8_t *buffer, uint16_t len, uint32_t index)
+{
+    uint32_t state = (_PRBS31_SEED ^ (index * 0x9E3779B9)) & 0x7FFFFFFF;
+    uint32_t word;
+
+    if (state == 0) {
+        state = _PRBS31_SEED;
+    }
+
+    memcpy(buffer, &index, sizeof(index));
+    for (uint16_t i = sizeof(index); i < len; i += sizeof(word)) {
+        word = _link_prbs31_next(&state);
+        memcpy(buffer + i, &word, sizeof(word));
+    }
+}
+
+/* @fn      _link_prbs_check
+ *
+ * @brief   Count the bits of a received calibration frame differing from the
+ *          expected PRBS
+ *          Only used internally
+ *
+ * @return  The number of bit errors
+ */
+static uint32_t
+_link_prbs_check(const uint8_t *buffer, uint16_t len)
+{
+    uint32_t index;
+    uint32_t state;
+    uint32_t word;
+    uint32_t errors = 0;
+
+    memcpy(&index, buffer, sizeof(index));
+    state = (_PRBS31_SEED ^ (index * 0x9E3779B9)) & 0x7FFFFFFF;
+    if (state == 0) {
+        state = _PRBS31_SEED;
+    }
+
+    for (uint16_t i = sizeof(index); i < len; i += sizeof(word)) {
+        memcpy(&word, buffer + i, sizeof(word));
+        errors += __builtin_popcount(word ^ _link_prbs31_next(&state));
+    }
+
+    return errors;
+}
+
+/* @fn      _link_throughput
+ *
+ * @brief   Compute a throughput in kB/s
+ *          Only used internally
+ *
+ * @return  The throughput in kB/s
+ */
+static uint32_t
+_link_throughput(uint32_t bytes, uint32_t ticks)
+{
+    uint32_t us = timebase_ticks_to_us(ticks);
+    if (us == 0) {
+        return 0;
+    }
+
+    return (bytes / us) * 1000 + ((bytes % us) * 1000) / us;
+}
+
+/* @fn      _link_select
+ *
+ * @brief   Select the fastest setting which ran error-free
+ *          Only used internally
+ *
+ * @return  The index of the setting, 0 (default) if none is error-free
+ */
+static uint8_t
+_link_select(const struct LinkCalibrationResult_t *results, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; ++i) {
+        if (results[i].frames == LINK_CALIBRATION_FRAMES
+            && results[i].frameErrors == 0
+            && results[i].bitErrors == 0) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+/* @fn      _link_hspi_init
+ *
+ * @brief   Initialise HSPI with the given setting
+ *          Only used internally
+ *
+ * @return  None
+ */
+static void
+_link_hspi_init(bool isHost, uint8_t setting)
+{
+    memset((void *)hspiDmaAddr0, 0, HSPI_DMA_LEN0);
+    memset((void *)hspiDmaAddr1, 0, HSPI_DMA_LEN1);
+    if (isHost) {
+        HSPI_DoubleDMA_Init(HSPI_HOST, g_linkHspiWidths[setting], (uint32_t)hspiDmaAddr0, (uint32_t)hspiDmaAddr1, HSPI_DMA_LEN);
+    } else {
+        HSPI_DoubleDMA_Init(HSPI_DEVICE, g_linkHspiWidths[setting], (uint32_t)hspiDmaAddr0, (uint32_t)hspiDmaAddr1, 0);
+    }
+}
+
+/* @fn      _link_serdes_init
+ *
+ * @brief   Initialise SerDes with the given setting
+ *          Only used internally
+ *
+ * @return  None
+ */
+static void
+_link_serdes_init(bool isHost, uint8_t setting)
+{
+    g_serdesPllMbps = _serdesMbps[setting];
+    if (isHost) {
+        SerDes_EnableIT(ALL_INT_TYPE);
+        SerDes_Rx_Init(g_linkSerdesFreqs[setting]);
+        SerDes_DMA_Rx_CFG((uint32_t)serdesDmaAddr);
+    } else {
+        // SDS_TX_INT_FLG should not trigger an interrupt, it is handled by
+        // SerDes_Wait_Txdone()
+        SerDes_EnableIT(ALL_INT_TYPE & ~SDS_TX_INT_FLG);
+        SerDes_Tx_Init(g_linkSerdesFreqs[setting]);
+        // reconfigured before each transaction, the custom number carries the
+        // header of the frame (channel and length), see serdes_channel_send()
+    }
+}
+
+/* @fn      _link_hspi_send
+ *
+ * @brief   Transmit the next HSPI buffer by polling (interrupts disabled)
+ *          Only used internally
+ *
+ * @return  The number of ticks spent in the DMA transfer
+ */
+static uint32_t
+_link_hspi_send(void)
+{
+    uint32_t start = timebase_get_ticks();
+    uint32_t ticks;
+
+    HSPI_DMA_Tx();
+    while (!(R8_HSPI_INT_FLAG & RB_HSPI_IF_T_DONE));
+    ticks = timebase_get_ticks() - start;
+    R8_HSPI_INT_FLAG = RB_HSPI_IF_T_DONE;
+
+    hspi_wait_for_tx(HSPI_DMA_LEN);
+    return ticks;
+}
+
+/* @fn      _link_hspi_receive
+ *
+ * @brief   Wait for an HSPI frame by polling (interrupts disabled)
+ *          Only used internally
+ *
+ * @return  The received buffer, NULL on timeout. *pStatus is set to the
+ *          CRC_ERR/NUM_MIS status
+ */
+static uint8_t *
+_link_hspi_receive(uint8_t *pStatus)
+{
+    uint32_t start = timebase_get_ticks();
+
+    while (!(R8_HSPI_INT_FLAG & RB_HSPI_IF_R_DONE)) {
+        if (R8_HSPI_INT_FLAG & RB_HSPI_IF_FIFO_OV) {
+            R8_HSPI_INT_FLAG = RB_HSPI_IF_FIFO_OV;
+        }
+        if (timebase_ticks_to_us(timebase_get_ticks() - start) > LINK_CALIBRATION_TIMEOUT_US) {
+            return NULL;
+        }
+    }
+    *pStatus = hspi_get_rtx_status();
+    R8_HSPI_INT_FLAG = RB_HSPI_IF_R_DONE;
+
+    return hspi_get_buffer_rx();
+}
+
+/* @fn      _link_serdes_receive
+ *
+ * @brief   Wait for a SerDes frame by polling (interrupts disabled)
+ *          Only used internally
+ *
+ * @return  The length of the received frame, -1 on timeout. *pRxError is set
+ *          if RX_ERR was raised or the header is invalid
+ */
+static int
+_link_serdes_receive(bool *pRxError)
+{
+    uint32_t start = timebase_get_ticks();
+    uint32_t status;
+    uint32_t header;
+
+    while (!((status = SerDes_StatusIT()) & SDS_RX_INT_FLG)) {
+        if (status & SDS_FIFO_OV_FLG) {
+            SerDes_ClearIT(SDS_FIFO_OV_FLG);
+        }
+        if (timebase_ticks_to_us(timebase_get_ticks() - start) > LINK_CALIBRATION_TIMEOUT_US) {
+            return -1;
+        }
+    }
+    header = SDS->SDS_DATA0;
+    *pRxError = (status & SDS_RX_ERR_FLG)
+                || SERDES_HEADER_GET_MAGIC(header) != SERDES_HEADER_MAGIC
+                || SERDES_HEADER_GET_CHANNEL(header) != SerdesChannelCalibration;
+    SerDes_ClearIT(status & ALL_INT_TYPE);
+
+    return SERDES_HEADER_GET_LEN(header);
+}
+
+/* @fn      _link_verdict_fill
+ *
+ * @brief   Write a verdict (a setting index) : magic, index, ~index
+ *          Only used internally
+ *
+ * @return  None
+ */
+static void
+_link_verdict_fill(uint8_t *buffer, uint8_t setting)
+{
+    uint32_t magic = _VERDICT_MAGIC;
+
+    memcpy(buffer, &magic, sizeof(magic));
+    buffer[4] = setting;
+    buffer[5] = ~setting;
+    buffer[6] = 0;
+    buffer[7] = 0;
+}
+
+/* @fn      _link_verdict_parse
+ *
+ * @brief   Check a received verdict
+ *          Only used internally
+ *
+ * @return  The setting index, -1 if the verdict is invalid
+ */
+static int
+_link_verdict_parse(const uint8_t *buffer, uint8_t count)
+{
+    uint32_t magic;
+
+    memcpy(&magic, buffer, sizeof(magic));
+    if (magic != _VERDICT_MAGIC || (uint8_t)~buffer[4] != buffer[5] || buffer[4] >= count) {
+        return -1;
+    }
+
+    return buffer[4];
+}
+
+/* @fn      _link_calibrate_hspi
+ *
+ * @brief   Stream the PRBS frames over HSPI with the given setting
+ *          Only used internally
+ *
+ * @return  None
+ */
+static void
+_link_calibrate_hspi(bool isHost, uint8_t setting)
+{
+    struct LinkCalibrationResult_t *result = &g_linkCalibrationHspi[setting];
+    uint32_t ticks = 0;
+    uint8_t *buffer;
+    uint8_t status;
+
+    _link_hspi_init(isHost, setting);
+    bsp_sync2boards(PA14, PA12, isHost ? BSP_BOARD1 : BSP_BOARD2);
+
+    if (isHost) {
+        for (uint32_t i = 0; i < LINK_CALIBRATION_FRAMES; ++i) {
+            _link_prbs_fill(hspi_get_buffer_next_tx(), HSPI_DMA_LEN, i);
+            ticks += _link_hspi_send();
+        }
+        result->throughput = _link_throughput(LINK_CALIBRATION_FRAMES * HSPI_DMA_LEN, ticks);
+    } else {
+        while (result->frames < LINK_CALIBRATION_FRAMES) {
+            buffer = _link_hspi_receive(&status);
+            if (buffer == NULL) {
+                break;
+            }
+            ++result->frames;
+            if (status) {
+                ++result->frameErrors;
+            }
+            result->bitErrors += _link_prbs_check(buffer, HSPI_DMA_LEN);
+        }
+        // Lost frames are errors too
+        result->frameErrors += LINK_CALIBRATION_FRAMES - result->frames;
+    }
+}
+
+/* @fn      _link_calibrate_serdes
+ *
+ * @brief   Stream the PRBS frames over SerDes with the given setting
+ *          Only used internally
+ *
+ * @return  None
+ */
+static void
+_link_calibrate_serdes(bool isHost, uint8_t setting)
+{
+    struct LinkCalibrationResult_t *result = &g_linkCalibrationSerdes[setting];
+    uint32_t ticks = 0;
+    uint32_t start;
+    bool rxError;
+    int len;
+
+    _link_serdes_init(isHost, setting);
+    bsp_sync2boards(PA14, PA12, isHost ? BSP_BOARD1 : BSP_BOARD2);
+
+    if (isHost) {
+        while (result->frames < LINK_CALIBRATION_FRAMES) {
+            len = _link_serdes_receive(&rxError);
+            if (len < 0) {
+                break;
+            }
+            ++result->frames;
+            if (rxError || len != SERDES_DMA_LEN) {
+                ++result->frameErrors;
+            }
+            result->bitErrors += _link_prbs_check(serdesDmaAddr, SERDES_DMA_LEN);
+        }
+        // Lost frames are errors too
+        result->frameErrors += LINK_CALIBRATION_FRAMES - result->frames;
+    } else {
+        for (uint32_t i = 0; i < LINK_CALIBRATION_FRAMES; ++i) {
+            _link_prbs_fill(serdesDmaAddr, SERDES_DMA_LEN, i);
+            start = timebase_get_ticks();
+            serdes_frame_transmit(serdesDmaAddr, SerdesChannelCalibration, SERDES_DMA_LEN);
+            ticks += timebase_get_ticks() - start;
+            serdes_wait_for_tx(SERDES_DMA_LEN);
+        }
+        result->throughput = _link_throughput(LINK_CALIBRATION_FRAMES * SERDES_DMA_LEN, ticks);
+    }
+}
+
+/* @fn      _link_exchange_verdicts
+ *
+ * @brief   Exchange the verdicts with the slowest settings : the top board
+ *          sends the SerDes verdict over HSPI, the bottom board sends the HSPI
+ *          verdict over SerDes
+ *          Only used internally
+ *
+ * @return  None
+ */
+static void
+_link_exchange_verdicts(bool isHost)
+{
+    const uint8_t hspiSlowest   = LINK_HSPI_SETTINGS_COUNT - 1;
+    const uint8_t serdesSlowest = LINK_SERDES_SETTINGS_COUNT - 1;
+    uint8_t *buffer;
+    uint8_t status;
+    bool rxError;
+    int verdict;
+
+    _link_hspi_init(isHost, hspiSlowest);
+    _link_serdes_init(isHost, serdesSlowest);
+    bsp_sync2boards(PA14, PA12, isHost ? BSP_BOARD1 : BSP_BOARD2);
+
+    // Top -> bottom over HSPI
+    if (isHost) {
+        for (uint8_t i = 0; i < LINK_CALIBRATION_VERDICT_REPEAT; ++i) {
+            _link_verdict_fill(hspi_get_buffer_next_tx(), g_linkSerdesSetting);
+            _link_hspi_send();
+        }
+    } else {
+        verdict = -1;
+        for (uint8_t i = 0; i < LINK_CALIBRATION_VERDICT_REPEAT; ++i) {
+            buffer = _link_hspi_receive(&status);
+            if (buffer == NULL) {
+                break;
+            }
+            if (verdict < 0 && status == 0) {
+                verdict = _link_verdict_parse(buffer, LINK_SERDES_SETTINGS_COUNT);
+            }
+        }
+        // Without a verdict both boards can not agree, keep the default
+        g_linkSerdesSetting = verdict < 0 ? 0 : verdict;
+    }
+
+    bsp_sync2boards(PA14, PA12, isHost ? BSP_BOARD1 : BSP_BOARD2);
+
+    // Bottom -> top over SerDes
+    if (isHost) {
+        verdict = -1;
+        for (uint8_t i = 0; i < LINK_CALIBRATION_VERDICT_REPEAT; ++i) {
+            if (_link_serdes_receive(&rxError) < 0) {
+                break;
+            }
+            if (verdict < 0 && !rxError) {
+                verdict = _link_verdict_parse(serdesDmaAddr, LINK_HSPI_SETTINGS_COUNT);
+            }
+        }
+        g_linkHspiSetting = verdict < 0 ? 0 : verdict;
+    } else {
+        for (uint8_t i = 0; i < LINK_CALIBRATION_VERDICT_REPEAT; ++i) {
+            _link_verdict_fill(serdesDmaAddr, g_linkHspiSetting);
+            serdes_frame_transmit(serdesDmaAddr, SerdesChannelCalibration, _VERDICT_SIZE);
+            serdes_wait_for_tx(_VERDICT_SIZE);
+        }
+    }
+
+    bsp_sync2boards(PA14, PA12, isHost ? BSP_BOARD1 : BSP_BOARD2);
+}
+
+/* @fn      link_init
+ *
+ * @brief   Initialise HSPI and SerDes with the settings currently selected
+ *
+ * @return  None
+ */
+void
+link_init(bool isHost)
+{
+    _link_hspi_init(isHost, g_linkHspiSetting);
+
+    PFIC_EnableIRQ(SERDES_IRQn);
+    _link_serdes_init(isHost, g_linkSerdesSetting);
+
+    // Both boards just left bsp_sync2boards(), the sync pins are idle
+    _syncInLevel = R32_PA_PIN & LINK_SYNC_IN_PIN;
+}
+
+/* @fn      link_calibrate
+ *
+ * @brief   Stream PRBS frames over HSPI and SerDes with each supported setting
+ *          then select the fastest settings which ran error-free
+ *
+ * @return  None
+ */
+void
+link_calibrate(bool isHost)
+{
+    bsp_disable_interrupt();
+
+    memset(g_linkCalibrationHspi, 0, sizeof(g_linkCalibrationHspi));
+    memset(g_linkCalibrationSerdes, 0, sizeof(g_linkCalibrationSerdes));
+
+    for (uint8_t i = 0; i < LINK_HSPI_SETTINGS_COUNT; ++i) {
+        _link_calibrate_hspi(isHost, i);
+    }
+    for (uint8_t i = 0; i < LINK_SERDES_SETTINGS_COUNT; ++i) {
+        _link_calibrate_serdes(isHost, i);
+    }
+
+    // Only the receiver of a link knows its errors
+    if (isHost) {
+        g_linkSerdesSetting = _link_select(g_linkCalibrationSerdes, LINK_SERDES_SETTINGS_COUNT);
+    } else {
+        g_linkHspiSetting = _link_select(g_linkCalibrationHspi, LINK_HSPI_SETTINGS_COUNT);
+    }
+    _link_exchange_verdicts(isHost);
+
+    link_init(isHost);
+    g_linkCalibrated = true;
+
+    // The calibration traffic must not show up in the runtime counters
+    memset((void *)&g_linkHealth, 0, sizeof(g_linkHealth));
+    R8_HSPI_INT_FLAG = R8_HSPI_INT_FLAG & HSPI_INT_FLAG;
+    SerDes_ClearIT(ALL_INT_FLG);
+
+    bsp_enable_interrupt();
+
+    // Formatted text (%s), not in the interrupts
+    if (LOG_ENABLED(LOG_LEVEL_INFO)) {
+        log_to_evaluator("Link calibrated: HSPI %s, SerDes %dMbps\r\n",
+                         _hspiNames[g_linkHspiSetting], _serdesMbps[g_linkSerdesSetting]);
+    }
+}
+
+/* @fn      _link_sync
+ *
+ * @brief   Resynchronise with the other board : toggle the sync output then
+ *          wait for the other board to toggle its own. Unlike
+ *          bsp_sync2boards() the wait is bounded, the output is restored when
+ *          the other board did not join
+ *          Only used internally
+ *
+ * @return  true if the other board joined, false if it timed out
+ */
+static bool
+_link_sync(void)
+{
+    uint32_t start = timebase_get_ticks();
+    uint32_t level;
+
+    R32_PA_OUT ^= LINK_SYNC_OUT_PIN;
+    do {
+        level = R32_PA_PIN & LINK_SYNC_IN_PIN;
+        if (level != _syncInLevel) {
+            _syncInLevel = level;
+            return true;
+        }
+    } while (timebase_ticks_to_us(timebase_get_ticks() - start) < LINK_RETRAIN_SYNC_TIMEOUT_US);
+
+    R32_PA_OUT ^= LINK_SYNC_OUT_PIN;
+    return false;
+}
+
+/* @fn      _link_retrain
+ *
+ * @brief   Quiesce the DMA, re-init HSPI and SerDes with the current settings
+ *          and resynchronise with the other board. The interrupts are
+ *          restored whatever the outcome
+ *          Only used internally
+ *
+ * @return  true if the other board joined, false if it timed out
+ */
+static bool
+_link_retrain(bool isHost)
+{
+    bool isSynced;
+
+    bsp_disable_interrupt();
+
+    // Quiesce, nothing must be pending when the links are re-initialised
+    R8_HSPI_INT_FLAG = R8_HSPI_INT_FLAG & HSPI_INT_FLAG;
+    SerDes_ClearIT(ALL_INT_FLG);
+
+    _link_hspi_init(isHost, g_linkHspiSetting);
+    _link_serdes_init(isHost, g_linkSerdesSetting);
+    isSynced = _link_sync();
+
+    // Drop everything received meanwhile (including the request of the other
+    // board if both requested a retrain)
+    R8_HSPI_INT_FLAG = R8_HSPI_INT_FLAG & HSPI_INT_FLAG;
+    SerDes_ClearIT(ALL_INT_FLG);
+    _consecutiveFaults = 0;
+
+    bsp_enable_interrupt();
+
+    return isSynced;
+}
+
+/* @fn      link_fault_report
+ *
+ * @brief   Report the status of a received frame, a retrain is requested after
+ *          LINK_RETRAIN_FAULT_THRESHOLD consecutive faulty frames
+ *
+ * @return  None
+ */
+HIGHCODE void
+link_fault_report(bool isFaulty)
+{
+    if (!isFaulty) {
+        _consecutiveFaults = 0;
+        return;
+    }
+
+    if (++_consecutiveFaults >= LINK_RETRAIN_FAULT_THRESHOLD) {
+        _consecutiveFaults = 0;
+        link_retrain_request(LinkRetrainReasonFault);
+    }
+}
+
+/* @fn      link_retrain_request
+ *
+ * @brief   Request a retrain, it is done by the next call to link_poll()
+ *
+ * @return  None
+ */
+HIGHCODE void
+link_retrain_request(enum LinkRetrainReason reason)
+{
+    // Only the first request is kept, the retrain time is measured from it
+    if (_retrainReason == LinkRetrainReasonNone) {
+        _retrainRequestTick = timebase_get_ticks();
+        _retrainReason = reason;
+    }
+}
+
+/* @fn      link_poll
+ *
+ * @brief   Retrain the links if requested
+ *
+ * @return  true if the links were retrained, false else
+ */
+bool
+link_poll(bool isHost)
+{
+    enum LinkRetrainReason reason = _retrainReason;
+    uint8_t event = SerdesEventLinkRetrain;
+    uint32_t us;
+
+    if (reason == LinkRetrainReasonNone) {
+        return false;
+    }
+
+    // The other board must join the resynchronisation, the request goes
+    // through the other link as the faulty one may not be usable
+    if (reason != LinkRetrainReasonPeer) {
+        if (isHost) {
+            bsp_disable_interrupt();
+            link_retrain_frame_fill(hspi_get_buffer_next_tx());
+            _link_hspi_send();
+            bsp_enable_interrupt();
+        } else {
+            serdes_channel_send(SerdesChannelEvent, &event, sizeof(event));
+            serdes_channel_poll();
+        }
+    }
+
+    if (!_link_retrain(isHost)) {
+        // The other board may have missed the request, it is resent by the
+        // next call
+        if (++_retrainAttempts < LINK_RETRAIN_ATTEMPTS) {
+            return false;
+        }
+
+        ++g_linkHealth.retrainFailures;
+        _retrainAttempts = 0;
+        _retrainReason = LinkRetrainReasonNone;
+        if (LOG_ENABLED(LOG_LEVEL_ERROR)) {
+            log_to_evaluator("Link retrain (%s) failed, no answer from the other board\r\n",
+                             _retrainReasonNames[reason]);
+        }
+        return false;
+    }
+
+    us = timebase_ticks_to_us(timebase_get_ticks() - _retrainRequestTick);
+    ++g_linkHealth.retrains;
+    g_linkHealth.lastRetrainUs = us;
+    if (us > g_linkHealth.maxRetrainUs) {
+        g_linkHealth.maxRetrainUs = us;
+    }
+    _retrainAttempts = 0;
+    _retrainReason = LinkRetrainReasonNone;
+
+    if (LOG_ENABLED(LOG_LEVEL_INFO)) {
+        log_to_evaluator("Link retrained (%s) in %uus\r\n", _retrainReasonNames[reason], us);
+    }
+    return true;
+}
+
+/* @fn      link_retrain_frame_fill
+ *
+ * @brief   Fill the HSPI frame sent by the top board to request a retrain
+ *
+ * @return  None
+ */
+void
+link_retrain_frame_fill(uint8_t *buffer)
+{
+    memcpy(buffer, _retrainFrame, LINK_RETRAIN_FRAME_SIZE);
+}
+
+/* @fn      link_is_retrain_frame
+ *
+ * @brief   Check if an HSPI frame is a retrain request
+ *
+ * @return  true if it is a retrain request, false else
+ */
+HIGHCODE bool
+link_is_retrain_frame(const uint8_t *buffer)
+{
+    return memcmp(buffer, _retrainFrame, LINK_RETRAIN_FRAME_SIZE) == 0;
+}
+
+/* @fn      link_report_fill
+ *
+ * @brief   Serialize the link health counters, the settings in use and the
+ *          calibration results :
+ *          - 1 byte  : HSPI setting index
+ *          - 1 byte  : SerDes setting index
+ *          - 1 byte  : 1 if calibrated, 0 else
+ *          - 1 byte  : reserved
+ *          - struct LinkHealth_t (including the retrain counters)
+ *          - struct LinkCalibrationResult_t[LINK_HSPI_SETTINGS_COUNT]
+ *          - struct LinkCalibrationResult_t[LINK_SERDES_SETTINGS_COUNT]
+ *          All the fields are little endian
+ *
+ * @return  The number of bytes written, 0 if it does not fit
+ */
+uint16_t
+link_report_fill(uint8_t *buffer, uint16_t capacity)
+{
+    uint16_t size = 4 + sizeof(struct LinkHealth_t) + sizeof(g_linkCalibrationHspi) + sizeof(g_linkCalibrationSerdes);
+    uint8_t *cursor = buffer;
+
+    if (size > capacity) {
+        return 0;
+    }
+
+    cursor[0] = g_linkHspiSetting;
+    cursor[1] = g_linkSerdesSetting;
+    cursor[2] = g_linkCalibrated;
+    cursor[3] = 0;
+    cursor += 4;
+
+    memcpy(cursor, (const void *)&g_linkHealth, sizeof(struct LinkHealth_t));
+    cursor += sizeof(struct LinkHealth_t);
+    memcpy(cursor, g_linkCalibrationHspi, sizeof(g_linkCalibrationHspi));
+    cursor += sizeof(g_linkCalibrationHspi);
+    memcpy(cursor, g_linkCalibrationSerdes, sizeof(g_linkCalibrationSerdes));
+
+    return size;
+}
@@ -0,0 +1,176 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "CH56xSFR.h"
+#include "CH56x_common.h"
+
+/* macros */
+/* Number of PRBS frames streamed for each setting during the calibration */
+#define LINK_CALIBRATION_FRAMES         (256)
+/* The receiver gives up on a setting when no frame is received for this
+ * duration */
+#define LINK_CALIBRATION_TIMEOUT_US     (20000)
+/* The verdicts are exchanged several times, the first valid one is used */
+#define LINK_CALIBRATION_VERDICT_REPEAT (8)
+
+/* Number of consecutive faulty frames (CRC_ERR/NUM_MIS, RX_ERR, invalid
+ * header, FIFO overflow) received before a retrain is requested */
+#define LINK_RETRAIN_FAULT_THRESHOLD    (4)
+/* Size of the HSPI frame requesting a retrain, see link_retrain_frame_fill() */
+#define LINK_RETRAIN_FRAME_SIZE         (8)
+/* A board waits at most this duration for the other one to join the
+ * resynchronisation of a retrain, then it resends its request */
+#define LINK_RETRAIN_SYNC_TIMEOUT_US    (100000)
+/* Number of resynchronisations attempted before a retrain is given up */
+#define LINK_RETRAIN_ATTEMPTS           (3)
+/* Pins of bsp_sync2boards() (PA14 and PA12), toggled by the resynchronisation
+ * of a retrain */
+#define LINK_SYNC_IN_PIN                (GPIO_Pin_14)
+#define LINK_SYNC_OUT_PIN               (GPIO_Pin_12)
+
+/* The settings are ordered from the fastest to the slowest, the index 0 is the
+ * default setting (used when the calibration is disabled or failed) */
+#define LINK_HSPI_SETTINGS_COUNT    (3)
+#define LINK_SERDES_SETTINGS_COUNT  (5)
+
+/* enums */
+enum LinkRetrainReason {
+    LinkRetrainReasonNone  = 0,
+    LinkRetrainReasonHost  = 1,     // BbioLinkRetrain
+    LinkRetrainReasonFault = 2,     // Too many consecutive faulty frames
+    LinkRetrainReasonPeer  = 3,     // Requested by the other board
+};
+
+/* structs */
+
+/* Runtime counters, each board only counts its own side of the links :
+ * - top board: HSPI transmitter, SerDes receiver
+ * - bottom board: HSPI receiver, SerDes transmitter
+ * Reset at the end of link_calibrate()
+ */
+struct LinkHealth_t {
+    uint32_t hspiFrames;            // Frames transmitted or received
+    uint32_t hspiCrcErrors;
+    uint32_t hspiNumMismatches;
+    uint32_t hspiFifoOverflows;
+    uint32_t serdesFrames;          // Frames transmitted or received
+    uint32_t serdesRxErrors;
+    uint32_t serdesFifoOverflows;
+    uint32_t serdesInvalidHeaders;
+    uint32_t retrains;
+    uint32_t lastRetrainUs;         // From the request to the resume
+    uint32_t maxRetrainUs;
+    uint32_t retrainFailures;       // Retrains given up, the other board never joined
+};
+
+/* Result of the calibration of one setting, the transmitter only fills
+ * throughput, the receiver fills the other fields */
+struct LinkCalibrationResult_t {
+    uint32_t frames;        // Frames received
+    uint32_t frameErrors;   // CRC_ERR/NUM_MIS (HSPI) or RX_ERR (SerDes) and lost frames
+    uint32_t bitErrors;     // Bits differing from the PRBS
+    uint32_t throughput;    // In kB/s, DMA time only
+};
+
+/* variables */
+extern volatile struct LinkHealth_t g_linkHealth;
+
+extern const uint8_t g_linkHspiWidths[LINK_HSPI_SETTINGS_COUNT];
+extern const uint8_t g_linkSerdesFreqs[LINK_SERDES_SETTINGS_COUNT];
+
+/* Index of the settings currently in use */
+extern uint8_t g_linkHspiSetting;
+extern uint8_t g_linkSerdesSetting;
+extern bool g_linkCalibrated;
+
+extern struct LinkCalibrationResult_t g_linkCalibrationHspi[LINK_HSPI_SETTINGS_COUNT];
+extern struct LinkCalibrationResult_t g_linkCalibrationSerdes[LINK_SERDES_SETTINGS_COUNT];
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : link_init
+ * Description    : Initialise HSPI and SerDes with the settings currently
+ *                  selected (g_linkHspiSetting and g_linkSerdesSetting)
+ * Input          : true for the top board, false for the bottom board
+ * Return         : None
+ *******************************************************************************/
+void link_init(bool isHost);
+
+/*******************************************************************************
+ * Function Name  : link_calibrate
+ * Description    : Stream PRBS frames over HSPI and SerDes with each supported
+ *                  data width and PLL frequency, then select the fastest
+ *                  settings which ran error-free. Both boards must call it at
+ *                  the same time, the interrupts are disabled meanwhile.
+ *                  The links are initialised with the selected settings when
+ *                  it returns
+ * Input          : true for the top board, false for the bottom board
+ * Return         : None
+ *******************************************************************************/
+void link_calibrate(bool isHost);
+
+/*******************************************************************************
+ * Function Name  : link_fault_report
+ * Description    : Report the status of a received frame, a retrain is
+ *                  requested after LINK_RETRAIN_FAULT_THRESHOLD consecutive
+ *                  faulty frames. Can be called from an interrupt
+ * Input          : true if the frame was faulty, false else
+ * Return         : None
+ *******************************************************************************/
+void link_fault_report(bool isFaulty);
+
+/*******************************************************************************
+ * Function Name  : link_retrain_request
+ * Description    : Request a retrain, it is done by the next call to
+ *                  link_poll(). Can be called from an interrupt
+ * Input          : The reason of the retrain
+ * Return         : None
+ *******************************************************************************/
+void link_retrain_request(enum LinkRetrainReason reason);
+
+/*******************************************************************************
+ * Function Name  : link_poll
+ * Description    : Retrain the links if requested : notify the other board
+ *                  (unless it requested it), quiesce the DMA, re-init HSPI and
+ *                  SerDes, resynchronise with the other board and resume.
+ *                  The resynchronisation gives up after
+ *                  LINK_RETRAIN_SYNC_TIMEOUT_US, the request is then resent by
+ *                  the next call, up to LINK_RETRAIN_ATTEMPTS times.
+ *                  Must be called regularly from the main loop of both boards
+ * Input          : true for the top board, false for the bottom board
+ * Return         : true if the links were retrained, false else
+ *******************************************************************************/
+bool link_poll(bool isHost);
+
+/*******************************************************************************
+ * Function Name  : link_retrain_frame_fill
+ * Description    : Fill the HSPI frame sent by the top board to request a
+ *                  retrain (LINK_RETRAIN_FRAME_SIZE bytes)
+ * Input          : The buffer to fill
+ * Return         : None
+ *******************************************************************************/
+void link_retrain_frame_fill(uint8_t *buffer);
+
+/*******************************************************************************
+ * Function Name  : link_is_retrain_frame
+ * Description    : Check if an HSPI frame is a retrain request
+ * Input          : The received buffer
+ * Return         : true if it is a retrain request, false else
+ *******************************************************************************/
+bool link_is_retrain_frame(const uint8_t *buffer);
+
+/*******************************************************************************
+ * Function Name  : link_report_fill
+ * Description    : Serialize the link health counters, the settings in use and
+ *                  the calibration results
+ * Input          : The buffer to fill and its capacity
+ * Return         : The number of bytes written, 0 if it does not fit
+ *******************************************************************************/
+uint16_t link_report_fill(uint8_t *buffer, uint16_t capacity);
+
+
+#endif /* LINK_H */
@@ -1,13 +1,24 @@
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "CH56xSFR.h"
 #include "CH56x_common.h"
 
+#include "highcode.h"
 #include "serdes.h"
+#include "timebase.h"
 #include "usb20.h"
 
 #include "log.h"
 
+/* variables */
+volatile uint32_t g_logMask = LOG_MASK_DEFAULT;
+
+
+/* functions implementation */
+
 void
 log_to_evaluator(const char *fmt, ...)
 {
@@ -24,3 +35,185 @@ log_to_evaluator(const char *fmt, ...)
 
     va_end(ap);
 }
+
+/* @fn      log_mask_fill
+ *
+ * @brief   Serialize the runtime mask, little endian
+ *
+ * @return  The number of bytes written, 0 if it does not fit
+ */
+uint16_t
+log_mask_fill(uint8_t *buffer, uint16_t capacity)
+{
+    uint32_t mask = g_logMask;
+
+    if (capacity < sizeof(mask)) {
+        return 0;
+    }
+    memcpy(buffer, &mask, sizeof(mask));
+
+    return sizeof(mask);
+}
+
+/* @fn      log_bin_emit
+ *
+ * @brief   Timestamp and send a binary record to the evaluator: appended to
+ *          the endpoint 6 ring on the top board, to the SerdesChannelLog
+ *          stream on the bottom board (forwarded to the endpoint 7 ring)
+ *
+ * @return  None
+ */
+HIGHCODE void
+log_bin_emit(uint16_t id, const uint32_t *args, uint8_t nargs)
+{
+    uint8_t record[LOG_BIN_RECORD_MAX_SIZE];
+    uint32_t ticks = timebase_get_ticks();
+    uint16_t len;
+
+    if (nargs > LOG_BIN_ARGS_MAX) {
+        nargs = LOG_BIN_ARGS_MAX;
+    }
+    len = LOG_BIN_HEADER_SIZE + 4 * nargs;
+
+    record[0] = LOG_BIN_MARKER;
+    record[1] = nargs;
+    record[2] = id & 0xFF;
+    record[3] = id >> 8;
+    memcpy(&record[4], &ticks, sizeof(ticks));
+    memcpy(&record[LOG_BIN_HEADER_SIZE], args, 4 * nargs);
+
+    if (bsp_switch()) {
+        // If is top board
+        usb20_log_append(Ep6Mask, record, len);
+    } else {
+        // Else is bottom board
+        serdes_log_append(record, len);
+    }
+}
+
+/* @fn      _log_ring_copy
+ *
+ * @brief   Copy data in a ring at a given position, wrapping around the end of
+ *          the buffer. Only used internally
+ *
+ * @return  None
+ */
+static HIGHCODE void
+_log_ring_copy(struct LogRing_t *ring, uint32_t position, const uint8_t *data, uint16_t len)
+{
+    uint32_t offset = position & (ring->capacity - 1);
+    uint32_t first = ring->capacity - offset;
+
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(ring->buffer + offset, data, first);
+    memcpy(ring->buffer, data + first, len - first);
+}
+
+/* @fn      _log_ring_leave
+ *
+ * @brief   Leave the ring after a write, the last writer leaving publishes
+ *          everything reserved so far: the writers which preempted it are
+ *          done. Only used internally
+ *
+ * @return  None
+ */
+static HIGHCODE void
+_log_ring_leave(struct LogRing_t *ring)
+{
+    uint32_t reserved;
+    uint32_t committed;
+
+    if (__atomic_sub_fetch(&ring->writers, 1, __ATOMIC_RELEASE) != 0) {
+        return;
+    }
+
+    reserved = __atomic_load_n(&ring->reserved, __ATOMIC_ACQUIRE);
+    committed = __atomic_load_n(&ring->committed, __ATOMIC_RELAXED);
+    // A writer which preempted this one may have published further already,
+    // committed never goes backward
+    while ((int32_t)(reserved - committed) > 0
+           && !__atomic_compare_exchange_n(&ring->committed, &committed, reserved, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* @fn      log_ring_write
+ *
+ * @brief   Append data to a logging ring, lock-free
+ *          1) The notice of the bytes dropped since the last write is claimed
+ *          2) The writer announces itself (writers)
+ *          3) The space is reserved with a compare-and-swap, a preempting
+ *             writer reserves the space after it
+ *          4) The data is copied, then the writer leaves
+ *          When it does not fit, the data (and the claimed notice) is counted
+ *          as dropped, it is reported by the next write which fits
+ *
+ * @return  The number of bytes appended, 0 if the data was dropped
+ */
+HIGHCODE uint16_t
+log_ring_write(struct LogRing_t *ring, const uint8_t *data, uint16_t len)
+{
+    char notice[LOG_RING_NOTICE_CAPACITY];
+    uint32_t pending;
+    uint32_t position;
+    uint32_t total;
+    int noticeLen = 0;
+
+    pending = __atomic_exchange_n(&ring->droppedPending, 0, __ATOMIC_ACQ_REL);
+    if (pending) {
+        noticeLen = snprintf(notice, sizeof(notice), "\r\n[%lu bytes dropped]\r\n", (unsigned long)pending);
+        if (noticeLen < 0) {
+            noticeLen = 0;
+        } else if (noticeLen > (int)sizeof(notice) - 1) {
+            noticeLen = sizeof(notice) - 1;
+        }
+    }
+    total = noticeLen + len;
+
+    __atomic_fetch_add(&ring->writers, 1, __ATOMIC_ACQUIRE);
+
+    position = __atomic_load_n(&ring->reserved, __ATOMIC_RELAXED);
+    do {
+        if (position + total - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->capacity) {
+            _log_ring_leave(ring);
+            __atomic_fetch_add(&ring->dropped, len, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&ring->droppedPending, pending + len, __ATOMIC_RELAXED);
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->reserved, &position, position + total, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    _log_ring_copy(ring, position, (const uint8_t *)notice, noticeLen);
+    _log_ring_copy(ring, position + noticeLen, data, len);
+
+    _log_ring_leave(ring);
+    return len;
+}
+
+/* @fn      log_ring_read
+ *
+ * @brief   Move the committed data of a logging ring to a buffer, the space
+ *          is given back to the writers
+ *
+ * @return  The number of bytes read
+ */
+HIGHCODE uint16_t
+log_ring_read(struct LogRing_t *ring, uint8_t *buffer, uint16_t capacity)
+{
+    uint32_t tail = ring->tail;
+    uint32_t available = __atomic_load_n(&ring->committed, __ATOMIC_ACQUIRE) - tail;
+    uint32_t offset = tail & (ring->capacity - 1);
+    uint32_t first = ring->capacity - offset;
+    uint16_t len = (available < capacity) ? available : capacity;
+
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(buffer, ring->buffer + offset, first);
+    memcpy(buffer + first, ring->buffer, len - first);
+
+    __atomic_store_n(&ring->tail, tail + len, __ATOMIC_RELEASE);
+    return len;
+}
@@ -1,7 +1,166 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stdint.h>
+
+/* macros */
+/* Capacity of the notice inserted in a ring after bytes were dropped */
+#define LOG_RING_NOTICE_CAPACITY    (32)
+
+/* Binary log records, see LOG_BIN(). A record is, in little endian:
+ * - byte 0       : LOG_BIN_MARKER, it never appears in the text logs
+ * - byte 1       : number of arguments
+ * - bytes 2..3   : format string ID, its offset in the .logfmt section
+ * - bytes 4..7   : timestamp, see timebase_get_ticks()
+ * - bytes 8..    : arguments, 32 bits each
+ * The format strings are not loaded in the flash, the host-controller reads
+ * them from the ELF of the firmware to decode the records.
+ */
+#define LOG_BIN_MARKER          (0x00)
+#define LOG_BIN_HEADER_SIZE     (8)
+#define LOG_BIN_ARGS_MAX        (6)
+#define LOG_BIN_RECORD_MAX_SIZE (LOG_BIN_HEADER_SIZE + 4 * LOG_BIN_ARGS_MAX)
+
+#define _LOG_BIN_NARGS(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define LOG_BIN_NARGS(...) _LOG_BIN_NARGS(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+
+/* Log a binary record to the evaluator: a few bytes instead of a formatted
+ * line. The arguments are integers (char, pointers...) converted to 32 bits,
+ * strings (%s) are not supported */
+#define LOG_BIN(fmt, ...) \
+    do { \
+        static const char _logBinFmt[] __attribute__((section(".logfmt"), used)) = fmt; \
+        const uint32_t _logBinArgs[LOG_BIN_NARGS(__VA_ARGS__) + 1] = { 0, ##__VA_ARGS__ }; \
+        log_bin_emit((uint16_t)(uintptr_t)_logBinFmt, &_logBinArgs[1], LOG_BIN_NARGS(__VA_ARGS__)); \
+    } while (0)
+
+/* Log to the evaluator, in binary when LOG_BINARY is set (see the Makefile),
+ * thus with the same restrictions as LOG_BIN() */
+#if LOG_BINARY
+#define LOG(fmt, ...)   LOG_BIN(fmt, ##__VA_ARGS__)
+#else
+#define LOG(fmt, ...)   log_to_evaluator(fmt, ##__VA_ARGS__)
+#endif
+
+/* Levels, a message is compiled in when its level is lower or equal to the
+ * threshold of its module */
+#define LOG_LEVEL_NONE  (0)
+#define LOG_LEVEL_ERROR (1)
+#define LOG_LEVEL_WARN  (2)
+#define LOG_LEVEL_INFO  (3)
+#define LOG_LEVEL_TRACE (4)
+
+/* Modules, a source file selects its module by defining LOG_MODULE before any
+ * include (LOG_MODULE_MAIN by default) */
+#define LOG_MODULE_MAIN     (0)     // main.c, interrupt handlers
+#define LOG_MODULE_BBIO     (1)     // bbio.c
+#define LOG_MODULE_USB      (2)     // usb20*.c
+#define LOG_MODULE_LINK     (3)     // hspi.c, serdes.c, link.c
+#define LOG_MODULE_COUNT    (4)
+
+/* Compile-time thresholds, can be set per module from the Makefile (e.g.
+ * -DLOG_LEVEL_USB=LOG_LEVEL_TRACE). Everything is compiled in for the debug
+ * builds, the enabled levels are then selected at runtime by g_logMask */
+#ifndef LOG_LEVEL
+#if DEBUG
+#define LOG_LEVEL   LOG_LEVEL_TRACE
+#else
+#define LOG_LEVEL   LOG_LEVEL_WARN
+#endif
+#endif
+#ifndef LOG_LEVEL_MAIN
+#define LOG_LEVEL_MAIN  LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_BBIO
+#define LOG_LEVEL_BBIO  LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_USB
+#define LOG_LEVEL_USB   LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_LINK
+#define LOG_LEVEL_LINK  LOG_LEVEL
+#endif
+
+#ifndef LOG_MODULE
+#define LOG_MODULE  LOG_MODULE_MAIN
+#endif
+#if LOG_MODULE == LOG_MODULE_BBIO
+#define LOG_MODULE_LEVEL    LOG_LEVEL_BBIO
+#elif LOG_MODULE == LOG_MODULE_USB
+#define LOG_MODULE_LEVEL    LOG_LEVEL_USB
+#elif LOG_MODULE == LOG_MODULE_LINK
+#define LOG_MODULE_LEVEL    LOG_LEVEL_LINK
+#else
+#define LOG_MODULE_LEVEL    LOG_LEVEL_MAIN
+#endif
+
+/* Runtime mask, 4 bits per module (one per level, ERROR is the bit 0), set by
+ * BbioSetLogMask. TRACE is disabled by default, in each module */
+#if LOG_MODULE_COUNT > 8
+#error "The log mask holds 8 modules"
+#endif
+#define LOG_MASK_BIT(module, level) (1UL << ((module) * 4 + (level) - 1))
+#define LOG_MASK_MODULE_DEFAULT     (0x7)
+#define LOG_MASK_DEFAULT            ((uint32_t)(((1ULL << (LOG_MODULE_COUNT * 4)) - 1) / 0xF * LOG_MASK_MODULE_DEFAULT))
+
+#define LOG_ENABLED(level) \
+    ((level) <= LOG_MODULE_LEVEL && (g_logMask & LOG_MASK_BIT(LOG_MODULE, level)))
+
+#define _LOG_LEVELED(level, fmt, ...) \
+    do { \
+        if (LOG_ENABLED(level)) { \
+            LOG(fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+/* The levels above the threshold of the module compile to nothing */
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...) _LOG_LEVELED(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) do { } while (0)
+#endif
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(fmt, ...) _LOG_LEVELED(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...) do { } while (0)
+#endif
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...) _LOG_LEVELED(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) do { } while (0)
+#endif
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(fmt, ...) _LOG_LEVELED(LOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
+#else
+#define LOG_TRACE(fmt, ...) do { } while (0)
+#endif
+
+/* structs */
+
+/* Logging ring buffer, lock-free. The producers are the main loop and the
+ * interrupts (which preempt each other), the consumer is the endpoint handler.
+ * The positions are free-running counters, the capacity must be a power of 2.
+ * - reserved is advanced with a compare-and-swap by the producers
+ * - committed is advanced by the last producer leaving (writers back to 0),
+ *   the consumer never reads a reserved byte which is not written yet
+ * - tail is only advanced by the consumer
+ * The bytes which do not fit are dropped, counted, and reported in the stream
+ * by the next producer which fits ("[N bytes dropped]")
+ */
+struct LogRing_t {
+    uint8_t *buffer;
+    uint32_t capacity;
+    volatile uint32_t reserved;
+    volatile uint32_t committed;
+    volatile uint32_t tail;
+    volatile uint32_t writers;
+    volatile uint32_t dropped;          // Total number of bytes dropped
+    volatile uint32_t droppedPending;   // Bytes dropped not reported yet
+};
+
 /* variables */
+/* See LOG_MASK_BIT() */
+extern volatile uint32_t g_logMask;
 
 /* functions declaration */
 
@@ -14,4 +173,42 @@
  *******************************************************************************/
 void log_to_evaluator(const char *fmt, ...);
 
+/*******************************************************************************
+ * Function Name  : log_mask_fill
+ * Description    : Serialize the runtime mask (4 bytes, little endian)
+ * Input          : The buffer to fill and its capacity
+ * Return         : The number of bytes written, 0 if it does not fit
+ *******************************************************************************/
+uint16_t log_mask_fill(uint8_t *buffer, uint16_t capacity);
+
+/*******************************************************************************
+ * Function Name  : log_bin_emit
+ * Description    : Timestamp and send a binary record to the evaluator, use
+ *                  LOG_BIN() instead. Can be called from an interrupt
+ * Input          : - id: The format string ID
+ *                  - args and nargs: The arguments (at most LOG_BIN_ARGS_MAX)
+ * Return         : None
+ *******************************************************************************/
+void log_bin_emit(uint16_t id, const uint32_t *args, uint8_t nargs);
+
+/*******************************************************************************
+ * Function Name  : log_ring_write
+ * Description    : Append data to a logging ring, never blocks. Can be called
+ *                  from an interrupt
+ * Input          : - ring: The ring to append to
+ *                  - data and len: The data to append
+ * Return         : The number of bytes appended, 0 if the data was dropped
+ *******************************************************************************/
+uint16_t log_ring_write(struct LogRing_t *ring, const uint8_t *data, uint16_t len);
+
+/*******************************************************************************
+ * Function Name  : log_ring_read
+ * Description    : Move the committed data of a logging ring to a buffer.
+ *                  Only one consumer per ring
+ * Input          : - ring: The ring to read from
+ *                  - buffer and capacity: The buffer to fill
+ * Return         : The number of bytes read
+ *******************************************************************************/
+uint16_t log_ring_read(struct LogRing_t *ring, uint8_t *buffer, uint16_t capacity);
+
 #endif /* LOG_H*/
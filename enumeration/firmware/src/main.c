@@ -17,23 +17,37 @@
 #include "CH56x_debug_log.h"
 
 #include "bbio.h"
+#include "capture.h"
+#include "highcode.h"
 #include "hspi.h"
+#include "irq.h"
+#include "link.h"
 #include "log.h"
+#include "profile.h"
+#include "progress.h"
+#include "responder.h"
 #include "serdes.h"
+#include "stack.h"
+#include "stats.h"
+#include "timebase.h"
+#include "trace.h"
 #include "usb20-endpoints.h"
 #include "usb20.h"
 
 
-// TODOO: Add clock for debug (PFIC_Enable(SysTick) ?)
-
 /* macros */
 #undef FREQ_SYS
 /* System clock / MCU frequency in Hz */
 #define FREQ_SYS (120000000)
+/* Half period of the LED of the bottom board */
+#define LED_TOGGLE_TICKS    (500 * 1000 * TIMEBASE_TICKS_PER_US)
 
 /* variables */
 static bool g_isHost = false;
 
+// Bbio commands are in 2 parts, see HSPI_IRQHandler(), reset by a link retrain
+static uint8_t g_bbioCurrentStep = 0;
+
 uint16_t sizeEndp1Buff = 0;
 const uint16_t capacityEndp1Buff = 4096;
 __attribute__((aligned(16))) uint8_t endp1BuffRaw[4096];
@@ -54,22 +68,19 @@ enum Endpoint g_usb20EpOutMask = Ep1Mask;
 int
 main(void)
 {
+    uint32_t ledTicks;
+    bool isLedOn = true;
+
+    // The interrupt handlers run from RAMX, copy them before anything else
+    highcode_init();
+    stack_init();
+    progress_init();
+
     bsp_gpio_init();
     bsp_init(FREQ_SYS);
     UART1_init(115200, FREQ_SYS);
 
 
-    /* USB Init */
-    if (bsp_switch()) {
-        // Filling structures "describing" our USB peripheral
-        g_descriptorDevice  = (uint8_t *)&stBoardTopDeviceDescriptor;
-        g_descriptorConfig  = (uint8_t *)&stBoardTopConfigurationDescriptor;
-        g_descriptorStrings = boardTopStringDescriptors;
-
-        usb20_registers_init(g_usb20Speed);
-        usb20_endpoints_init(g_usb20EpInMask, g_usb20EpOutMask);
-    }
-
     /* Board sync */
     int retCode;
     if (bsp_switch()) {
@@ -80,49 +91,62 @@ main(void)
         retCode = bsp_sync2boards(PA14, PA12, BSP_BOARD2);
     }
 
-    /* HSPI Init */
-    memset((void *)hspiDmaAddr0, 0, HSPI_DMA_LEN0);
-    hspiDmaAddr0[HSPI_DMA_LEN0-1] = 0;
-    memset((void *)hspiDmaAddr1, 0, HSPI_DMA_LEN1);
-    hspiDmaAddr1[HSPI_DMA_LEN1-1] = 0;
-    if (g_isHost) {
-        HSPI_DoubleDMA_Init(HSPI_HOST, RB_HSPI_DAT32_MOD, (uint32_t)hspiDmaAddr0, (uint32_t)hspiDmaAddr1, HSPI_DMA_LEN);
-    } else {
-        HSPI_DoubleDMA_Init(HSPI_DEVICE, RB_HSPI_DAT32_MOD, (uint32_t)hspiDmaAddr0, (uint32_t)hspiDmaAddr1, 0);
-    }
+    /* HSPI and SerDes Init */
+#if LINK_CALIBRATION
+    // Select the fastest settings the boards and the cable support
+    link_calibrate(g_isHost);
+#else
+    link_init(g_isHost);
+#endif
 
-    /* SerDes Init */
-    PFIC_EnableIRQ(SERDES_IRQn);
-    SerDes_EnableIT(ALL_INT_TYPE);
+    /* USB Init */
+    // Done after the calibration, it runs with the interrupts disabled
     if (g_isHost) {
-        SerDes_Rx_Init(SDS_PLL_FREQ_1_20G);
-        SerDes_DMA_Rx_CFG((uint32_t)serdesDmaAddr);
-    } else {
-        // SDS_TX_INT_FLG should not trigger an interrupt, it is handled by
-        // SerDes_Wait_Txdone()
-        SerDes_EnableIT(ALL_INT_TYPE & ~SDS_TX_INT_FLG);
-        SerDes_Tx_Init(SDS_PLL_FREQ_1_20G);
-        // reconfigured before each transaction, used to identify the "kind" of
-        // the transaction
-        // SerDes_DMA_Tx_CFG((uint32_t)serdesDmaAddr, SERDES_DMA_LEN, serdesCustomNumber);
-    }
+        // Filling structures "describing" our USB peripheral
+        g_descriptorDevice  = (uint8_t *)&stBoardTopDeviceDescriptor;
+        g_descriptorConfig  = (uint8_t *)&stBoardTopConfigurationDescriptor;
+        g_descriptorStrings = boardTopStringDescriptors;
+        g_descriptorStringsCount = sizeof(boardTopStringDescriptors) / sizeof(*boardTopStringDescriptors);
+        usb20_descriptors_derive(g_usb20Speed);
 
+        usb20_registers_init(g_usb20Speed);
+        usb20_endpoints_init(g_usb20EpInMask, g_usb20EpOutMask);
+    }
 
+    /* Interrupts priority and nesting */
+    irq_init();
 
     if (g_isHost) {
-        log_to_evaluator("Init all done!\r\n");
+        LOG_INFO("Init all done!\r\n");
         while (1) {
             // BBIO commands are passed directly to the bottom board,
             // There is no logic in the top board
             // See usb20_ep1_transceive_and_update_host()
+            link_poll(g_isHost);
         }
     } else {
-        log_to_evaluator("Init all done!\r\n");
-        while (1) { 
-            bsp_uled_on();
-            bsp_wait_ms_delay(500);
-            bsp_uled_off();
-            bsp_wait_ms_delay(500);
+        LOG_INFO("Init all done!\r\n");
+        ledTicks = timebase_get_ticks();
+        bsp_uled_on();
+        while (1) {
+            // The queued SerDes frames and the log stream (logs, captured
+            // transactions) are transmitted from here, so the interrupts only
+            // pay for their own frames. Without delay: a burst of the ToE is
+            // drained as it comes, not once per ms
+            serdes_channel_poll();
+            if (link_poll(g_isHost)) {
+                g_bbioCurrentStep = 0;
+            }
+
+            if (timebase_get_ticks() - ledTicks >= LED_TOGGLE_TICKS) {
+                ledTicks += LED_TOGGLE_TICKS;
+                isLedOn = !isLedOn;
+                if (isLedOn) {
+                    bsp_uled_on();
+                } else {
+                    bsp_uled_off();
+                }
+            }
         }
     }
 
@@ -136,10 +160,14 @@ main(void)
  *
  * @return None
  */
-__attribute__((interrupt("WCH-Interrupt-fast"))) void 
+__attribute__((interrupt("WCH-Interrupt-fast"))) HIGHCODE void
 SERDES_IRQHandler(void)
 {
-    uint16_t logLen;
+    uint32_t entry = irq_stats_enter(IrqHandlerSerdes);
+    uint32_t serdesHeader;
+    uint16_t frameLen;
+
+    TRACE_BEGIN(TraceIdIsrSerdes, SerDes_StatusIT());
     switch (SerDes_StatusIT() & ALL_INT_TYPE) {
     case SDS_PHY_RDY_FLG:
         SerDes_ClearIT(SDS_PHY_RDY_FLG);
@@ -149,20 +177,45 @@ SERDES_IRQHandler(void)
         SerDes_ClearIT(SDS_TX_INT_FLG);
         break;
     case SDS_RX_INT_FLG | SDS_RX_ERR_FLG:
-        log_to_evaluator("SDS_RX_INT_FLG | SDS_RX_ERR_FLG\r\n");
+        LOG_WARN("SDS_RX_INT_FLG | SDS_RX_ERR_FLG\r\n");
+        ++g_linkHealth.serdesRxErrors;
         // No breaks, the handling is the same for both interrupts
     case SDS_RX_INT_FLG:
-        switch(SDS->SDS_DATA0 & SerdesMagicNumberMask) {
-        case SerdesMagicNumberLog:
-            // Handle log received from bottom board
-            logLen = strnlen(serdesDmaAddr, SERDES_DMA_LEN);
-            if (sizeEndp7LoggingBuff + logLen <= capacityEndp7LoggingBuff) {
-                memcpy(endp7LoggingBuff + sizeEndp7LoggingBuff, serdesDmaAddr, logLen);
-                sizeEndp7LoggingBuff += logLen;
+        ++g_linkHealth.serdesFrames;
+        serdesHeader = SDS->SDS_DATA0;
+        if (SERDES_HEADER_GET_MAGIC(serdesHeader) != SERDES_HEADER_MAGIC) {
+            ++g_linkHealth.serdesInvalidHeaders;
+            link_fault_report(true);
+            LOG_ERROR("SERDES_IRQHandler() invalid frame header\r\n");
+            SerDes_ClearIT(SerDes_StatusIT() & ALL_INT_TYPE);
+            break;
+        }
+        link_fault_report(SerDes_StatusIT() & SDS_RX_ERR_FLG);
+        frameLen = SERDES_HEADER_GET_LEN(serdesHeader);
+        if (frameLen > SERDES_DMA_LEN) {
+            frameLen = SERDES_DMA_LEN;
+        }
+        TRACE_INSTANT(TraceIdSerdesRx, TRACE_SERDES_ARG(SERDES_HEADER_GET_CHANNEL(serdesHeader), frameLen));
+
+        switch (SERDES_HEADER_GET_CHANNEL(serdesHeader)) {
+        case SerdesChannelEvent:
+            if (frameLen >= 1 && serdesDmaAddr[0] == SerdesEventLinkRetrain) {
+                // Done from the main loop, see link_poll()
+                link_retrain_request(LinkRetrainReasonPeer);
+                break;
             }
+            // No breaks, text events are handled as logs
+        case SerdesChannelLog:
+            // Handle log received from bottom board, events are forwarded
+            // along with the logs
+            usb20_log_append(Ep7Mask, serdesDmaAddr, frameLen);
             break;
-        case SerdesMagicNumberRetCode:
+        case SerdesChannelRetCode:
             // Handle the return code received from bbio_*()
+            if (frameLen == 0) {
+                LOG_ERROR("SERDES_IRQHandler() empty return code\r\n");
+                break;
+            }
 
             /* As mentionned in HSPI_IRQHandler(), if the transaction is
              * faulted, we set the bit 0x80
@@ -172,21 +225,53 @@ SERDES_IRQHandler(void)
             }
 
             // fill ep1 with bbio return code
-            endp1Tbuff[0] = serdesDmaAddr[0];
+            memcpy(endp1Tbuff, serdesDmaAddr, frameLen);
 
             // re enable ack for ep1 IN
             usb20_endpoint_ack(0x81);
-            R16_UEP1_T_LEN = 1; /* The call to usb20_endpoint_ack() reset R16_UEP1_T_LEN to 0 */
+            R16_UEP1_T_LEN = frameLen; /* The call to usb20_endpoint_ack() reset R16_UEP1_T_LEN to 0 */
 
+            break;
+        case SerdesChannelStats:
+            // Handle a BBIO reply : return code, kind, bottom board blocks
+            if (frameLen < 2) {
+                LOG_ERROR("SERDES_IRQHandler() truncated reply\r\n");
+                break;
+            }
+            if (SerDes_StatusIT() & SDS_RX_ERR_FLG) {
+                serdesDmaAddr[0] ^= 0x80;
+            }
+            memcpy(endp1Tbuff, serdesDmaAddr, frameLen);
+
+            // BbioSetLogMask applies to both boards, the bottom board block
+            // holds the new mask
+            if (serdesDmaAddr[1] == StatsKindLogMask && frameLen >= 2 + STATS_BLOCK_HEADER_SIZE + sizeof(g_logMask)) {
+                memcpy((void *)&g_logMask, serdesDmaAddr + 2 + STATS_BLOCK_HEADER_SIZE, sizeof(g_logMask));
+            }
+            // Same for BbioSetProfile, with the period applied
+            if (serdesDmaAddr[1] == StatsKindProfile && frameLen >= 2 + STATS_BLOCK_HEADER_SIZE + sizeof(uint32_t)) {
+                uint32_t periodUs;
+
+                memcpy(&periodUs, serdesDmaAddr + 2 + STATS_BLOCK_HEADER_SIZE, sizeof(periodUs));
+                profile_period_set(periodUs);
+            }
+
+            // Append the block of the top board
+            frameLen += stats_block_fill(serdesDmaAddr[1], StatsBoardTop, endp1Tbuff + frameLen, U20_UEP1_MAXSIZE - frameLen);
+
+            usb20_endpoint_ack(0x81);
+            R16_UEP1_T_LEN = frameLen;
             break;
         default:
-            log_to_evaluator("ERROR: SERDES_IRQHandler() unknown magic number\r\n");
+            LOG_ERROR("SERDES_IRQHandler() channel %d not routed\r\n", SERDES_HEADER_GET_CHANNEL(serdesHeader));
             break;
         }
 
         SerDes_ClearIT(SerDes_StatusIT() & ALL_INT_TYPE);
         break;
     case SDS_FIFO_OV_FLG:
+        ++g_linkHealth.serdesFifoOverflows;
+        link_fault_report(true);
         SerDes_ClearIT(SDS_FIFO_OV_FLG);
         break;
     case SDS_COMMA_INT_FLG:
@@ -196,6 +281,8 @@ SERDES_IRQHandler(void)
         SerDes_ClearIT(ALL_INT_FLG);
         break;
     }
+    TRACE_END(TraceIdIsrSerdes, 0);
+    irq_stats_exit(IrqHandlerSerdes, entry);
 }
 
 
@@ -206,47 +293,75 @@ SERDES_IRQHandler(void)
  *
  * @return None
  */
-__attribute__((interrupt("WCH-Interrupt-fast"))) void
+__attribute__((interrupt("WCH-Interrupt-fast"))) HIGHCODE void
 HSPI_IRQHandler(void)
 {
     // Bbio commands are in 2 parts
     // 1) Bbio instruction, see specs for more details
     // 2) Datas associated to the instruction previously received
-    // Thus the following static var is used to track which part we are in
-    static uint8_t currentStep = 0;
+    // Thus g_bbioCurrentStep is used to track which part we are in
+    uint32_t entry = irq_stats_enter(IrqHandlerHspi);
     uint8_t bbioRetCode = 0;
 
     uint8_t hspiRtxStatus;
     uint8_t *hspiRxBuffer;
 
+    TRACE_BEGIN(TraceIdIsrHspi, R8_HSPI_INT_FLAG);
     switch (R8_HSPI_INT_FLAG & HSPI_INT_FLAG) {
     case RB_HSPI_IF_T_DONE:
         hspiRtxStatus = hspi_get_rtx_status();
+        TRACE_INSTANT(TraceIdHspiTx, hspiRtxStatus);
+        ++g_linkHealth.hspiFrames;
+        g_linkHealth.hspiCrcErrors     += (hspiRtxStatus & RB_HSPI_CRC_ERR) != 0;
+        g_linkHealth.hspiNumMismatches += (hspiRtxStatus & RB_HSPI_NUM_MIS) != 0;
         if (hspiRtxStatus) {
-            log_to_evaluator("[Interrupt HSPI]   Error transmitting: %s\r\n", hspiRtxStatus&RB_HSPI_CRC_ERR? "CRC_ERR" : "NUM_MIS");
+            if (hspiRtxStatus & RB_HSPI_CRC_ERR) {
+                LOG_WARN("[Interrupt HSPI]   Error transmitting: CRC_ERR\r\n");
+            } else {
+                LOG_WARN("[Interrupt HSPI]   Error transmitting: NUM_MIS\r\n");
+            }
         }
         R8_HSPI_INT_FLAG = RB_HSPI_IF_T_DONE;
         break;
     case RB_HSPI_IF_R_DONE:
         hspiRtxStatus = hspi_get_rtx_status();
         hspiRxBuffer = hspi_get_buffer_rx();
+        TRACE_INSTANT(TraceIdHspiRx, hspiRtxStatus);
+        ++g_linkHealth.hspiFrames;
+        g_linkHealth.hspiCrcErrors     += (hspiRtxStatus & RB_HSPI_CRC_ERR) != 0;
+        g_linkHealth.hspiNumMismatches += (hspiRtxStatus & RB_HSPI_NUM_MIS) != 0;
         if (hspiRtxStatus) {
-            log_to_evaluator("[Interrupt HSPI]   Error receiving: %s\r\n", hspiRtxStatus&RB_HSPI_CRC_ERR? "CRC_ERR" : "NUM_MIS");
+            if (hspiRtxStatus & RB_HSPI_CRC_ERR) {
+                LOG_WARN("[Interrupt HSPI]   Error receiving: CRC_ERR\r\n");
+            } else {
+                LOG_WARN("[Interrupt HSPI]   Error receiving: NUM_MIS\r\n");
+            }
+        }
+        link_fault_report(hspiRtxStatus);
+
+        // The top board requests a retrain, done from the main loop, see
+        // link_poll()
+        if (!hspiRtxStatus && link_is_retrain_frame(hspiRxBuffer)) {
+            link_retrain_request(LinkRetrainReasonPeer);
+            R8_HSPI_INT_FLAG = RB_HSPI_IF_R_DONE;
+            break;
         }
 
         // Business logic goes here
-        if (currentStep == 0) {
+        if (g_bbioCurrentStep == 0) {
+            TRACE_BEGIN(TraceIdBbio, hspiRxBuffer[0]);
             bbioRetCode = bbio_command_decode(hspiRxBuffer);
 
             // Epilog
-            currentStep ^= 1;
-        } else if (currentStep == 1) {
+            g_bbioCurrentStep ^= 1;
+        } else if (g_bbioCurrentStep == 1) {
             bbioRetCode = bbio_command_handle(hspiRxBuffer);
+            TRACE_END(TraceIdBbio, bbioRetCode);
 
             // Epilog
-            currentStep ^= 1;
+            g_bbioCurrentStep ^= 1;
         } else {
-            log_to_evaluator("ERROR: Bottom board HSPI Handler current step: %x\r\n", currentStep);
+            LOG_ERROR("Bottom board HSPI Handler current step: %x\r\n", g_bbioCurrentStep);
         }
 
         /* Some documentation about bbioRetCode :
@@ -257,14 +372,20 @@ HSPI_IRQHandler(void)
         if (hspiRtxStatus) {
             bbioRetCode ^= 0x40;
         }
-        serdesDmaAddr[0] = bbioRetCode;
-        SerDes_DMA_Tx_CFG((uint32_t)serdesDmaAddr, SERDES_DMA_LEN, SerdesMagicNumberRetCode);
-        SerDes_DMA_Tx();
-        SerDes_Wait_Txdone();
+        // The return code preempts the logs queued on the SerDes
+        if (g_bbioReplySize) {
+            g_bbioReply[0] = bbioRetCode;
+            serdes_channel_send(SerdesChannelStats, g_bbioReply, g_bbioReplySize);
+            g_bbioReplySize = 0;
+        } else {
+            serdes_channel_send(SerdesChannelRetCode, &bbioRetCode, 1);
+        }
         // Clear the interrupt before sending the bbioRetCode via SerDes
         R8_HSPI_INT_FLAG = RB_HSPI_IF_R_DONE;
         break;
     case RB_HSPI_IF_FIFO_OV:
+        ++g_linkHealth.hspiFifoOverflows;
+        link_fault_report(true);
         R8_HSPI_INT_FLAG = RB_HSPI_IF_FIFO_OV;
         break;
     case RB_HSPI_IF_B_DONE:
@@ -272,21 +393,45 @@ HSPI_IRQHandler(void)
         break;
     default:
         R8_HSPI_INT_FLAG = R8_HSPI_INT_FLAG & HSPI_INT_FLAG;
-        log_to_evaluator("ERROR: HSPI_IRQHandler() switch hits default\r\n");
+        LOG_ERROR("HSPI_IRQHandler() switch hits default\r\n");
         break;
     }
+    TRACE_END(TraceIdIsrHspi, 0);
+    irq_stats_exit(IrqHandlerHspi, entry);
 }
 
 
 /*******************************************************************************
- * @fn     USBHS_IRQHandler
+ * @fn     _usbhs_irq_is_log_poll
  *
- * @brief  USB2.0 Interrupt Handler
+ * @brief  Check if the pending USB2.0 interrupt is an IN transfer on a logging
+ *         endpoint of the top board, the host polls them continuously
+ *         Only used internally
+ *
+ * @return true if it is, else false
+ */
+static HIGHCODE bool
+_usbhs_irq_is_log_poll(void)
+{
+    uint8_t endpNum = R8_USB_INT_ST & RB_DEV_ENDP_MASK;
+
+    // Same order as _usbhs_irq_handle()
+    if (!g_isHost || (R8_USB_INT_FG & (RB_USB_IF_ISOACT | RB_USB_IF_SETUOACT | RB_USB_IF_FIFOOV | RB_USB_IF_SUSPEND))) {
+        return false;
+    }
+    return (R8_USB_INT_FG & RB_USB_IF_TRANSFER) && (endpNum == 6 || endpNum == 7);
+}
+
+/*******************************************************************************
+ * @fn     _usbhs_irq_handle
+ *
+ * @brief  Handle the USB2.0 interrupt, see USBHS_IRQHandler()
+ *         Only used internally
  *
  * @return None
  */
-__attribute__((interrupt("WCH-Interrupt-fast"))) void
-USBHS_IRQHandler(void)
+static HIGHCODE void
+_usbhs_irq_handle(void)
 {
     static uint16_t bytesToWrite = 0;
     static uint8_t *pDataToWrite = NULL;
@@ -299,23 +444,49 @@ USBHS_IRQHandler(void)
         /* Unused */
         R8_USB_INT_FG = RB_USB_IF_ISOACT;
     } else if (R8_USB_INT_FG & RB_USB_IF_SETUOACT) { // Setup interrupt
+        enum ResponderAction responderAction = ResponderActionNone;
+
         SetupReqType = UsbSetupBuf->bRequestType;
         SetupReq = UsbSetupBuf->bRequest;
         SetupReqLen = UsbSetupBuf->wLength;
+        // A SETUP aborts the data stage of the previous request
+        pDataToWrite = NULL;
+
+        TRACE_INSTANT(TraceIdSetup, (SetupReqType << 8) | SetupReq);
+        irq_stats_setup_count(SetupReqType, SetupReq);
+        if (!g_isHost) {
+            capture_setup(UsbSetupBuf);
+            progress_setup_record(SetupReqType, SetupReq, UsbSetupBuf->wValue.w, UsbSetupBuf->wIndex.w, SetupReqLen);
+        }
 
         /* If bRequest != 0 it is a non standard request, thus not covered  by the spec */
         if ((SetupReqType & USB_REQ_TYP_MASK) != USB_REQ_TYP_STANDARD) {
-            if ((SetupReqType & USB_REQ_TYP_MASK) != USB_REQ_TYP_CLASS) {
+            /* The table uploaded by the host answers first, without a round
+             * trip to the host, see responder.h */
+            if (!g_isHost) {
+                responderAction = responder_lookup(SetupReqType, SetupReq, UsbSetupBuf->wValue.w,
+                                                   UsbSetupBuf->wIndex.w, &pDataToWrite, &bytesToWrite);
+            }
+            if (responderAction == ResponderActionStall) {
+                usb20_endpoint_halt(0x80);
+                usb20_endpoint_halt(0x00);
+                R8_USB_INT_FG = RB_USB_IF_SETUOACT;
                 return;
             }
-            /* As of now only Hub enumeration requires a class specific
-             * response. */
-            /* HID uses it too but for setIdle(), which can be discarded for
-             * enumeration. */
-            if (SetupReq == HUB_GET_DESCRIPTOR) {
-                // WARNING! We get the size from the descriptor itself
-                pDataToWrite = g_descriptorHubReport;
-                bytesToWrite = g_descriptorHubReport[0];
+
+            if (responderAction == ResponderActionNone) {
+                if ((SetupReqType & USB_REQ_TYP_MASK) != USB_REQ_TYP_CLASS) {
+                    return;
+                }
+                /* As of now only Hub enumeration requires a class specific
+                 * response. */
+                /* HID uses it too but for setIdle(), which can be discarded for
+                 * enumeration. */
+                if (SetupReq == HUB_GET_DESCRIPTOR) {
+                    // WARNING! We get the size from the descriptor itself
+                    pDataToWrite = g_descriptorHubReport;
+                    bytesToWrite = g_descriptorHubReport[0];
+                }
             }
 
         } else {
@@ -340,7 +511,7 @@ USBHS_IRQHandler(void)
                     // usb20_endpoint_clear(UsbSetupBuf->wValue.bw.bb1);
                     break;
                 default:
-                    log_to_evaluator("ERROR: SETUP Interrupt USB_CLEAR_FEATURE invalid recipient");
+                    LOG_ERROR("SETUP Interrupt USB_CLEAR_FEATURE invalid recipient");
                     break;
                 }
                 break;
@@ -348,11 +519,11 @@ USBHS_IRQHandler(void)
                 switch (SetupReqType & USB_REQ_RECIP_MASK) {
                 case USB_REQ_RECIP_DEVICE:
                     /* Not implemented */
-                    log_to_evaluator("ERROR: SETUP Interrupt USB_SET_FEATURE (toward device) unimplemented");
+                    LOG_ERROR("SETUP Interrupt USB_SET_FEATURE (toward device) unimplemented");
                     break;
                 case USB_REQ_RECIP_INTERF:
                     /* Not implemented */
-                    log_to_evaluator("ERROR: SETUP Interrupt USB_SET_FEATURE (toward interface) unimplemented");
+                    LOG_ERROR("SETUP Interrupt USB_SET_FEATURE (toward interface) unimplemented");
                     break;
                 case USB_REQ_RECIP_ENDP:
                     switch (UsbSetupBuf->wValue.w) {
@@ -360,12 +531,12 @@ USBHS_IRQHandler(void)
                         usb20_endpoint_halt(UsbSetupBuf->wValue.bw.bb1);
                         break;
                     default:
-                        log_to_evaluator("ERROR: SETUP Interrupt USB_SET_FEATURE (toward endpoint) unimplemented");
+                        LOG_ERROR("SETUP Interrupt USB_SET_FEATURE (toward endpoint) unimplemented");
                         break;
                     }
                     break;
                 default:
-                    log_to_evaluator("ERROR: SETUP Interrupt USB_SET_FEATURE invalid recipient");
+                    LOG_ERROR("SETUP Interrupt USB_SET_FEATURE invalid recipient");
                     break;
                 }
                 break;
@@ -374,8 +545,15 @@ USBHS_IRQHandler(void)
                 // following one (RB_USB_IF_TRANSFER IN)
                 break;
             case USB_GET_DESCRIPTOR:
-                // log_to_evaluator("getDescriptor(0x%04x)\r\n", UsbSetupBuf->wValue);
-                usb20_fill_buffer_with_descriptor(UsbSetupBuf->wValue, &pDataToWrite, &bytesToWrite);
+                LOG_TRACE("getDescriptor(0x%04x)\r\n", UsbSetupBuf->wValue.w);
+                if (usb20_fill_buffer_with_descriptor(UsbSetupBuf->wValue, &pDataToWrite, &bytesToWrite)) {
+                    // The device has no such descriptor, the request error
+                    // is a STALL
+                    usb20_endpoint_halt(0x80);
+                    usb20_endpoint_halt(0x00);
+                    R8_USB_INT_FG = RB_USB_IF_SETUOACT;
+                    return;
+                }
                 break;
             case USB_SET_DESCRIPTOR:
                 /* Unused */
@@ -392,9 +570,12 @@ USBHS_IRQHandler(void)
                      * After giving an address to the device and getting its
                      * descriptors, the last step is to set a configuration
                      * Thus, when a configuration is set we can assume that the
-                     * device is supported by the ToE's USB stack
+                     * device is supported by the ToE's USB stack, unless the
+                     * host selected ProgressCriterionEndpointTraffic
                      */
-                    g_doesToeSupportCurrentDevice = true;   /* From src/bbio.h */
+                    if (progress_is_supported()) {
+                        g_doesToeSupportCurrentDevice = true;   /* From src/bbio.h */
+                    }
                 }
                 break;
             case USB_GET_INTERFACE:
@@ -456,16 +637,17 @@ USBHS_IRQHandler(void)
                 ep1_transceive_and_update_host(uisToken, (uint8_t **)&endp1Buff, &sizeEndp1Buff);
                 break;
             case 6:
-                ep6_transmit_and_update(uisToken, (uint8_t **)&endp6LoggingBuff, &sizeEndp6LoggingBuff);
+                ep6_transmit_and_update(uisToken, &endp6LoggingRing);
                 break;
             case 7:
-                ep7_transmit_and_update(uisToken, (uint8_t **)&endp7LoggingBuff, &sizeEndp7LoggingBuff);
+                ep7_transmit_and_update(uisToken, &endp7LoggingRing);
                 break;
             default:
-                log_to_evaluator("ERROR: USBHS_IRQHandler() endpoint requested (%d) has no handler associated\r\n", endpNum);
+                LOG_ERROR("USBHS_IRQHandler() endpoint requested (%d) has no handler associated\r\n", endpNum);
                 break;
             }
         } else {
+            capture_transaction(endpNum, uisToken);
             switch (endpNum) {
             case 0:
                 if (SetupReq == USB_SET_ADDRESS) {
@@ -487,15 +669,23 @@ USBHS_IRQHandler(void)
             case 6:
             case 7:
                 epX_handler_toe(uisToken, endpNum);
+                // With ProgressCriterionEndpointTraffic
+                if (progress_is_supported()) {
+                    g_doesToeSupportCurrentDevice = true;
+                }
                 break;
             default:
-                log_to_evaluator("ERROR: USBHS_IRQHandler() endpoint requested (%d) has no handler associated\r\n", endpNum);
+                LOG_ERROR("USBHS_IRQHandler() endpoint requested (%d) has no handler associated\r\n", endpNum);
                 break;
             }
         }
 
         R8_USB_INT_FG = RB_USB_IF_TRANSFER; // Clear int flag
     } else if (R8_USB_INT_FG & RB_USB_IF_BUSRST) {
+        if (!g_isHost) {
+            capture_bus_reset();
+            progress_stage_reach(ProgressStageBusReset);
+        }
         usb20_registers_init(g_usb20Speed);
         usb20_endpoints_init(g_usb20EpInMask, g_usb20EpOutMask);
 
@@ -503,6 +693,57 @@ USBHS_IRQHandler(void)
     }
 }
 
+/*******************************************************************************
+ * @fn     USBHS_IRQHandler
+ *
+ * @brief  USB2.0 Interrupt Handler
+ *
+ * @return None
+ */
+__attribute__((interrupt("WCH-Interrupt-fast"))) HIGHCODE void
+USBHS_IRQHandler(void)
+{
+    uint32_t entry = irq_stats_enter(IrqHandlerUsb);
+    // The polling of the logs would fill the trace ring on the top board
+    bool isTraced = TRACE_EVENTS && !_usbhs_irq_is_log_poll();
+
+    if (isTraced) {
+        TRACE_BEGIN(TraceIdIsrUsb, R8_USB_INT_FG);
+    }
+    _usbhs_irq_handle();
+    if (isTraced) {
+        TRACE_END(TraceIdIsrUsb, 0);
+    }
+    profile_usb_exit();
+    irq_stats_exit(IrqHandlerUsb, entry);
+}
+
+
+/*******************************************************************************
+ * @fn     TMR0_IRQHandler
+ *
+ * @brief  Profiler sampling Interrupt Handler, see profile_period_set()
+ *
+ * @return None
+ */
+__attribute__((interrupt("WCH-Interrupt-fast"))) HIGHCODE void
+TMR0_IRQHandler(void)
+{
+    uint32_t pc;
+
+    // The interrupted PC: the main loop or a link interrupt. Read directly,
+    // __get_MEPC() is in the flash
+    __asm__ volatile ("csrr %0, mepc" : "=r"(pc));
+    // Held off by the USB interrupt (same preemption level), the period
+    // elapsed in it rather than in the code it returned to
+    if (profile_is_held_by_usb()) {
+        pc = (uint32_t)USBHS_IRQHandler;
+    }
+    profile_sample(pc);
+
+    TMR0_ClearITFlag(RB_TMR_IF_CYC_END);
+}
+
 
 /*********************************************************************
  * @fn      HardFault_Handler
@@ -0,0 +1,126 @@
+#include <string.h>
+
+#include "CH56xSFR.h"
+#include "CH56x_common.h"
+
+#include "highcode.h"
+#include "log.h"
+#include "timebase.h"
+
+#include "profile.h"
+
+
+/* internal variables */
+/* Only accessed by TMR0_IRQHandler() once the sampling is started */
+static uint32_t _samples[PROFILE_SAMPLES_PER_RECORD];
+static uint8_t _sizeSamples = 0;
+static volatile uint32_t _periodUs = 0;
+/* Set by USBHS_IRQHandler(), cleared by TMR0_IRQHandler(), same preemption
+ * level */
+static bool _isHeldByUsb = false;
+
+
+/* functions implementation */
+
+/* @fn      profile_period_set
+ *
+ * @brief   Start or stop sampling the interrupted PC
+ *
+ * @return  None
+ */
+void
+profile_period_set(uint32_t periodUs)
+{
+    PFIC_DisableIRQ(TMR0_IRQn);
+    TMR0_Disable();
+    TMR0_ClearITFlag(RB_TMR_IF_CYC_END);
+    _sizeSamples = 0;
+
+    if (periodUs == 0) {
+        _periodUs = 0;
+        return;
+    }
+    if (periodUs < PROFILE_PERIOD_US_MIN) {
+        periodUs = PROFILE_PERIOD_US_MIN;
+    }
+    if (periodUs > PROFILE_PERIOD_US_MAX) {
+        periodUs = PROFILE_PERIOD_US_MAX;
+    }
+    _periodUs = periodUs;
+
+    // TMR0 counts at the system clock, as the timebase
+    TMR0_TimerInit(periodUs * TIMEBASE_TICKS_PER_US);
+    TMR0_ITCfg(ENABLE, RB_TMR_IE_CYC_END);
+    PFIC_EnableIRQ(TMR0_IRQn);
+}
+
+/* @fn      profile_sample
+ *
+ * @brief   Record a sample, the samples are sent by records of
+ *          PROFILE_SAMPLES_PER_RECORD
+ *
+ * @return  None
+ */
+HIGHCODE void
+profile_sample(uint32_t pc)
+{
+    _samples[_sizeSamples++] = pc;
+    if (_sizeSamples < PROFILE_SAMPLES_PER_RECORD) {
+        return;
+    }
+    _sizeSamples = 0;
+
+    // Not masked by g_logMask, the host-controller collects them
+    LOG_BIN(PROFILE_RECORD_FORMAT, _samples[0], _samples[1], _samples[2], _samples[3], _samples[4], _samples[5]);
+}
+
+/* @fn      profile_usb_exit
+ *
+ * @brief   Note if the sampling interrupt was held off by the USB interrupt
+ *
+ * @return  None
+ */
+HIGHCODE void
+profile_usb_exit(void)
+{
+    // TMR0 preempts everything else, pending here it was raised while the USB
+    // interrupt ran (or with it)
+    if (_periodUs && PFIC_GetPendingIRQ(TMR0_IRQn)) {
+        _isHeldByUsb = true;
+    }
+}
+
+/* @fn      profile_is_held_by_usb
+ *
+ * @brief   Tell if the pending sample was held off by the USB interrupt, then
+ *          forget it
+ *
+ * @return  true if held off by the USB interrupt, false else
+ */
+HIGHCODE bool
+profile_is_held_by_usb(void)
+{
+    bool isHeldByUsb = _isHeldByUsb;
+
+    _isHeldByUsb = false;
+    return isHeldByUsb;
+}
+
+/* @fn      profile_fill
+ *
+ * @brief   Serialize the sampling period applied, little endian
+ *
+ * @return  The number of bytes written, 0 if it does not fit
+ */
+uint16_t
+profile_fill(uint8_t *buffer, uint16_t capacity)
+{
+    uint32_t periodUs = _periodUs;
+
+    if (capacity < sizeof(periodUs)) {
+        return 0;
+    }
+    memcpy(buffer, &periodUs, sizeof(periodUs));
+
+    return sizeof(periodUs);
+}
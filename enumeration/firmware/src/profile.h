@@ -0,0 +1,73 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* macros */
+/* The samples are sent with the logs, as binary records of this format (see
+ * LOG_BIN()), PROFILE_SAMPLES_PER_RECORD interrupted PCs each. Must match
+ * host-controller/log_decoder.h */
+#define PROFILE_RECORD_FORMAT       "PC samples %x %x %x %x %x %x\r\n"
+#define PROFILE_SAMPLES_PER_RECORD  (6)
+
+/* Sampling period bounds, in us. At 1 kHz a board sends ~5 kB/s of records */
+#define PROFILE_PERIOD_US_MIN       (20)
+#define PROFILE_PERIOD_US_MAX       (100000)
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : profile_period_set
+ * Description    : Start sampling the interrupted PC with TMR0, or stop it.
+ *                  The sampling interrupt preempts the main loop and the link
+ *                  interrupts, not the USB one (see IRQ_PRIORITY_PROFILE) : a
+ *                  sample held off by USBHS_IRQHandler() is credited to it,
+ *                  see profile_usb_exit(). The samples not sent yet are
+ *                  dropped when stopping
+ * Input          : The sampling period in us, clamped to PROFILE_PERIOD_US_*,
+ *                  0 stops the sampling
+ * Return         : None
+ *******************************************************************************/
+void profile_period_set(uint32_t periodUs);
+
+/*******************************************************************************
+ * Function Name  : profile_sample
+ * Description    : Record a sample, called by TMR0_IRQHandler()
+ * Input          : The interrupted PC (mepc)
+ * Return         : None
+ *******************************************************************************/
+void profile_sample(uint32_t pc);
+
+/*******************************************************************************
+ * Function Name  : profile_usb_exit
+ * Description    : Note if the sampling interrupt was held off by the USB
+ *                  interrupt (pending when it returns), to call last in
+ *                  USBHS_IRQHandler()
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void profile_usb_exit(void);
+
+/*******************************************************************************
+ * Function Name  : profile_is_held_by_usb
+ * Description    : Tell if the pending sample was held off by the USB
+ *                  interrupt, then forget it. The interrupted PC is then the
+ *                  code USBHS_IRQHandler() returned to, the period elapsed in
+ *                  the handler
+ * Input          : None
+ * Return         : true if held off by the USB interrupt, false else
+ *******************************************************************************/
+bool profile_is_held_by_usb(void);
+
+/*******************************************************************************
+ * Function Name  : profile_fill
+ * Description    : Serialize the sampling period applied (4 bytes, little
+ *                  endian, 0 if stopped)
+ * Input          : The buffer to fill and its capacity
+ * Return         : The number of bytes written, 0 if it does not fit
+ *******************************************************************************/
+uint16_t profile_fill(uint8_t *buffer, uint16_t capacity);
+
+
+#endif /* PROFILE_H */
@@ -0,0 +1,339 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "CH56xSFR.h"
+#include "CH56x_common.h"
+
+#include "highcode.h"
+#include "timebase.h"
+
+#include "progress.h"
+
+
+/* structs */
+struct ProgressRequest_t {
+    uint8_t requestType;
+    uint8_t request;
+    uint16_t value;
+    uint16_t index;
+    uint16_t length;
+    uint32_t ticks;     // From BbioConnect
+};
+
+struct Progress_t {
+    volatile uint32_t stages;       // 1 << enum ProgressStage, set once timestamped
+    volatile uint32_t setups;
+    uint32_t connectTicks;
+    volatile uint32_t lastSetupTicks;
+    volatile uint32_t stageTicks[ProgressStageCount];
+    uint32_t disconnectTicks;
+    bool isDisconnected;
+    volatile uint32_t endpoints;    // See PROGRESS_SIZE, set once timestamped
+    uint32_t endpointTicks[2 * PROGRESS_ENDPOINTS];
+    struct ProgressRequest_t requests[PROGRESS_REQUESTS];  // The first SETUP packets
+};
+
+struct ProgressCriterion_t {
+    uint8_t criterion;
+    uint32_t windowTicks;   // 0 for no limit
+};
+
+/* internal variables */
+/* Written by the USB interrupt, read by a link interrupt it preempts: a stage
+ * is published after its time */
+static struct Progress_t _progress RAMX_BSS;
+/* Kept across progress_reset() */
+static struct ProgressCriterion_t _criterion RAMX_BSS;
+
+
+/* functions implementation */
+
+/* @fn      progress_init
+ *
+ * @brief   Clear the record and select ProgressCriterionSetConfiguration
+ *
+ * @return  None
+ */
+void
+progress_init(void)
+{
+    _criterion.criterion = ProgressCriterionSetConfiguration;
+    progress_reset();
+}
+
+/* @fn      progress_reset
+ *
+ * @brief   Forget the stages reached, the times are counted from now
+ *
+ * @return  None
+ */
+void
+progress_reset(void)
+{
+    memset((void *)&_progress, 0, sizeof(_progress));
+    _progress.connectTicks = timebase_get_ticks();
+    _progress.lastSetupTicks = _progress.connectTicks;
+}
+
+/* @fn      progress_stage_reach
+ *
+ * @brief   Record a stage, only its first occurrence is timestamped
+ *
+ * @return  None
+ */
+HIGHCODE void
+progress_stage_reach(enum ProgressStage stage)
+{
+    if (_progress.stages & (1u << stage)) {
+        return;
+    }
+
+    _progress.stageTicks[stage] = timebase_get_ticks() - _progress.connectTicks;
+    __atomic_fetch_or(&_progress.stages, 1u << stage, __ATOMIC_RELEASE);
+}
+
+/* @fn      progress_setup_record
+ *
+ * @brief   Count a SETUP packet of the ToE, log it and record the stage it
+ *          marks
+ *
+ * @return  None
+ */
+HIGHCODE void
+progress_setup_record(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index, uint16_t length)
+{
+    uint32_t setups = _progress.setups;
+    struct ProgressRequest_t *entry;
+
+    _progress.lastSetupTicks = timebase_get_ticks();
+    if (setups < PROGRESS_REQUESTS) {
+        entry = &_progress.requests[setups];
+        entry->requestType = requestType;
+        entry->request = request;
+        entry->value = value;
+        entry->index = index;
+        entry->length = length;
+        entry->ticks = _progress.lastSetupTicks - _progress.connectTicks;
+    }
+    // The entry is published with the count
+    __atomic_store_n(&_progress.setups, setups + 1, __ATOMIC_RELEASE);
+
+    if ((requestType & USB_REQ_TYP_MASK) != USB_REQ_TYP_STANDARD) {
+        return;
+    }
+
+    switch (request) {
+    case USB_SET_ADDRESS:
+        progress_stage_reach(ProgressStageSetAddress);
+        break;
+    case USB_GET_DESCRIPTOR:
+        // The descriptor type is the high byte of wValue
+        switch (value >> 8) {
+        case USB_DESCR_TYP_DEVICE:
+            progress_stage_reach(ProgressStageDeviceDescriptor);
+            break;
+        case USB_DESCR_TYP_CONFIG:
+            progress_stage_reach(ProgressStageConfigDescriptor);
+            break;
+        case USB_DESCR_TYP_STRING:
+            progress_stage_reach(ProgressStageStringDescriptor);
+            break;
+        default:
+            break;
+        }
+        break;
+    case USB_SET_CONFIGURATION:
+        progress_stage_reach(ProgressStageSetConfiguration);
+        break;
+    default:
+        break;
+    }
+}
+
+/* @fn      progress_endpoint_record
+ *
+ * @brief   Record a transaction on an endpoint other than 0, only the first
+ *          one of each endpoint is timestamped
+ *
+ * @return  None
+ */
+HIGHCODE void
+progress_endpoint_record(uint8_t token, uint8_t endpoint)
+{
+    uint8_t index;
+
+    if (endpoint == 0 || endpoint > PROGRESS_ENDPOINTS) {
+        return;
+    }
+
+    index = (token == UIS_TOKEN_IN ? 0 : PROGRESS_ENDPOINTS) + endpoint - 1;
+    if (_progress.endpoints & (1u << index)) {
+        return;
+    }
+
+    _progress.endpointTicks[index] = timebase_get_ticks() - _progress.connectTicks;
+    __atomic_fetch_or(&_progress.endpoints, 1u << index, __ATOMIC_RELEASE);
+    progress_stage_reach(ProgressStageEndpointTraffic);
+}
+
+/* @fn      progress_criterion_set
+ *
+ * @brief   Select when the emulated device is supported
+ *
+ * @return  0 if success, 1 if the criterion is unknown
+ */
+uint8_t
+progress_criterion_set(uint8_t criterion, uint32_t windowMs)
+{
+    if (criterion >= ProgressCriterionCount) {
+        return 1;
+    }
+
+    if (windowMs > PROGRESS_WINDOW_MAX_MS) {
+        windowMs = PROGRESS_WINDOW_MAX_MS;
+    }
+    _criterion.criterion = criterion;
+    _criterion.windowTicks = windowMs * (TIMEBASE_TICKS_PER_US * 1000);
+
+    return 0;
+}
+
+/* @fn      progress_is_supported
+ *
+ * @brief   Tell if the stages reached meet the selected criterion
+ *
+ * @return  true if the ToE supports the emulated device, false else
+ */
+HIGHCODE bool
+progress_is_supported(void)
+{
+    uint32_t stages = _progress.stages;
+    uint32_t both = (1u << ProgressStageSetConfiguration) | (1u << ProgressStageEndpointTraffic);
+    int32_t delayTicks;
+
+    switch (_criterion.criterion) {
+    case ProgressCriterionSetConfiguration:
+        return stages & (1u << ProgressStageSetConfiguration);
+    case ProgressCriterionEndpointTraffic:
+        if ((stages & both) != both) {
+            return false;
+        }
+        delayTicks = _progress.stageTicks[ProgressStageEndpointTraffic] - _progress.stageTicks[ProgressStageSetConfiguration];
+        return _criterion.windowTicks == 0 || delayTicks <= (int32_t)_criterion.windowTicks;
+    default:
+        return false;
+    }
+}
+
+/* @fn      progress_disconnect
+ *
+ * @brief   Record the disconnection of the emulated device, the bus settles
+ *          from now
+ *
+ * @return  None
+ */
+void
+progress_disconnect(void)
+{
+    _progress.disconnectTicks = timebase_get_ticks();
+    _progress.isDisconnected = true;
+}
+
+/* @fn      progress_bus_is_idle
+ *
+ * @brief   Tell if the settle time elapsed since the disconnection
+ *
+ * @return  true if the device is disconnected since windowUs at least, false
+ *          else
+ */
+bool
+progress_bus_is_idle(uint32_t windowUs)
+{
+    if (!_progress.isDisconnected) {
+        return false;
+    }
+
+    // The USB device is stopped once disconnected, nothing on the bus can be
+    // observed: the window is a fixed settle time
+    return timebase_ticks_to_us(timebase_get_ticks() - _progress.disconnectTicks) >= windowUs;
+}
+
+/* @fn      _progress_put
+ *
+ * @brief   Write a little endian 32 bits value
+ *          Only used internally
+ *
+ * @return  The position after the value
+ */
+static uint8_t *
+_progress_put(uint8_t *cursor, uint32_t value)
+{
+    for (uint8_t i = 0; i < 4; ++i) {
+        cursor[i] = value >> (8 * i);
+    }
+
+    return cursor + 4;
+}
+
+/* @fn      progress_fill
+ *
+ * @brief   Serialize the record
+ *
+ * @return  The number of bytes written, 0 if it does not fit
+ */
+uint16_t
+progress_fill(uint8_t *buffer, uint16_t capacity)
+{
+    uint32_t stages = __atomic_load_n(&_progress.stages, __ATOMIC_ACQUIRE);
+    uint32_t endpoints = __atomic_load_n(&_progress.endpoints, __ATOMIC_ACQUIRE);
+    uint32_t now = timebase_get_ticks();
+    uint8_t *cursor = buffer;
+
+    if (PROGRESS_SIZE > capacity) {
+        return 0;
+    }
+
+    cursor = _progress_put(cursor, stages);
+    cursor = _progress_put(cursor, _progress.setups);
+    cursor = _progress_put(cursor, timebase_ticks_to_us(now - _progress.connectTicks));
+    cursor = _progress_put(cursor, timebase_ticks_to_us(now - _progress.lastSetupTicks));
+    for (uint8_t stage = 0; stage < ProgressStageCount; ++stage) {
+        // Only the stages published before the load above are complete
+        cursor = _progress_put(cursor, (stages & (1u << stage)) ? timebase_ticks_to_us(_progress.stageTicks[stage]) : 0);
+    }
+    cursor = _progress_put(cursor, endpoints);
+    for (uint8_t index = 0; index < 2 * PROGRESS_ENDPOINTS; ++index) {
+        cursor = _progress_put(cursor, (endpoints & (1u << index)) ? timebase_ticks_to_us(_progress.endpointTicks[index]) : 0);
+    }
+
+    return cursor - buffer;
+}
+
+/* @fn      progress_requests_fill
+ *
+ * @brief   Serialize the request log
+ *
+ * @return  The number of bytes written, 0 if it does not fit
+ */
+uint16_t
+progress_requests_fill(uint8_t *buffer, uint16_t capacity)
+{
+    uint32_t setups = __atomic_load_n(&_progress.setups, __ATOMIC_ACQUIRE);
+    uint32_t count = setups < PROGRESS_REQUESTS ? setups : PROGRESS_REQUESTS;
+    const struct ProgressRequest_t *entry;
+    uint8_t *cursor = buffer;
+
+    if (4 + count * PROGRESS_REQUEST_SIZE > capacity) {
+        return 0;
+    }
+
+    cursor = _progress_put(cursor, setups);
+    for (uint32_t i = 0; i < count; ++i) {
+        entry = &_progress.requests[i];
+        cursor = _progress_put(cursor, entry->requestType | (entry->request << 8) | ((uint32_t)entry->value << 16));
+        cursor = _progress_put(cursor, entry->index | ((uint32_t)entry->length << 16));
+        cursor = _progress_put(cursor, timebase_ticks_to_us(entry->ticks));
+    }
+
+    return cursor - buffer;
+}
@@ -0,0 +1,180 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* macros */
+/* Endpoints 1 to 7 are timestamped, in both directions */
+#define PROGRESS_ENDPOINTS  (7)
+/* Longest window of ProgressCriterionEndpointTraffic, the timebase wraps
+ * around ~35 s */
+#define PROGRESS_WINDOW_MAX_MS  (30000)
+
+/* Serialized record (StatsKindProgress), little endian :
+ * - 4 bytes : stages reached, 1 << enum ProgressStage
+ * - 4 bytes : SETUP packets received since BbioConnect
+ * - 4 bytes : us since BbioConnect
+ * - 4 bytes : us since the last SETUP packet (since BbioConnect if none)
+ * - ProgressStageCount * 4 bytes : us from BbioConnect to the first
+ *   occurrence of each stage, 0 if not reached
+ * - 4 bytes : endpoints with traffic, the bit n - 1 for the IN endpoint n,
+ *   the bit PROGRESS_ENDPOINTS + n - 1 for the OUT endpoint n
+ * - 2 * PROGRESS_ENDPOINTS * 4 bytes : us from BbioConnect to the first
+ *   transaction of each endpoint, in the order of the bits, 0 if none
+ * The times are computed from timebase_get_ticks(), they wrap around ~35 s
+ * after the event
+ */
+#define PROGRESS_SIZE   (16 + ProgressStageCount * 4 + 4 + 2 * PROGRESS_ENDPOINTS * 4)
+
+/* The first SETUP packets since BbioConnect are kept, to fingerprint the ToE */
+#define PROGRESS_REQUESTS       (20)
+#define PROGRESS_REQUEST_SIZE   (12)
+
+/* Serialized request log (StatsKindRequests), little endian :
+ * - 4 bytes : SETUP packets received since BbioConnect
+ * - For each of the first ones, at most PROGRESS_REQUESTS :
+ *   - 8 bytes : bmRequestType, bRequest, wValue, wIndex, wLength
+ *   - 4 bytes : us from BbioConnect to the SETUP packet
+ */
+#define PROGRESS_REQUESTS_SIZE  (4 + PROGRESS_REQUESTS * PROGRESS_REQUEST_SIZE)
+
+/* enums */
+/* Enumeration milestones of the emulated device, must match
+ * host-controller/stats.h */
+enum ProgressStage {
+    ProgressStageBusReset           = 0,
+    ProgressStageDeviceDescriptor   = 1,    // First GET_DESCRIPTOR(device)
+    ProgressStageSetAddress         = 2,
+    ProgressStageConfigDescriptor   = 3,    // First GET_DESCRIPTOR(configuration)
+    ProgressStageStringDescriptor   = 4,    // First GET_DESCRIPTOR(string)
+    ProgressStageSetConfiguration   = 5,
+    ProgressStageEndpointTraffic    = 6,    // First transaction on an endpoint other than 0
+    ProgressStageCount,
+};
+
+/* When the ToE supports the emulated device (BbioGetStatus), set by
+ * BbioSetCriterion, must match host-controller/stats.h */
+enum ProgressCriterion {
+    ProgressCriterionSetConfiguration   = 0,
+    // Traffic on an endpoint other than 0, within the window after
+    // SET_CONFIGURATION if any: a driver is bound to the device
+    ProgressCriterionEndpointTraffic    = 1,
+    ProgressCriterionCount,
+};
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : progress_init
+ * Description    : Clear the record and select ProgressCriterionSetConfiguration,
+ *                  called at boot
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void progress_init(void);
+
+/*******************************************************************************
+ * Function Name  : progress_reset
+ * Description    : Forget the stages reached, the times are counted from now.
+ *                  Called at boot and by BbioConnect
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void progress_reset(void);
+
+/*******************************************************************************
+ * Function Name  : progress_stage_reach
+ * Description    : Record a stage, only its first occurrence is timestamped.
+ *                  Must only be called from the USB interrupt
+ * Input          : The stage
+ * Return         : None
+ *******************************************************************************/
+void progress_stage_reach(enum ProgressStage stage);
+
+/*******************************************************************************
+ * Function Name  : progress_setup_record
+ * Description    : Count a SETUP packet of the ToE, log it if it is one of the
+ *                  first PROGRESS_REQUESTS and record the stage it marks, if
+ *                  any. Must only be called from the USB interrupt
+ * Input          : - requestType: bmRequestType
+ *                  - request: bRequest
+ *                  - value: wValue
+ *                  - index: wIndex
+ *                  - length: wLength
+ * Return         : None
+ *******************************************************************************/
+void progress_setup_record(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index, uint16_t length);
+
+/*******************************************************************************
+ * Function Name  : progress_endpoint_record
+ * Description    : Record a transaction on an endpoint other than 0, only the
+ *                  first one of each endpoint is timestamped. Must only be
+ *                  called from the USB interrupt
+ * Input          : - token: UIS_TOKEN_IN or UIS_TOKEN_OUT
+ *                  - endpoint: The endpoint number, 1 to PROGRESS_ENDPOINTS
+ * Return         : None
+ *******************************************************************************/
+void progress_endpoint_record(uint8_t token, uint8_t endpoint);
+
+/*******************************************************************************
+ * Function Name  : progress_criterion_set
+ * Description    : Select when the emulated device is supported, kept across
+ *                  BbioConnect
+ * Input          : - criterion: enum ProgressCriterion
+ *                  - windowMs: ProgressCriterionEndpointTraffic only, the
+ *                    longest time from SET_CONFIGURATION to the traffic, 0 for
+ *                    no limit, at most PROGRESS_WINDOW_MAX_MS
+ * Return         : 0 if success, 1 if the criterion is unknown
+ *******************************************************************************/
+uint8_t progress_criterion_set(uint8_t criterion, uint32_t windowMs);
+
+/*******************************************************************************
+ * Function Name  : progress_is_supported
+ * Description    : Tell if the stages reached meet the selected criterion
+ * Input          : None
+ * Return         : true if the ToE supports the emulated device, false else
+ *******************************************************************************/
+bool progress_is_supported(void);
+
+/*******************************************************************************
+ * Function Name  : progress_disconnect
+ * Description    : Record the disconnection of the emulated device, called by
+ *                  BbioDisconnect
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void progress_disconnect(void);
+
+/*******************************************************************************
+ * Function Name  : progress_bus_is_idle
+ * Description    : Tell if the bus settled: the device is disconnected since
+ *                  windowUs at least (BbioGetBusIdle). The USB device is
+ *                  stopped once disconnected, so the bus can not be observed
+ *                  and the window is a fixed settle time
+ * Input          : The window in us, less than the wrap around of the
+ *                  timebase (~35 s)
+ * Return         : true if the bus is idle, false else
+ *******************************************************************************/
+bool progress_bus_is_idle(uint32_t windowUs);
+
+/*******************************************************************************
+ * Function Name  : progress_fill
+ * Description    : Serialize the record, see PROGRESS_SIZE
+ * Input          : - buffer: Where to write the record
+ *                  - capacity: The capacity of buffer
+ * Return         : The number of bytes written, 0 if it does not fit
+ *******************************************************************************/
+uint16_t progress_fill(uint8_t *buffer, uint16_t capacity);
+
+/*******************************************************************************
+ * Function Name  : progress_requests_fill
+ * Description    : Serialize the request log, see PROGRESS_REQUESTS_SIZE
+ * Input          : - buffer: Where to write the log
+ *                  - capacity: The capacity of buffer
+ * Return         : The number of bytes written, 0 if it does not fit
+ *******************************************************************************/
+uint16_t progress_requests_fill(uint8_t *buffer, uint16_t capacity);
+
+
+#endif /* PROGRESS_H */
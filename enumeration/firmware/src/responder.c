@@ -0,0 +1,129 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "highcode.h"
+
+#include "responder.h"
+
+
+/* structs */
+struct ResponderRule_t {
+    uint16_t key;           // bmRequestType << 8 | bRequest, the table is sorted on it
+    uint8_t action;
+    uint16_t value;         // Masked
+    uint16_t valueMask;
+    uint16_t index;         // Masked
+    uint16_t indexMask;
+    uint8_t *response;
+    uint16_t sizeResponse;
+};
+
+struct Responder_t {
+    uint8_t sizeRules;
+    struct ResponderRule_t rules[RESPONDER_RULES];
+};
+
+/* internal variables */
+/* Read by the USB interrupt, only written while the device is disconnected */
+static struct Responder_t _responder RAMX_BSS;
+
+
+/* functions implementation */
+
+/* @fn      responder_reset
+ *
+ * @brief   Empty the table
+ *
+ * @return  None
+ */
+void
+responder_reset(void)
+{
+    memset(&_responder, 0, sizeof(_responder));
+}
+
+/* @fn      responder_rule_add
+ *
+ * @brief   Add a rule after the ones of the same (bmRequestType, bRequest)
+ *
+ * @return  0 if success, 1 if the rule is invalid, 2 if the table is full
+ */
+uint8_t
+responder_rule_add(const uint8_t *rule, uint16_t size, uint8_t *response)
+{
+    struct ResponderRule_t entry;
+    uint8_t position;
+
+    if (size < RESPONDER_RULE_HEADER_SIZE || rule[2] == ResponderActionNone || rule[2] >= ResponderActionCount) {
+        return 1;
+    }
+    if (_responder.sizeRules >= RESPONDER_RULES) {
+        return 2;
+    }
+
+    // The rule may be unaligned
+    entry.key = (rule[0] << 8) | rule[1];
+    entry.action = rule[2];
+    entry.valueMask = rule[6] | (rule[7] << 8);
+    entry.value = (rule[4] | (rule[5] << 8)) & entry.valueMask;
+    entry.indexMask = rule[10] | (rule[11] << 8);
+    entry.index = (rule[8] | (rule[9] << 8)) & entry.indexMask;
+    entry.response = response;
+    entry.sizeResponse = size - RESPONDER_RULE_HEADER_SIZE;
+
+    // Insertion sort, a few rules per device
+    position = _responder.sizeRules;
+    while (position > 0 && _responder.rules[position - 1].key > entry.key) {
+        _responder.rules[position] = _responder.rules[position - 1];
+        --position;
+    }
+    _responder.rules[position] = entry;
+    ++_responder.sizeRules;
+
+    return 0;
+}
+
+/* @fn      responder_lookup
+ *
+ * @brief   Find the rule of a class or vendor request
+ *
+ * @return  The action of the rule, ResponderActionNone if none matches
+ */
+HIGHCODE enum ResponderAction
+responder_lookup(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index,
+                 uint8_t **pResponse, uint16_t *pSizeResponse)
+{
+    uint16_t key = (requestType << 8) | request;
+    uint8_t low = 0;
+    uint8_t high = _responder.sizeRules;
+    uint8_t middle;
+    const struct ResponderRule_t *rule;
+
+    *pResponse = NULL;
+    *pSizeResponse = 0;
+
+    // First rule of the key
+    while (low < high) {
+        middle = (low + high) / 2;
+        if (_responder.rules[middle].key < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    for (; low < _responder.sizeRules && _responder.rules[low].key == key; ++low) {
+        rule = &_responder.rules[low];
+        if ((value & rule->valueMask) != rule->value || (index & rule->indexMask) != rule->index) {
+            continue;
+        }
+
+        if (rule->action == ResponderActionData) {
+            *pResponse = rule->response;
+            *pSizeResponse = rule->sizeResponse;
+        }
+        return rule->action;
+    }
+
+    return ResponderActionNone;
+}
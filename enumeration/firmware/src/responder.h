@@ -0,0 +1,72 @@
+#ifndef RESPONDER_H
+#define RESPONDER_H
+
+#include <stdint.h>
+
+/* macros */
+/* Rules of the table, the class and vendor requests not matched keep the
+ * default handling of USBHS_IRQHandler() */
+#define RESPONDER_RULES         (32)
+
+/* Serialized rule (BbioSubSetDescrResponder), little endian :
+ * - 1 byte : bmRequestType
+ * - 1 byte : bRequest
+ * - 1 byte : action, see enum ResponderAction
+ * - 1 byte : reserved, 0
+ * - 2 bytes : wValue, then its mask
+ * - 2 bytes : wIndex, then its mask
+ * - The response, sent by ResponderActionData (truncated to wLength)
+ * A request matches when (wValue & mask) == (value & mask), same for wIndex.
+ * The rules of a (bmRequestType, bRequest) are tried in the order they were
+ * added */
+#define RESPONDER_RULE_HEADER_SIZE  (12)
+
+/* enums */
+/* Must match host-controller/usb_descriptors.h */
+enum ResponderAction {
+    ResponderActionNone     = 0,    // No rule matches
+    ResponderActionData     = 1,    // IN data stage with the response
+    ResponderActionAck      = 2,    // Accept, the OUT data stage if any is discarded
+    ResponderActionStall    = 3,
+    ResponderActionCount,
+};
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : responder_reset
+ * Description    : Empty the table, called by BbioResetDescr
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void responder_reset(void);
+
+/*******************************************************************************
+ * Function Name  : responder_rule_add
+ * Description    : Add a rule to the table. The response is not copied, it
+ *                  must stay valid until responder_reset(). Must not be called
+ *                  while the device is connected
+ * Input          : - rule: The serialized rule, see RESPONDER_RULE_HEADER_SIZE
+ *                  - size: The size of the rule, response included
+ *                  - response: Where the response is kept
+ * Return         : 0 if success, 1 if the rule is invalid, 2 if the table is
+ *                  full
+ *******************************************************************************/
+uint8_t responder_rule_add(const uint8_t *rule, uint16_t size, uint8_t *response);
+
+/*******************************************************************************
+ * Function Name  : responder_lookup
+ * Description    : Find the rule of a class or vendor request, O(log n) on
+ *                  (bmRequestType, bRequest). Must only be called from the USB
+ *                  interrupt
+ * Input          : - requestType, request, value and index: The fields of the
+ *                    SETUP packet
+ *                  - pResponse and pSizeResponse: Set to the response for
+ *                    ResponderActionData, else to NULL and 0
+ * Return         : The action of the rule, ResponderActionNone if none matches
+ *******************************************************************************/
+enum ResponderAction responder_lookup(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index,
+                                      uint8_t **pResponse, uint16_t *pSizeResponse);
+
+
+#endif /* RESPONDER_H */
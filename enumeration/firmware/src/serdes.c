@@ -1,18 +1,162 @@
+#define LOG_MODULE  LOG_MODULE_LINK
+
 #include <stdarg.h>
+#include <string.h>
+
+#include "highcode.h"
+#include "irq.h"
+#include "link.h"
+#include "log.h"
+#include "trace.h"
 
 #include "serdes.h"
 
+/* structs */
+
+/* Lock-free queue of frames waiting to be transmitted by serdes_channel_poll()
+ * - Several producers (main loop and interrupts of any priority) reserve a slot
+ *   by moving tail with a compare-and-swap, fill it, then commit it by
+ *   publishing its length with the SERDES_SLOT_READY flag
+ * - A single consumer (serdes_channel_poll(), main loop) transmits the slots in
+ *   order and stops at the first one not committed yet
+ * head and tail are free running counters, thus the capacity must be a power
+ * of 2 (so that 2^32 % capacity == 0)
+ */
+struct SerdesQueue_t {
+    uint8_t *slots;                 // capacity * SERDES_QUEUE_SLOT_LEN bytes
+    volatile uint16_t *slotsLen;    // Length of the frame | SERDES_SLOT_READY, 0 if not committed
+    uint32_t capacity;
+    volatile uint32_t head;         // Next slot to transmit, only modified by serdes_channel_poll()
+    volatile uint32_t tail;         // Next slot to reserve
+    volatile uint32_t dropped;      // Number of frames dropped because the queue was full
+};
+
+/* macros */
+#define SERDES_SLOT_READY   (0x8000)
+
 /* variables */
 __attribute__((aligned(16))) uint8_t serdesDmaAddr[4096] __attribute__((section(".DMADATA"))); // Buffer for SerDes
+uint16_t g_serdesPllMbps = 1200;
+
+/* internal variables */
+/* The slots are transmitted without any copy, thus they must be DMA-able */
+__attribute__((aligned(16))) static uint8_t _queueEventSlots[SERDES_QUEUE_EVENT_SLOTS * SERDES_QUEUE_SLOT_LEN] __attribute__((section(".DMADATA")));
+static volatile uint16_t _queueEventSlotsLen[SERDES_QUEUE_EVENT_SLOTS];
+
+static struct SerdesQueue_t _queueEvent = {
+    .slots = _queueEventSlots,
+    .slotsLen = _queueEventSlotsLen,
+    .capacity = SERDES_QUEUE_EVENT_SLOTS,
+};
+
+/* NULL for the channels transmitted immediately, and for SerdesChannelLog
+ * which is a stream, see _logRing */
+static struct SerdesQueue_t *_queues[SerdesChannelCount] = {
+    [SerdesChannelEvent] = &_queueEvent,
+};
+
+/* The logs (text and binary records) of the bottom board, a byte stream as the
+ * endpoint 6 ring of the top board. serdes_channel_poll() batches it in frames
+ * of up to SERDES_DMA_LEN bytes, the top board appends them to the endpoint 7
+ * ring */
+static uint8_t _logRingBuffer[SERDES_LOG_RING_CAPACITY];
+static struct LogRing_t _logRing = {
+    .buffer = _logRingBuffer,
+    .capacity = sizeof(_logRingBuffer),
+};
+__attribute__((aligned(16))) static uint8_t _logFrame[SERDES_DMA_LEN] __attribute__((section(".DMADATA")));
+/* The line formatted by serdes_vlog(), one per nesting level as a context is
+ * only preempted by the deeper levels */
+static char _logLines[IRQ_NESTING_MAX + 1][SERDES_LOG_LINE_CAPACITY];
 
 /* functions implementation */
 
+/* @fn      serdes_frame_transmit
+ *
+ * @brief   Transmit a frame and wait until the transmission is done
+ *
+ * @warning The buffer must be DMA-able, the caller must ensure no other
+ *          transmission can be started concurrently
+ *
+ * @return  None
+ */
+HIGHCODE void
+serdes_frame_transmit(uint8_t *dmaBuffer, enum SerdesChannel channel, uint16_t len)
+{
+    // The DMA length is rounded up, the receiver relies on the header for the
+    // real length of the payload
+    uint16_t dmaLen = (len + SERDES_DMA_ALIGN - 1) & ~(SERDES_DMA_ALIGN - 1);
+    if (dmaLen == 0) {
+        dmaLen = SERDES_DMA_ALIGN;
+    }
+
+    TRACE_BEGIN(TraceIdSerdesTx, TRACE_SERDES_ARG(channel, len));
+    SerDes_DMA_Tx_CFG((uint32_t)dmaBuffer, dmaLen, SERDES_HEADER(channel, len));
+    SerDes_DMA_Tx();
+    SerDes_Wait_Txdone();
+    ++g_linkHealth.serdesFrames;
+    TRACE_END(TraceIdSerdesTx, 0);
+}
+
+/* @fn      _serdes_queue_slot
+ *
+ * @brief   Get the slot at the given position of the queue
+ *          Only used internally
+ *
+ * @return  The slot at the given position
+ */
+static HIGHCODE uint8_t *
+_serdes_queue_slot(struct SerdesQueue_t *queue, uint32_t position)
+{
+    return queue->slots + (position % queue->capacity) * SERDES_QUEUE_SLOT_LEN;
+}
+
+/* @fn      _serdes_queue_reserve
+ *
+ * @brief   Reserve the next slot of the queue, lock-free
+ *          Only used internally
+ *
+ * @return  The reserved slot, NULL if the queue is full (the frame is counted
+ *          as dropped)
+ */
+static HIGHCODE uint8_t *
+_serdes_queue_reserve(struct SerdesQueue_t *queue, uint32_t *pPosition)
+{
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+    do {
+        if (tail - queue->head >= queue->capacity) {
+            __atomic_fetch_add(&queue->dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        // On failure tail is updated with the current value, a preempting
+        // producer reserved the slot meanwhile
+    } while (!__atomic_compare_exchange_n(&queue->tail, &tail, tail + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    *pPosition = tail;
+    return _serdes_queue_slot(queue, tail);
+}
+
+/* @fn      _serdes_queue_commit
+ *
+ * @brief   Publish a slot previously reserved, it can then be transmitted
+ *          Only used internally
+ *
+ * @return  None
+ */
+static HIGHCODE void
+_serdes_queue_commit(struct SerdesQueue_t *queue, uint32_t position, uint16_t len)
+{
+    __atomic_store_n(&queue->slotsLen[position % queue->capacity], len | SERDES_SLOT_READY, __ATOMIC_RELEASE);
+}
+
 /* @fn      serdes_wait_for_tx
  *
  * @brief   Wait the amount of time required to ensure the transmission is
  *          completed and that we can safely send the next one
  *
- * @warning This function assumes the transfer speed is 1.2Gbps
+ * @note    The delay scales with the PLL frequency selected by
+ *          link_init() (g_serdesPllMbps)
  *
  * @return  Nothing
  */
@@ -31,7 +175,122 @@ serdes_wait_for_tx(uint16_t sizeTransmission)
     // refers to e_sds_pll_freq):
     // (sizeTransmission*20) / 1200 = delay in us
     // Additionally we add a margin of 20us
-    bsp_wait_us_delay((sizeTransmission*20)/1200 + 20);
+    bsp_wait_us_delay((sizeTransmission*20)/g_serdesPllMbps + 20);
+}
+
+/* @fn      serdes_channel_send
+ *
+ * @brief   Send a frame on the given channel. High priority channels are
+ *          transmitted immediately, the other ones are queued until the next
+ *          call to serdes_channel_poll()
+ *
+ * @return  0 if success, 1 if the frame was dropped
+ */
+HIGHCODE uint8_t
+serdes_channel_send(enum SerdesChannel channel, const uint8_t *payload, uint16_t len)
+{
+    struct SerdesQueue_t *queue;
+    uint32_t position;
+    uint8_t *slot;
+
+    if (channel >= SerdesChannelCount) {
+        return 1;
+    }
+    if (channel == SerdesChannelLog) {
+        return serdes_log_append(payload, len) == 0;
+    }
+    if (len > SERDES_DMA_LEN) {
+        len = SERDES_DMA_LEN;
+    }
+
+    queue = _queues[channel];
+    if (queue == NULL) {
+        // Immediate transmission, serdes_channel_poll() can not interleave as
+        // it transmits with the link interrupts masked
+        if (payload != serdesDmaAddr) {
+            memcpy(serdesDmaAddr, payload, len);
+        }
+        serdes_frame_transmit(serdesDmaAddr, channel, len);
+        return 0;
+    }
+
+    if (len > SERDES_QUEUE_SLOT_LEN) {
+        len = SERDES_QUEUE_SLOT_LEN;
+    }
+
+    slot = _serdes_queue_reserve(queue, &position);
+    if (slot == NULL) {
+        return 1;
+    }
+    memcpy(slot, payload, len);
+    _serdes_queue_commit(queue, position, len);
+
+    return 0;
+}
+
+/* @fn      serdes_log_append
+ *
+ * @brief   Append raw data to the log stream, lock-free, see log_ring_write()
+ *
+ * @return  The number of bytes appended, 0 if the data was dropped
+ */
+HIGHCODE uint16_t
+serdes_log_append(const uint8_t *data, uint16_t len)
+{
+    return log_ring_write(&_logRing, data, len);
+}
+
+/* @fn      serdes_channel_poll
+ *
+ * @brief   Transmit the queued frames, highest priority channel first, then
+ *          the log stream
+ *
+ * @return  None
+ */
+void
+serdes_channel_poll(void)
+{
+    struct SerdesQueue_t *queue;
+    enum SerdesChannel channel;
+    uint32_t threshold;
+    uint16_t len;
+
+    while (1) {
+        // Channels are ordered by priority, a slot reserved but not committed
+        // yet (its producer was preempted) stops its queue
+        for (channel = 0; channel < SerdesChannelCount; ++channel) {
+            queue = _queues[channel];
+            if (queue != NULL && queue->head != queue->tail
+                && (__atomic_load_n(&queue->slotsLen[queue->head % queue->capacity], __ATOMIC_ACQUIRE) & SERDES_SLOT_READY)) {
+                break;
+            }
+        }
+        if (channel == SerdesChannelCount) {
+            break;
+        }
+
+        len = queue->slotsLen[queue->head % queue->capacity] & ~SERDES_SLOT_READY;
+
+        // Frames sent from the link interrupts (return codes...) wait at most
+        // for the transmission of one queued frame, the USB interrupts are
+        // still served meanwhile
+        threshold = irq_threshold_raise(IRQ_PRIORITY_LINK);
+        serdes_frame_transmit(_serdes_queue_slot(queue, queue->head), channel, len);
+        irq_threshold_restore(threshold);
+
+        queue->slotsLen[queue->head % queue->capacity] = 0;
+        __atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_RELEASE);
+        serdes_wait_for_tx(len);
+    }
+
+    // The log stream last, as many records as a frame holds. A record may be
+    // split over two frames, the top board appends them back to back
+    while ((len = log_ring_read(&_logRing, _logFrame, SERDES_DMA_LEN)) != 0) {
+        threshold = irq_threshold_raise(IRQ_PRIORITY_LINK);
+        serdes_frame_transmit(_logFrame, SerdesChannelLog, len);
+        irq_threshold_restore(threshold);
+        serdes_wait_for_tx(len);
+    }
 }
 
 /* @fn      serdes_log
@@ -43,44 +302,37 @@ serdes_wait_for_tx(uint16_t sizeTransmission)
 void
 serdes_log(const char *fmt, ...)
 {
-    // Critical section, if we print something (outside of an interrrupt) and an
-    // interrupt is called and do a print, then the first print is partially
-    // overwritten
     va_list ap;
-    // bsp_disable_interrupt();
     va_start(ap, fmt);
-    SerDes_DMA_Tx_CFG((uint32_t)serdesDmaAddr, SERDES_DMA_LEN, SerdesMagicNumberLog);
-
-    vsnprintf((char *)serdesDmaAddr, SERDES_DMA_LEN, fmt, ap);
-
-    SerDes_DMA_Tx();
-    SerDes_Wait_Txdone();
-    serdes_wait_for_tx(SDS_PLL_FREQ_1_20G);
+    serdes_vlog(fmt, ap);
     va_end(ap);
-    // bsp_enable_interrupt();
 }
 
 /* @fn      serdes_vlog
  *
  * @brief   Function used to log data to the top board via SerDes, takes a
  *          va_list as the second argument
+ *          The log is appended to the log stream, it is transmitted by
+ *          serdes_channel_poll()
  *
  * @return  None
  */
 void
 serdes_vlog(const char *fmt, va_list vargs)
 {
-    // Critical section, if we print something (outside of an interrrupt) and an
-    // interrupt is called and do a print, then the first print is partially
-    // overwritten
-    // bsp_disable_interrupt();
-    SerDes_DMA_Tx_CFG((uint32_t)serdesDmaAddr, SERDES_DMA_LEN, SerdesMagicNumberLog);
+    // Not formatted on the stack of the interrupts
+    char *line = _logLines[irq_nesting_get()];
+    int len;
 
-    vsnprintf((char *)serdesDmaAddr, SERDES_DMA_LEN, fmt, vargs);
+    len = vsnprintf(line, SERDES_LOG_LINE_CAPACITY, fmt, vargs);
+    if (len <= 0) {
+        return;
+    }
+    if (len > SERDES_LOG_LINE_CAPACITY - 1) {
+        // The end of the line is replaced, a log is never clipped silently
+        len = SERDES_LOG_LINE_CAPACITY - 1;
+        memcpy(line + len - (sizeof(SERDES_LOG_TRUNCATED) - 1), SERDES_LOG_TRUNCATED, sizeof(SERDES_LOG_TRUNCATED) - 1);
+    }
 
-    SerDes_DMA_Tx();
-    SerDes_Wait_Txdone();
-    serdes_wait_for_tx(SDS_PLL_FREQ_1_20G);
-    // bsp_enable_interrupt();
+    serdes_log_append((const uint8_t *)line, len);
 }
-
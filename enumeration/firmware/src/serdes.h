@@ -8,17 +8,64 @@
 #include "CH56x_common.h"
 
 /* macros */
-#define SERDES_DMA_LEN  (512)
+#define SERDES_DMA_LEN  (512)   // Maximum payload of a SerDes frame
+#define SERDES_DMA_ALIGN (4)    // DMA transfers are done with 32 bits words
+
+/* Queued channels store their frames in fixed size slots, a frame longer than
+ * a slot is truncated */
+#define SERDES_QUEUE_SLOT_LEN       (128)
+#define SERDES_QUEUE_EVENT_SLOTS    (4)
+
+/* SerdesChannelLog is a byte stream batched in frames, see serdes_log_append().
+ * A text log is formatted in a line before being appended, a longer log ends
+ * with SERDES_LOG_TRUNCATED */
+#define SERDES_LOG_RING_CAPACITY    (4096)  // Power of 2, see struct LogRing_t
+#define SERDES_LOG_LINE_CAPACITY    (SERDES_DMA_LEN)
+#define SERDES_LOG_TRUNCATED        "[truncated]\r\n"
+
+/* Frame header, it is transmitted in the SerDes custom number (SDS_DATA0).
+ * Only the 28 lower bits of the custom number are usable :
+ * - bits 27..20 : magic number, used to reject garbage
+ * - bits 19..16 : channel, see enum SerdesChannel
+ * - bits 15..12 : reserved, must be 0
+ * - bits 11..0  : length of the payload in bytes
+ */
+#define SERDES_HEADER_MAGIC                 (0xA5)
+#define SERDES_HEADER(channel, len)         ((SERDES_HEADER_MAGIC << 20) | (((channel) & 0x0F) << 16) | ((len) & 0x0FFF))
+#define SERDES_HEADER_GET_MAGIC(header)     (((header) >> 20) & 0xFF)
+#define SERDES_HEADER_GET_CHANNEL(header)   (((header) >> 16) & 0x0F)
+#define SERDES_HEADER_GET_LEN(header)       ((header) & 0x0FFF)
 
 /* enums */
-enum SerdesMagicNumber {
-    SerdesMagicNumberLog     = 0x01111111,
-    SerdesMagicNumberRetCode = 0x02222222,
-    SerdesMagicNumberMask    = 0x0FFFFFFF,
+
+/* Channels multiplexed over the SerDes link (bottom board -> top board).
+ * The value of a channel is also its priority, the lower the value the higher
+ * the priority.
+ * Channels with a higher priority than SerdesChannelEvent are transmitted
+ * immediately by the caller (preempting queued frames), the other ones are
+ * queued and transmitted by serdes_channel_poll(). SerdesChannelLog is a
+ * stream : its frames hold as many logs as they fit.
+ * SerdesChannelCalibration is never multiplexed, its frames are only sent
+ * while link_calibrate() runs (before any other traffic).
+ */
+enum SerdesChannel {
+    SerdesChannelRetCode     = 0,   // Return code of the bbio_*() functions
+    SerdesChannelStats       = 1,   // Statistics requested by the host
+    SerdesChannelEvent       = 2,   // Asynchronous events
+    SerdesChannelLog         = 3,   // Logs (text and binary records)
+    SerdesChannelCalibration = 4,   // PRBS frames, only used by link_calibrate()
+    SerdesChannelCount,
+};
+
+/* First byte of a binary SerdesChannelEvent frame, the other event frames
+ * (starting with a printable char) are forwarded along with the logs */
+enum SerdesEvent {
+    SerdesEventLinkRetrain = 0x01,  // The bottom board requests a retrain, see link_poll()
 };
 
 /* variables */
 extern uint8_t serdesDmaAddr[]; // Buffer for SerDes
+extern uint16_t g_serdesPllMbps; // Line rate of the PLL, set by link_init()
 
 /* functions declaration */
 
@@ -32,6 +79,54 @@ extern uint8_t serdesDmaAddr[]; // Buffer for SerDes
  *******************************************************************************/
 void serdes_wait_for_tx(uint16_t sizeTransmission);
 
+/*******************************************************************************
+ * Function Name  : serdes_frame_transmit
+ * Description    : Transmit a frame and wait until the transmission is done,
+ *                  bypassing the queues. Most callers want
+ *                  serdes_channel_send() instead
+ * Input          : - dmaBuffer: The payload, must be DMA-able
+ *                  - channel: The channel written in the frame header
+ *                  - len: The length of the payload
+ * Return         : None
+ *******************************************************************************/
+void serdes_frame_transmit(uint8_t *dmaBuffer, enum SerdesChannel channel, uint16_t len);
+
+/*******************************************************************************
+ * Function Name  : serdes_channel_send
+ * Description    : Send a frame on the given channel. High priority channels
+ *                  are transmitted immediately, the other ones are queued until
+ *                  the next call to serdes_channel_poll(). Queuing is lock-free,
+ *                  the immediate channels must only be sent from the link
+ *                  interrupts (IRQ_PRIORITY_LINK) or with them masked
+ * Input          : - channel: The channel to send the frame on
+ *                  - payload and len: The payload of the frame and its length,
+ *                    at most SERDES_DMA_LEN bytes
+ * Return         : 0 if success, 1 if the frame was dropped (queue full)
+ *******************************************************************************/
+uint8_t serdes_channel_send(enum SerdesChannel channel, const uint8_t *payload, uint16_t len);
+
+/*******************************************************************************
+ * Function Name  : serdes_log_append
+ * Description    : Append raw data to the log stream (SerdesChannelLog),
+ *                  lock-free. The stream is transmitted by
+ *                  serdes_channel_poll(), batched in frames of up to
+ *                  SERDES_DMA_LEN bytes
+ * Input          : - data: The data to append
+ *                  - len: The length of the data
+ * Return         : The number of bytes appended, 0 if the data was dropped
+ *******************************************************************************/
+uint16_t serdes_log_append(const uint8_t *data, uint16_t len);
+
+/*******************************************************************************
+ * Function Name  : serdes_channel_poll
+ * Description    : Transmit the queued frames, highest priority channel first,
+ *                  then the log stream. Must be called regularly from the main
+ *                  loop of the bottom board
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void serdes_channel_poll(void);
+
 /*******************************************************************************
  * Function Name  : serdes_log
  * Description    : Function used to log data to the top board via SerDes
@@ -0,0 +1,109 @@
+#include <stdbool.h>
+
+#include "highcode.h"
+#include "irq.h"
+
+#include "stack.h"
+
+
+/* internal variables */
+/* Lowest word found written, kept as the repaints of the interrupts (see
+ * stack_repaint()) erase the deepest usage */
+static volatile uint32_t _lowest = 0;
+
+
+/* functions implementation */
+
+/* @fn      stack_init
+ *
+ * @brief   Paint the stack below the caller. Volatile writes, the loop must
+ *          not become a memset() call using the stack being painted
+ *
+ * @return  None
+ */
+void
+stack_init(void)
+{
+    volatile uint32_t *word = _susrstack;
+    uint32_t *sp = (uint32_t *)stack_pointer_get();
+
+    while (word < sp) {
+        *word++ = STACK_PAINT;
+    }
+
+    _lowest = (uint32_t)_eusrstack;
+}
+
+/* @fn      stack_lowest
+ *
+ * @brief   Find the lowest word written since it was painted
+ *
+ * @return  The address of the word, _eusrstack if none
+ */
+HIGHCODE uint32_t
+stack_lowest(void)
+{
+    const volatile uint32_t *word = _susrstack;
+    uint32_t lowest = __atomic_load_n(&_lowest, __ATOMIC_RELAXED);
+
+    while (word < _eusrstack && *word == STACK_PAINT) {
+        ++word;
+    }
+
+    // The interrupts of higher priority update it too
+    while ((uint32_t)word < lowest && !__atomic_compare_exchange_n(&_lowest, &lowest, (uint32_t)word, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    return (uint32_t)word;
+}
+
+/* @fn      stack_repaint
+ *
+ * @brief   Paint the stack from an address up to the caller
+ *
+ * @return  None
+ */
+HIGHCODE void
+stack_repaint(uint32_t lowest)
+{
+    volatile uint32_t *word = (uint32_t *)lowest;
+    uint32_t *sp = (uint32_t *)stack_pointer_get();
+
+    while (word < sp) {
+        *word++ = STACK_PAINT;
+    }
+}
+
+/* @fn      stack_fill
+ *
+ * @brief   Serialize the stack report
+ *
+ * @return  The number of bytes written, 0 if it does not fit
+ */
+uint16_t
+stack_fill(uint8_t *buffer, uint16_t capacity)
+{
+    uint32_t size = (uint32_t)_eusrstack - (uint32_t)_susrstack;
+    uint32_t highWater;
+    uint16_t sizeWorst;
+
+    // The deepest usage may have been repainted, see _lowest
+    stack_lowest();
+    highWater = (uint32_t)_eusrstack - _lowest;
+
+    if (capacity < STACK_REPORT_HEADER_SIZE) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < 4; ++i) {
+        buffer[i] = size >> (8 * i);
+        buffer[4 + i] = highWater >> (8 * i);
+    }
+
+    sizeWorst = irq_worst_fill(buffer + STACK_REPORT_HEADER_SIZE, capacity - STACK_REPORT_HEADER_SIZE);
+    if (sizeWorst == 0) {
+        return 0;
+    }
+
+    return STACK_REPORT_HEADER_SIZE + sizeWorst;
+}
@@ -0,0 +1,85 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <stdint.h>
+
+/* macros */
+/* STACK_STATS=1 measures the stack depth of the instrumented interrupt
+ * handlers (see irq_stats_enter()), see the Makefile. Each measured interrupt
+ * scans the free stack twice, up to ~25 us with the 2 KiB stack */
+#ifndef STACK_STATS
+#define STACK_STATS     (0)
+#endif
+
+/* The free stack is painted with this word, the words still holding it were
+ * never written */
+#define STACK_PAINT     (0xA5A5A5A5)
+
+/* Serialized report (StatsKindStack), little endian :
+ * - 4 bytes : stack size, in bytes
+ * - 4 bytes : high-water mark, the most bytes used since boot
+ * then the worst cases of the interrupt handlers, see irq_worst_fill()
+ */
+#define STACK_REPORT_HEADER_SIZE    (8)
+
+/* variables */
+/* Defined by the linker script, the stack grows down from _eusrstack. The
+ * interrupts run on it too, the registers are saved by the hardware stack */
+extern uint32_t _susrstack[];
+extern uint32_t _eusrstack[];
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : stack_pointer_get
+ * Description    : Read the stack pointer
+ * Input          : None
+ * Return         : The stack pointer
+ *******************************************************************************/
+static inline uint32_t
+stack_pointer_get(void)
+{
+    uint32_t sp;
+
+    __asm__ volatile ("mv %0, sp" : "=r"(sp));
+    return sp;
+}
+
+/*******************************************************************************
+ * Function Name  : stack_init
+ * Description    : Paint the stack below the caller. Must be called early in
+ *                  main(), before the interrupts are enabled
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void stack_init(void);
+
+/*******************************************************************************
+ * Function Name  : stack_lowest
+ * Description    : Find the lowest word written since it was painted, and keep
+ *                  it for the high-water mark
+ * Input          : None
+ * Return         : The address of the word, _eusrstack if none
+ *******************************************************************************/
+uint32_t stack_lowest(void);
+
+/*******************************************************************************
+ * Function Name  : stack_repaint
+ * Description    : Paint the stack from an address up to the caller, the
+ *                  measure of the next interrupt then only sees its own usage
+ * Input          : The lowest word to paint, see stack_lowest()
+ * Return         : None
+ *******************************************************************************/
+void stack_repaint(uint32_t lowest);
+
+/*******************************************************************************
+ * Function Name  : stack_fill
+ * Description    : Serialize the stack report, see STACK_REPORT_HEADER_SIZE
+ * Input          : - buffer: Where to write the report
+ *                  - capacity: The capacity of buffer
+ * Return         : The number of bytes written, 0 if it does not fit
+ *******************************************************************************/
+uint16_t stack_fill(uint8_t *buffer, uint16_t capacity);
+
+
+#endif /* STACK_H */
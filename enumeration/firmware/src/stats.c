@@ -0,0 +1,67 @@
+#include "irq.h"
+#include "link.h"
+#include "log.h"
+#include "profile.h"
+#include "progress.h"
+#include "stack.h"
+#include "trace.h"
+
+#include "stats.h"
+
+
+/* functions implementation */
+
+/* @fn      stats_block_fill
+ *
+ * @brief   Append the block of the current board for the given kind of
+ *          statistics to a reply
+ *
+ * @return  The number of bytes written, 0 if the kind is unknown or if the
+ *          block does not fit
+ */
+uint16_t
+stats_block_fill(enum StatsKind kind, enum StatsBoard board, uint8_t *buffer, uint16_t capacity)
+{
+    uint16_t size;
+
+    if (capacity <= STATS_BLOCK_HEADER_SIZE) {
+        return 0;
+    }
+
+    switch (kind) {
+    case StatsKindLinkHealth:
+        size = link_report_fill(buffer + STATS_BLOCK_HEADER_SIZE, capacity - STATS_BLOCK_HEADER_SIZE);
+        break;
+    case StatsKindLogMask:
+        size = log_mask_fill(buffer + STATS_BLOCK_HEADER_SIZE, capacity - STATS_BLOCK_HEADER_SIZE);
+        break;
+    case StatsKindTrace:
+        size = trace_block_fill(buffer + STATS_BLOCK_HEADER_SIZE, capacity - STATS_BLOCK_HEADER_SIZE);
+        break;
+    case StatsKindIrq:
+        size = irq_stats_fill(buffer + STATS_BLOCK_HEADER_SIZE, capacity - STATS_BLOCK_HEADER_SIZE);
+        break;
+    case StatsKindProfile:
+        size = profile_fill(buffer + STATS_BLOCK_HEADER_SIZE, capacity - STATS_BLOCK_HEADER_SIZE);
+        break;
+    case StatsKindStack:
+        size = stack_fill(buffer + STATS_BLOCK_HEADER_SIZE, capacity - STATS_BLOCK_HEADER_SIZE);
+        break;
+    case StatsKindProgress:
+        size = progress_fill(buffer + STATS_BLOCK_HEADER_SIZE, capacity - STATS_BLOCK_HEADER_SIZE);
+        break;
+    case StatsKindRequests:
+        size = progress_requests_fill(buffer + STATS_BLOCK_HEADER_SIZE, capacity - STATS_BLOCK_HEADER_SIZE);
+        break;
+    default:
+        return 0;
+    }
+
+    if (size == 0 || size > UINT8_MAX) {
+        return 0;
+    }
+    buffer[0] = board;
+    buffer[1] = size;
+
+    return STATS_BLOCK_HEADER_SIZE + size;
+}
@@ -0,0 +1,46 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/* macros */
+/* Each board appends a block to a statistics reply :
+ * - 1 byte : board, see enum StatsBoard
+ * - 1 byte : length of the payload
+ * - payload, depends on the kind of statistics
+ */
+#define STATS_BLOCK_HEADER_SIZE (2)
+
+/* enums */
+enum StatsKind {
+    StatsKindLinkHealth = 1,    // See link_report_fill()
+    StatsKindLogMask    = 2,    // See log_mask_fill()
+    StatsKindTrace      = 3,    // See trace_block_fill()
+    StatsKindIrq        = 4,    // See irq_stats_fill()
+    StatsKindProfile    = 5,    // See profile_fill()
+    StatsKindStack      = 6,    // See stack_fill()
+    StatsKindProgress   = 7,    // See progress_fill()
+    StatsKindRequests   = 8,    // See progress_requests_fill()
+};
+
+enum StatsBoard {
+    StatsBoardTop    = 0,
+    StatsBoardBottom = 1,
+};
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : stats_block_fill
+ * Description    : Append the block of the current board for the given kind of
+ *                  statistics to a reply
+ * Input          : - kind: The kind of statistics requested
+ *                  - board: The board filling the block
+ *                  - buffer and capacity: Where to write the block
+ * Return         : The number of bytes written, 0 if the kind is unknown or
+ *                  if the block does not fit
+ *******************************************************************************/
+uint16_t stats_block_fill(enum StatsKind kind, enum StatsBoard board, uint8_t *buffer, uint16_t capacity);
+
+
+#endif /* STATS_H */
@@ -0,0 +1,30 @@
+#include "highcode.h"
+
+#include "timebase.h"
+
+
+/* functions implementation */
+
+/* @fn      timebase_get_ticks
+ *
+ * @brief   Get the lower 32 bits of the SysTick counter
+ *
+ * @return  The current tick
+ */
+HIGHCODE uint32_t
+timebase_get_ticks(void)
+{
+    return bsp_get_SysTickCNT_LSB();
+}
+
+/* @fn      timebase_ticks_to_us
+ *
+ * @brief   Convert a number of ticks to microseconds
+ *
+ * @return  The number of microseconds
+ */
+uint32_t
+timebase_ticks_to_us(uint32_t ticks)
+{
+    return ticks / TIMEBASE_TICKS_PER_US;
+}
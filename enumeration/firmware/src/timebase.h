@@ -0,0 +1,37 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdint.h>
+
+#include "CH56xSFR.h"
+#include "CH56x_common.h"
+
+/* macros */
+/* SysTick is configured by bsp_init() to count at the system clock (see
+ * FREQ_SYS in main.c) */
+#define TIMEBASE_FREQ           (120000000)
+#define TIMEBASE_TICKS_PER_US   (TIMEBASE_FREQ / 1000000)
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : timebase_get_ticks
+ * Description    : Get the lower 32 bits of the SysTick counter, it wraps
+ *                  around every ~35 seconds, only differences between two
+ *                  values are meaningful
+ * Input          : None
+ * Return         : The current tick
+ *******************************************************************************/
+uint32_t timebase_get_ticks(void);
+
+/*******************************************************************************
+ * Function Name  : timebase_ticks_to_us
+ * Description    : Convert a number of ticks (a difference between two ticks)
+ *                  to microseconds
+ * Input          : The number of ticks
+ * Return         : The number of microseconds
+ *******************************************************************************/
+uint32_t timebase_ticks_to_us(uint32_t ticks);
+
+
+#endif /* TIMEBASE_H */
@@ -0,0 +1,105 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "highcode.h"
+
+#include "trace.h"
+
+
+/* internal variables */
+/* Same scheme as the SerDes queues (see serdes.c): the producers reserve a
+ * slot by moving _tail with a compare-and-swap, then commit it by setting
+ * TRACE_EVENT_READY, the single consumer stops at the first slot not
+ * committed yet, no slot looks committed before it is written */
+static struct TraceEvent_t _ring[TRACE_RING_EVENTS] RAMX_BSS;
+static volatile uint32_t _head = 0;     // Next event to read, only modified by trace_block_fill()
+static volatile uint32_t _tail = 0;     // Next event to reserve
+static volatile uint32_t _dropped = 0;  // Dropped since the previous block
+
+
+/* functions implementation */
+
+/* @fn      trace_event
+ *
+ * @brief   Record an event in the ring, lock-free
+ *
+ * @return  None
+ */
+HIGHCODE void
+trace_event(uint32_t ticks, enum TraceId id, enum TracePhase phase, uint16_t arg)
+{
+    uint32_t tail = __atomic_load_n(&_tail, __ATOMIC_RELAXED);
+    struct TraceEvent_t *event;
+
+    do {
+        if (tail - _head >= TRACE_RING_EVENTS) {
+            __atomic_fetch_add(&_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&_tail, &tail, tail + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    event = &_ring[tail % TRACE_RING_EVENTS];
+    event->ticks = ticks;
+    event->arg = arg;
+    event->id = id;
+    __atomic_store_n(&event->phase, phase | TRACE_EVENT_READY, __ATOMIC_RELEASE);
+}
+
+/* @fn      trace_block_fill
+ *
+ * @brief   Move the oldest committed events of the ring to a trace block
+ *
+ * @return  The size of the block, 0 if the header does not fit
+ */
+HIGHCODE uint16_t
+trace_block_fill(uint8_t *buffer, uint16_t capacity)
+{
+    // Sampled first, it is the time of the reply for the host
+    uint32_t ticks = timebase_get_ticks();
+    uint32_t head = _head;
+    uint32_t dropped;
+    uint32_t pending;
+    uint16_t size = TRACE_BLOCK_HEADER_SIZE;
+    uint8_t phase;
+
+    if (capacity < TRACE_BLOCK_HEADER_SIZE) {
+        return 0;
+    }
+    if (capacity > TRACE_BLOCK_HEADER_SIZE + TRACE_BLOCK_EVENTS_MAX * TRACE_EVENT_SIZE) {
+        capacity = TRACE_BLOCK_HEADER_SIZE + TRACE_BLOCK_EVENTS_MAX * TRACE_EVENT_SIZE;
+    }
+
+    while (head != __atomic_load_n(&_tail, __ATOMIC_ACQUIRE) && size + TRACE_EVENT_SIZE <= capacity) {
+        struct TraceEvent_t *event = &_ring[head % TRACE_RING_EVENTS];
+
+        // Reserved by a preempted producer, the next call reads it
+        phase = __atomic_load_n(&event->phase, __ATOMIC_ACQUIRE);
+        if (!(phase & TRACE_EVENT_READY)) {
+            break;
+        }
+        memcpy(buffer + size, event, TRACE_EVENT_SIZE);
+        buffer[size + TRACE_EVENT_SIZE - 1] = phase & ~TRACE_EVENT_READY;
+        size += TRACE_EVENT_SIZE;
+
+        event->phase = 0;
+        ++head;
+    }
+    __atomic_store_n(&_head, head, __ATOMIC_RELEASE);
+
+    dropped = __atomic_exchange_n(&_dropped, 0, __ATOMIC_RELAXED);
+    pending = _tail - head;
+    if (dropped > UINT16_MAX) {
+        dropped = UINT16_MAX;
+    }
+    if (pending > UINT16_MAX) {
+        pending = UINT16_MAX;
+    }
+
+    memcpy(buffer, &ticks, sizeof(ticks));
+    buffer[4] = dropped & 0xFF;
+    buffer[5] = dropped >> 8;
+    buffer[6] = pending & 0xFF;
+    buffer[7] = pending >> 8;
+
+    return size;
+}
@@ -0,0 +1,105 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "timebase.h"
+
+/* macros */
+/* TRACE_EVENTS=1 compiles the trace points in, see the Makefile */
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS    (0)
+#endif
+
+/* Events kept until the host fetches them (BbioGetTrace), must be a power of
+ * 2. The newest events are dropped when the ring is full. An enumeration
+ * records a few hundred events on the bottom board */
+#define TRACE_RING_EVENTS       (1024)
+
+/* A trace block (StatsKindTrace), in little endian :
+ * - bytes 0..3 : timebase_get_ticks() when the block is filled, the host
+ *                correlates it with its own clock
+ * - bytes 4..5 : number of events dropped since the previous block
+ * - bytes 6..7 : number of events still in the ring after this block
+ * - events, TRACE_EVENT_SIZE bytes each, see struct TraceEvent_t
+ * A block holds at most TRACE_BLOCK_EVENTS_MAX events, so that the blocks of
+ * both boards fit in one reply
+ */
+#define TRACE_BLOCK_HEADER_SIZE (8)
+#define TRACE_EVENT_SIZE        (8)
+#define TRACE_BLOCK_EVENTS_MAX  (30)
+
+/* Set in struct TraceEvent_t.phase once the event is written */
+#define TRACE_EVENT_READY       (0x80)
+
+/* Trace points: TRACE_BEGIN()/TRACE_END() pairs must nest, except for
+ * TraceIdBbio which spans two HSPI interrupts */
+#if TRACE_EVENTS
+#define TRACE_BEGIN(id, arg)    trace_event(timebase_get_ticks(), (id), TracePhaseBegin, (arg))
+#define TRACE_END(id, arg)      trace_event(timebase_get_ticks(), (id), TracePhaseEnd, (arg))
+#define TRACE_INSTANT(id, arg)  trace_event(timebase_get_ticks(), (id), TracePhaseInstant, (arg))
+#else
+#define TRACE_BEGIN(id, arg)    do { } while (0)
+#define TRACE_END(id, arg)      do { } while (0)
+#define TRACE_INSTANT(id, arg)  do { } while (0)
+#endif
+
+/* Argument of the SerDes events */
+#define TRACE_SERDES_ARG(channel, len)  ((uint16_t)(((channel) << 13) | ((len) & 0x1FFF)))
+
+/* enums */
+/* Must match host-controller/trace.c */
+enum TraceId {
+    TraceIdIsrUsb   = 1,    // Begin/End, arg: R8_USB_INT_FG
+    TraceIdIsrHspi  = 2,    // Begin/End, arg: R8_HSPI_INT_FLAG
+    TraceIdIsrSerdes = 3,   // Begin/End, arg: SerDes_StatusIT()
+    TraceIdHspiTx   = 4,    // Instant (transmission done), arg: status
+    TraceIdHspiRx   = 5,    // Instant, arg: status
+    TraceIdSerdesTx = 6,    // Begin/End, arg: TRACE_SERDES_ARG()
+    TraceIdSerdesRx = 7,    // Instant, arg: TRACE_SERDES_ARG()
+    TraceIdSetup    = 8,    // Instant, arg: bRequestType << 8 | bRequest
+    TraceIdBbio     = 9,    // Begin: command, End: return code
+};
+
+enum TracePhase {
+    TracePhaseInstant   = 0,
+    TracePhaseBegin     = 1,
+    TracePhaseEnd       = 2,
+};
+
+/* structs */
+/* TRACE_EVENT_SIZE bytes, copied as is in the blocks */
+struct TraceEvent_t {
+    uint32_t ticks;             // timebase_get_ticks()
+    uint16_t arg;
+    uint8_t id;                 // enum TraceId
+    volatile uint8_t phase;     // enum TracePhase, | TRACE_EVENT_READY in the ring
+};
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : trace_event
+ * Description    : Record an event, lock-free, it can be called from any
+ *                  interrupt. Use the TRACE_*() macros instead
+ * Input          : - ticks: When the event happened
+ *                  - id: enum TraceId
+ *                  - phase: enum TracePhase
+ *                  - arg: Depends on the event, see enum TraceId
+ * Return         : None
+ *******************************************************************************/
+void trace_event(uint32_t ticks, enum TraceId id, enum TracePhase phase, uint16_t arg);
+
+/*******************************************************************************
+ * Function Name  : trace_block_fill
+ * Description    : Move the oldest events of the ring to a trace block. There
+ *                  must be a single caller at a time (the HSPI interrupt on the
+ *                  bottom board, the SerDes interrupt on the top board)
+ * Input          : - buffer: Where to write the block
+ *                  - capacity: The capacity of buffer
+ * Return         : The size of the block, 0 if the header does not fit
+ *******************************************************************************/
+uint16_t trace_block_fill(uint8_t *buffer, uint16_t capacity);
+
+
+#endif /* TRACE_H */
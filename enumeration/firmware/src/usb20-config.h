@@ -90,95 +90,15 @@ static struct DescriptorConfigComplete_t stBoardTopConfigurationDescriptor = {
     },
 };
 
-static uint8_t stringLangID[] =
-{
-	0x04, /* length of this descriptor */
-	0x03, /* USB Descriptor Type String */
-	0x09, /* Language ID 0 low byte */
-	0x04  /* Language ID 0 high byte */
-};
-
-static uint8_t stringDescriptorManufacturer[] = {
-    26,                     /* .bLength */
-    USB_DESCR_TYP_STRING,   /* .bDescriptorType */
-    'M', 0x00,
-    'a', 0x00,
-    'n', 0x00,
-    'u', 0x00,
-    'f', 0x00,
-    'a', 0x00,
-    'c', 0x00,
-    't', 0x00,
-    'u', 0x00,
-    'r', 0x00,
-    'e', 0x00,
-    'r', 0x00,
-};
-
-static uint8_t stringDescriptorProduct[] = {
-    16,                     /* .bLength */
-    USB_DESCR_TYP_STRING,   /* .bDescriptorType */
-    'P', 0x0,
-    'r', 0x0,
-    'o', 0x0,
-    'd', 0x0,
-    'u', 0x0,
-    'c', 0x0,
-    't', 0x0,
-};
-
-static uint8_t stringDescriptorSerialNumber[] = {
-    28,                     /* .bLength */
-    USB_DESCR_TYP_STRING,   /* .bDescriptorType */
-    'S', 0x0,
-    'e', 0x0,
-    'r', 0x0,
-    'i', 0x0,
-    'a', 0x0,
-    'l', 0x0,
-    '-', 0x0,
-    'n', 0x0,
-    'u', 0x0,
-    'm', 0x0,
-    'b', 0x0,
-    'e', 0x0,
-    'r', 0x0,
-};
-
-
-static uint8_t stringDescriptorConfig[] = {
-    14,                     /* .bLength */
-    USB_DESCR_TYP_STRING,   /* .bDescriptorType */
-    'C', 0x0,
-    'o', 0x0,
-    'n', 0x0,
-    'f', 0x0,
-    'i', 0x0,
-    'g', 0x0,
-};
-
-static uint8_t stringDescriptorInterface[] = {
-    20,                     /* .bLength */
-    USB_DESCR_TYP_STRING,   /* .bDescriptorType */
-    'I', 0x0,
-    'n', 0x0,
-    't', 0x0,
-    'e', 0x0,
-    'r', 0x0,
-    'f', 0x0,
-    'a', 0x0,
-    'c', 0x0,
-    'e', 0x0,
-};
-
-static uint8_t *boardTopStringDescriptors[] = {
-    stringLangID,
-    stringDescriptorManufacturer,
-    stringDescriptorProduct,
-    stringDescriptorSerialNumber,
-    stringDescriptorConfig,
-    stringDescriptorInterface,
-    NULL /* Must be NULL-terminated as we need to determine its length */
+/* UTF-8 texts, see g_descriptorStrings. The index 0 (LANGID) is synthesised
+ */
+static const char *boardTopStringDescriptors[] = {
+    NULL,
+    "Manufacturer",
+    "Product",
+    "Serial-number",
+    "Config",
+    "Interface",
 };
 
 #endif /* USB20_CONFIG_H */
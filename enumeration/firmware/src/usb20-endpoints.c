@@ -1,18 +1,24 @@
+#define LOG_MODULE  LOG_MODULE_USB
+
 #include "usb20-endpoints.h"
 
+#include "highcode.h"
 #include "log.h"
+#include "progress.h"
 
 
 /* variables */
-uint16_t sizeEndp6LoggingBuff = 0;
-const uint16_t capacityEndp6LoggingBuff = 4096;
 __attribute__((aligned(16))) uint8_t endp6LoggingBuffRaw[4096] __attribute__((section(".DMADATA")));
-uint8_t *endp6LoggingBuff = endp6LoggingBuffRaw;
+struct LogRing_t endp6LoggingRing = {
+    .buffer = endp6LoggingBuffRaw,
+    .capacity = sizeof(endp6LoggingBuffRaw),
+};
 
-uint16_t sizeEndp7LoggingBuff = 0;
-const uint16_t capacityEndp7LoggingBuff = 4096;
 __attribute__((aligned(16))) uint8_t endp7LoggingBuffRaw[4096] __attribute__((section(".DMADATA")));
-uint8_t *endp7LoggingBuff = endp7LoggingBuffRaw;
+struct LogRing_t endp7LoggingRing = {
+    .buffer = endp7LoggingBuffRaw,
+    .capacity = sizeof(endp7LoggingBuffRaw),
+};
 
 
 /* functions implementation */
@@ -45,7 +51,7 @@ uint8_t *endp7LoggingBuff = endp7LoggingBuffRaw;
 
  * @return  None
  */
-void
+HIGHCODE void
 epX_transceive_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pSizeBuffer)
 {
     static uint8_t *bufferResetValue = NULL;
@@ -86,7 +92,7 @@ epX_transceive_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pSizeBu
         /* Only used with ep0, should not trigger here */
         break;
         default:
-            log_to_evaluator("ERROR: epX_transceive_and_update default!");
+            LOG_ERROR("epX_transceive_and_update default!");
             break;
     }
 }
@@ -100,7 +106,7 @@ epX_transceive_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pSizeBu
  *
  * @return  None
  */
-void
+HIGHCODE void
 ep1_transceive_and_update_host(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pSizeBuffer)
 {
     static uint8_t *bufferResetValue = NULL;
@@ -130,7 +136,7 @@ ep1_transceive_and_update_host(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pS
 
         break;
     default:
-        log_to_evaluator("ERROR: ep1_transceive_and_update default!");
+        LOG_ERROR("ep1_transceive_and_update default!");
         break;
     }
 }
@@ -138,13 +144,16 @@ ep1_transceive_and_update_host(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pS
 /*******************************************************************************
 /* @fn      epX_handler_toe
  *
- * @brief   Dummy endpoint handler for ToE board, just ACK the request
+ * @brief   Dummy endpoint handler for ToE board, just ACK the request, the
+ *          first transaction of each endpoint is timestamped
  *
  * @return  None
  */
-void
+HIGHCODE void
 epX_handler_toe(uint8_t uisToken, uint8_t endpoint)
 {
+    progress_endpoint_record(uisToken, endpoint);
+
     switch (uisToken) {
         case UIS_TOKEN_OUT:
             switch (endpoint) {
@@ -184,7 +193,7 @@ epX_handler_toe(uint8_t uisToken, uint8_t endpoint)
                 R8_UEP7_TX_CTRL = (R8_UEP7_TX_CTRL & ~RB_UEP_TRES_MASK) | UEP_T_RES_ACK;
                 break;
             default:
-                log_to_evaluator("ERROR: epX_handler_toe() invalid endpoint (OUT)\r\n");
+                LOG_ERROR("epX_handler_toe() invalid endpoint (OUT)\r\n");
                 return;
             }
         break;
@@ -219,94 +228,62 @@ epX_handler_toe(uint8_t uisToken, uint8_t endpoint)
                 R8_UEP7_RX_CTRL = (R8_UEP7_RX_CTRL & ~RB_UEP_TRES_MASK) | UEP_T_RES_ACK;
                 break;
             default:
-                log_to_evaluator("ERROR: epX_handler_toe() invalid endpoint (IN)\r\n");
+                LOG_ERROR("epX_handler_toe() invalid endpoint (IN)\r\n");
                 return;
             }
         break;
     default:
-        log_to_evaluator("ERROR: epX_handler_toe() default!\r\n");
+        LOG_ERROR("epX_handler_toe() default!\r\n");
         return;
     }
 }
 
 /* @fn      ep6_transmit_and_update
  *
- * @brief   Handle the "command" on endpoint 6 (transmit debug of bottom board)
- *          and update the buffer accordingly
+ * @brief   Handle the "command" on endpoint 6 (transmit debug of top board),
+ *          each IN transaction moves the next committed bytes of the ring
+ *          to the endpoint, an empty packet is sent when there is none
  *
  * @return  None
  */
-void
-ep6_transmit_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pSizeBuffer)
+HIGHCODE void
+ep6_transmit_and_update(uint8_t uisToken, struct LogRing_t *ring)
 {
-    static uint8_t *bufferResetValue = NULL;
-    if (bufferResetValue == NULL) {
-        bufferResetValue = *pBuffer;
-    }
-
     switch (uisToken) {
     case UIS_TOKEN_IN:
-        if (*pSizeBuffer != 0x0000) {
-            uint16_t sizeCurrentTransaction = min(*pSizeBuffer, U20_UEP6_MAXSIZE);
-            memcpy(endp6Tbuff, *pBuffer, sizeCurrentTransaction);
-
-            R16_UEP6_T_LEN = sizeCurrentTransaction;
-            R8_UEP6_TX_CTRL ^= RB_UEP_T_TOG_1;
-            R8_UEP6_TX_CTRL = (R8_UEP6_TX_CTRL & ~RB_UEP_TRES_MASK) | UEP_T_RES_ACK;
-
-            *pSizeBuffer -= sizeCurrentTransaction;
-            *(uint32_t *)pBuffer += U20_UEP6_MAXSIZE; /* Careful! We increase from the PREVIOUSLY read value */
-        } else {
-            *pBuffer = bufferResetValue;
-
-            R16_UEP6_T_LEN = 0;
-            R8_UEP6_TX_CTRL ^= RB_UEP_T_TOG_1;
-            R8_UEP6_TX_CTRL = (R8_UEP6_TX_CTRL & ~RB_UEP_TRES_MASK) | UEP_T_RES_ACK;
-        }
+        // This handler has the highest priority, it can preempt a writer in
+        // the middle of its copy, only the committed bytes are read
+        R16_UEP6_T_LEN = log_ring_read(ring, endp6Tbuff, U20_UEP6_MAXSIZE);
+        R8_UEP6_TX_CTRL ^= RB_UEP_T_TOG_1;
+        R8_UEP6_TX_CTRL = (R8_UEP6_TX_CTRL & ~RB_UEP_TRES_MASK) | UEP_T_RES_ACK;
         break;
         default:
-            log_to_evaluator("ERROR: ep6_transmit_and_update default!");
+            LOG_ERROR("ep6_transmit_and_update default!");
             break;
     }
 }
 
 /* @fn      ep7_transmit_and_update
  *
- * @brief   Handle the "command" on endpoint 7 (transmit debug of bottom board)
- *          and update the buffer accordingly
+ * @brief   Handle the "command" on endpoint 7 (transmit debug of bottom board),
+ *          each IN transaction moves the next committed bytes of the ring
+ *          to the endpoint, an empty packet is sent when there is none
  *
  * @return  None
  */
-void
-ep7_transmit_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pSizeBuffer)
+HIGHCODE void
+ep7_transmit_and_update(uint8_t uisToken, struct LogRing_t *ring)
 {
-    static uint8_t *bufferResetValue = NULL;
-    if (bufferResetValue == NULL) {
-        bufferResetValue = *pBuffer;
-    }
-
     switch (uisToken) {
     case UIS_TOKEN_IN:
-        if (*pSizeBuffer != 0x0000) {
-            uint16_t sizeCurrentTransaction = min(*pSizeBuffer, U20_UEP7_MAXSIZE);
-            memcpy(endp7Tbuff, *pBuffer, sizeCurrentTransaction);
-
-            R16_UEP7_T_LEN = sizeCurrentTransaction;
-            R8_UEP7_TX_CTRL ^= RB_UEP_T_TOG_1;
-            R8_UEP7_TX_CTRL = (R8_UEP7_TX_CTRL & ~RB_UEP_TRES_MASK) | UEP_T_RES_ACK;
-
-            *pSizeBuffer -= sizeCurrentTransaction;
-            *(uint32_t *)pBuffer += U20_UEP7_MAXSIZE; /* Careful! We increase from the PREVIOUSLY read value */
-        } else {
-            *pBuffer = bufferResetValue;
-
-            R16_UEP7_T_LEN = 0;
-            R8_UEP7_TX_CTRL ^= RB_UEP_T_TOG_1;
-            R8_UEP7_TX_CTRL = (R8_UEP7_TX_CTRL & ~RB_UEP_TRES_MASK) | UEP_T_RES_ACK;
-        }
+        // This handler has the highest priority, it can preempt a writer in
+        // the middle of its copy, only the committed bytes are read
+        R16_UEP7_T_LEN = log_ring_read(ring, endp7Tbuff, U20_UEP7_MAXSIZE);
+        R8_UEP7_TX_CTRL ^= RB_UEP_T_TOG_1;
+        R8_UEP7_TX_CTRL = (R8_UEP7_TX_CTRL & ~RB_UEP_TRES_MASK) | UEP_T_RES_ACK;
         break;
         default:
-            log_to_evaluator("ERROR: ep7_transmit_and_update default!");
+            LOG_ERROR("ep7_transmit_and_update default!");
             break;
     }
 }
@@ -8,17 +8,15 @@
 #include "CH56x_common.h"
 
 #include "hspi.h"
+#include "log.h"
 #include "usb20.h"
 
 
 /* variables */
-extern uint16_t sizeEndp6LoggingBuff;
-extern const uint16_t capacityEndp6LoggingBuff;
-extern uint8_t *endp6LoggingBuff;
-
-extern uint16_t sizeEndp7LoggingBuff;
-extern const uint16_t capacityEndp7LoggingBuff;
-extern uint8_t *endp7LoggingBuff;
+/* Logging rings of the top (endpoint 6) and bottom (endpoint 7) boards, filled
+ * by usb20_log_append() and drained by the endpoint handlers */
+extern struct LogRing_t endp6LoggingRing;
+extern struct LogRing_t endp7LoggingRing;
 
 /* functions declaration */
 
@@ -71,25 +69,22 @@ void epX_handler_toe(uint8_t uisToken, uint8_t endpoint);
 /*******************************************************************************
  * Function Name  : ep6_transmit_and_update
  * Description    : Handle the "command" on endpoint 6 (transmit debug of top
- *                  board) and update the buffer accordingly
- *
+ *                  board) from its logging ring
  * Input          : - uisToken is the bmRequestType field of the Setup Packet
- *                  - pBuffer and pSizeBuffer are the buffer to transceive and
- *                    the associated size
+ *                  - ring is the logging ring to drain
  * Return         : None
  *******************************************************************************/
-void ep6_transmit_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pSizeBuffer);
+void ep6_transmit_and_update(uint8_t uisToken, struct LogRing_t *ring);
 
 /*******************************************************************************
  * Function Name  : ep7_transmit_and_update
  * Description    : Handle the "command" on endpoint 7 (transmit debug of
- *                  bottom board) and update the buffer accordingly
+ *                  bottom board) from its logging ring
  * Input          : - uisToken is the bmRequestType field of the Setup Packet
- *                  - pBuffer and pSizeBuffer are the buffer to transceive and
- *                    the associated size
+ *                  - ring is the logging ring to drain
  * Return         : None
  *******************************************************************************/
-void ep7_transmit_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pSizeBuffer);
+void ep7_transmit_and_update(uint8_t uisToken, struct LogRing_t *ring);
 
 
 #endif /* USB20_ENDPOINTS_H */
@@ -1,6 +1,11 @@
+#define LOG_MODULE  LOG_MODULE_USB
+
 #include <stdarg.h>
+#include <stdbool.h>
 #include <string.h>
 
+#include "highcode.h"
+#include "irq.h"
 #include "log.h"
 
 #include "usb20.h"
@@ -15,7 +20,41 @@ uint8_t *g_descriptorDevice     = NULL;
 uint8_t *g_descriptorConfig     = NULL;
 uint8_t *g_descriptorHidReport  = NULL;
 uint8_t *g_descriptorHubReport  = NULL;
-uint8_t **g_descriptorStrings   = NULL;
+const char **g_descriptorStrings = NULL;
+uint16_t g_usb20Ep0MaxSize = U20_UEP0_MAXSIZE;
+uint8_t g_descriptorStringsCount = 0;
+uint8_t *g_descriptorQualifier  = NULL;
+uint8_t *g_descriptorOtherSpeed = NULL;
+uint16_t g_descriptorOtherSpeedSize = 0;
+uint8_t *g_descriptorBos        = NULL;
+
+/* structs */
+/* The bytes [start, end[ of a string descriptor, see _usb20_string_expand() */
+struct Usb20StringPart_t {
+    uint8_t *buffer;    // NULL to only compute the size
+    uint8_t start;
+    uint8_t end;
+};
+
+/* internal variables */
+static uint32_t _serial = 0;    // See usb20_serial_next()
+// LANGID 0x0409, English (United States)
+static uint8_t _descriptorLangId[] = { 0x04, USB_DESCR_TYP_STRING, 0x09, 0x04 };
+/* The string descriptor being sent, expanded in endp0RTbuff packet after
+ * packet, see usb20_ep0_transceive_and_update() */
+static const char *_stringText = NULL;
+static uint8_t _stringOffset = 0;
+/* The line formatted by usb20_vlog(), one per nesting level as a context is
+ * only preempted by the deeper levels */
+static char _logLines[IRQ_NESTING_MAX + 1][USB20_LOG_LINE_CAPACITY];
+/* Built by usb20_descriptors_derive() */
+static uint8_t _descriptorQualifier[10];
+static uint8_t _descriptorOtherSpeed[USB20_OTHER_SPEED_CAPACITY] __attribute__((section(".DMADATA")));
+// USB 2.0 extension capability, LPM not supported
+static uint8_t _descriptorBos[] = {
+    0x05, USB_DESCR_TYP_BOS, 0x0C, 0x00, 0x01,
+    0x07, 0x10, 0x02, 0x00, 0x00, 0x00, 0x00,
+};
 
 __attribute__((aligned(16))) uint8_t endp0RTbuff[512] __attribute__((section(".DMADATA"))); // Endpoint 0 data transceiver buffer.
 __attribute__((aligned(16))) uint8_t endp1Rbuff[4096] __attribute__((section(".DMADATA"))); // Endpoint 1 data recceiver buffer.
@@ -36,23 +75,6 @@ __attribute__((aligned(16))) uint8_t endp7Tbuff[4096] __attribute__((section(".D
 
 /* functions implementation */
 
-/* @fn      array_addr_len
- *
- * @brief   Get the length of an array of pointers
- *          Only used internally
- *
- * @return  Return the length of an array of pointers
- */
-static uint8_t
-_array_addr_len(void **array)
-{
-    for (uint8_t i = 0;; ++i) {
-        if (array[i] == NULL) {
-            return i;
-        }
-    }
-}
-
 /* @fn      usb20_registers_init
  *
  * @brief   Initialize registers and enable interrupt related to USB 2.0
@@ -107,7 +129,7 @@ usb20_endpoints_init(enum Endpoint endpointsInMask, enum Endpoint endpointsOutMa
     R8_UEP5_6_MOD = 0;
     R8_UEP7_MOD   = 0;
 
-    R16_UEP0_MAX_LEN = U20_UEP0_MAXSIZE;
+    R16_UEP0_MAX_LEN = g_usb20Ep0MaxSize;
     R16_UEP1_MAX_LEN = U20_MAXPACKET_LEN;
     R16_UEP2_MAX_LEN = U20_MAXPACKET_LEN;
     R16_UEP3_MAX_LEN = U20_MAXPACKET_LEN;
@@ -245,7 +267,7 @@ usb20_endpoints_init(enum Endpoint endpointsInMask, enum Endpoint endpointsOutMa
  * 
  * @return  None
  */
-void
+HIGHCODE void
 usb20_endpoint_ack(uint8_t endpointToACK)
 {
     switch (endpointToACK) {
@@ -299,7 +321,7 @@ usb20_endpoint_ack(uint8_t endpointToACK)
         R8_UEP7_RX_CTRL = UEP_R_RES_ACK | RB_UEP_R_TOG_0;
         break;
     default:
-        log_to_evaluator("ERROR: endpoint_clear() invalid argument");
+        LOG_ERROR("endpoint_clear() invalid argument");
         break;
     }
 }
@@ -312,7 +334,7 @@ usb20_endpoint_ack(uint8_t endpointToACK)
  * 
  * @return  None
  */
-void
+HIGHCODE void
 usb20_endpoint_nak(uint8_t endpointToNAK)
 {
     switch (endpointToNAK) {
@@ -366,7 +388,7 @@ usb20_endpoint_nak(uint8_t endpointToNAK)
         R8_UEP7_RX_CTRL = UEP_R_RES_NAK | RB_UEP_R_TOG_0;
         break;
     default:
-        log_to_evaluator("ERROR: endpoint_clear() invalid argument");
+        LOG_ERROR("endpoint_clear() invalid argument");
         break;
     }
 }
@@ -379,10 +401,16 @@ usb20_endpoint_nak(uint8_t endpointToNAK)
  * 
  * @return  None
  */
-void
+HIGHCODE void
 usb20_endpoint_halt(uint8_t endpointToHalt)
 {
     switch(endpointToHalt) {
+    case 0x80: /* Set endpoint 0 IN STALL, until the next SETUP packet */
+        R8_UEP0_TX_CTRL = (R8_UEP0_TX_CTRL & ~RB_UEP_TRES_MASK) | UEP_T_RES_STALL;
+        break;
+    case 0x00: /* Set endpoint 0 OUT STALL, until the next SETUP packet */
+        R8_UEP0_RX_CTRL = (R8_UEP0_RX_CTRL & ~RB_UEP_RRES_MASK) | UEP_R_RES_STALL;
+        break;
     case 0x81: /* Set endpoint 1 IN STALL */
         R8_UEP1_TX_CTRL = (R8_UEP1_TX_CTRL & ~RB_UEP_TRES_MASK) | UEP_T_RES_STALL;
         break;
@@ -426,18 +454,340 @@ usb20_endpoint_halt(uint8_t endpointToHalt)
         R8_UEP7_RX_CTRL = (R8_UEP7_RX_CTRL & ~RB_UEP_RRES_MASK) | UEP_R_RES_STALL;
         break;
     default:
-        log_to_evaluator("ERROR: endpoint_halt() invalid argument");
+        LOG_ERROR("endpoint_halt() invalid argument");
         break;
     }
 }
 
-/* @fn      usb20_fill_buffer_with_descriptor
+/* @fn      _usb20_endpoint_other_speed
  *
- * @brief   Fill the given buffer with the requested descriptor
+ * @brief   Set the wMaxPacketSize of an endpoint descriptor for the other
+ *          speed: at full speed, 64 bytes at most and 1023 for isochronous
+ *          endpoints, without additional transactions; at high speed, 512
+ *          bytes for bulk endpoints
+ *          Only used internally
+ *
+ * @return  None
+ */
+static void
+_usb20_endpoint_other_speed(uint8_t *endpoint, bool isOtherHigh)
+{
+    uint16_t maxPacket = (endpoint[4] | (endpoint[5] << 8)) & 0x07FF;
+    uint8_t transferType = endpoint[3] & 0x03;
+
+    if (isOtherHigh) {
+        if (transferType != 0x02) {
+            return;
+        }
+        maxPacket = 512;
+    } else if (transferType == 0x01) {
+        maxPacket = maxPacket > 1023 ? 1023 : maxPacket;
+    } else {
+        maxPacket = maxPacket > 64 ? 64 : maxPacket;
+    }
+
+    endpoint[4] = maxPacket & 0xFF;
+    endpoint[5] = maxPacket >> 8;
+}
+
+/* @fn      _usb20_endpoint_check
+ *
+ * @brief   Check the wMaxPacketSize of an endpoint descriptor against the
+ *          limits of a speed
+ *          Only used internally
+ *
+ * @return  0 if the endpoint is valid, 1 else
+ */
+static uint8_t
+_usb20_endpoint_check(const uint8_t *endpoint, enum Speed speed)
+{
+    uint16_t maxPacket = (endpoint[4] | (endpoint[5] << 8)) & 0x07FF;
+    uint8_t transactions = (endpoint[5] >> 3) & 0x03;   // Additional transactions per microframe
+    uint8_t transferType = endpoint[3] & 0x03;
+
+    switch (speed) {
+    case SpeedLow:
+        // Control and interrupt endpoints only
+        return transferType == 0x01 || transferType == 0x02 || maxPacket > 8 || transactions;
+    case SpeedFull:
+        if (transactions) {
+            return 1;
+        }
+        if (transferType == 0x01) {
+            return maxPacket > 1023;
+        }
+        if (transferType == 0x02) {
+            return maxPacket != 8 && maxPacket != 16 && maxPacket != 32 && maxPacket != 64;
+        }
+        return maxPacket > 64;
+    default:
+        if (transferType == 0x02) {
+            return maxPacket != 512 || transactions;
+        }
+        if (transferType == 0x00) {
+            return maxPacket > 64 || transactions;
+        }
+        return maxPacket > 1024 || transactions > 2;
+    }
+}
+
+/* @fn      usb20_descriptors_check
+ *
+ * @brief   Check the device and configuration descriptors against the limits
+ *          of a speed
+ *
+ * @return  0 if the descriptors are valid, 1 else
+ */
+uint8_t
+usb20_descriptors_check(enum Speed speed)
+{
+    uint8_t maxPacket0;
+    uint16_t sizeConfig;
+
+    if (g_descriptorDevice == NULL) {
+        return 1;
+    }
+
+    maxPacket0 = g_descriptorDevice[7];
+    if ((speed == SpeedLow && maxPacket0 != 8)
+        || (speed == SpeedFull && maxPacket0 != 8 && maxPacket0 != 16 && maxPacket0 != 32 && maxPacket0 != 64)
+        || (speed == SpeedHigh && maxPacket0 != 64)) {
+        LOG_WARN("usb20_descriptors_check() bMaxPacketSize0 %d invalid at this speed\r\n", maxPacket0);
+        return 1;
+    }
+
+    if (g_descriptorConfig == NULL) {
+        return 0;
+    }
+    // The descriptors may be unaligned in the descriptor store
+    sizeConfig = g_descriptorConfigCustomSize ? g_descriptorConfigCustomSize
+                                              : g_descriptorConfig[2] | (g_descriptorConfig[3] << 8);
+    for (uint16_t offset = 0; offset + 2 <= sizeConfig && g_descriptorConfig[offset] >= 2;
+         offset += g_descriptorConfig[offset]) {
+        if (g_descriptorConfig[offset + 1] == USB_DESCR_TYP_ENDP && offset + 7 <= sizeConfig
+            && _usb20_endpoint_check(g_descriptorConfig + offset, speed)) {
+            LOG_WARN("usb20_descriptors_check() endpoint 0x%02x invalid at this speed\r\n", g_descriptorConfig[offset + 2]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* @fn      usb20_descriptors_derive
+ *
+ * @brief   Build the descriptors the host did not upload
  *
  * @return  None
  */
 void
+usb20_descriptors_derive(enum Speed speed)
+{
+    uint16_t bcdUsb;
+    uint16_t sizeConfig;
+    bool isDualSpeed;
+
+    if (g_descriptorDevice == NULL) {
+        return;
+    }
+
+    // The descriptors may be unaligned in the descriptor store
+    bcdUsb = g_descriptorDevice[2] | (g_descriptorDevice[3] << 8);
+    isDualSpeed = speed != SpeedLow && bcdUsb >= 0x0200;
+
+    if (g_descriptorQualifier == NULL && isDualSpeed) {
+        _descriptorQualifier[0] = sizeof(_descriptorQualifier);
+        _descriptorQualifier[1] = USB_DESCR_TYP_QUALIF;
+        _descriptorQualifier[2] = g_descriptorDevice[2];    // bcdUSB
+        _descriptorQualifier[3] = g_descriptorDevice[3];
+        _descriptorQualifier[4] = g_descriptorDevice[4];    // bDeviceClass
+        _descriptorQualifier[5] = g_descriptorDevice[5];    // bDeviceSubClass
+        _descriptorQualifier[6] = g_descriptorDevice[6];    // bDeviceProtocol
+        _descriptorQualifier[7] = 64;                       // bMaxPacketSize0, valid at both speeds
+        _descriptorQualifier[8] = g_descriptorDevice[17];   // bNumConfigurations
+        _descriptorQualifier[9] = 0;
+        g_descriptorQualifier = _descriptorQualifier;
+    }
+
+    if (g_descriptorOtherSpeed == NULL && isDualSpeed && g_descriptorConfig != NULL) {
+        sizeConfig = g_descriptorConfigCustomSize ? g_descriptorConfigCustomSize
+                                                  : g_descriptorConfig[2] | (g_descriptorConfig[3] << 8);
+        if (sizeConfig <= USB20_OTHER_SPEED_CAPACITY) {
+            memcpy(_descriptorOtherSpeed, g_descriptorConfig, sizeConfig);
+            _descriptorOtherSpeed[1] = USB_DESCR_TYP_SPEED;
+            for (uint16_t offset = 0; offset + 2 <= sizeConfig && _descriptorOtherSpeed[offset] >= 2;
+                 offset += _descriptorOtherSpeed[offset]) {
+                if (_descriptorOtherSpeed[offset + 1] == USB_DESCR_TYP_ENDP && offset + 7 <= sizeConfig) {
+                    _usb20_endpoint_other_speed(_descriptorOtherSpeed + offset, speed != SpeedHigh);
+                }
+            }
+            g_descriptorOtherSpeed = _descriptorOtherSpeed;
+            g_descriptorOtherSpeedSize = sizeConfig;
+        } else {
+            LOG_WARN("usb20_descriptors_derive() configuration too large for the other speed\r\n");
+        }
+    }
+
+    if (g_descriptorBos == NULL && bcdUsb >= 0x0201) {
+        g_descriptorBos = _descriptorBos;
+    }
+}
+
+/* @fn      usb20_serial_next
+ *
+ * @brief   Take the next serial number of the string placeholders
+ *
+ * @return  None
+ */
+void
+usb20_serial_next(void)
+{
+    ++_serial;
+}
+
+/* @fn      _usb20_string_byte_put
+ *
+ * @brief   Write a byte of a string descriptor if it is in the part built
+ *          Only used internally
+ *
+ * @return  None
+ */
+static HIGHCODE void
+_usb20_string_byte_put(struct Usb20StringPart_t *part, uint8_t index, uint8_t value)
+{
+    if (part->buffer && index >= part->start && index < part->end) {
+        part->buffer[index - part->start] = value;
+    }
+}
+
+/* @fn      _usb20_string_unit_add
+ *
+ * @brief   Append a UTF-16LE code unit to a string descriptor
+ *          Only used internally
+ *
+ * @return  The new size of the descriptor, unchanged if it is full
+ */
+static HIGHCODE uint8_t
+_usb20_string_unit_add(struct Usb20StringPart_t *part, uint8_t size, uint16_t unit)
+{
+    if (size + 2 > USB20_STRING_DESCRIPTOR_CAPACITY) {
+        return size;
+    }
+    _usb20_string_byte_put(part, size, unit & 0xFF);
+    _usb20_string_byte_put(part, size + 1, unit >> 8);
+    return size + 2;
+}
+
+/* @fn      _usb20_string_serial_add
+ *
+ * @brief   Append the serial number to a string descriptor, 8 digits
+ *          Only used internally
+ *
+ * @return  The new size of the descriptor
+ */
+static HIGHCODE uint8_t
+_usb20_string_serial_add(struct Usb20StringPart_t *part, uint8_t size, uint8_t base)
+{
+    uint16_t digits[8];
+    uint32_t value = _serial;
+
+    for (int8_t i = 7; i >= 0; --i) {
+        digits[i] = value % base < 10 ? '0' + value % base : 'A' + value % base - 10;
+        value /= base;
+    }
+    for (uint8_t i = 0; i < 8; ++i) {
+        size = _usb20_string_unit_add(part, size, digits[i]);
+    }
+    return size;
+}
+
+/* @fn      _usb20_string_expand
+ *
+ * @brief   Build a part of the string descriptor of a UTF-8 text, placeholders
+ *          filled, truncated to USB20_STRING_DESCRIPTOR_CAPACITY. The whole
+ *          text is decoded each time, a part is at most one EP0 packet
+ *          Only used internally
+ *
+ * @return  The size of the whole descriptor
+ */
+static HIGHCODE uint8_t
+_usb20_string_expand(const char *text, struct Usb20StringPart_t *part)
+{
+    // Shortest code point of a UTF-8 sequence per size, the longer (overlong)
+    // encodings are invalid
+    static const uint32_t minimums[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+    const uint8_t *c = (const uint8_t *)text;
+    uint8_t size = 2;
+    uint32_t codePoint;
+    uint8_t sizeSequence;
+
+    while (*c && size < USB20_STRING_DESCRIPTOR_CAPACITY) {
+        if (c[0] == '%' && (c[1] == 'n' || c[1] == 'x')) {
+            size = _usb20_string_serial_add(part, size, c[1] == 'n' ? 10 : 16);
+            c += 2;
+            continue;
+        }
+        if (c[0] == '%' && c[1] == '%') {
+            ++c;
+        }
+
+        // UTF-8 decoding, an invalid sequence is U+FFFD
+        if (c[0] < 0x80) {
+            codePoint = c[0];
+            sizeSequence = 1;
+        } else if ((c[0] & 0xE0) == 0xC0) {
+            codePoint = c[0] & 0x1F;
+            sizeSequence = 2;
+        } else if ((c[0] & 0xF0) == 0xE0) {
+            codePoint = c[0] & 0x0F;
+            sizeSequence = 3;
+        } else if ((c[0] & 0xF8) == 0xF0) {
+            codePoint = c[0] & 0x07;
+            sizeSequence = 4;
+        } else {
+            codePoint = 0xFFFD;
+            sizeSequence = 1;
+        }
+        for (uint8_t i = 1; i < sizeSequence; ++i) {
+            if ((c[i] & 0xC0) != 0x80) {
+                codePoint = 0xFFFD;
+                sizeSequence = i;
+                break;
+            }
+            codePoint = (codePoint << 6) | (c[i] & 0x3F);
+        }
+        c += sizeSequence;
+
+        // Overlong encodings and encoded surrogates are not characters
+        if (codePoint < minimums[sizeSequence] || (codePoint >= 0xD800 && codePoint < 0xE000)) {
+            codePoint = 0xFFFD;
+        }
+
+        if (codePoint >= 0x10000 && codePoint < 0x110000) {
+            // Surrogate pair, not split by the truncation
+            if (size + 4 > USB20_STRING_DESCRIPTOR_CAPACITY) {
+                break;
+            }
+            codePoint -= 0x10000;
+            size = _usb20_string_unit_add(part, size, 0xD800 | (codePoint >> 10));
+            size = _usb20_string_unit_add(part, size, 0xDC00 | (codePoint & 0x3FF));
+        } else {
+            size = _usb20_string_unit_add(part, size, codePoint < 0x10000 ? codePoint : 0xFFFD);
+        }
+    }
+
+    _usb20_string_byte_put(part, 0, size);
+    _usb20_string_byte_put(part, 1, USB_DESCR_TYP_STRING);
+    return size;
+}
+
+/* @fn      usb20_fill_buffer_with_descriptor
+ *
+ * @brief   Fill the given buffer with the requested descriptor
+ *
+ * @return  0 if Success, 1 if the device has no such descriptor
+ */
+HIGHCODE uint8_t
 usb20_fill_buffer_with_descriptor(UINT16_UINT8 descritorRequested, uint8_t **pBuffer, uint16_t *pSizeBuffer)
 {
     switch(descritorRequested.bw.bb0) {
@@ -459,41 +809,79 @@ usb20_fill_buffer_with_descriptor(UINT16_UINT8 descritorRequested, uint8_t **pBu
         break;
     case USB_DESCR_TYP_STRING: {
         uint8_t i = descritorRequested.bw.bb1;
-        if (i >= 0 && i < _array_addr_len((void **)g_descriptorStrings)) {
-            *pBuffer = g_descriptorStrings[i];
-            *pSizeBuffer = g_descriptorStrings[i][0];
+        if (i == 0) {
+            *pBuffer = _descriptorLangId;
+            *pSizeBuffer = sizeof(_descriptorLangId);
+            break;
+        }
+        if (g_descriptorStrings == NULL || i >= g_descriptorStringsCount || g_descriptorStrings[i] == NULL) {
+            return 1;
         }
+        // Only the size now, the descriptor is expanded in endp0RTbuff
+        // packet after packet
+        struct Usb20StringPart_t part = { NULL, 0, 0 };
+        _stringText = g_descriptorStrings[i];
+        _stringOffset = 0;
+        *pBuffer = endp0RTbuff;
+        *pSizeBuffer = _usb20_string_expand(_stringText, &part);
     }
     break;
     case USB_DESCR_TYP_INTERF:
-        log_to_evaluator("getDescriptor(USB_DESCR_TYP_INTERF) not implemented\r\n");
+        LOG_WARN("getDescriptor(USB_DESCR_TYP_INTERF) not implemented\r\n");
         /* Not supported for now */
         // *pBuffer = (uint8_t *)&stInterfaceDescriptor;
         // *pSizeBuffer = stInterfaceDescriptor.bLength;
-        break;
+        return 1;
     case USB_DESCR_TYP_ENDP:
-        log_to_evaluator("getDescriptor(USB_DESCR_TYP_ENDP) not implemented\r\n");
+        LOG_WARN("getDescriptor(USB_DESCR_TYP_ENDP) not implemented\r\n");
         /* Not supported for now */
         // *pBuffer = (uint8_t *)&stEndpointDescriptor;
         // *pSizeBuffer = stEndpointDescriptor.bLength;
+        return 1;
+    case USB_DESCR_TYP_QUALIF:
+        if (g_descriptorQualifier == NULL) {
+            return 1;
+        }
+        *pBuffer = g_descriptorQualifier;
+        *pSizeBuffer = g_descriptorQualifier[0];
+        break;
+    case USB_DESCR_TYP_SPEED:
+        if (g_descriptorOtherSpeed == NULL) {
+            return 1;
+        }
+        *pBuffer = g_descriptorOtherSpeed;
+        *pSizeBuffer = g_descriptorOtherSpeedSize;
+        break;
+    case USB_DESCR_TYP_BOS:
+        if (g_descriptorBos == NULL) {
+            return 1;
+        }
+        // wTotalLength, the descriptor may be unaligned
+        *pBuffer = g_descriptorBos;
+        *pSizeBuffer = g_descriptorBos[2] | (g_descriptorBos[3] << 8);
         break;
     case USB_DESCR_TYP_HID:
-        log_to_evaluator("getDescriptor(USB_DESCR_TYP_HID) not implemented\r\n");
+        LOG_WARN("getDescriptor(USB_DESCR_TYP_HID) not implemented\r\n");
         /* Not supported yet, it should already be sent with the configuration
          * descriptor */
         // *pBuffer = (uint8_t *)&stHidDescriptor;
         // *pSizeBuffer = stHidDescriptor.bLength;
-        break;
+        return 1;
     case USB_DESCR_TYP_REPORT:
+        if (g_descriptorHidReport == NULL) {
+            return 1;
+        }
         // WARNING! To get the size we reconstruct the uint16_t from the
         // configuration descriptor
         *pBuffer = g_descriptorHidReport;
         *pSizeBuffer = (g_descriptorConfig[26] << 8) + g_descriptorConfig[25];
         break;
     default:
-        log_to_evaluator("ERROR: fill_buffer_with_descriptor() invalid descriptor requested");
-        break;
+        LOG_ERROR("fill_buffer_with_descriptor() invalid descriptor requested");
+        return 1;
     }
+
+    return 0;
 }
 
 /* @fn      usb20_ep0_transceive_and_update
@@ -503,10 +891,11 @@ usb20_fill_buffer_with_descriptor(UINT16_UINT8 descritorRequested, uint8_t **pBu
  *
  * @return  None
  */
-void
+HIGHCODE void
 usb20_ep0_transceive_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *pSizeBuffer)
 {
     uint16_t bytesToWriteForCurrentTransaction = 0;
+    bool isString = *pBuffer == endp0RTbuff && _stringText != NULL;
 
     switch (uisToken) {
     case UIS_TOKEN_OUT:
@@ -517,11 +906,18 @@ usb20_ep0_transceive_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *p
         break;
     case UIS_TOKEN_IN:
         bytesToWriteForCurrentTransaction = *pSizeBuffer;
-        if (bytesToWriteForCurrentTransaction >= U20_UEP0_MAXSIZE) {
-            bytesToWriteForCurrentTransaction = U20_UEP0_MAXSIZE;
+        if (bytesToWriteForCurrentTransaction >= g_usb20Ep0MaxSize) {
+            bytesToWriteForCurrentTransaction = g_usb20Ep0MaxSize;
         }
 
-        if (*pBuffer && bytesToWriteForCurrentTransaction > 0) {
+        if (isString) {
+            // A string descriptor, see usb20_fill_buffer_with_descriptor()
+            struct Usb20StringPart_t part = {
+                endp0RTbuff, _stringOffset, _stringOffset + bytesToWriteForCurrentTransaction
+            };
+            _usb20_string_expand(_stringText, &part);
+            _stringOffset += bytesToWriteForCurrentTransaction;
+        } else if (*pBuffer && bytesToWriteForCurrentTransaction > 0) {
             memcpy(endp0RTbuff, *pBuffer, bytesToWriteForCurrentTransaction);
         }
         break;
@@ -529,7 +925,7 @@ usb20_ep0_transceive_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *p
         /* Not implemented */
         break;
     default:
-        log_to_evaluator("ERROR: ep0_transceive_and_update() invalid uisToken");
+        LOG_ERROR("ep0_transceive_and_update() invalid uisToken");
         break;
     }
 
@@ -537,6 +933,7 @@ usb20_ep0_transceive_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *p
 
     if (bytesToWriteForCurrentTransaction == 0) {    /* If it was the last transaction */
         *pBuffer = NULL;
+        _stringText = NULL;
 
         R16_UEP0_T_LEN = 0;
         R8_UEP0_TX_CTRL ^= RB_UEP_T_TOG_1;
@@ -544,7 +941,11 @@ usb20_ep0_transceive_and_update(uint8_t uisToken, uint8_t **pBuffer, uint16_t *p
         R8_UEP0_RX_CTRL ^= RB_UEP_R_TOG_1;
         R8_UEP0_RX_CTRL = (R8_UEP0_RX_CTRL & ~RB_UEP_RRES_MASK) | UEP_R_RES_ACK;
     } else {
-        *pBuffer += bytesToWriteForCurrentTransaction;
+        // The string descriptors are always expanded at the start of
+        // endp0RTbuff
+        if (!isString) {
+            *pBuffer += bytesToWriteForCurrentTransaction;
+        }
 
         R16_UEP0_T_LEN = bytesToWriteForCurrentTransaction;
         R8_UEP0_TX_CTRL ^= RB_UEP_T_TOG_1;
@@ -562,47 +963,11 @@ void
 usb20_log(enum Endpoint endp, const char *fmt, ...)
 {
     va_list ap;
-
-    uint8_t *loggingbuff = NULL;
-    uint16_t *pSizeLoggingBuff = NULL;
-    uint16_t capLoggingBuff = 0;
-
-    uint16_t sizeLeft;
-    int bytesWritten;
-
-    switch (endp) {
-    case Ep6Mask:
-        loggingbuff = endp6LoggingBuff;
-        pSizeLoggingBuff = &sizeEndp6LoggingBuff;
-        capLoggingBuff = capacityEndp6LoggingBuff;
-        break;
-    case Ep7Mask:
-        loggingbuff = endp7LoggingBuff;
-        pSizeLoggingBuff = &sizeEndp7LoggingBuff;
-        capLoggingBuff = capacityEndp7LoggingBuff;
-        break;
-    default:
-        log_to_evaluator("ERROR: usb20_log() cannot log on given endpoint (%x)\r\n", endp);
-        return;
-    }
-
-    // Critical section, if we print something (outside of an interrrupt) and an
-    // interrupt is called and do a print, then the first print is partially
-    // overwritten
-    bsp_disable_interrupt();
     va_start(ap, fmt);
-    sizeLeft = capLoggingBuff - *pSizeLoggingBuff;
-    
-    if (*pSizeLoggingBuff >= capLoggingBuff) {
-        log_to_evaluator("ERROR: usb20_log() buffer already filled!");
-        sizeLeft = 0;
-    }
-    
-    bytesWritten = vsnprintf(loggingbuff + *pSizeLoggingBuff, sizeLeft, fmt, ap);
-    *pSizeLoggingBuff += bytesWritten;
+    usb20_vlog(endp, fmt, ap);
     va_end(ap);
-    bsp_enable_interrupt();
 }
+
 /* @fn      usb20_vlog
  *
  * @brief   Function used to log data to the Host computer over USB, takes a
@@ -613,43 +978,39 @@ usb20_log(enum Endpoint endp, const char *fmt, ...)
 void
 usb20_vlog(enum Endpoint endp, const char *fmt, va_list ap)
 {
-    uint8_t *loggingbuff = NULL;
-    uint16_t *pSizeLoggingBuff = NULL;
-    uint16_t capLoggingBuff = 0;
+    // Not formatted on the stack of the interrupts
+    char *line = _logLines[irq_nesting_get()];
+    int len;
+
+    len = vsnprintf(line, USB20_LOG_LINE_CAPACITY, fmt, ap);
+    if (len <= 0) {
+        return;
+    }
+    if (len > USB20_LOG_LINE_CAPACITY - 1) {
+        len = USB20_LOG_LINE_CAPACITY - 1;
+    }
 
-    uint16_t sizeLeft;
-    int bytesWritten;
+    usb20_log_append(endp, (const uint8_t *)line, len);
+}
 
+/* @fn      usb20_log_append
+ *
+ * @brief   Append raw data to the logging ring of an endpoint, lock-free, see
+ *          log_ring_write()
+ *
+ * @return  The number of bytes appended, 0 if the data was dropped
+ */
+HIGHCODE uint16_t
+usb20_log_append(enum Endpoint endp, const uint8_t *data, uint16_t len)
+{
     switch (endp) {
     case Ep6Mask:
-        loggingbuff = endp6LoggingBuff;
-        pSizeLoggingBuff = &sizeEndp6LoggingBuff;
-        capLoggingBuff = capacityEndp6LoggingBuff;
-        break;
+        return log_ring_write(&endp6LoggingRing, data, len);
     case Ep7Mask:
-        loggingbuff = endp7LoggingBuff;
-        pSizeLoggingBuff = &sizeEndp7LoggingBuff;
-        capLoggingBuff = capacityEndp7LoggingBuff;
-        break;
+        return log_ring_write(&endp7LoggingRing, data, len);
     default:
-        log_to_evaluator("ERROR: usb20_log() cannot log on given endpoint (%x)\r\n", endp);
-        return;
+        return 0;
     }
-
-    // Critical section, if we print something (outside of an interrrupt) and an
-    // interrupt is called and do a print, then the first print is partially
-    // overwritten
-    bsp_disable_interrupt();
-    sizeLeft = capLoggingBuff - *pSizeLoggingBuff;
-    
-    if (*pSizeLoggingBuff >= capLoggingBuff) {
-        log_to_evaluator("ERROR: usb20_log() buffer already filled!");
-        sizeLeft = 0;
-    }
-    
-    bytesWritten = vsnprintf(loggingbuff + *pSizeLoggingBuff, sizeLeft, fmt, ap);
-    *pSizeLoggingBuff += bytesWritten;
-    bsp_enable_interrupt();
 }
 
 // TODO: Add description
@@ -699,12 +1060,12 @@ usb20_descriptor_set(const uint8_t *newDescriptor)
 	case USB_DESCR_TYP_HUB:
         // Not supported yet
     default:
-        log_to_evaluator("ERROR: usb20_descriptor_set() bDescriptorType %x not supported", bDescriptorType);
+        LOG_ERROR("usb20_descriptor_set() bDescriptorType %x not supported", bDescriptorType);
         return;
     }
 
     memset(pTargetDescr, 0, targetSize);
-    log_to_evaluator("targetSize: %d, bLength: %d\r\n", targetSize, bLength);
+    LOG_TRACE("targetSize: %d, bLength: %d\r\n", targetSize, bLength);
     memcpy(pTargetDescr, newDescriptor, min(targetSize, bLength));
 }
 
@@ -15,7 +15,18 @@
 #define U20_UEP1_MAXSIZE  (512) // Change accordingly to USB mode (Here HS)
 #define U20_UEP6_MAXSIZE  (512) // Change accordingly to USB mode (Here HS)
 #define U20_UEP7_MAXSIZE  (512) // Change accordingly to USB mode (Here HS)
-#define UsbSetupBuf       ((PUSB_SETUP)endp0RTbuff)                                                 
+#define UsbSetupBuf       ((PUSB_SETUP)endp0RTbuff)
+#define USB20_LOG_LINE_CAPACITY (128) // A log is formatted in a line per nesting level before being appended                                                 
+#ifndef USB_DESCR_TYP_BOS
+#define USB_DESCR_TYP_BOS (0x0F)
+#endif
+/* Largest configuration descriptor usb20_descriptors_derive() builds the other
+ * speed configuration of */
+#define USB20_OTHER_SPEED_CAPACITY (512)
+/* String descriptors of a device, the index 0 (LANGID) is synthesised */
+#define USB20_STRINGS_CAPACITY (16)
+/* A string descriptor is at most 254 bytes, 126 UTF-16 code units */
+#define USB20_STRING_DESCRIPTOR_CAPACITY (254)
 
 /* enums */
 enum Speed { SpeedLow = UCST_LS, SpeedFull = UCST_FS, SpeedHigh = UCST_HS };
@@ -33,6 +44,8 @@ enum Endpoint {
 
 /* variables */
 extern enum Speed g_usb20Speed;
+/* bMaxPacketSize0 of the device, see usb20_descriptors_check() */
+extern uint16_t g_usb20Ep0MaxSize;
 extern enum Endpoint g_usb20EpInMask;
 extern enum Endpoint g_usb20EpOutMask;
 
@@ -42,7 +55,16 @@ extern uint8_t *g_descriptorDevice;
 extern uint8_t *g_descriptorConfig;
 extern uint8_t *g_descriptorHidReport;
 extern uint8_t *g_descriptorHubReport;
-extern uint8_t **g_descriptorStrings;
+/* UTF-8 texts, NUL-terminated, expanded to UTF-16LE on GET_DESCRIPTOR, see
+ * usb20_fill_buffer_with_descriptor(). An entry may be NULL, the index 0 is
+ * unused */
+extern const char **g_descriptorStrings;
+extern uint8_t g_descriptorStringsCount;
+// NULL if the device has none, GET_DESCRIPTOR is then stalled
+extern uint8_t *g_descriptorQualifier;
+extern uint8_t *g_descriptorOtherSpeed;
+extern uint16_t g_descriptorOtherSpeedSize;
+extern uint8_t *g_descriptorBos;
 
 extern uint8_t endp0RTbuff[]; // Endpoint 0 data transceiver buffer
 extern uint8_t endp1Rbuff[];  // Endpoint 1 data receiver buffer
@@ -119,15 +141,55 @@ void usb20_endpoint_nak(uint8_t endpointToNAK);
  *******************************************************************************/
 void usb20_endpoint_halt(uint8_t endpointToHalt);
 
+/*******************************************************************************
+ * Function Name  : usb20_descriptors_check
+ * Description    : Check the device and configuration descriptors against the
+ *                  limits of a speed: bMaxPacketSize0 (8 at low speed, 8 to 64
+ *                  at full speed, 64 at high speed) and the wMaxPacketSize of
+ *                  the endpoints (no bulk nor isochronous endpoint at low
+ *                  speed, no additional transaction below high speed...).
+ *                  Called by BbioConnect
+ * Input          : The speed of the device, see enum Speed
+ * Return         : 0 if the descriptors are valid, 1 else
+ *******************************************************************************/
+uint8_t usb20_descriptors_check(enum Speed speed);
+
+/*******************************************************************************
+ * Function Name  : usb20_descriptors_derive
+ * Description    : Build the descriptors the host did not upload from the
+ *                  device and configuration descriptors: the device qualifier
+ *                  and the other speed configuration of a USB 2.0 device that
+ *                  is not low speed, the BOS (USB 2.0 extension without LPM)
+ *                  of a USB 2.01 device. Called by BbioConnect
+ * Input          : The speed of the device, see enum Speed
+ * Return         : None
+ *******************************************************************************/
+void usb20_descriptors_derive(enum Speed speed);
+
+/*******************************************************************************
+ * Function Name  : usb20_serial_next
+ * Description    : Take the next serial number of the string placeholders, the
+ *                  strings then read differently at each connection. Called
+ *                  by BbioConnect
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void usb20_serial_next(void);
+
 /*******************************************************************************
  * Function Name  : usb20_fill_buffer_with_descriptor
- * Description    : Fill the given buffer with the requested descriptor
+ * Description    : Fill the given buffer with the requested descriptor. The
+ *                  texts of the string descriptors are expanded to UTF-16LE,
+ *                  with their placeholders: "%n" the serial number in decimal
+ *                  (8 digits), "%x" in hexadecimal (8 digits), "%%" a '%'. The
+ *                  buffer of a string is endp0RTbuff, it is expanded there by
+ *                  usb20_ep0_transceive_and_update() packet after packet
  * Input          : - descritorRequested is the wValue field of the Setup Packet
  *                  - pBuffer and pSizeBuffer are the buffer to populate and the
  *                    size we wrote
- * Return         : None
+ * Return         : 0 if Success, 1 if the device has no such descriptor
  *******************************************************************************/
-void usb20_fill_buffer_with_descriptor(UINT16_UINT8 descritorRequested, uint8_t **pBuffer, uint16_t *pSizeBuffer);
+uint8_t usb20_fill_buffer_with_descriptor(UINT16_UINT8 descritorRequested, uint8_t **pBuffer, uint16_t *pSizeBuffer);
 
 /*******************************************************************************
  * Function Name  : usb20_ep0_transceive_and_update
@@ -159,6 +221,17 @@ void usb20_log(enum Endpoint endp, const char *fmt, ...);
  *******************************************************************************/
 void usb20_vlog(enum Endpoint endp, const char *fmt, va_list ap);
 
+/*******************************************************************************
+ * Function Name  : usb20_log_append
+ * Description    : Append raw data to the logging ring of an endpoint,
+ *                  lock-free : it can be called from any priority level
+ * Input          : - endp: The endpoint to log to (Ep6Mask or Ep7Mask)
+ *                  - data and len: The data to append
+ * Return         : The number of bytes appended, 0 if the data was dropped
+ *                  (counted and reported in the stream, see log_ring_write())
+ *******************************************************************************/
+uint16_t usb20_log_append(enum Endpoint endp, const uint8_t *data, uint16_t len);
+
 
 
 #endif /* USB20_H */
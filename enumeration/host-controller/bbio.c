@@ -1,15 +1,121 @@
 #include <libusb-1.0/libusb.h>
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
 #include <ctype.h>
 
+#include "metrics.h"
+#include "trace.h"
 #include "usb.h"
 
 #include "bbio.h"
 
+
+/* internal variables */
+/* Names of enum BbioCommand, for the trace */
+static const char *_commandNames[] = {
+    [0]                 = "BBIO",
+    [BbioMainMode]      = "BbioMainMode",
+    [BbioIdentifMode]   = "BbioIdentifMode",
+    [BbioSetDescr]      = "BbioSetDescr",
+    [BbioSetEndp]       = "BbioSetEndp",
+    [BbioConnect]       = "BbioConnect",
+    [BbioGetStatus]     = "BbioGetStatus",
+    [BbioDisconnect]    = "BbioDisconnect",
+    [BbioResetDescr]    = "BbioResetDescr",
+    [BbioGetLinkHealth] = "BbioGetLinkHealth",
+    [BbioLinkRetrain]   = "BbioLinkRetrain",
+    [BbioSetLogMask]    = "BbioSetLogMask",
+    [BbioGetTrace]      = "BbioGetTrace",
+    [BbioGetIrqStats]   = "BbioGetIrqStats",
+    [BbioSetProfile]    = "BbioSetProfile",
+    [BbioGetStack]      = "BbioGetStack",
+    [BbioGetProgress]   = "BbioGetProgress",
+    [BbioGetBusIdle]    = "BbioGetBusIdle",
+    [BbioSetCriterion]  = "BbioSetCriterion",
+    [BbioSetCapture]    = "BbioSetCapture",
+    [BbioGetRequests]   = "BbioGetRequests",
+};
+static enum BbioCommand _command = 0;   // The command in progress, for the trace
+static bool _isFailed = false;          // Its return code was an error, for the metrics
+
 /* functions implementation */
 
+/*******************************************************************************
+ * @fn      bbio_command_begin
+ *
+ * @brief   Note the command in progress, a command sent again after its
+ *          return code was an error is counted as a retry
+ *
+ * @return  None
+ */
+static void
+bbio_command_begin(enum BbioCommand bbioCommand)
+{
+    metrics_add(MetricBbioCommands, 1);
+    if (_isFailed && bbioCommand == _command) {
+        metrics_add(MetricBbioRetries, 1);
+    }
+
+    _command = bbioCommand;
+    _isFailed = false;
+}
+
+/*******************************************************************************
+ * @fn      bbio_command_name
+ *
+ * @brief   Name of the command in progress, for the trace and the errors
+ *
+ * @return  The name, "BBIO" if the command is unknown
+ */
+static const char *
+bbio_command_name(void)
+{
+    if ((unsigned int)_command < sizeof(_commandNames) / sizeof(*_commandNames) && _commandNames[_command]) {
+        return _commandNames[_command];
+    }
+    return _commandNames[0];
+}
+
+/*******************************************************************************
+ * @fn      bbio_bulk_transfer
+ *
+ * @brief   Bulk transfer on EP1 without timeout, counted in the metrics and
+ *          recorded in the trace with the command in progress
+ *
+ * @return  The return code of libusb_bulk_transfer()
+ */
+int
+bbio_bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred)
+{
+    int retCode;
+    int sizeTransferred = 0;
+    double submitUs = 0.0;
+
+    if (trace_is_enabled()) {
+        submitUs = trace_now_us();
+    }
+    retCode = libusb_bulk_transfer(g_deviceHandle, endpoint, data, length, &sizeTransferred, 0);
+
+    metrics_add(MetricTransfers, 1);
+    metrics_add(MetricTransferBytes, sizeTransferred);
+    if (retCode) {
+        metrics_add(retCode == LIBUSB_ERROR_TIMEOUT ? MetricTransferTimeouts : MetricTransferErrors, 1);
+    }
+
+    if (trace_is_enabled()) {
+        trace_transfer_add(bbio_command_name(), endpoint, length, sizeTransferred, retCode, submitUs, trace_now_us());
+    }
+
+    if (transferred) {
+        *transferred = sizeTransferred;
+    }
+    return retCode;
+}
+
 /*******************************************************************************
  * @fn      bbio_command_send
  *
@@ -24,8 +130,9 @@ bbio_command_send(enum BbioCommand bbioCommand)
     unsigned char bbioBuffer[1];
 
     bbioBuffer[0] = bbioCommand;
+    bbio_command_begin(bbioCommand);
 
-    retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, bbioBuffer, 1, NULL, 0);
+    retCode = bbio_bulk_transfer(EP1OUT, bbioBuffer, 1, NULL);
     if (retCode) {
         printf("[ERROR]\t bbio_command_send(): bulk transfer failed");
     }
@@ -50,12 +157,13 @@ bbio_command_sub_send(enum BbioCommand bbioCommand, enum BbioSubCommand bbioSubC
     unsigned char bbioBuffer[5];
 
     bbioBuffer[0] = bbioCommand;
+    bbio_command_begin(bbioCommand);
     bbioBuffer[1] = bbioSubCommand;
     bbioBuffer[2] = indexDescriptor;
     bbioBuffer[3] = sizeDescriptor % 256;   // Lower byte
     bbioBuffer[4] = sizeDescriptor / 256;   // Higher Byte
 
-    retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, bbioBuffer, 5, NULL, 0);
+    retCode = bbio_bulk_transfer(EP1OUT, bbioBuffer, 5, NULL);
     if (retCode) {
         printf("[ERROR]\t bbio_command_sub_send(): bulk transfer failed");
     }
@@ -78,12 +186,206 @@ bbio_get_return_code(void)
     int retCode;
     unsigned char bbioRetCode;
 
-    retCode = libusb_bulk_transfer(g_deviceHandle, EP1IN, &bbioRetCode, 1, NULL, 0);
+    retCode = bbio_bulk_transfer(EP1IN, &bbioRetCode, 1, NULL);
     if (retCode) {
         printf("[ERROR]\t bbio_command_sub_send(): bulk transfer failed");
     }
 
+    // The status of BbioGetStatus and BbioGetBusIdle is not an error
+    if (bbioRetCode && _command != BbioGetStatus && _command != BbioGetBusIdle) {
+        metrics_add(MetricBbioErrors, 1);
+        _isFailed = true;
+    }
+
     return bbioRetCode;
 }
 
+/*******************************************************************************
+ * @fn      bbio_payload_send
+ *
+ * @brief   Complete the command just sent: get its return code, send its
+ *          payload, or the dummy packet if payload is NULL, and get the return
+ *          code of its handling. The payload is sent even if the command
+ *          failed, the bottom board expects it
+ *
+ * @return  The return code of the handling, -1 if the command or a transfer
+ *          failed
+ */
+int
+bbio_payload_send(unsigned char *payload, int sizePayload)
+{
+    unsigned char dummyPacket[] = "toto";
+    unsigned char bbioRetCode;
+    unsigned char handleRetCode;
+    int retCode;
+
+    bbioRetCode = bbio_get_return_code();
+    if (payload == NULL) {
+        payload = dummyPacket;
+        sizePayload = sizeof(dummyPacket);
+    }
+    retCode = bbio_bulk_transfer(EP1OUT, payload, sizePayload, NULL);
+    if (retCode) {
+        printf("[ERROR]\t %s: bulk transfer failed\n", bbio_command_name());
+    }
+    handleRetCode = bbio_get_return_code();
+
+    if (bbioRetCode || retCode) {
+        return -1;
+    }
+    return handleRetCode;
+}
+
+
+
+/*******************************************************************************
+ * @fn      bbio_get_reply
+ *
+ * @brief   Query the ToE board for the reply of the previous request
+ *
+ * @return  The size of the reply, -1 if the transfer failed
+ */
+int
+bbio_get_reply(unsigned char *reply, int capReply)
+{
+    int retCode;
+    int transferred = 0;
+
+    assert(capReply >= USB20_EP1_MAX_SIZE && "bbio_get_reply(): buffer smaller than a packet\n");
+
+    retCode = bbio_bulk_transfer(EP1IN, reply, capReply, &transferred);
+    if (retCode) {
+        printf("[ERROR]\t bbio_get_reply(): bulk transfer failed");
+        return -1;
+    }
+
+    return transferred;
+}
+
+/*******************************************************************************
+ * @fn      bbio_dummy_reply
+ *
+ * @brief   Send the dummy packet of a command without payload and get its
+ *          reply, once the return code of the command packet is received
+ *
+ * @return  The size of the reply, -1 if the transfer failed
+ */
+int
+bbio_dummy_reply(unsigned char *reply, int capReply)
+{
+    int retCode;
+    char dummyPacket[] = "toto";
+    int dummyPacketSize = sizeof(dummyPacket);
+
+    retCode = bbio_bulk_transfer(EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL);
+    if (retCode) {
+        printf("[ERROR]\t %s: bulk transfer failed\n", bbio_command_name());
+        return -1;
+    }
+
+    return bbio_get_reply(reply, capReply);
+}
+
+/*******************************************************************************
+ * @fn      bbio_command_reply
+ *
+ * @brief   Send a BBIO command without payload and get its reply
+ *
+ * @return  The size of the reply, -1 if the command failed
+ */
+int
+bbio_command_reply(enum BbioCommand bbioCommand, unsigned char *reply, int capReply)
+{
+    unsigned char bbioRetCode;
+    int sizeReply;
+
+    bbio_command_send(bbioCommand);
+    bbioRetCode = bbio_get_return_code();
+    // The bottom board expects the dummy packet even if the command failed
+    sizeReply = bbio_dummy_reply(reply, capReply);
+
+    return bbioRetCode ? -1 : sizeReply;
+}
 
+/*******************************************************************************
+ * @fn      bbio_command_value_send
+ *
+ * @brief   Send the given BBIO command with a 32 bits value (little endian)
+ *
+ * @return  None
+ */
+void
+bbio_command_value_send(enum BbioCommand bbioCommand, uint32_t value)
+{
+    int retCode;
+    unsigned char bbioBuffer[5];
+
+    bbioBuffer[0] = bbioCommand;
+    bbio_command_begin(bbioCommand);
+    bbioBuffer[1] = value & 0xFF;
+    bbioBuffer[2] = (value >> 8) & 0xFF;
+    bbioBuffer[3] = (value >> 16) & 0xFF;
+    bbioBuffer[4] = (value >> 24) & 0xFF;
+
+    retCode = bbio_bulk_transfer(EP1OUT, bbioBuffer, 5, NULL);
+    if (retCode) {
+        printf("[ERROR]\t bbio_command_value_send(): bulk transfer failed");
+    }
+}
+
+/*******************************************************************************
+ * @fn      bbio_command_value_reply
+ *
+ * @brief   Send a BBIO command with a 32 bits value and get its reply
+ *
+ * @return  The size of the reply, -1 if the command failed
+ */
+int
+bbio_command_value_reply(enum BbioCommand bbioCommand, uint32_t value, unsigned char *reply, int capReply)
+{
+    unsigned char bbioRetCode;
+    int sizeReply;
+
+    bbio_command_value_send(bbioCommand, value);
+    bbioRetCode = bbio_get_return_code();
+    // The bottom board expects the dummy packet even if the command failed
+    sizeReply = bbio_dummy_reply(reply, capReply);
+
+    return bbioRetCode ? -1 : sizeReply;
+}
+
+/*******************************************************************************
+ * @fn      bbio_bus_idle_wait
+ *
+ * @brief   Poll BbioGetBusIdle until the bus settled or timeoutUs elapsed
+ *
+ * @return  true if the bus settled, false if the wait timed out
+ */
+bool
+bbio_bus_idle_wait(uint32_t windowUs, uint32_t timeoutUs)
+{
+    int isIdle;
+    struct timespec start;
+    struct timespec now;
+    uint64_t elapsedUs = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (elapsedUs < timeoutUs) {
+        bbio_command_value_send(BbioGetBusIdle, windowUs);
+        isIdle = bbio_payload_send(NULL, 0);
+        if (isIdle < 0) {
+            // Unknown command, fall back to the whole wait
+            usleep(timeoutUs - elapsedUs);
+            return false;
+        }
+        if (isIdle == 1) {
+            return true;
+        }
+
+        usleep(BBIO_BUS_IDLE_POLL_US);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsedUs = (now.tv_sec - start.tv_sec) * 1000000ull + (now.tv_nsec - start.tv_nsec) / 1000;
+    }
+
+    return false;
+}
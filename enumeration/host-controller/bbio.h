@@ -1,6 +1,19 @@
 #ifndef BBIO_H
 #define BBIO_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* macros */
+/* Period of the polling of BbioGetBusIdle, see bbio_bus_idle_wait() */
+#define BBIO_BUS_IDLE_POLL_US   (1000)
+/* Second return code of BbioConnect when the descriptors are not valid at the
+ * speed requested, must match firmware/src/bbio.h */
+#define BBIO_CONNECT_INVALID    (2)
+/* Second return code of BbioSubSetDescrResponder when the rule is rejected,
+ * must match firmware/src/bbio.h */
+#define BBIO_RESPONDER_REJECTED (4)
 
 /* enums */
 enum BbioCommand {
@@ -12,6 +25,26 @@ enum BbioCommand {
     BbioGetStatus     = 0x06, // 0b00000110
     BbioDisconnect    = 0x07, // 0b00000111
     BbioResetDescr    = 0x08, // 0b00001000
+    BbioGetLinkHealth = 0x09, // 0b00001001
+    BbioLinkRetrain   = 0x0A, // 0b00001010
+    BbioSetLogMask    = 0x0B, // 0b00001011
+    BbioGetTrace      = 0x0C, // 0b00001100
+    BbioGetIrqStats   = 0x0D, // 0b00001101
+    BbioSetProfile    = 0x0E, // 0b00001110
+    BbioGetStack      = 0x0F, // 0b00001111
+    BbioGetProgress   = 0x10, // 0b00010000
+    BbioGetBusIdle    = 0x11, // 0b00010001
+    BbioSetCriterion  = 0x12, // 0b00010010
+    BbioSetCapture    = 0x13, // 0b00010011
+    BbioGetRequests   = 0x14, // 0b00010100
+};
+
+/* Speed of BbioConnect */
+enum BbioSpeed {
+    BbioSpeedHigh = 0,
+    BbioSpeedFull = 1,
+    BbioSpeedLow  = 2,
+    BbioSpeedCount,
 };
 
 enum BbioSubCommand {
@@ -22,6 +55,10 @@ enum BbioSubCommand {
     BbioSubSetDescrHubReport   = 0x05, // 0b00000101
     BbioSubSetDescrEndpoint    = 0x06, // 0b00000110
     BbioSubSetDescrString      = 0x07, // 0b00000111
+    BbioSubSetDescrResponder   = 0x08, // 0b00001000
+    BbioSubSetDescrQualifier   = 0x09, // 0b00001001
+    BbioSubSetDescrOtherSpeed  = 0x0A, // 0b00001010
+    BbioSubSetDescrBos         = 0x0B, // 0b00001011
 };
 
 /* variables */
@@ -29,6 +66,16 @@ enum BbioSubCommand {
 
 /* functions declaration */
 
+/*******************************************************************************
+ * Function Name  : bbio_bulk_transfer
+ * Description    : Bulk transfer on EP1 without timeout, every transfer of the
+ *                  BBIO commands must go through it to be traced, see trace.h
+ * Input          : - endpoint: EP1OUT or EP1IN
+ *                  - data, length, transferred: See libusb_bulk_transfer()
+ * Return         : The return code of libusb_bulk_transfer()
+ *******************************************************************************/
+int bbio_bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred);
+
 /*******************************************************************************
  * Function Name  : bbio_command_send
  * Description    : Send the given BBIO command to the ToE board
@@ -61,11 +108,86 @@ void bbio_command_sub_send(enum BbioCommand bbioCommand, enum BbioSubCommand bbi
  * Return         : Depending on the previous request :
  *                  - BbioGetStatus: 1 if device is support by ToE USB's stack,
  *                    0 else
+ *                  - BbioGetBusIdle: 1 if the bus settled, 0 else
  *                  - Everything else: The return code from the associated
  *                    function in firmware/src/bbio.c
  *******************************************************************************/
 unsigned char bbio_get_return_code(void);
 
+/*******************************************************************************
+ * Function Name  : bbio_payload_send
+ * Description    : Complete the command just sent: get its return code, send
+ *                  its payload and get the return code of its handling
+ * Input          : - payload: The payload of the command, NULL to send the
+ *                    dummy packet of a command without payload
+ *                  - sizePayload: The size of the payload
+ * Return         : The return code of the handling (see bbio_get_return_code),
+ *                  -1 if the command or a transfer failed
+ *******************************************************************************/
+int bbio_payload_send(unsigned char *payload, int sizePayload);
 
-#endif /* BBIO_H */
+/*******************************************************************************
+ * Function Name  : bbio_get_reply
+ * Description    : Query the ToE board for the reply of the previous request,
+ *                  used by the commands returning more than a return code
+ * Input          : - reply: The buffer to fill, reply[0] is the return code
+ *                  - capReply: The capacity of the buffer, at least
+ *                    USB20_EP1_MAX_SIZE
+ * Return         : The size of the reply, -1 if the transfer failed
+ *******************************************************************************/
+int bbio_get_reply(unsigned char *reply, int capReply);
+
+/*******************************************************************************
+ * Function Name  : bbio_dummy_reply
+ * Description    : Send the dummy packet of a command without payload and get
+ *                  its reply, once the return code of the command packet is
+ *                  received
+ * Input          : - reply and capReply: See bbio_get_reply()
+ * Return         : The size of the reply, -1 if the transfer failed
+ *******************************************************************************/
+int bbio_dummy_reply(unsigned char *reply, int capReply);
 
+/*******************************************************************************
+ * Function Name  : bbio_command_reply
+ * Description    : Send a BBIO command without payload and get its reply
+ * Input          : - bbioCommand: The BBIO command to send
+ *                  - reply and capReply: See bbio_get_reply()
+ * Return         : The size of the reply, -1 if the command failed
+ *******************************************************************************/
+int bbio_command_reply(enum BbioCommand bbioCommand, unsigned char *reply, int capReply);
+
+/*******************************************************************************
+ * Function Name  : bbio_command_value_send
+ * Description    : Send the given BBIO command with a 32 bits value, stored
+ *                  little endian in place of the sub command, index and size
+ * Input          : - bbioCommand: The BBIO command to send
+ *                  - value: The value of the command (e.g. the log mask)
+ * Return         : None
+ *******************************************************************************/
+void bbio_command_value_send(enum BbioCommand bbioCommand, uint32_t value);
+
+/*******************************************************************************
+ * Function Name  : bbio_command_value_reply
+ * Description    : Send a BBIO command with a 32 bits value and get its reply
+ * Input          : - bbioCommand: The BBIO command to send
+ *                  - value: See bbio_command_value_send()
+ *                  - reply and capReply: See bbio_get_reply()
+ * Return         : The size of the reply, -1 if the command failed
+ *******************************************************************************/
+int bbio_command_value_reply(enum BbioCommand bbioCommand, uint32_t value, unsigned char *reply, int capReply);
+
+/*******************************************************************************
+ * Function Name  : bbio_bus_idle_wait
+ * Description    : Wait until the ToE board reports the bus settled once the
+ *                  device is disconnected (BbioGetBusIdle): the ToE is ready
+ *                  for the next device
+ * Input          : - windowUs: The settle time, counted by the ToE board from
+ *                    the disconnection
+ *                  - timeoutUs: The longest wait, all of it is waited if the
+ *                    firmware does not know BbioGetBusIdle
+ * Return         : true if the bus settled, false if the wait timed out
+ *******************************************************************************/
+bool bbio_bus_idle_wait(uint32_t windowUs, uint32_t timeoutUs);
+
+
+#endif /* BBIO_H */
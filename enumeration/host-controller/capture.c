@@ -0,0 +1,364 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bbio.h"
+#include "usb.h"
+
+#include "capture.h"
+
+
+/* macros */
+/* pcap, see https://www.tcpdump.org/linktypes.html */
+#define CAPTURE_PCAP_MAGIC      (0xa1b2c3d4)
+#define CAPTURE_PCAP_SNAPLEN    (65535)
+#define CAPTURE_LINKTYPE        (220)   // LINKTYPE_USB_LINUX_MMAPPED
+
+/* usbmon, see Documentation/usb/usbmon.rst of Linux */
+#define CAPTURE_XFER_CONTROL    (2)
+#define CAPTURE_XFER_BULK       (3)
+
+/* structs */
+struct CapturePcapHeader_t {
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    int32_t thisZone;
+    uint32_t sigFigs;
+    uint32_t snapLen;
+    uint32_t linkType;
+};
+
+struct CapturePcapRecord_t {
+    uint32_t tsSec;
+    uint32_t tsUsec;
+    uint32_t inclLen;
+    uint32_t origLen;
+};
+
+/* struct usbmon_packet, 64 bytes in the byte order of the host */
+struct CaptureUsbmon_t {
+    uint64_t id;
+    uint8_t type;           // 'S'ubmission, 'C'allback
+    uint8_t xferType;
+    uint8_t epnum;          // 0x80 for IN
+    uint8_t devnum;
+    uint16_t busnum;
+    char flagSetup;         // 0 if setup is valid
+    char flagData;          // 0 if data follows, the captures carry none
+    int64_t tsSec;
+    int32_t tsUsec;
+    int32_t status;
+    uint32_t length;
+    uint32_t lenCap;
+    uint8_t setup[8];
+    int32_t interval;
+    int32_t startFrame;
+    uint32_t xferFlags;
+    uint32_t ndesc;
+};
+
+
+/* variables */
+/* The records arrive in the log reader thread, everything below is protected
+ * by _lock */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *_file = NULL;
+static uint64_t _packets = 0;
+static uint64_t _controlId = 0;     // Id of the SETUP packet, for its transactions
+static uint8_t _devnum = 0;
+static int _pendingAddress = -1;    // Applied once SET_ADDRESS completes
+// The firmware ticks wrap around, they are extended to 64 bits and anchored
+// to the time of reception of the first record
+static bool _isAnchored = false;
+static uint32_t _lastTicks = 0;
+static uint64_t _wrappedTicks = 0;
+static uint64_t _anchorTicks = 0;
+static uint64_t _anchorUs = 0;
+
+static bool _running = false;
+
+
+/* functions implementation */
+
+/*******************************************************************************
+ * @fn      capture_file_path
+ *
+ * @brief   Get the path of the capture
+ *
+ * @return  CAPTURE_FILE_ENV if set, else CAPTURE_FILE
+ */
+const char *
+capture_file_path(void)
+{
+    const char *path = getenv(CAPTURE_FILE_ENV);
+
+    if (path == NULL || path[0] == '\0') {
+        path = CAPTURE_FILE;
+    }
+    return path;
+}
+
+/*******************************************************************************
+ * @fn      capture_is_running
+ *
+ * @brief   Check if the transactions of the ToE are captured
+ *
+ * @return  true if running, else false
+ */
+bool
+capture_is_running(void)
+{
+    return _running;
+}
+
+/*******************************************************************************
+ * @fn      capture_enable
+ *
+ * @brief   Start or stop the capture on the bottom board
+ *
+ * @return  0 if success, else a non zero value
+ */
+static int
+capture_enable(bool isEnabled)
+{
+    char dummyPacket[] = "toto";
+    int dummyPacketSize = sizeof(dummyPacket);
+    unsigned char bbioRetCode;
+    int retCode;
+
+    bbio_command_value_send(BbioSetCapture, isEnabled);
+    bbioRetCode = bbio_get_return_code();
+    // The bottom board expects the dummy packet even if the command failed
+    retCode = bbio_bulk_transfer(EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL);
+    if (retCode) {
+        printf("[ERROR]\t capture_enable(): bulk transfer failed\n");
+        return 2;
+    }
+    bbioRetCode |= bbio_get_return_code();
+    if (bbioRetCode) {
+        printf("[ERROR]\t capture_enable(): command failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      capture_start
+ *
+ * @brief   Create the capture file and start the capture
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+capture_start(const char *path)
+{
+    struct CapturePcapHeader_t header = {
+        .magic = CAPTURE_PCAP_MAGIC,
+        .versionMajor = 2,
+        .versionMinor = 4,
+        .snapLen = CAPTURE_PCAP_SNAPLEN,
+        .linkType = CAPTURE_LINKTYPE,
+    };
+    FILE *file;
+
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("[ERROR]\t capture_start(): could not create %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+
+    pthread_mutex_lock(&_lock);
+    _file = file;
+    _packets = 0;
+    _controlId = 0;
+    _devnum = 0;
+    _pendingAddress = -1;
+    _isAnchored = false;
+    pthread_mutex_unlock(&_lock);
+
+    if (capture_enable(true)) {
+        pthread_mutex_lock(&_lock);
+        _file = NULL;
+        pthread_mutex_unlock(&_lock);
+        fclose(file);
+        return 2;
+    }
+
+    _running = true;
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      capture_stop
+ *
+ * @brief   Stop the capture and close the file
+ *
+ * @return  None
+ */
+void
+capture_stop(void)
+{
+    FILE *file;
+    uint64_t packets;
+
+    if (!_running) {
+        return;
+    }
+    _running = false;
+
+    capture_enable(false);
+    usleep(CAPTURE_DRAIN_US);
+
+    pthread_mutex_lock(&_lock);
+    file = _file;
+    packets = _packets;
+    _file = NULL;
+    pthread_mutex_unlock(&_lock);
+
+    fclose(file);
+    printf("Capture stopped, %llu packets written\n", (unsigned long long)packets);
+}
+
+/*******************************************************************************
+ * @fn      capture_time_us
+ *
+ * @brief   Convert a firmware timestamp to the time of day, the records are in
+ *          order and less than a wrap around (~35 s) apart. Called with _lock
+ *          held
+ *
+ * @return  The time in us since the Epoch
+ */
+static uint64_t
+capture_time_us(uint32_t ticks)
+{
+    struct timespec now;
+
+    if (!_isAnchored) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        _anchorUs = now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+        _anchorTicks = ticks;
+        _wrappedTicks = ticks;
+        _lastTicks = ticks;
+        _isAnchored = true;
+    }
+
+    _wrappedTicks += (uint32_t)(ticks - _lastTicks);
+    _lastTicks = ticks;
+
+    return _anchorUs + (_wrappedTicks - _anchorTicks) / LOG_TICKS_PER_US;
+}
+
+/*******************************************************************************
+ * @fn      capture_packet_write
+ *
+ * @brief   Write a usbmon packet, without data. Called with _lock held
+ *
+ * @return  None
+ */
+static void
+capture_packet_write(struct CaptureUsbmon_t *packet, uint32_t ticks)
+{
+    struct CapturePcapRecord_t record;
+    uint64_t timeUs = capture_time_us(ticks);
+
+    packet->busnum = CAPTURE_BUS;
+    packet->devnum = _devnum;
+    packet->tsSec = timeUs / 1000000;
+    packet->tsUsec = timeUs % 1000000;
+
+    record.tsSec = packet->tsSec;
+    record.tsUsec = packet->tsUsec;
+    record.inclLen = sizeof(*packet);
+    record.origLen = sizeof(*packet);
+
+    fwrite(&record, sizeof(record), 1, _file);
+    fwrite(packet, sizeof(*packet), 1, _file);
+    ++_packets;
+}
+
+/*******************************************************************************
+ * @fn      capture_record_add
+ *
+ * @brief   Write a capture record of the bottom board: a SETUP packet is a
+ *          control submission, a transaction is a completion of the endpoint
+ *          with its length (the data is not captured)
+ *
+ * @return  None
+ */
+void
+capture_record_add(enum LogCapture record, uint32_t ticks, const uint32_t *args, int count)
+{
+    struct CaptureUsbmon_t packet;
+    uint8_t endpoint;
+    uint8_t response;
+
+    memset(&packet, 0, sizeof(packet));
+
+    pthread_mutex_lock(&_lock);
+    if (_file == NULL) {
+        pthread_mutex_unlock(&_lock);
+        return;
+    }
+
+    switch (record) {
+    case LogCaptureSetup:
+        if (count < 2) {
+            break;
+        }
+        memcpy(packet.setup, &args[0], 4);
+        memcpy(packet.setup + 4, &args[1], 4);
+        // A SET_ADDRESS applies once its status stage completes
+        if (packet.setup[0] == 0x00 && packet.setup[1] == 0x05) {
+            _pendingAddress = packet.setup[2] & 0x7F;
+        }
+
+        _controlId = _packets + 1;
+        packet.id = _controlId;
+        packet.type = 'S';
+        packet.xferType = CAPTURE_XFER_CONTROL;
+        packet.epnum = packet.setup[0] & 0x80;
+        packet.flagSetup = 0;
+        packet.flagData = (packet.setup[0] & 0x80) ? '<' : '>';
+        packet.status = -EINPROGRESS;
+        packet.length = packet.setup[6] | (packet.setup[7] << 8);
+        capture_packet_write(&packet, ticks);
+        break;
+    case LogCaptureTransaction:
+        if (count < 1) {
+            break;
+        }
+        endpoint = args[0] & CAPTURE_TRANSACTION_ENDPOINT_MASK;
+        response = (args[0] >> CAPTURE_TRANSACTION_RESPONSE_SHIFT) & 0xFF;
+
+        packet.id = endpoint == 0 ? _controlId : _packets + 1;
+        packet.type = 'C';
+        packet.xferType = endpoint == 0 ? CAPTURE_XFER_CONTROL : CAPTURE_XFER_BULK;
+        packet.epnum = endpoint | (args[0] & CAPTURE_TRANSACTION_IN);
+        packet.flagSetup = '-';
+        packet.flagData = (args[0] & CAPTURE_TRANSACTION_IN) ? '<' : '>';
+        packet.status = response == CaptureResponseStall ? -EPIPE : (response == CaptureResponseNak ? -EAGAIN : 0);
+        packet.length = args[0] >> CAPTURE_TRANSACTION_LENGTH_SHIFT;
+        capture_packet_write(&packet, ticks);
+
+        // The status stage of SET_ADDRESS is an empty IN transaction
+        if (endpoint == 0 && (args[0] & CAPTURE_TRANSACTION_IN) && _pendingAddress >= 0) {
+            _devnum = _pendingAddress;
+            _pendingAddress = -1;
+        }
+        break;
+    case LogCaptureReset:
+        _devnum = 0;
+        _pendingAddress = -1;
+        break;
+    default:
+        break;
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,90 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "log_decoder.h"
+
+
+/* macros */
+/* Default path of the capture, relative to host-controller/ */
+#define CAPTURE_FILE            "capture.pcap"
+/* Environment variable overriding CAPTURE_FILE, the capture starts with the
+ * host-controller when it is set */
+#define CAPTURE_FILE_ENV        "HYDRADANCER_CAPTURE"
+
+/* Bus number of the packets, the ToE is the only host of the bus */
+#define CAPTURE_BUS             (1)
+/* Time for the last records to reach the host once the bottom board stops */
+#define CAPTURE_DRAIN_US        (200000)
+
+/* Must match firmware/src/capture.h */
+#define CAPTURE_TRANSACTION_ENDPOINT_MASK   (0x0F)
+#define CAPTURE_TRANSACTION_IN              (0x80)
+#define CAPTURE_TRANSACTION_RESPONSE_SHIFT  (8)
+#define CAPTURE_TRANSACTION_LENGTH_SHIFT    (16)
+
+/* enums */
+/* Must match firmware/src/capture.h */
+enum CaptureResponse {
+    CaptureResponseAck      = 0,
+    CaptureResponseNak      = 1,
+    CaptureResponseStall    = 2,
+};
+
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : capture_file_path
+ * Description    : Get the path of the capture, CAPTURE_FILE_ENV if set,
+ *                  CAPTURE_FILE else
+ * Input          : None
+ * Return         : The path of the capture
+ *******************************************************************************/
+const char *capture_file_path(void);
+
+/*******************************************************************************
+ * Function Name  : capture_is_running
+ * Description    : Check if the transactions of the ToE are captured, see
+ *                  capture_start()
+ * Input          : None
+ * Return         : true if running, else false
+ *******************************************************************************/
+bool capture_is_running(void);
+
+/*******************************************************************************
+ * Function Name  : capture_start
+ * Description    : Create the capture file, then make the bottom board send
+ *                  every SETUP packet, transaction and bus reset of the ToE
+ *                  with its logs (BbioSetCapture). They are written as usbmon
+ *                  packets (pcap, LINKTYPE_USB_LINUX_MMAPPED) that Wireshark
+ *                  opens
+ * Input          : The path of the capture, see capture_file_path()
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int capture_start(const char *path);
+
+/*******************************************************************************
+ * Function Name  : capture_stop
+ * Description    : Stop the capture, then close the file once the last
+ *                  records are received
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void capture_stop(void);
+
+/*******************************************************************************
+ * Function Name  : capture_record_add
+ * Description    : Write a capture record of the bottom board, thread-safe.
+ *                  The records received while not running are dropped
+ * Input          : - record: The kind of record
+ *                  - ticks: The firmware timestamp of the record
+ *                  - args and count: The arguments of the record
+ * Return         : None
+ *******************************************************************************/
+void capture_record_add(enum LogCapture record, uint32_t ticks, const uint32_t *args, int count);
+
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+
+
+/* macros */
+#define ELF_HEADER_SIZE         (52)
+#define ELF_SECTION_HEADER_SIZE (40)
+#define ELF_SECTION_NAME_MAX    (64)
+#define ELF_SYMBOL_SIZE         (16)
+#define ELF_SYMBOL_TYPE_FUNC    (2)
+
+
+/* variables */
+static unsigned char _symbols[ELF_SYMBOLS_CAPACITY];
+static char _symbolNames[ELF_SYMBOLS_CAPACITY];
+
+
+/* functions implementation */
+
+/*******************************************************************************
+ * @fn      elf_read_u16
+ *
+ * @brief   Read a little endian 16 bits value
+ *
+ * @return  The value read
+ */
+static uint16_t
+elf_read_u16(const unsigned char *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+/*******************************************************************************
+ * @fn      elf_read_u32
+ *
+ * @brief   Read a little endian 32 bits value
+ *
+ * @return  The value read
+ */
+static uint32_t
+elf_read_u32(const unsigned char *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/*******************************************************************************
+ * @fn      elf_read_at
+ *
+ * @brief   Read size bytes at the given offset of the file
+ *
+ * @return  0 if success, else a non zero value
+ */
+static int
+elf_read_at(FILE *file, long offset, unsigned char *buffer, long size)
+{
+    if (fseek(file, offset, SEEK_SET)) {
+        return 1;
+    }
+    return fread(buffer, 1, size, file) != (size_t)size;
+}
+
+/*******************************************************************************
+ * @fn      elf_firmware_path
+ *
+ * @brief   Get the path of the firmware ELF
+ *
+ * @return  The path of the firmware ELF
+ */
+const char *
+elf_firmware_path(void)
+{
+    const char *path = getenv(ELF_FIRMWARE_ENV);
+
+    return (path != NULL && path[0] != '\0') ? path : ELF_FIRMWARE_PATH;
+}
+
+/*******************************************************************************
+ * @fn      elf_section_read
+ *
+ * @brief   Read the content of a section, looked up by name in the section
+ *          header string table
+ *
+ * @return  The size of the section, -1 if it is not found or does not fit
+ */
+long
+elf_section_read(const char *path, const char *name, unsigned char *buffer, long capBuffer)
+{
+    unsigned char header[ELF_HEADER_SIZE];
+    unsigned char sectionHeader[ELF_SECTION_HEADER_SIZE];
+    unsigned char stringsHeader[ELF_SECTION_HEADER_SIZE];
+    char sectionName[ELF_SECTION_NAME_MAX];
+    uint32_t sectionsOffset;
+    uint16_t sectionsCount;
+    uint16_t stringsIndex;
+    long size = -1;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    // ELF32 (class 1), little endian (data 1)
+    if (elf_read_at(file, 0, header, sizeof(header))
+        || memcmp(header, "\x7f" "ELF", 4) || header[4] != 1 || header[5] != 1) {
+        fclose(file);
+        return -1;
+    }
+    sectionsOffset = elf_read_u32(header + 32);
+    sectionsCount = elf_read_u16(header + 48);
+    stringsIndex = elf_read_u16(header + 50);
+
+    if (elf_read_at(file, sectionsOffset + stringsIndex * ELF_SECTION_HEADER_SIZE, stringsHeader, sizeof(stringsHeader))) {
+        fclose(file);
+        return -1;
+    }
+
+    for (uint16_t i = 0; i < sectionsCount; ++i) {
+        uint32_t sectionSize;
+
+        if (elf_read_at(file, sectionsOffset + i * ELF_SECTION_HEADER_SIZE, sectionHeader, sizeof(sectionHeader))) {
+            break;
+        }
+
+        memset(sectionName, 0, sizeof(sectionName));
+        if (fseek(file, elf_read_u32(stringsHeader + 16) + elf_read_u32(sectionHeader), SEEK_SET)
+            || fread(sectionName, 1, sizeof(sectionName) - 1, file) == 0
+            || strcmp(sectionName, name)) {
+            continue;
+        }
+
+        sectionSize = elf_read_u32(sectionHeader + 20);
+        if ((long)sectionSize <= capBuffer
+            && !elf_read_at(file, elf_read_u32(sectionHeader + 16), buffer, sectionSize)) {
+            size = sectionSize;
+        }
+        break;
+    }
+
+    fclose(file);
+    return size;
+}
+
+/*******************************************************************************
+ * @fn      elf_function_compare
+ *
+ * @brief   Order the functions by address, for qsort()
+ *
+ * @return  < 0, 0 or > 0 as strcmp()
+ */
+static int
+elf_function_compare(const void *a, const void *b)
+{
+    const struct ElfFunction_t *functionA = a;
+    const struct ElfFunction_t *functionB = b;
+
+    return (functionA->address > functionB->address) - (functionA->address < functionB->address);
+}
+
+/*******************************************************************************
+ * @fn      elf_functions_read
+ *
+ * @brief   Read the function symbols (.symtab and .strtab), sorted by address
+ *
+ * @return  The number of functions, -1 if there is no symbol table
+ */
+int
+elf_functions_read(const char *path, struct ElfFunction_t *functions, int capFunctions)
+{
+    long sizeSymbols = elf_section_read(path, ".symtab", _symbols, sizeof(_symbols));
+    long sizeNames = elf_section_read(path, ".strtab", (unsigned char *)_symbolNames, sizeof(_symbolNames) - 1);
+    int count = 0;
+
+    if (sizeSymbols < 0 || sizeNames < 0) {
+        return -1;
+    }
+    _symbolNames[sizeNames] = '\0';
+
+    for (long i = 0; i + ELF_SYMBOL_SIZE <= sizeSymbols && count < capFunctions; i += ELF_SYMBOL_SIZE) {
+        const unsigned char *symbol = _symbols + i;
+        uint32_t name = elf_read_u32(symbol);
+
+        if ((symbol[12] & 0xF) != ELF_SYMBOL_TYPE_FUNC || name >= sizeNames) {
+            continue;
+        }
+        functions[count].address = elf_read_u32(symbol + 4);
+        functions[count].size = elf_read_u32(symbol + 8);
+        functions[count].name = _symbolNames + name;
+        ++count;
+    }
+
+    qsort(functions, count, sizeof(*functions), elf_function_compare);
+    return count;
+}
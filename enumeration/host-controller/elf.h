@@ -0,0 +1,59 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <stdint.h>
+
+
+/* macros */
+/* Default path of the firmware ELF, relative to host-controller/ */
+#define ELF_FIRMWARE_PATH   "../firmware/build/HydraDancer-enumeration-fw.elf"
+/* Environment variable overriding ELF_FIRMWARE_PATH */
+#define ELF_FIRMWARE_ENV    "HYDRADANCER_FW_ELF"
+
+/* Capacity of the symbol table and of its string table */
+#define ELF_SYMBOLS_CAPACITY    (1 << 20)
+
+
+/* structs */
+struct ElfFunction_t {
+    uint32_t address;
+    uint32_t size;
+    const char *name;
+};
+
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : elf_firmware_path
+ * Description    : Get the path of the firmware ELF, ELF_FIRMWARE_ENV if set,
+ *                  ELF_FIRMWARE_PATH else
+ * Input          : None
+ * Return         : The path of the firmware ELF
+ *******************************************************************************/
+const char *elf_firmware_path(void);
+
+/*******************************************************************************
+ * Function Name  : elf_section_read
+ * Description    : Read the content of a section of an ELF32 little endian
+ *                  file (the firmware is RV32)
+ * Input          : - path: The ELF file
+ *                  - name: The name of the section (e.g. ".logfmt")
+ *                  - buffer and capBuffer: The buffer to fill
+ * Return         : The size of the section, -1 if it is not found or does not
+ *                  fit in the buffer
+ *******************************************************************************/
+long elf_section_read(const char *path, const char *name, unsigned char *buffer, long capBuffer);
+
+/*******************************************************************************
+ * Function Name  : elf_functions_read
+ * Description    : Read the function symbols of an ELF32 little endian file,
+ *                  sorted by address. The names are kept until the next call
+ * Input          : - path: The ELF file
+ *                  - functions and capFunctions: The array to fill
+ * Return         : The number of functions, -1 if there is no symbol table
+ *******************************************************************************/
+int elf_functions_read(const char *path, struct ElfFunction_t *functions, int capFunctions);
+
+
+#endif /* ELF_H */
@@ -0,0 +1,311 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fingerprint.h"
+
+
+/* macros */
+#define FINGERPRINT_HEADER      "toe,signature"
+#define FINGERPRINT_TOKEN_MAX   (32)
+
+/* Standard requests and descriptor types, see the chapter 9 of the USB 2.0
+ * specification */
+#define FINGERPRINT_TYPE_MASK           (0x60)
+#define FINGERPRINT_TYPE_STANDARD       (0x00)
+#define FINGERPRINT_TYPE_CLASS          (0x20)
+#define FINGERPRINT_STRING_LANGIDS      (0x00)
+#define FINGERPRINT_STRING_MS_OS        (0xEE)
+
+/* structs */
+struct FingerprintSignature_t {
+    char toe[FINGERPRINT_NAME_MAX];
+    char signature[FINGERPRINT_SIGNATURE_MAX];
+};
+
+
+/* variables */
+static const char *_requestNames[] = {
+    [0x00] = "status",
+    [0x01] = "clrfeat",
+    [0x03] = "setfeat",
+    [0x05] = "addr",
+    [0x08] = "getcfg",
+    [0x09] = "setcfg",
+    [0x0A] = "getif",
+    [0x0B] = "setif",
+};
+static const char *_descriptorNames[] = {
+    [0x01] = "dev",
+    [0x02] = "cfg",
+    [0x03] = "str",
+    [0x06] = "qual",
+    [0x07] = "other",
+    [0x0F] = "bos",
+    [0x21] = "hid",
+    [0x22] = "report",
+};
+
+/* No built-in signatures: the requests of a stack depend on its version and
+ * on the devices already enumerated, only the signatures recorded on the
+ * actual ToEs are reliable */
+static struct FingerprintSignature_t _signatures[FINGERPRINT_SIGNATURES_CAPACITY];
+static int _sizeSignatures = 0;
+
+
+/* functions implementation */
+
+/*******************************************************************************
+ * @fn      fingerprint_file_path
+ *
+ * @brief   Get the path of the signature database
+ *
+ * @return  FINGERPRINT_FILE_ENV if set, else FINGERPRINT_FILE
+ */
+const char *
+fingerprint_file_path(void)
+{
+    const char *path = getenv(FINGERPRINT_FILE_ENV);
+
+    if (path == NULL || path[0] == '\0') {
+        path = FINGERPRINT_FILE;
+    }
+    return path;
+}
+
+/*******************************************************************************
+ * @fn      fingerprint_load
+ *
+ * @brief   Load the signature database
+ *
+ * @return  The number of signatures loaded, -1 if the file is invalid
+ */
+int
+fingerprint_load(const char *path)
+{
+    char line[FINGERPRINT_NAME_MAX + FINGERPRINT_SIGNATURE_MAX + 2];
+    struct FingerprintSignature_t *entry;
+    char *comma;
+    FILE *file;
+
+    _sizeSignatures = 0;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    if (fgets(line, sizeof(line), file) == NULL || strncmp(line, FINGERPRINT_HEADER, strlen(FINGERPRINT_HEADER))) {
+        printf("[WARNING]\t fingerprint_load(): %s is not a signature database, it is not used\n", path);
+        fclose(file);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) && _sizeSignatures < FINGERPRINT_SIGNATURES_CAPACITY) {
+        line[strcspn(line, "\r\n")] = '\0';
+        comma = strchr(line, ',');
+        if (comma == NULL || comma == line || comma[1] == '\0') {
+            continue;
+        }
+        *comma = '\0';
+
+        entry = &_signatures[_sizeSignatures++];
+        snprintf(entry->toe, sizeof(entry->toe), "%.*s", FINGERPRINT_NAME_MAX - 1, line);
+        snprintf(entry->signature, sizeof(entry->signature), "%.*s", FINGERPRINT_SIGNATURE_MAX - 1, comma + 1);
+    }
+
+    fclose(file);
+    return _sizeSignatures;
+}
+
+/*******************************************************************************
+ * @fn      fingerprint_token
+ *
+ * @brief   Write the token of a request :
+ *          - GET_DESCRIPTOR: the descriptor then wLength, e.g. "dev:18",
+ *            "str0:255" for the language IDs, "msos:18" for the Microsoft OS
+ *            string descriptor, "desc<type>:<wLength>" if unknown
+ *          - The other standard requests: "addr", "setcfg", "status"...
+ *          - The class and vendor requests: "class:<bRequest>",
+ *            "vendor:<bRequest>" (hexadecimal)
+ *
+ * @return  None
+ */
+static void
+fingerprint_token(const struct ProgressRequest_t *request, char *token, size_t capacity)
+{
+    uint8_t type = request->requestType & FINGERPRINT_TYPE_MASK;
+    uint8_t descriptor = request->value >> 8;
+    uint8_t descriptorIndex = request->value & 0xFF;
+    int countRequests = sizeof(_requestNames) / sizeof(*_requestNames);
+    int countDescriptors = sizeof(_descriptorNames) / sizeof(*_descriptorNames);
+
+    if (type != FINGERPRINT_TYPE_STANDARD) {
+        snprintf(token, capacity, "%s:%02x", type == FINGERPRINT_TYPE_CLASS ? "class" : "vendor", request->request);
+    } else if (request->request == 0x06 && descriptor == 0x03 && descriptorIndex == FINGERPRINT_STRING_LANGIDS) {
+        snprintf(token, capacity, "str0:%u", request->length);
+    } else if (request->request == 0x06 && descriptor == 0x03 && descriptorIndex == FINGERPRINT_STRING_MS_OS) {
+        snprintf(token, capacity, "msos:%u", request->length);
+    } else if (request->request == 0x06 && descriptor < countDescriptors && _descriptorNames[descriptor]) {
+        snprintf(token, capacity, "%s:%u", _descriptorNames[descriptor], request->length);
+    } else if (request->request == 0x06) {
+        snprintf(token, capacity, "desc%02x:%u", descriptor, request->length);
+    } else if (request->request < countRequests && _requestNames[request->request]) {
+        snprintf(token, capacity, "%s", _requestNames[request->request]);
+    } else {
+        snprintf(token, capacity, "std:%02x", request->request);
+    }
+}
+
+/*******************************************************************************
+ * @fn      fingerprint_signature
+ *
+ * @brief   Write the signature of a request log
+ *
+ * @return  None
+ */
+void
+fingerprint_signature(const struct ProgressRequests_t *requests, char *signature, size_t capacity)
+{
+    char token[FINGERPRINT_TOKEN_MAX];
+    size_t size = 0;
+
+    if (capacity == 0) {
+        return;
+    }
+    signature[0] = '\0';
+
+    for (int i = 0; i < requests->count; ++i) {
+        fingerprint_token(&requests->requests[i], token, sizeof(token));
+        if (size + (i > 0) + strlen(token) >= capacity) {
+            break;
+        }
+        size += snprintf(signature + size, capacity - size, "%s%s", i > 0 ? " " : "", token);
+    }
+}
+
+/*******************************************************************************
+ * @fn      fingerprint_token_match
+ *
+ * @brief   Match a token of the log against a token of a signature. The
+ *          signature token may end with "*" (any wLength, e.g. "cfg:*") and
+ *          be followed by "+<ms>": the request came at least this long after
+ *          the previous one
+ *
+ * @return  true if it matches, else false
+ */
+static bool
+fingerprint_token_match(const char *pattern, size_t sizePattern, const char *token, uint32_t gapUs)
+{
+    const char *plus = memchr(pattern, '+', sizePattern);
+    size_t sizeName = plus ? (size_t)(plus - pattern) : sizePattern;
+
+    if (plus && gapUs < strtoul(plus + 1, NULL, 10) * 1000) {
+        return false;
+    }
+    if (sizeName > 0 && pattern[sizeName - 1] == '*') {
+        return strncmp(pattern, token, sizeName - 1) == 0;
+    }
+    return strlen(token) == sizeName && strncmp(pattern, token, sizeName) == 0;
+}
+
+/*******************************************************************************
+ * @fn      fingerprint_match
+ *
+ * @brief   Match a request log against a signature, its tokens must appear in
+ *          order
+ *
+ * @return  The number of tokens of the signature if it matches, else 0
+ */
+static int
+fingerprint_match(const struct ProgressRequests_t *requests, const char *signature)
+{
+    char token[FINGERPRINT_TOKEN_MAX];
+    const char *pattern = signature;
+    size_t sizePattern;
+    int countTokens = 0;
+    int i = 0;
+    uint32_t gapUs;
+
+    for (;;) {
+        pattern += strspn(pattern, " ");
+        sizePattern = strcspn(pattern, " ");
+        if (sizePattern == 0) {
+            return countTokens;
+        }
+
+        // The first request matching the token, the leftmost match never
+        // prevents the next tokens from matching
+        for (; i < requests->count; ++i) {
+            fingerprint_token(&requests->requests[i], token, sizeof(token));
+            gapUs = requests->requests[i].us - (i > 0 ? requests->requests[i - 1].us : 0);
+            if (fingerprint_token_match(pattern, sizePattern, token, gapUs)) {
+                break;
+            }
+        }
+        if (i == requests->count) {
+            return 0;
+        }
+
+        ++i;
+        ++countTokens;
+        pattern += sizePattern;
+    }
+}
+
+/*******************************************************************************
+ * @fn      fingerprint_identify
+ *
+ * @brief   Find the ToE whose signature matches the request log
+ *
+ * @return  The name of the ToE, NULL if no signature matches
+ */
+const char *
+fingerprint_identify(const struct ProgressRequests_t *requests)
+{
+    const char *toe = NULL;
+    int countBest = 0;
+    int countTokens;
+
+    // A tie keeps the first signature of the database
+    for (int i = 0; i < _sizeSignatures; ++i) {
+        countTokens = fingerprint_match(requests, _signatures[i].signature);
+        if (countTokens > countBest) {
+            countBest = countTokens;
+            toe = _signatures[i].toe;
+        }
+    }
+
+    return toe;
+}
+
+/*******************************************************************************
+ * @fn      fingerprint_print
+ *
+ * @brief   Print the request log, its signature and the ToE identified
+ *
+ * @return  None
+ */
+void
+fingerprint_print(const struct ProgressRequests_t *requests)
+{
+    char signature[FINGERPRINT_SIGNATURE_MAX];
+    char token[FINGERPRINT_TOKEN_MAX];
+    const struct ProgressRequest_t *request;
+    const char *toe;
+
+    printf("First %d of %u SETUP packets since the connection:\n", requests->count, requests->setups);
+    printf("  Time (ms)   Gap (ms)  bmRequestType bRequest wValue wIndex wLength  Token\n");
+    for (int i = 0; i < requests->count; ++i) {
+        request = &requests->requests[i];
+        fingerprint_token(request, token, sizeof(token));
+        printf("  %9.1f  %9.1f  0x%02X          0x%02X     0x%04X 0x%04X %7u  %s\n",
+               request->us / 1000.0, (request->us - (i > 0 ? requests->requests[i - 1].us : 0)) / 1000.0,
+               request->requestType, request->request, request->value, request->index, request->length, token);
+    }
+
+    fingerprint_signature(requests, signature, sizeof(signature));
+    toe = fingerprint_identify(requests);
+    printf("Signature: %s\n", signature);
+    printf("ToE: %s\n", toe ? toe : "unknown");
+}
@@ -0,0 +1,74 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <stddef.h>
+
+#include "stats.h"
+
+
+/* macros */
+/* Default path of the signature database, relative to host-controller/ */
+#define FINGERPRINT_FILE        "toe_signatures.csv"
+/* Environment variable overriding FINGERPRINT_FILE */
+#define FINGERPRINT_FILE_ENV    "HYDRADANCER_SIGNATURES"
+
+#define FINGERPRINT_NAME_MAX        (64)
+#define FINGERPRINT_SIGNATURE_MAX   (512)
+/* Signatures loaded from the database */
+#define FINGERPRINT_SIGNATURES_CAPACITY (64)
+
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : fingerprint_file_path
+ * Description    : Get the path of the signature database,
+ *                  FINGERPRINT_FILE_ENV if set, FINGERPRINT_FILE else
+ * Input          : None
+ * Return         : The path of the database
+ *******************************************************************************/
+const char *fingerprint_file_path(void);
+
+/*******************************************************************************
+ * Function Name  : fingerprint_load
+ * Description    : Load the signature database, a CSV file of lines
+ *                  "toe,signature", the only signatures matched. A missing
+ *                  file is an empty database, no ToE is identified
+ * Input          : The path of the database, see fingerprint_file_path()
+ * Return         : The number of signatures loaded, -1 if the file is invalid
+ *******************************************************************************/
+int fingerprint_load(const char *path);
+
+/*******************************************************************************
+ * Function Name  : fingerprint_signature
+ * Description    : Write the signature of a request log: one token per
+ *                  request, separated by spaces, e.g. "dev:64 addr dev:18
+ *                  cfg:255". See fingerprint.c for the tokens
+ * Input          : - requests: The log, see stats_requests_get()
+ *                  - signature and capacity: Where to write the signature
+ * Return         : None
+ *******************************************************************************/
+void fingerprint_signature(const struct ProgressRequests_t *requests, char *signature, size_t capacity);
+
+/*******************************************************************************
+ * Function Name  : fingerprint_identify
+ * Description    : Find the ToE whose signature matches the request log. A
+ *                  signature matches when its tokens appear in the log in
+ *                  order, other requests may come between them; the one with
+ *                  the most tokens wins
+ * Input          : The log, see stats_requests_get()
+ * Return         : The name of the ToE, NULL if no signature matches
+ *******************************************************************************/
+const char *fingerprint_identify(const struct ProgressRequests_t *requests);
+
+/*******************************************************************************
+ * Function Name  : fingerprint_print
+ * Description    : Print the request log with the time of each request, its
+ *                  signature and the ToE identified
+ * Input          : The log, see stats_requests_get()
+ * Return         : None
+ *******************************************************************************/
+void fingerprint_print(const struct ProgressRequests_t *requests);
+
+
+#endif /* FINGERPRINT_H */
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+
+/* macros */
+#define HISTORY_HEADER          "toe,class,set_configuration_us"
+
+/* structs */
+struct HistorySample_t {
+    char toe[HISTORY_TOE_MAX];
+    uint8_t deviceClass;
+    uint32_t setConfigurationUs;
+};
+
+
+/* variables */
+static struct HistorySample_t _samples[HISTORY_SAMPLES_CAPACITY];
+static int _sizeSamples = 0;
+static int _nextSample = 0;     // The oldest sample once _samples is full
+static const char *_path = NULL;   // Where the new samples are appended
+static char _toe[HISTORY_TOE_MAX] = "";   // See history_toe_set()
+
+
+/* functions implementation */
+
+/*******************************************************************************
+ * @fn      history_file_path
+ *
+ * @brief   Get the path of the history
+ *
+ * @return  HISTORY_FILE_ENV if set, else HISTORY_FILE
+ */
+const char *
+history_file_path(void)
+{
+    const char *path = getenv(HISTORY_FILE_ENV);
+
+    if (path == NULL || path[0] == '\0') {
+        path = HISTORY_FILE;
+    }
+    return path;
+}
+
+/*******************************************************************************
+ * @fn      history_toe_name
+ *
+ * @brief   Get the name of the ToE
+ *
+ * @return  HISTORY_TOE_ENV if set, else the name set, else HISTORY_TOE_DEFAULT
+ */
+const char *
+history_toe_name(void)
+{
+    const char *toe = getenv(HISTORY_TOE_ENV);
+
+    if (toe == NULL || toe[0] == '\0') {
+        toe = _toe[0] != '\0' ? _toe : HISTORY_TOE_DEFAULT;
+    }
+    return toe;
+}
+
+/*******************************************************************************
+ * @fn      history_toe_set
+ *
+ * @brief   Name the ToE when HISTORY_TOE_ENV is not set
+ *
+ * @return  None
+ */
+void
+history_toe_set(const char *toe)
+{
+    snprintf(_toe, sizeof(_toe), "%s", toe);
+}
+
+/*******************************************************************************
+ * @fn      history_toe_store
+ *
+ * @brief   Copy the name of a ToE as it is stored: truncated and its commas
+ *          replaced, it is a CSV field
+ *
+ * @return  None
+ */
+static void
+history_toe_store(char *stored, int capStored, const char *toe)
+{
+    snprintf(stored, capStored, "%s", toe);
+    for (char *c = stored; *c; ++c) {
+        if (*c == ',' || *c == '\n') {
+            *c = '_';
+        }
+    }
+}
+
+/*******************************************************************************
+ * @fn      history_sample_add
+ *
+ * @brief   Add a sample in memory, it replaces the oldest one when the memory
+ *          is full
+ *
+ * @return  None
+ */
+static void
+history_sample_add(const char *toe, uint8_t deviceClass, uint32_t setConfigurationUs)
+{
+    struct HistorySample_t *sample = &_samples[_nextSample];
+
+    _nextSample = (_nextSample + 1) % HISTORY_SAMPLES_CAPACITY;
+    if (_sizeSamples < HISTORY_SAMPLES_CAPACITY) {
+        ++_sizeSamples;
+    }
+
+    history_toe_store(sample->toe, sizeof(sample->toe), toe);
+    sample->deviceClass = deviceClass;
+    sample->setConfigurationUs = setConfigurationUs;
+}
+
+/*******************************************************************************
+ * @fn      history_load
+ *
+ * @brief   Load the history
+ *
+ * @return  The number of samples loaded, -1 if the file is invalid
+ */
+int
+history_load(const char *path)
+{
+    char line[HISTORY_TOE_MAX + 32];
+    char toe[HISTORY_TOE_MAX];
+    unsigned int deviceClass;
+    unsigned int setConfigurationUs;
+    FILE *file;
+
+    _path = path;
+    _sizeSamples = 0;
+    _nextSample = 0;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    if (fgets(line, sizeof(line), file) == NULL || strncmp(line, HISTORY_HEADER, strlen(HISTORY_HEADER))) {
+        printf("[WARNING]\t history_load(): %s is not a history, it is not used\n", path);
+        fclose(file);
+        _path = NULL;
+        return -1;
+    }
+    // The file is in chronological order, the newest samples are kept
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%63[^,],%u,%u", toe, &deviceClass, &setConfigurationUs) == 3) {
+            history_sample_add(toe, deviceClass, setConfigurationUs);
+        }
+    }
+
+    fclose(file);
+    return _sizeSamples;
+}
+
+/*******************************************************************************
+ * @fn      history_record
+ *
+ * @brief   Record the time the ToE took to configure a device
+ *
+ * @return  None
+ */
+void
+history_record(const char *toe, uint8_t deviceClass, uint32_t setConfigurationUs)
+{
+    char stored[HISTORY_TOE_MAX];
+    FILE *file;
+    long sizeFile;
+
+    history_sample_add(toe, deviceClass, setConfigurationUs);
+    if (_path == NULL) {
+        return;
+    }
+
+    file = fopen(_path, "a");
+    if (file == NULL) {
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    sizeFile = ftell(file);
+    if (sizeFile == 0) {
+        fprintf(file, "%s\n", HISTORY_HEADER);
+    }
+    history_toe_store(stored, sizeof(stored), toe);
+    fprintf(file, "%s,%u,%u\n", stored, deviceClass, setConfigurationUs);
+    fclose(file);
+}
+
+/*******************************************************************************
+ * @fn      history_u32_compare
+ *
+ * @brief   Order the times, for qsort()
+ *
+ * @return  < 0, 0 or > 0 as strcmp()
+ */
+static int
+history_u32_compare(const void *a, const void *b)
+{
+    uint32_t valueA = *(const uint32_t *)a;
+    uint32_t valueB = *(const uint32_t *)b;
+
+    return (valueA > valueB) - (valueA < valueB);
+}
+
+/*******************************************************************************
+ * @fn      history_timeout_us
+ *
+ * @brief   Get the time to wait for SET_CONFIGURATION learned for a ToE and a
+ *          class
+ *
+ * @return  The timeout from BbioConnect in us, 0 if not learned yet
+ */
+uint32_t
+history_timeout_us(const char *toe, uint8_t deviceClass)
+{
+    static uint32_t times[HISTORY_SAMPLES_CAPACITY];
+    char stored[HISTORY_TOE_MAX];
+    int countTimes = 0;
+    uint64_t timeout;
+
+    // Compare with the name as it is stored, the order of the samples does
+    // not matter
+    history_toe_store(stored, sizeof(stored), toe);
+    for (int i = 0; i < _sizeSamples; ++i) {
+        if (_samples[i].deviceClass == deviceClass && strcmp(_samples[i].toe, stored) == 0) {
+            times[countTimes++] = _samples[i].setConfigurationUs;
+        }
+    }
+    if (countTimes < HISTORY_SAMPLES_MIN) {
+        return 0;
+    }
+
+    // Nearest rank
+    qsort(times, countTimes, sizeof(*times), history_u32_compare);
+    timeout = times[(countTimes * HISTORY_PERCENTILE + 99) / 100 - 1];
+    timeout = timeout * HISTORY_FACTOR_PERCENT / 100 + HISTORY_MARGIN_US;
+
+    return timeout > UINT32_MAX ? UINT32_MAX : timeout;
+}
+
+/*******************************************************************************
+ * @fn      history_device_class
+ *
+ * @brief   Get the class a device is learned under
+ *
+ * @return  The class
+ */
+uint8_t
+history_device_class(const unsigned char *descriptorDevice, const unsigned char *descriptorConfig)
+{
+    // bDeviceClass, else bInterfaceClass of the first interface (it follows
+    // the 9 bytes configuration descriptor)
+    if (descriptorDevice[4] != 0) {
+        return descriptorDevice[4];
+    }
+    return descriptorConfig[14];
+}
@@ -0,0 +1,102 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+
+/* macros */
+/* Default path of the history, relative to host-controller/ */
+#define HISTORY_FILE            "toe_history.csv"
+/* Environment variable overriding HISTORY_FILE */
+#define HISTORY_FILE_ENV        "HYDRADANCER_HISTORY"
+/* Environment variable naming the ToE, each ToE has its own history */
+#define HISTORY_TOE_ENV         "HYDRADANCER_TOE"
+#define HISTORY_TOE_DEFAULT     "default"
+#define HISTORY_TOE_MAX         (64)
+
+/* Samples kept in memory, beyond the newest ones replace the oldest ones */
+#define HISTORY_SAMPLES_CAPACITY (1 << 16)
+
+/* The timeout of a ToE and a class is learned once it has this many samples:
+ * the HISTORY_PERCENTILE of the time to SET_CONFIGURATION, times
+ * HISTORY_FACTOR_PERCENT, plus HISTORY_MARGIN_US */
+#define HISTORY_SAMPLES_MIN     (5)
+#define HISTORY_PERCENTILE      (95)
+#define HISTORY_FACTOR_PERCENT  (150)
+#define HISTORY_MARGIN_US       (250000)
+
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : history_file_path
+ * Description    : Get the path of the history, HISTORY_FILE_ENV if set,
+ *                  HISTORY_FILE else
+ * Input          : None
+ * Return         : The path of the history
+ *******************************************************************************/
+const char *history_file_path(void);
+
+/*******************************************************************************
+ * Function Name  : history_toe_name
+ * Description    : Get the name of the ToE, HISTORY_TOE_ENV if set, else the
+ *                  name given to history_toe_set(), else HISTORY_TOE_DEFAULT
+ * Input          : None
+ * Return         : The name of the ToE
+ *******************************************************************************/
+const char *history_toe_name(void);
+
+/*******************************************************************************
+ * Function Name  : history_toe_set
+ * Description    : Name the ToE when HISTORY_TOE_ENV is not set, e.g. from its
+ *                  fingerprint
+ * Input          : The name of the ToE, copied
+ * Return         : None
+ *******************************************************************************/
+void history_toe_set(const char *toe);
+
+/*******************************************************************************
+ * Function Name  : history_load
+ * Description    : Load the history, the new samples are appended to it. A
+ *                  missing file is an empty history
+ * Input          : The path of the history, see history_file_path()
+ * Return         : The number of samples loaded, -1 if the file is invalid
+ *******************************************************************************/
+int history_load(const char *path);
+
+/*******************************************************************************
+ * Function Name  : history_record
+ * Description    : Record the time the ToE took to configure a device, and
+ *                  append it to the history file
+ * Input          : - toe: The name of the ToE, see history_toe_name()
+ *                  - deviceClass: The class of the device, see
+ *                    history_device_class()
+ *                  - setConfigurationUs: The time from BbioConnect to
+ *                    SET_CONFIGURATION
+ * Return         : None
+ *******************************************************************************/
+void history_record(const char *toe, uint8_t deviceClass, uint32_t setConfigurationUs);
+
+/*******************************************************************************
+ * Function Name  : history_timeout_us
+ * Description    : Get the time to wait for SET_CONFIGURATION learned for a ToE
+ *                  and a class, see HISTORY_SAMPLES_MIN
+ * Input          : - toe: The name of the ToE
+ *                  - deviceClass: The class of the device
+ * Return         : The timeout from BbioConnect in us, 0 if not learned yet
+ *******************************************************************************/
+uint32_t history_timeout_us(const char *toe, uint8_t deviceClass);
+
+/*******************************************************************************
+ * Function Name  : history_device_class
+ * Description    : Get the class a device is learned under: the class of the
+ *                  device descriptor, or of the first interface if it is
+ *                  defined at the interface level (0)
+ * Input          : - descriptorDevice: The device descriptor
+ *                  - descriptorConfig: The configuration descriptor
+ * Return         : The class
+ *******************************************************************************/
+uint8_t history_device_class(const unsigned char *descriptorDevice, const unsigned char *descriptorConfig);
+
+
+#endif /* HISTORY_H */
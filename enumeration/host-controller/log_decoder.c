@@ -0,0 +1,318 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "elf.h"
+
+#include "log_decoder.h"
+
+
+/* macros */
+#define LOG_CONVERSION_MAX  (16)
+
+
+/* variables */
+static unsigned char _formats[LOG_FORMATS_CAPACITY];
+static long _sizeFormats = -1;
+static long _profileFormatId = -1;
+static long _captureFormatIds[LogCaptureCount] = { -1, -1, -1 };
+static const char *_captureFormats[LogCaptureCount] = {
+    [LogCaptureSetup]       = LOG_CAPTURE_SETUP_FORMAT,
+    [LogCaptureTransaction] = LOG_CAPTURE_TRANSACTION_FORMAT,
+    [LogCaptureReset]       = LOG_CAPTURE_RESET_FORMAT,
+};
+
+
+/* functions implementation */
+
+/*******************************************************************************
+ * @fn      log_decoder_init
+ *
+ * @brief   Load the format strings from the .logfmt section of the firmware
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+log_decoder_init(const char *elfPath)
+{
+    _sizeFormats = elf_section_read(elfPath, ".logfmt", _formats, sizeof(_formats));
+    if (_sizeFormats < 0) {
+        printf("[WARNING]\t log_decoder_init(): no .logfmt section in %s, binary logs will not be decoded\n", elfPath);
+        return 1;
+    }
+
+    // The format strings are stored one after the other
+    for (long id = 0; id < _sizeFormats; id += strlen((const char *)_formats + id) + 1) {
+        if (memchr(_formats + id, '\0', _sizeFormats - id) == NULL) {
+            break;
+        }
+        if (strcmp((const char *)_formats + id, LOG_PROFILE_FORMAT) == 0) {
+            _profileFormatId = id;
+        }
+        for (int record = 0; record < LogCaptureCount; ++record) {
+            if (strcmp((const char *)_formats + id, _captureFormats[record]) == 0) {
+                _captureFormatIds[record] = id;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      log_decoder_append
+ *
+ * @brief   Append text to the current line, the line is passed to lineDone
+ *          at each end of line or when it is full. Carriage returns are
+ *          dropped
+ *
+ * @return  None
+ */
+static void
+log_decoder_append(struct LogDecoder_t *decoder, const char *text, int sizeText,
+                   void (*lineDone)(const char *line, void *context), void *context)
+{
+    for (int i = 0; i < sizeText; ++i) {
+        if (text[i] == '\r') {
+            continue;
+        }
+        if (text[i] != '\n') {
+            decoder->line[decoder->sizeLine++] = text[i];
+            if (decoder->sizeLine < LOG_DECODER_LINE_MAX - 1) {
+                continue;
+            }
+        }
+        decoder->line[decoder->sizeLine] = '\0';
+        lineDone(decoder->line, context);
+        decoder->sizeLine = 0;
+    }
+}
+
+/*******************************************************************************
+ * @fn      log_decoder_format
+ *
+ * @brief   Format a string with 32 bits arguments, one conversion at a time.
+ *          Strings (%s) are not supported by the firmware
+ *
+ * @return  The length of the text, truncated to capText - 1
+ */
+static int
+log_decoder_format(const char *format, const uint32_t *args, int nargs, char *text, int capText)
+{
+    char conversion[LOG_CONVERSION_MAX];
+    int sizeText = 0;
+    int iArg = 0;
+    int len;
+
+    while (*format && sizeText < capText - 1) {
+        if (*format != '%') {
+            text[sizeText++] = *format++;
+            continue;
+        }
+        if (format[1] == '%') {
+            text[sizeText++] = '%';
+            format += 2;
+            continue;
+        }
+
+        // Flags, width, precision, length: copied as is, except the length
+        // modifiers as the arguments are always 32 bits
+        len = 0;
+        conversion[len++] = *format++;
+        while (*format && strchr("-+ #0123456789.", *format) && len < LOG_CONVERSION_MAX - 3) {
+            conversion[len++] = *format++;
+        }
+        while (*format && strchr("hlzjt", *format)) {
+            ++format;
+        }
+        if (*format == '\0') {
+            break;
+        }
+
+        uint32_t arg = (iArg < nargs) ? args[iArg++] : 0;
+        switch (*format) {
+        case 'd':
+        case 'i':
+            conversion[len++] = *format;
+            conversion[len] = '\0';
+            len = snprintf(text + sizeText, capText - sizeText, conversion, (int32_t)arg);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            conversion[len++] = *format;
+            conversion[len] = '\0';
+            len = snprintf(text + sizeText, capText - sizeText, conversion, (unsigned int)arg);
+            break;
+        case 'p':
+            len = snprintf(text + sizeText, capText - sizeText, "0x%08x", (unsigned int)arg);
+            break;
+        default:
+            len = snprintf(text + sizeText, capText - sizeText, "<%%%c 0x%08x>", *format, (unsigned int)arg);
+            break;
+        }
+        if (len > 0) {
+            sizeText += len;
+        }
+        ++format;
+    }
+
+    return (sizeText < capText) ? sizeText : capText - 1;
+}
+
+/*******************************************************************************
+ * @fn      log_decoder_record_format
+ *
+ * @brief   Decode a complete binary record
+ *
+ * @return  The length of the text, truncated to capText - 1
+ */
+static int
+log_decoder_record_format(const unsigned char *record, char *text, int capText)
+{
+    uint32_t args[LOG_BIN_ARGS_MAX];
+    int nargs = record[1];
+    uint16_t id = record[2] | (record[3] << 8);
+    uint32_t ticks = record[4] | (record[5] << 8) | (record[6] << 16) | ((uint32_t)record[7] << 24);
+    int sizeText;
+
+    for (int i = 0; i < nargs; ++i) {
+        const unsigned char *arg = record + LOG_BIN_HEADER_SIZE + 4 * i;
+        args[i] = arg[0] | (arg[1] << 8) | (arg[2] << 16) | ((uint32_t)arg[3] << 24);
+    }
+
+    sizeText = snprintf(text, capText, "[%10u us] ", ticks / LOG_TICKS_PER_US);
+    if (id < _sizeFormats && memchr(_formats + id, '\0', _sizeFormats - id) != NULL) {
+        sizeText += log_decoder_format((const char *)_formats + id, args, nargs, text + sizeText, capText - sizeText);
+    } else {
+        sizeText += snprintf(text + sizeText, capText - sizeText, "<log 0x%04x", id);
+        for (int i = 0; i < nargs && sizeText < capText; ++i) {
+            sizeText += snprintf(text + sizeText, capText - sizeText, " 0x%08x", args[i]);
+        }
+        if (sizeText < capText) {
+            sizeText += snprintf(text + sizeText, capText - sizeText, ">\n");
+        }
+    }
+
+    return (sizeText < capText) ? sizeText : capText - 1;
+}
+
+/*******************************************************************************
+ * @fn      log_decoder_record_id
+ *
+ * @brief   Get the format string ID of a binary record
+ *
+ * @return  The format string ID
+ */
+static long
+log_decoder_record_id(const unsigned char *record)
+{
+    return record[2] | (record[3] << 8);
+}
+
+/*******************************************************************************
+ * @fn      log_decoder_samples
+ *
+ * @brief   Pass the PCs of a complete profiler record to samplesDone
+ *
+ * @return  None
+ */
+static void
+log_decoder_samples(struct LogDecoder_t *decoder, void *context)
+{
+    uint32_t samples[LOG_BIN_ARGS_MAX];
+    int count = decoder->record[1];
+
+    for (int i = 0; i < count; ++i) {
+        const unsigned char *arg = decoder->record + LOG_BIN_HEADER_SIZE + 4 * i;
+        samples[i] = arg[0] | (arg[1] << 8) | (arg[2] << 16) | ((uint32_t)arg[3] << 24);
+    }
+
+    decoder->samplesDone(samples, count, context);
+}
+
+/*******************************************************************************
+ * @fn      log_decoder_capture
+ *
+ * @brief   Pass a complete capture record to captureDone
+ *
+ * @return  true if the record is a capture record, false else
+ */
+static bool
+log_decoder_capture(struct LogDecoder_t *decoder, void *context)
+{
+    uint32_t args[LOG_BIN_ARGS_MAX];
+    int count = decoder->record[1];
+    const unsigned char *ticks = decoder->record + 4;
+    long id = log_decoder_record_id(decoder->record);
+
+    for (int record = 0; record < LogCaptureCount; ++record) {
+        if (id != _captureFormatIds[record]) {
+            continue;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            const unsigned char *arg = decoder->record + LOG_BIN_HEADER_SIZE + 4 * i;
+            args[i] = arg[0] | (arg[1] << 8) | (arg[2] << 16) | ((uint32_t)arg[3] << 24);
+        }
+        decoder->captureDone(record, ticks[0] | (ticks[1] << 8) | (ticks[2] << 16) | ((uint32_t)ticks[3] << 24),
+                             args, count, context);
+        return true;
+    }
+
+    return false;
+}
+
+/*******************************************************************************
+ * @fn      log_decoder_feed
+ *
+ * @brief   Decode a chunk of a log stream, the text is kept as is until a
+ *          LOG_BIN_MARKER, then the record is accumulated until complete
+ *
+ * @return  None
+ */
+void
+log_decoder_feed(struct LogDecoder_t *decoder, const unsigned char *data, int sizeData,
+                 void (*lineDone)(const char *line, void *context), void *context)
+{
+    char text[LOG_DECODER_LINE_MAX];
+    int sizeExpected;
+    int sizeText;
+
+    for (int i = 0; i < sizeData; ++i) {
+        if (decoder->sizeRecord == 0) {
+            if (data[i] == LOG_BIN_MARKER) {
+                decoder->record[decoder->sizeRecord++] = data[i];
+            } else {
+                log_decoder_append(decoder, (const char *)data + i, 1, lineDone, context);
+            }
+            continue;
+        }
+
+        decoder->record[decoder->sizeRecord++] = data[i];
+        if (decoder->sizeRecord < 2) {
+            continue;
+        }
+        if (decoder->record[1] > LOG_BIN_ARGS_MAX) {
+            // Not a record, resynchronise on the next marker
+            log_decoder_append(decoder, "<invalid log record>\n", 21, lineDone, context);
+            decoder->sizeRecord = 0;
+            continue;
+        }
+
+        sizeExpected = LOG_BIN_HEADER_SIZE + 4 * decoder->record[1];
+        if (decoder->sizeRecord == sizeExpected) {
+            if (decoder->samplesDone != NULL && log_decoder_record_id(decoder->record) == _profileFormatId) {
+                log_decoder_samples(decoder, context);
+            } else if (decoder->captureDone != NULL && log_decoder_capture(decoder, context)) {
+                // Written to the capture file only
+            } else {
+                sizeText = log_decoder_record_format(decoder->record, text, sizeof(text));
+                log_decoder_append(decoder, text, sizeText, lineDone, context);
+            }
+            decoder->sizeRecord = 0;
+        }
+    }
+}
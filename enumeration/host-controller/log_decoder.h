@@ -0,0 +1,88 @@
+#ifndef LOG_DECODER_H
+#define LOG_DECODER_H
+
+#include <stdint.h>
+
+
+/* macros */
+/* Must match firmware/src/log.h */
+#define LOG_BIN_MARKER          (0x00)
+#define LOG_BIN_HEADER_SIZE     (8)
+#define LOG_BIN_ARGS_MAX        (6)
+#define LOG_BIN_RECORD_MAX_SIZE (LOG_BIN_HEADER_SIZE + 4 * LOG_BIN_ARGS_MAX)
+
+/* Must match firmware/src/timebase.h */
+#define LOG_TICKS_PER_US        (120)
+
+/* The format string IDs are 16 bits offsets in .logfmt */
+#define LOG_FORMATS_CAPACITY    (65536)
+
+/* Must match firmware/src/profile.h, the records of this format are passed
+ * to LogDecoder_t.samplesDone instead of being printed */
+#define LOG_PROFILE_FORMAT      "PC samples %x %x %x %x %x %x\r\n"
+
+/* Must match firmware/src/capture.h, the records of these formats are passed
+ * to LogDecoder_t.captureDone instead of being printed */
+#define LOG_CAPTURE_SETUP_FORMAT        "USB setup %08x %08x\r\n"
+#define LOG_CAPTURE_TRANSACTION_FORMAT  "USB transaction %08x\r\n"
+#define LOG_CAPTURE_RESET_FORMAT        "USB bus reset\r\n"
+
+/* Longer lines are split */
+#define LOG_DECODER_LINE_MAX    (512)
+
+
+/* enums */
+/* The capture records, in the order of their LOG_CAPTURE_*_FORMAT */
+enum LogCapture {
+    LogCaptureSetup = 0,
+    LogCaptureTransaction,
+    LogCaptureReset,
+    LogCaptureCount,
+};
+
+/* structs */
+/* State of the decoding of one log stream (one board), a record or a line can
+ * be split between two transfers */
+struct LogDecoder_t {
+    unsigned char record[LOG_BIN_RECORD_MAX_SIZE];
+    int sizeRecord;
+    char line[LOG_DECODER_LINE_MAX];
+    int sizeLine;
+    // Optional, called with the PCs of each profiler record
+    void (*samplesDone)(const uint32_t *samples, int count, void *context);
+    // Optional, called with the timestamp (firmware ticks) and the arguments
+    // of each capture record
+    void (*captureDone)(enum LogCapture record, uint32_t ticks, const uint32_t *args, int count, void *context);
+};
+
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : log_decoder_init
+ * Description    : Load the format strings of the binary records (.logfmt
+ *                  section) from the firmware ELF
+ * Input          : The path of the firmware ELF
+ * Return         : 0 if success, else a non zero value (the records are then
+ *                  printed undecoded)
+ *******************************************************************************/
+int log_decoder_init(const char *elfPath);
+
+/*******************************************************************************
+ * Function Name  : log_decoder_feed
+ * Description    : Decode a chunk of a log stream: the text is kept as is, the
+ *                  binary records are decoded. Each complete line is passed to
+ *                  lineDone, without its end of line. The profiler records go
+ *                  to decoder->samplesDone and the capture records to
+ *                  decoder->captureDone when set
+ * Input          : - decoder: The state of the stream
+ *                  - data and sizeData: The chunk received
+ *                  - lineDone: Called for each complete line
+ *                  - context: Passed to lineDone, samplesDone and captureDone
+ * Return         : None
+ *******************************************************************************/
+void log_decoder_feed(struct LogDecoder_t *decoder, const unsigned char *data, int sizeData,
+                      void (*lineDone)(const char *line, void *context), void *context);
+
+
+#endif /* LOG_DECODER_H */
@@ -0,0 +1,512 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "libusb.h"
+
+#include "capture.h"
+#include "log_decoder.h"
+#include "metrics.h"
+#include "profile.h"
+#include "stats.h"
+#include "usb.h"
+
+#include "log_reader.h"
+
+
+/* macros */
+#define LOG_READER_PATH_MAX         (1024)
+#define LOG_READER_TIMESTAMP_MAX    (32)
+#define LOG_READER_STREAMS          (2)
+
+/* enums */
+enum LogTransferState {
+    LogTransferStopped = 0, // Not submitted anymore (cancelled, device lost...)
+    LogTransferQueued,
+    LogTransferIdle,        // Submitted again once LOG_READER_IDLE_US elapsed
+};
+
+/* structs */
+/* The log stream of one board, received on its own endpoint */
+struct LogStream_t {
+    const char *name;
+    unsigned char endpoint;
+    struct LogDecoder_t decoder;
+    char path[LOG_READER_PATH_MAX];
+    FILE *file;
+    long sizeFile;
+    struct libusb_transfer *transfers[LOG_READER_TRANSFERS];
+    enum LogTransferState states[LOG_READER_TRANSFERS];
+    struct timespec idleSince[LOG_READER_TRANSFERS];
+    unsigned char buffers[LOG_READER_TRANSFERS][LOG_READER_TRANSFER_SIZE];
+};
+
+
+/* variables */
+static struct LogStream_t _streams[LOG_READER_STREAMS] = {
+    { .name = "top",    .endpoint = EP_DEBUG_BOARD_TOP },
+    { .name = "bottom", .endpoint = EP_DEBUG_BOARD_BOTTOM },
+};
+
+/* The transfers complete in the reader thread, but also in the main thread
+ * while it waits for a synchronous transfer (BBIO), everything below and the
+ * streams are protected by _lock */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t _thread;
+static bool _running = false;
+static bool _stop = false;
+static bool _tail = false;
+static int _queued = 0;
+
+
+/* functions implementation */
+
+/*******************************************************************************
+ * @fn      log_reader_directory
+ *
+ * @brief   Get the directory of the log files
+ *
+ * @return  LOG_READER_DIRECTORY_ENV if set, else LOG_READER_DIRECTORY
+ */
+const char *
+log_reader_directory(void)
+{
+    const char *directory = getenv(LOG_READER_DIRECTORY_ENV);
+
+    if (directory == NULL || directory[0] == '\0') {
+        directory = LOG_READER_DIRECTORY;
+    }
+    return directory;
+}
+
+/*******************************************************************************
+ * @fn      log_reader_timestamp
+ *
+ * @brief   Format the current local time, with milliseconds
+ *
+ * @return  None
+ */
+static void
+log_reader_timestamp(char *text, int capText)
+{
+    struct timespec now;
+    struct tm local;
+    size_t len;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    localtime_r(&now.tv_sec, &local);
+    len = strftime(text, capText, "%Y-%m-%d %H:%M:%S", &local);
+    snprintf(text + len, capText - len, ".%03ld", now.tv_nsec / 1000000);
+}
+
+/*******************************************************************************
+ * @fn      log_reader_rotate
+ *
+ * @brief   Rotate the log file of a stream: .log.N-1 -> .log.N ... .log ->
+ *          .log.1, the oldest one is removed. Called with _lock held
+ *
+ * @return  None
+ */
+static void
+log_reader_rotate(struct LogStream_t *stream)
+{
+    char from[LOG_READER_PATH_MAX + 16];
+    char to[LOG_READER_PATH_MAX + 16];
+
+    fclose(stream->file);
+
+    for (int i = LOG_READER_FILES_KEPT; i > 0; --i) {
+        if (i > 1) {
+            snprintf(from, sizeof(from), "%s.%d", stream->path, i - 1);
+        } else {
+            snprintf(from, sizeof(from), "%s", stream->path);
+        }
+        snprintf(to, sizeof(to), "%s.%d", stream->path, i);
+        // rename() does not replace an existing file on every platform
+        remove(to);
+        rename(from, to);
+    }
+
+    stream->file = fopen(stream->path, "w");
+    stream->sizeFile = 0;
+    if (stream->file == NULL) {
+        printf("[ERROR]\t log_reader_rotate(): can not open %s: %s\n", stream->path, strerror(errno));
+    }
+}
+
+/*******************************************************************************
+ * @fn      log_reader_notice_parse
+ *
+ * @brief   Parse a notice of the firmware, the whole line must match the
+ *          format, which holds a %lu and ends with %n
+ *
+ * @return  true if the line is the notice, false else
+ */
+static bool
+log_reader_notice_parse(const char *line, const char *format, unsigned long *pValue)
+{
+    int end = -1;
+
+    // The %n is only reached when the text after the value matched
+    return sscanf(line, format, pValue, &end) == 1 && end >= 0 && line[end] == '\0';
+}
+
+/*******************************************************************************
+ * @fn      log_reader_line_done
+ *
+ * @brief   Write a decoded line to the log file of its stream, and to stdout
+ *          if tailing. The lines and the bytes dropped by the firmware (see
+ *          log_ring_write()) are counted in the metrics. Called with _lock
+ *          held
+ *
+ * @return  None
+ */
+static void
+log_reader_line_done(const char *line, void *context)
+{
+    struct LogStream_t *stream = context;
+    char timestamp[LOG_READER_TIMESTAMP_MAX];
+    unsigned long dropped;
+    int len;
+
+    metrics_add(MetricLogLinesTop + (stream - _streams), 1);
+    if (log_reader_notice_parse(line, "[%lu bytes dropped]%n", &dropped)) {
+        metrics_add(MetricLogDroppedBytesTop + (stream - _streams), dropped);
+    }
+
+    log_reader_timestamp(timestamp, sizeof(timestamp));
+
+    if (stream->file != NULL && stream->sizeFile >= LOG_READER_FILE_MAX_SIZE) {
+        log_reader_rotate(stream);
+    }
+    if (stream->file != NULL) {
+        len = fprintf(stream->file, "%s %s\n", timestamp, line);
+        if (len > 0) {
+            stream->sizeFile += len;
+        }
+    }
+
+    if (_tail) {
+        printf("%s [%s] %s\n", timestamp, stream->name, line);
+    }
+}
+
+/*******************************************************************************
+ * @fn      log_reader_samples_done
+ *
+ * @brief   Pass the profiler samples of a stream to the profiler, the streams
+ *          are in the order of enum StatsBoard. Called with _lock held
+ *
+ * @return  None
+ */
+static void
+log_reader_samples_done(const uint32_t *samples, int count, void *context)
+{
+    struct LogStream_t *stream = context;
+
+    profile_samples_add(stream - _streams, samples, count);
+}
+
+/*******************************************************************************
+ * @fn      log_reader_capture_done
+ *
+ * @brief   Pass the capture records of the bottom board to the capture, only
+ *          the bottom board sees the ToE. Called with _lock held
+ *
+ * @return  None
+ */
+static void
+log_reader_capture_done(enum LogCapture record, uint32_t ticks, const uint32_t *args, int count, void *context)
+{
+    struct LogStream_t *stream = context;
+
+    if (stream - _streams == StatsBoardBottom) {
+        capture_record_add(record, ticks, args, count);
+    }
+}
+
+/*******************************************************************************
+ * @fn      log_reader_submit
+ *
+ * @brief   Queue a transfer of a stream. Called with _lock held
+ *
+ * @return  None
+ */
+static void
+log_reader_submit(struct LogStream_t *stream, int iTransfer)
+{
+    char error[LOG_DECODER_LINE_MAX];
+    int retCode;
+
+    retCode = libusb_submit_transfer(stream->transfers[iTransfer]);
+    if (retCode) {
+        metrics_add(MetricLogTransferErrorsTop + (stream - _streams), 1);
+        stream->states[iTransfer] = LogTransferStopped;
+        snprintf(error, sizeof(error), "<log reader: transfer %d not submitted: %s>", iTransfer, libusb_error_name(retCode));
+        log_reader_line_done(error, stream);
+        return;
+    }
+
+    stream->states[iTransfer] = LogTransferQueued;
+    ++_queued;
+}
+
+/*******************************************************************************
+ * @fn      log_reader_transfer_done
+ *
+ * @brief   Transfer callback: decode the logs received and queue the transfer
+ *          again. An empty transfer, or a failed one, is queued again after
+ *          LOG_READER_IDLE_US by the reader thread
+ *
+ * @return  None
+ */
+static void
+log_reader_transfer_done(struct libusb_transfer *transfer)
+{
+    struct LogStream_t *stream = transfer->user_data;
+    char error[LOG_DECODER_LINE_MAX];
+    int iTransfer = 0;
+
+    while (stream->transfers[iTransfer] != transfer) {
+        ++iTransfer;
+    }
+
+    pthread_mutex_lock(&_lock);
+    --_queued;
+
+    if (transfer->actual_length > 0) {
+        log_decoder_feed(&stream->decoder, transfer->buffer, transfer->actual_length, log_reader_line_done, stream);
+        if (stream->file != NULL) {
+            fflush(stream->file);
+        }
+        if (_tail) {
+            fflush(stdout);
+        }
+    }
+
+    switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+        if (transfer->actual_length > 0 && !_stop) {
+            log_reader_submit(stream, iTransfer);
+            break;
+        }
+        stream->states[iTransfer] = LogTransferIdle;
+        clock_gettime(CLOCK_MONOTONIC, &stream->idleSince[iTransfer]);
+        break;
+    case LIBUSB_TRANSFER_CANCELLED:
+        stream->states[iTransfer] = LogTransferStopped;
+        break;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        stream->states[iTransfer] = LogTransferStopped;
+        log_reader_line_done("<log reader: device disconnected>", stream);
+        break;
+    default:
+        metrics_add(MetricLogTransferErrorsTop + (stream - _streams), 1);
+        snprintf(error, sizeof(error), "<log reader: transfer %d failed, status %d>", iTransfer, transfer->status);
+        log_reader_line_done(error, stream);
+        stream->states[iTransfer] = LogTransferIdle;
+        clock_gettime(CLOCK_MONOTONIC, &stream->idleSince[iTransfer]);
+        break;
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+/*******************************************************************************
+ * @fn      log_reader_resubmit_idle
+ *
+ * @brief   Queue again the transfers idle for at least LOG_READER_IDLE_US.
+ *          Called with _lock held
+ *
+ * @return  None
+ */
+static void
+log_reader_resubmit_idle(void)
+{
+    struct timespec now;
+    long idleUs;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int iStream = 0; iStream < LOG_READER_STREAMS; ++iStream) {
+        struct LogStream_t *stream = &_streams[iStream];
+
+        for (int i = 0; i < LOG_READER_TRANSFERS; ++i) {
+            if (stream->states[i] != LogTransferIdle) {
+                continue;
+            }
+            idleUs = (now.tv_sec - stream->idleSince[i].tv_sec) * 1000000L
+                     + (now.tv_nsec - stream->idleSince[i].tv_nsec) / 1000;
+            if (idleUs >= LOG_READER_IDLE_US) {
+                log_reader_submit(stream, i);
+            }
+        }
+    }
+}
+
+/*******************************************************************************
+ * @fn      log_reader_thread
+ *
+ * @brief   Handle the libusb events until log_reader_stop() is called and all
+ *          the transfers are cancelled
+ *
+ * @return  NULL
+ */
+static void *
+log_reader_thread(void *unused)
+{
+    struct timeval timeout;
+
+    (void)unused;
+
+    pthread_mutex_lock(&_lock);
+    while (!_stop || _queued > 0) {
+        pthread_mutex_unlock(&_lock);
+        timeout.tv_sec = 0;
+        timeout.tv_usec = LOG_READER_IDLE_US;
+        libusb_handle_events_timeout_completed(NULL, &timeout, NULL);
+        pthread_mutex_lock(&_lock);
+
+        if (!_stop) {
+            log_reader_resubmit_idle();
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+
+    return NULL;
+}
+
+/*******************************************************************************
+ * @fn      log_reader_start
+ *
+ * @brief   Open the log files, queue the transfers on both logging endpoints
+ *          and start the reader thread
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+log_reader_start(const char *directory)
+{
+    sigset_t signals;
+    sigset_t signalsPrevious;
+    int retCode;
+
+#ifdef _WIN32
+    retCode = mkdir(directory);
+#else
+    retCode = mkdir(directory, 0755);
+#endif
+    if (retCode && errno != EEXIST) {
+        printf("[ERROR]\t log_reader_start(): can not create %s: %s\n", directory, strerror(errno));
+        return 1;
+    }
+
+    pthread_mutex_lock(&_lock);
+    _stop = false;
+    for (int iStream = 0; iStream < LOG_READER_STREAMS; ++iStream) {
+        struct LogStream_t *stream = &_streams[iStream];
+
+        snprintf(stream->path, sizeof(stream->path), "%s/board-%s.log", directory, stream->name);
+        stream->file = fopen(stream->path, "a");
+        if (stream->file == NULL) {
+            printf("[ERROR]\t log_reader_start(): can not open %s: %s\n", stream->path, strerror(errno));
+        } else {
+            fseek(stream->file, 0, SEEK_END);
+            stream->sizeFile = ftell(stream->file);
+        }
+        log_reader_line_done("<log reader: started>", stream);
+        stream->decoder.samplesDone = log_reader_samples_done;
+        stream->decoder.captureDone = log_reader_capture_done;
+
+        for (int i = 0; i < LOG_READER_TRANSFERS; ++i) {
+            stream->transfers[i] = libusb_alloc_transfer(0);
+            if (stream->transfers[i] == NULL) {
+                stream->states[i] = LogTransferStopped;
+                continue;
+            }
+            libusb_fill_bulk_transfer(stream->transfers[i], g_deviceHandle, stream->endpoint,
+                                      stream->buffers[i], LOG_READER_TRANSFER_SIZE,
+                                      log_reader_transfer_done, stream, 0);
+            log_reader_submit(stream, i);
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+
+    // SIGINT is handled by the main thread
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, &signalsPrevious);
+    retCode = pthread_create(&_thread, NULL, log_reader_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &signalsPrevious, NULL);
+    if (retCode) {
+        printf("[ERROR]\t log_reader_start(): can not create the reader thread: %s\n", strerror(retCode));
+        // The queued transfers are still handled while the main thread waits
+        // for its synchronous transfers, the logs are only delayed
+        return 2;
+    }
+
+    _running = true;
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      log_reader_stop
+ *
+ * @brief   Cancel the transfers, wait until the reader thread has handled all
+ *          of them, then free them and close the log files
+ *
+ * @return  None
+ */
+void
+log_reader_stop(void)
+{
+    if (!_running) {
+        return;
+    }
+
+    pthread_mutex_lock(&_lock);
+    _stop = true;
+    for (int iStream = 0; iStream < LOG_READER_STREAMS; ++iStream) {
+        for (int i = 0; i < LOG_READER_TRANSFERS; ++i) {
+            if (_streams[iStream].states[i] == LogTransferQueued) {
+                libusb_cancel_transfer(_streams[iStream].transfers[i]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+
+    pthread_join(_thread, NULL);
+    _running = false;
+
+    for (int iStream = 0; iStream < LOG_READER_STREAMS; ++iStream) {
+        struct LogStream_t *stream = &_streams[iStream];
+
+        for (int i = 0; i < LOG_READER_TRANSFERS; ++i) {
+            libusb_free_transfer(stream->transfers[i]);
+            stream->transfers[i] = NULL;
+            stream->states[i] = LogTransferStopped;
+        }
+        if (stream->file != NULL) {
+            fclose(stream->file);
+            stream->file = NULL;
+        }
+    }
+}
+
+/*******************************************************************************
+ * @fn      log_reader_tail
+ *
+ * @brief   Start or stop printing the lines received on stdout
+ *
+ * @return  None
+ */
+void
+log_reader_tail(bool enable)
+{
+    pthread_mutex_lock(&_lock);
+    _tail = enable;
+    pthread_mutex_unlock(&_lock);
+}
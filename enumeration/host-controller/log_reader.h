@@ -0,0 +1,66 @@
+#ifndef LOG_READER_H
+#define LOG_READER_H
+
+#include <stdbool.h>
+
+
+/* macros */
+/* Transfers kept queued on each logging endpoint */
+#define LOG_READER_TRANSFERS        (4)
+#define LOG_READER_TRANSFER_SIZE    (4096)
+/* The firmware answers with an empty packet when it has no log, such a
+ * transfer is submitted again after this delay instead of immediately */
+#define LOG_READER_IDLE_US          (10000)
+
+/* Default directory of the log files, relative to host-controller/ */
+#define LOG_READER_DIRECTORY        "logs"
+/* Environment variable overriding LOG_READER_DIRECTORY */
+#define LOG_READER_DIRECTORY_ENV    "HYDRADANCER_LOG_DIR"
+/* A log file is rotated (.log -> .log.1 -> ... -> .log.N) above this size */
+#define LOG_READER_FILE_MAX_SIZE    (4 * 1024 * 1024)
+#define LOG_READER_FILES_KEPT       (4)
+
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : log_reader_directory
+ * Description    : Get the directory of the log files, LOG_READER_DIRECTORY_ENV
+ *                  if set, LOG_READER_DIRECTORY else
+ * Input          : None
+ * Return         : The directory of the log files
+ *******************************************************************************/
+const char *log_reader_directory(void);
+
+/*******************************************************************************
+ * Function Name  : log_reader_start
+ * Description    : Start reading the logs of both boards in the background:
+ *                  LOG_READER_TRANSFERS transfers are kept queued on each
+ *                  logging endpoint, the decoded lines are written with the
+ *                  time of reception to <directory>/board-top.log and
+ *                  <directory>/board-bottom.log
+ * Input          : The directory of the log files, it is created if needed
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int log_reader_start(const char *directory);
+
+/*******************************************************************************
+ * Function Name  : log_reader_stop
+ * Description    : Cancel the transfers, wait for them and close the log files.
+ *                  Must be called before closing the USB connection
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void log_reader_stop(void);
+
+/*******************************************************************************
+ * Function Name  : log_reader_tail
+ * Description    : Also print the lines received on stdout (live tail), they
+ *                  are still written to the log files
+ * Input          : true to start printing, false to stop
+ * Return         : None
+ *******************************************************************************/
+void log_reader_tail(bool enable);
+
+
+#endif /* LOG_READER_H */
@@ -5,29 +5,72 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "bbio.h"
+#include "capture.h"
+#include "elf.h"
+#include "fingerprint.h"
+#include "history.h"
+#include "log_decoder.h"
+#include "log_reader.h"
 #include "menu.h"
+#include "metrics.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
 #include "usb_descriptors.h"
 #include "usb.h"
 
 
 /* macros */
 #define TIMEOUT 50
+/* The ToE gave up on the device when it sends no request for this long once
+ * it read the configuration descriptor */
+#define TOE_IDLE_ABORT_US   (3000000)
+/* Settle time after the disconnection, the ToE is then ready for the next
+ * device. The bottom board can not observe the ToE handling the detach : the
+ * window is measured from the attach instead, BUS_SETTLE_FACTOR times the
+ * longest time the ToE took to reset a device once attached (its port
+ * polling and debounce). BUS_SETTLE_WINDOW_ENV overrides it */
+#define BUS_SETTLE_FACTOR       (2)
+#define BUS_SETTLE_WINDOW_ENV   "HYDRADANCER_SETTLE_US"
+/* Longest wait for the bus to settle, the former fixed delay between devices,
+ * also the window until a reset was measured */
+#define BUS_SETTLE_TIMEOUT_US   (500000)
 
 /* enums */
+/* Outcome of a device at a speed */
+enum Outcome {
+    OutcomeNotSupported = 0,
+    OutcomeSupported,
+    OutcomeInvalid,     // The descriptors are not valid at this speed
+    OutcomeRejected,    // The bottom board could not store the descriptors
+    OutcomeCount,
+};
 
 
 /* variables */
 bool g_verbosity = false;
+/* When the device is supported, see stats_criterion_set() */
+enum ProgressCriterion g_criterion = ProgressCriterionSetConfiguration;
+uint32_t g_criterionWindowMs = 0;
+/* The first device of a campaign fingerprints the ToE */
+bool g_isToeFingerprinted = false;
+/* The speeds each device is emulated at, a bit per enum BbioSpeed */
+unsigned int g_speedsMask = 1 << BbioSpeedHigh;
+const char *g_speedNames[BbioSpeedCount] = { "high", "full", "low" };
+/* Longest time from BbioConnect to the bus reset of the ToE, 0 until measured */
+uint32_t g_busResetMaxUs = 0;
+/* Set on C-c, the main loop then stops everything and exits */
+volatile sig_atomic_t g_isInterrupted = 0;
 
 
 /* functions declaration */
-void handler_sigint();
+void handler_sigint(int signal);
 int usb_init_verbose(void);
 void usb_close(void);
-void usb_log_print(unsigned char endpoint, unsigned char *buffer, int capBuffer);
 
 
 /* functions implementation */
@@ -35,61 +78,94 @@ void usb_log_print(unsigned char endpoint, unsigned char *buffer, int capBuffer)
 /*******************************************************************************
  * @fn      handler_sigint
  *
- * @brief   Function that will be used to cleanly exit when receiving C-c
+ * @brief   Function that will be used to cleanly exit when receiving C-c.
+ *          Stopping talks to the boards and joins threads, which is not
+ *          async-signal-safe: it is left to the end of main()
  *
  * @return  None
  */
 void
-handler_sigint()
+handler_sigint(int signal)
 {
-    usb_close();
+    (void)signal;
+    g_isInterrupted = 1;
+}
 
-    printf("Exiting\n");
-    exit(0);
+void
+print_table_devices_header(void)
+{
+    printf("                  Device Descriptor        Configuration Descriptor\n");
+    printf("Status           Class SubClass Protocol    Class SubClass Protocol\n");
 }
+
 /*******************************************************************************
- * @fn      usb_log_print
+ * @fn      bus_settle_window_us
  *
- * @brief   Query the given endpoint for logs and print received logs
+ * @brief   Get the settle time of the bus between two devices
  *
- * @return  None
+ * @return  BUS_SETTLE_WINDOW_ENV if set, else the window measured from the
+ *          bus resets (see BUS_SETTLE_FACTOR), BUS_SETTLE_TIMEOUT_US until
+ *          one was measured
  */
-void
-usb_log_print(unsigned char endpoint, unsigned char *buffer, int capBuffer)
+uint32_t
+bus_settle_window_us(void)
 {
-    int retCode;
+    const char *window = getenv(BUS_SETTLE_WINDOW_ENV);
 
-    retCode = libusb_bulk_transfer(g_deviceHandle, endpoint, buffer, capBuffer, NULL, 0);
-    buffer[capBuffer-1] = 0; // Force null terminating the string
-    if (retCode == 0) {
-        // If we received something
-        if (buffer[0] != 0) {
-            printf("%s", buffer);
-        }
-    } else {
-        printf("[ERROR]\tData NOT received successfully: %s\n", libusb_strerror(retCode));
+    if (window != NULL && window[0] != '\0') {
+        return strtoul(window, NULL, 0);
+    }
+    if (g_busResetMaxUs == 0 || g_busResetMaxUs >= BUS_SETTLE_TIMEOUT_US / BUS_SETTLE_FACTOR) {
+        return BUS_SETTLE_TIMEOUT_US;
     }
-    memset(buffer, 0, capBuffer);
+    return g_busResetMaxUs * BUS_SETTLE_FACTOR;
 }
 
-void
-print_table_devices_header(void)
+/*******************************************************************************
+ * @fn      descriptor_set
+ *
+ * @brief   Upload a descriptor, a string or a response to the bottom board
+ *          (BbioSetDescr). It is sent again only if the transfer or the
+ *          command failed, the errors of the store would be the same again
+ *
+ * @return  0 if success, else the error code of the bottom board
+ */
+int
+descriptor_set(const char *name, enum BbioSubCommand bbioSubCommand, int index, unsigned char *data, int size, bool verbose)
 {
-    printf("                  Device Descriptor        Configuration Descriptor\n");
-    printf("Status           Class SubClass Protocol    Class SubClass Protocol\n");
+    int retCode;
+
+    if (verbose) { printf("Setting %s\n", name); }
+    do {
+        bbio_command_sub_send(BbioSetDescr, bbioSubCommand, index, size);
+        retCode = bbio_payload_send(data, size);
+    } while (retCode < 0);
+
+    if (retCode) {
+        printf("[ERROR]\t The bottom board rejected the %s (%d)\n", name, retCode);
+    }
+    return retCode;
 }
 
 // TODOO: Use struct rather than multiple arguments tied together
 // TODO: Header doc
-bool
-enumerate_device(struct Device_t device, bool verbose)
+enum Outcome
+enumerate_device(struct Device_t device, enum BbioSpeed speed, bool verbose)
 {
-    int retCode;
-    int bbioRetCode;
+    int connectRetCode;
+    int responderRetCode;
     bool isDeviceSupported = false;
-
-    char dummyPacket[] = "toto";
-    int dummyPacketSize = sizeof(dummyPacket);
+    bool isAbandoned = false;
+    bool isProgressKnown = false;
+    bool isConfigured = false;
+    bool isInvalid = false;
+    bool isRejected = false;
+    struct Progress_t progress;
+    struct ProgressRequests_t requests;
+    const char *toe;
+    uint8_t deviceClass;
+    uint32_t timeoutUs;
+    uint32_t sleepUs;
 
     unsigned char *descriptorDevice = device.descriptorDevice;
     unsigned char *descriptorConfig = device.descriptorConfig;
@@ -99,181 +175,281 @@ enumerate_device(struct Device_t device, bool verbose)
     int sz_descriptorConfig = (descriptorConfig[3] << 8) + descriptorConfig[2];         // From 2 char to short
     int sz_descriptorHidReport = 0;
     int sz_descriptorHubReport = 0;
+    unsigned char bufferResponse[USB20_EP1_MAX_SIZE];
+    int sz_response;
+    unsigned char bufferDevice[UINT8_MAX + 1];
+    unsigned char bufferConfig[4096];
+    bool isStringsAdded = false;
+    const char *string;
+    int sz_string;
+    char name[64];
     if (descriptorHidReport) {
         sz_descriptorHidReport = (descriptorConfig[26] << 8) + descriptorConfig[25];    // From 2 char to short
     }
     if (descriptorHubReport) {
         sz_descriptorHubReport = descriptorHubReport[0];
     }
+    // The descriptors are adapted to the device, the originals are kept
+    memcpy(bufferDevice, descriptorDevice, sz_descriptorDevice);
+    descriptorDevice = bufferDevice;
+    // A device without strings gets the ones of usb_string_get()
+    if (sz_descriptorDevice >= 17 && !descriptorDevice[14] && !descriptorDevice[15] && !descriptorDevice[16]) {
+        descriptorDevice[14] = USB_STRING_MANUFACTURER;    // iManufacturer
+        descriptorDevice[15] = USB_STRING_PRODUCT;         // iProduct
+        descriptorDevice[16] = USB_STRING_SERIAL;          // iSerialNumber
+        isStringsAdded = true;
+    }
+    // The devices are written for high speed
+    if (speed != BbioSpeedHigh && sz_descriptorConfig <= (int)sizeof(bufferConfig)) {
+        memcpy(bufferConfig, descriptorConfig, sz_descriptorConfig);
+        descriptorConfig = bufferConfig;
+        usb_descriptors_speed_adapt(descriptorDevice, descriptorConfig, sz_descriptorConfig, speed);
+    }
+
+    trace_begin(device.s_name);
+
+    // 0 until the ToE configured enough devices of this class, TIMEOUT applies
+    deviceClass = history_device_class(descriptorDevice, descriptorConfig);
+    timeoutUs = history_timeout_us(history_toe_name(), deviceClass);
+    if (verbose && timeoutUs) {
+        printf("Learned timeout of the ToE for class 0x%02X: %u ms\n", deviceClass, timeoutUs / 1000);
+    }
 
     // Reset the board
     do {
         if (verbose) { printf("Resetting board\n"); }
         bbio_command_send(BbioDisconnect);
-        usleep(10000);
-        bbioRetCode = bbio_get_return_code();
-        usleep(10000);
-        retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL, 0);
-        usleep(10000);
-        if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-        bbioRetCode |= bbio_get_return_code();
-        usleep(10000);
-    } while (bbioRetCode);
+    } while (bbio_payload_send(NULL, 0));
 
     // Reset descriptors
     do {
         if (verbose) { printf("Resetting descriptors\n"); }
         bbio_command_send(BbioResetDescr);
-        usleep(10000);
-        bbioRetCode = bbio_get_return_code();
-        usleep(10000);
-        retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL, 0);
-        usleep(10000);
-        if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-        bbioRetCode |= bbio_get_return_code();
-        usleep(10000);
-    } while (bbioRetCode);
-
-    // Send device descriptor
-    do {
-        if (verbose) { printf("Setting device descriptor\n"); }
-        bbio_command_sub_send(BbioSetDescr, BbioSubSetDescrDevice, 0, sz_descriptorDevice);
-        usleep(10000);
-        bbioRetCode = bbio_get_return_code();
-        usleep(10000);
-        retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, descriptorDevice, sz_descriptorDevice, NULL, 0);
-        usleep(10000);
-        if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-        bbioRetCode |= bbio_get_return_code();
-        usleep(10000);
-    } while (bbioRetCode);
-
-    // Send configuration descriptor
-    do {
-        if (verbose) { printf("Setting configuration descriptor\n"); }
-        bbio_command_sub_send(BbioSetDescr, BbioSubSetDescrConfig, 0, sz_descriptorConfig);
-        usleep(10000);
-        bbioRetCode = bbio_get_return_code();
-        usleep(10000);
-        retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, descriptorConfig, sz_descriptorConfig, NULL, 0);
-        usleep(10000);
-        if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-        bbioRetCode |= bbio_get_return_code();
-        usleep(10000);
-    } while (bbioRetCode);
+    } while (bbio_payload_send(NULL, 0));
+
+    // Send the descriptors, the device is not connected if the bottom board
+    // can not store one of them
+    isRejected = descriptor_set("device descriptor", BbioSubSetDescrDevice, 0, descriptorDevice, sz_descriptorDevice, verbose)
+                 || descriptor_set("configuration descriptor", BbioSubSetDescrConfig, 0, descriptorConfig, sz_descriptorConfig, verbose);
 
     // if it exists
-    if (descriptorHidReport) {
-        // Send HID report descriptor
-        do {
-            if (verbose) { printf("Setting HID report descriptor\n"); }
-            bbio_command_sub_send(BbioSetDescr, BbioSubSetDescrHidReport, 0, sz_descriptorHidReport);
-            usleep(10000);
-            bbioRetCode = bbio_get_return_code();
-            usleep(10000);
-            retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, descriptorHidReport, sz_descriptorHidReport, NULL, 0);
-            usleep(10000);
-            if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-            bbioRetCode |= bbio_get_return_code();
-            usleep(10000);
-        } while (bbioRetCode);
+    if (descriptorHidReport && !isRejected) {
+        isRejected = descriptor_set("HID report descriptor", BbioSubSetDescrHidReport, 0, descriptorHidReport, sz_descriptorHidReport, verbose);
     }
 
     // if it exists
-    if (descriptorHubReport) {
-        // Send HID report descriptor
-        do {
-            if (verbose) { printf("Setting HUB descriptor\n"); }
-            bbio_command_sub_send(BbioSetDescr, BbioSubSetDescrHubReport, 0, sz_descriptorHubReport);
-            usleep(10000);
-            bbioRetCode = bbio_get_return_code();
-            usleep(10000);
-            retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, descriptorHubReport, sz_descriptorHubReport, NULL, 0);
-            usleep(10000);
-            if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-            bbioRetCode |= bbio_get_return_code();
-            usleep(10000);
-        } while (bbioRetCode);
+    if (descriptorHubReport && !isRejected) {
+        isRejected = descriptor_set("HUB descriptor", BbioSubSetDescrHubReport, 0, descriptorHubReport, sz_descriptorHubReport, verbose);
+    }
+
+    // Strings, if the device got the ones of usb_string_get(). The bottom board
+    // fills their placeholders at each connection
+    for (int i = 1; i < USB_STRINGS && isStringsAdded && !isRejected; ++i) {
+        string = usb_string_get(&device, i);
+        if (string == NULL) {
+            continue;
+        }
+        sz_string = strlen(string);
+        snprintf(name, sizeof(name), "string %d \"%s\"", i, string);
+        isRejected = descriptor_set(name, BbioSubSetDescrString, i, (unsigned char *)string, sz_string, verbose);
+    }
+
+    // Class and vendor requests answered by the bottom board, the descriptor
+    // store holds them until BbioResetDescr. A rule the responder rejected is
+    // skipped, the device is connected without it
+    for (const struct UsbResponse_t *response = device.responses; response && response->action && !isRejected; ++response) {
+        sz_response = usb_response_fill(response, bufferResponse, sizeof(bufferResponse));
+        if (sz_response == 0) {
+            printf("[ERROR]\t Response to 0x%02X 0x%02X too large\n", response->requestType, response->request);
+            continue;
+        }
+        snprintf(name, sizeof(name), "response to 0x%02X 0x%02X", response->requestType, response->request);
+        responderRetCode = descriptor_set(name, BbioSubSetDescrResponder, 0, bufferResponse, sz_response, verbose);
+        isRejected = responderRetCode && responderRetCode != BBIO_RESPONDER_REJECTED;
     }
 
     // No necessity to enable endpoints according to the descriptor
 
-    // Connect the device
-    do {
-        if (verbose) { printf("Connecting the device\n"); }
-        bbio_command_send(BbioConnect);
-        usleep(10000);
-        bbioRetCode = bbio_get_return_code();
-        usleep(10000);
-        retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL, 0);
-        usleep(10000);
-        if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-        bbioRetCode |= bbio_get_return_code();
-        usleep(10000);
-    } while (bbioRetCode);
+    // Connect the device, not retried if its descriptors are not valid at
+    // this speed
+    if (!isRejected) {
+        do {
+            if (verbose) { printf("Connecting the device at %s speed\n", g_speedNames[speed]); }
+            bbio_command_value_send(BbioConnect, speed);
+            connectRetCode = bbio_payload_send(NULL, 0);
+            isInvalid = connectRetCode == BBIO_CONNECT_INVALID;
+        } while (connectRetCode && !isInvalid);
+    }
 
     // Wait to see if our device is supported
     if (verbose) { printf("Querying results...\n"); }
-    for (int i = 0; i < TIMEOUT; ++i) {
+    trace_begin("Wait for the ToE");
+    for (int i = 0; i < TIMEOUT && !isInvalid && !isRejected; ++i) {
         bbio_command_send(BbioGetStatus);
-        usleep(10000);
-        bbio_get_return_code();
-        usleep(10000);
-        retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL, 0);
-        usleep(10000);
-        if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-        bbioRetCode = bbio_get_return_code();
-        usleep(10000);
-        if (bbioRetCode == 1) {
+        if (bbio_payload_send(NULL, 0) == 1) {
             isDeviceSupported = true;
             break;
         }
-        usleep(100000);
+
+        isProgressKnown = stats_progress_get(&progress) == 0;
+        isConfigured = isProgressKnown && (progress.stages & (1u << ProgressStageSetConfiguration));
+        if (isProgressKnown && !isConfigured && (progress.stages & (1u << ProgressStageConfigDescriptor))
+            && progress.sinceSetupUs >= TOE_IDLE_ABORT_US) {
+            isAbandoned = true;
+            break;
+        }
+        // Configured, but no traffic on the endpoints within the window
+        if (isConfigured && g_criterion == ProgressCriterionEndpointTraffic && g_criterionWindowMs
+            && progress.sinceConnectUs - progress.stageUs[ProgressStageSetConfiguration] > g_criterionWindowMs * 1000) {
+            break;
+        }
+        sleepUs = 100000;
+        // The learned timeout bounds the wait for SET_CONFIGURATION only
+        if (isProgressKnown && !isConfigured && timeoutUs) {
+            if (progress.sinceConnectUs >= timeoutUs) {
+                break;
+            }
+            if (timeoutUs - progress.sinceConnectUs < sleepUs) {
+                sleepUs = timeoutUs - progress.sinceConnectUs;
+            }
+        }
+        usleep(sleepUs);
+    }
+    trace_end("Wait for the ToE");
+
+    isProgressKnown = stats_progress_get(&progress) == 0;
+
+    // The settle time between the devices follows the reaction of the ToE
+    if (isProgressKnown && (progress.stages & (1u << ProgressStageBusReset))
+        && progress.stageUs[ProgressStageBusReset] > g_busResetMaxUs) {
+        g_busResetMaxUs = progress.stageUs[ProgressStageBusReset];
+        if (verbose) {
+            printf("Settle time between devices: %u ms\n", bus_settle_window_us() / 1000);
+        }
+    }
+
+    // Identify the ToE from its requests, the next devices use its history
+    if (!g_isToeFingerprinted && isProgressKnown && progress.setups && stats_requests_get(&requests) == 0) {
+        g_isToeFingerprinted = true;
+        if (verbose) {
+            fingerprint_print(&requests);
+        }
+        toe = fingerprint_identify(&requests);
+        if (toe == NULL) {
+            printf("Unknown ToE, select 25 to print its signature for %s\n", fingerprint_file_path());
+        } else {
+            printf("ToE identified: %s\n", toe);
+            history_toe_set(toe);
+        }
+    }
+
+    // Learn how long the ToE takes to configure this class
+    if (isDeviceSupported) {
+        if (isProgressKnown && (progress.stages & (1u << ProgressStageSetConfiguration))) {
+            history_record(history_toe_name(), deviceClass, progress.stageUs[ProgressStageSetConfiguration]);
+        }
+    }
+
+    if (verbose && isAbandoned) {
+        printf("The ToE stopped sending requests, not waiting for the timeout\n");
+    }
+    if (verbose && isProgressKnown) {
+        stats_progress_print(&progress);
     }
 
     // Reset the board
     do {
         if (verbose) { printf("Resetting board\n"); }
         bbio_command_send(BbioDisconnect);
-        usleep(10000);
-        bbioRetCode = bbio_get_return_code();
-        usleep(10000);
-        retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL, 0);
-        usleep(10000);
-        if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-        bbioRetCode |= bbio_get_return_code();
-        usleep(10000);
-    } while (bbioRetCode);
+    } while (bbio_payload_send(NULL, 0));
 
     // Reset descriptors
     do {
         if (verbose) { printf("Resetting descriptors\n"); }
         bbio_command_send(BbioResetDescr);
-        usleep(10000);
-        bbioRetCode = bbio_get_return_code();
-        usleep(10000);
-        retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL, 0);
-        usleep(10000);
-        if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-        bbioRetCode |= bbio_get_return_code();
-        usleep(10000);
-    } while (bbioRetCode);
+    } while (bbio_payload_send(NULL, 0));
+
+    // The next device can be connected once the ToE saw the disconnection
+    trace_begin("Wait for the bus");
+    if (!bbio_bus_idle_wait(bus_settle_window_us(), BUS_SETTLE_TIMEOUT_US) && verbose) {
+        printf("The bus did not settle\n");
+    }
+    trace_end("Wait for the bus");
+
+    trace_end(device.s_name);
+
+    metrics_add(MetricDevices, 1);
+    if (isDeviceSupported) {
+        metrics_add(MetricDevicesSupported, 1);
+    } else if (!isInvalid) {
+        metrics_add(isAbandoned ? MetricToeAbandons : MetricToeTimeouts, 1);
+    }
+    metrics_set(MetricLastDeviceTimestamp, time(NULL));
+    // The board rings are small, they are emptied after each device
+    if (trace_is_enabled()) {
+        trace_boards_fetch();
+    }
 
     // Print the result
-    printf("%s     0x%02X     0x%02X     0x%02X:    0x%02X     0x%02X     0x%02X (%s)\n",
-           isDeviceSupported ? "SUPPORTED    " : "NOT SUPPORTED",
+    printf("%s     0x%02X     0x%02X     0x%02X:    0x%02X     0x%02X     0x%02X (%s, %s speed)",
+           isDeviceSupported ? "SUPPORTED    " : isInvalid ? "INVALID      " : isRejected ? "REJECTED     " : "NOT SUPPORTED",
            descriptorDevice[4],
            descriptorDevice[5],
            descriptorDevice[6],
            descriptorConfig[14],
            descriptorConfig[15],
            descriptorConfig[16],
-           device.s_name);
+           device.s_name,
+           g_speedNames[speed]);
+    if (isProgressKnown && !isInvalid && !isRejected) {
+        stats_verdict_print(&progress, g_criterion, isDeviceSupported);
+    }
+    printf("\n");
 
-    return isDeviceSupported;
+    return isDeviceSupported ? OutcomeSupported : isInvalid ? OutcomeInvalid : isRejected ? OutcomeRejected : OutcomeNotSupported;
     
 }
 
+/*******************************************************************************
+ * @fn      enumerate_devices
+ *
+ * @brief   Enumerate the devices at each speed of g_speedsMask, speed after
+ *          speed, and print the outcomes per speed when there are several
+ *
+ * @return  None
+ */
+void
+enumerate_devices(struct Device_t **devices, bool verbose)
+{
+    int outcomes[BbioSpeedCount][OutcomeCount];
+    int countResults = 0;
+
+    memset(outcomes, 0, sizeof(outcomes));
+    // On C-c, the device being enumerated is completed so that its spans of
+    // the trace are closed, the trace is then written by main()
+    for (int speed = 0; speed < BbioSpeedCount && !g_isInterrupted; ++speed) {
+        if (!(g_speedsMask & (1u << speed))) {
+            continue;
+        }
+        for (struct Device_t **ppDevice = devices; *ppDevice && !g_isInterrupted; ++ppDevice) {
+            ++outcomes[speed][enumerate_device(**ppDevice, speed, verbose)];
+            ++countResults;
+        }
+    }
+    if (countResults < 2) {
+        return;
+    }
+
+    printf("\n");
+    for (int speed = 0; speed < BbioSpeedCount; ++speed) {
+        if (g_speedsMask & (1u << speed)) {
+            printf("%-4s speed: %d supported, %d not supported, %d invalid at this speed, %d rejected by the board\n", g_speedNames[speed],
+                   outcomes[speed][OutcomeSupported], outcomes[speed][OutcomeNotSupported], outcomes[speed][OutcomeInvalid],
+                   outcomes[speed][OutcomeRejected]);
+        }
+    }
+}
+
 
 /*******************************************************************************
  * @fn      main
@@ -287,27 +463,53 @@ main(void)
 {
     bool exit = false;
     int retCode;
-    int bbioRetCode;
     int userChoice;
-
-    unsigned char buffer[4096];
-    const int capBuffer = 4096;
-
-    char dummyPacket[] = "toto";
-    int dummyPacketSize = sizeof(dummyPacket);
-
-    signal(SIGINT, handler_sigint);
+    unsigned int logMask;
+    unsigned int profilePeriodUs;
+    unsigned int criterion;
+    unsigned int criterionWindowMs;
+    char speeds[8];
+    unsigned int speedsMask;
+    struct ProgressRequests_t requests;
+    int c;
+    struct sigaction actionSigint;
+
+    // Without SA_RESTART the menu input returns on C-c, a second C-c kills the
+    // process if stopping hangs
+    memset(&actionSigint, 0, sizeof(actionSigint));
+    actionSigint.sa_handler = handler_sigint;
+    actionSigint.sa_flags = SA_RESETHAND;
+    sigemptyset(&actionSigint.sa_mask);
+    sigaction(SIGINT, &actionSigint, NULL);
 
     retCode = usb_init_verbose();
     if (retCode) {
         return retCode;
     }
 
+    // The logs are still written if it fails, the binary records undecoded
+    log_decoder_init(elf_firmware_path());
+    if (log_reader_start(log_reader_directory())) {
+        printf("[ERROR]\t Could not start reading the logs in %s/\n", log_reader_directory());
+    }
+    if (getenv(TRACE_FILE_ENV) && trace_start()) {
+        printf("[ERROR]\t Could not start the trace\n");
+    }
+    metrics_start(metrics_file_path());
+    history_load(history_file_path());
+    fingerprint_load(fingerprint_file_path());
+    if (getenv(CAPTURE_FILE_ENV) && capture_start(capture_file_path())) {
+        printf("[ERROR]\t Could not start the capture\n");
+    }
+
 
-    while (!exit) {
+    while (!exit && !g_isInterrupted) {
         // Print menu
         menu_print();
         userChoice = menu_get_input();
+        if (g_isInterrupted) {
+            break;
+        }
         
         // Handle selected action :
         switch (userChoice) {
@@ -324,77 +526,181 @@ main(void)
         // - Enumerate Automode
         case 3:
             printf("Enumeration has started\n");
-            printf("It can take up to 5 seconds (timeout) if the device is not supported by the ToE\n");
+            printf("It can take up to 5 seconds (timeout) if the device is not supported by the ToE,\n");
+            printf("less once the timeout of its class is learned for the ToE (%s)\n", history_toe_name());
             printf("\n");
 
             print_table_devices_header();
 
-            for (struct Device_t **ppDevice = g_devices; *ppDevice; ++ppDevice) {
-                enumerate_device(**ppDevice, g_verbosity);
-                usleep(500000);
-            }
+            enumerate_devices(g_devices, g_verbosity);
             break;
         // - Enumerate Audio
         case 4:
-            enumerate_device(g_deviceAudio, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_deviceAudio, NULL }, g_verbosity);
             break;
         // - Enumerate CDC
         case 5:
-            enumerate_device(g_deviceCdc, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_deviceCdc, NULL }, g_verbosity);
             break;
         // - Enumerate Keyboard
         case 6:
-            enumerate_device(g_deviceKeyboard, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_deviceKeyboard, NULL }, g_verbosity);
             break;
         // - Enumerate Image
         case 7:
-            enumerate_device(g_deviceImage, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_deviceImage, NULL }, g_verbosity);
             break;
         // - Enumerate Image
         case 8:
-            enumerate_device(g_devicePrinter, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_devicePrinter, NULL }, g_verbosity);
             break;
         // - Enumerate Mass Storage
         case 9:
-            enumerate_device(g_deviceMassStorage, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_deviceMassStorage, NULL }, g_verbosity);
             break;
         // - Enumerate Smart Card
         case 10:
-            enumerate_device(g_deviceSmartCard, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_deviceSmartCard, NULL }, g_verbosity);
             break;
         // - Enumerate Personal Healthcare
         case 11:
-            enumerate_device(g_devicePersonalHealthcare, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_devicePersonalHealthcare, NULL }, g_verbosity);
             break;
         // - Enumerate Video
         case 12:
-            enumerate_device(g_deviceVideo, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_deviceVideo, NULL }, g_verbosity);
             break;
         // - Enumerate DFU
         case 13:
-            enumerate_device(g_deviceDFU, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_deviceDFU, NULL }, g_verbosity);
             break;
         // - Enumerate FTDI
         case 14:
-            enumerate_device(g_deviceFTDI, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_deviceFTDI, NULL }, g_verbosity);
             break;
         // - Enumerate Hub
         case 15:
-            enumerate_device(g_deviceHub, g_verbosity);
+            enumerate_devices((struct Device_t *[]){ &g_deviceHub, NULL }, g_verbosity);
             break;
-        // - Get log
-        case 98:
-            // TODOO: Fix bug where the first IN bulk transfer is empty (even
-            // when there is data to transmit)
-            memset(buffer, 0, capBuffer);
-            printf("Top Board:\n");
-            usb_log_print(EP_DEBUG_BOARD_TOP, buffer, capBuffer);
-            usb_log_print(EP_DEBUG_BOARD_TOP, buffer, capBuffer);
-            printf("Bottom Board:\n");
-            memset(buffer, 0, capBuffer);
-            usb_log_print(EP_DEBUG_BOARD_BOTTOM, buffer, capBuffer);
-            usb_log_print(EP_DEBUG_BOARD_BOTTOM, buffer, capBuffer);
+        // - Print inter-board link health
+        case 16:
+            stats_link_health_print();
+            break;
+        // - Retrain inter-board link
+        case 17:
+            printf("Retraining inter-board link\n");
+            stats_link_retrain();
+            break;
+        // - Set log levels mask
+        case 18:
+            printf("Log mask (hex, 4 bits per module main/bbio/usb/link, from the bit 0: error warn info trace): ");
+            retCode = scanf("%x", &logMask);
+            // Discard the rest of the line
+            if (scanf("%*[^\n]") == EOF || getchar() == EOF || retCode != 1) {
+                printf("[ERROR]\t Invalid mask\n");
+                break;
+            }
+            stats_log_mask_set(logMask);
+            break;
+        // - Toggle event tracing
+        case 19:
+            if (trace_is_enabled()) {
+                trace_stop(trace_file_path());
+            } else if (trace_start()) {
+                printf("[ERROR]\t Could not start the trace\n");
+            } else {
+                printf("Tracing events, select 19 again to write %s\n", trace_file_path());
+            }
+            break;
+        // - Print interrupt statistics
+        case 20:
+            stats_irq_print();
+            break;
+        // - Toggle firmware profiling
+        case 21:
+            if (profile_is_running()) {
+                profile_stop(elf_firmware_path());
+                break;
+            }
+            printf("Sampling period in us (0 for %d): ", PROFILE_PERIOD_US_DEFAULT);
+            retCode = scanf("%u", &profilePeriodUs);
+            // Discard the rest of the line
+            if (scanf("%*[^\n]") == EOF || getchar() == EOF || retCode != 1) {
+                printf("[ERROR]\t Invalid period\n");
+                break;
+            }
+            if (profile_start(profilePeriodUs ? profilePeriodUs : PROFILE_PERIOD_US_DEFAULT) == 0) {
+                printf("Profiling both boards, select 21 again to print the profiles\n");
+            }
             break;
+        // - Print stack usage
+        case 22:
+            stats_stack_print();
+            break;
+        // - Set supported criterion
+        case 23:
+            criterionWindowMs = 0;
+            printf("Supported when (0: SET_CONFIGURATION, 1: traffic on an endpoint other than 0): ");
+            retCode = scanf("%u", &criterion);
+            if (retCode == 1 && criterion == ProgressCriterionEndpointTraffic) {
+                printf("Longest time from SET_CONFIGURATION to the traffic in ms (0 for no limit): ");
+                retCode = scanf("%u", &criterionWindowMs);
+            }
+            // Discard the rest of the line
+            if (scanf("%*[^\n]") == EOF || getchar() == EOF || retCode != 1 || criterion >= ProgressCriterionCount) {
+                printf("[ERROR]\t Invalid criterion\n");
+                break;
+            }
+            if (stats_criterion_set(criterion, criterionWindowMs) == 0) {
+                g_criterion = criterion;
+                g_criterionWindowMs = criterionWindowMs < PROGRESS_WINDOW_MAX_MS ? criterionWindowMs : PROGRESS_WINDOW_MAX_MS;
+            }
+            break;
+        // - Toggle capture of the ToE traffic
+        case 24:
+            if (capture_is_running()) {
+                capture_stop();
+            } else if (capture_start(capture_file_path())) {
+                printf("[ERROR]\t Could not start the capture\n");
+            } else {
+                printf("Capturing the traffic of the ToE in %s, select 24 again to stop\n", capture_file_path());
+            }
+            break;
+        // - Print ToE fingerprint
+        case 25:
+            // The log is kept until the next connection
+            if (stats_requests_get(&requests) == 0) {
+                fingerprint_print(&requests);
+            }
+            break;
+        // - Set emulated speeds
+        case 26:
+            speedsMask = 0;
+            printf("Speeds to emulate each device at (h: high, f: full, l: low, e.g. hf): ");
+            retCode = scanf("%7s", speeds);
+            // Discard the rest of the line
+            if (scanf("%*[^\n]") == EOF || getchar() == EOF) {
+                retCode = 0;
+            }
+            for (char *speed = speeds; retCode == 1 && *speed; ++speed) {
+                speedsMask |= *speed == 'h' ? 1u << BbioSpeedHigh
+                            : *speed == 'f' ? 1u << BbioSpeedFull
+                            : *speed == 'l' ? 1u << BbioSpeedLow : 0;
+            }
+            if (speedsMask == 0) {
+                printf("[ERROR]\t Invalid speeds\n");
+                break;
+            }
+            g_speedsMask = speedsMask;
+            break;
+        // - Tail logs
+        case 98:
+            // The logs are read continuously in the background, this only
+            // prints them as they arrive
+            printf("Logs of both boards, also written in %s/, press Enter to stop\n", log_reader_directory());
+            log_reader_tail(true);
+            while ((c = getchar()) != '\n' && c != EOF);
+            log_reader_tail(false);
             break;
         // - Disconnect Current Device 
         case 99:
@@ -402,21 +708,13 @@ main(void)
             do {
                 printf("Resetting board\n");
                 bbio_command_send(BbioDisconnect);
-                bbioRetCode = bbio_get_return_code();
-                retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL, 0);
-                if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-                bbioRetCode |= bbio_get_return_code();
-            } while (bbioRetCode);
+            } while (bbio_payload_send(NULL, 0));
 
             // Reset descriptors
             do {
                 printf("Resetting descriptors\n");
                 bbio_command_send(BbioResetDescr);
-                bbioRetCode = bbio_get_return_code();
-                retCode = libusb_bulk_transfer(g_deviceHandle, EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL, 0);
-                if (retCode) { printf("[ERROR]\t usb_descriptor_set(): bulk transfer failed"); }
-                bbioRetCode |= bbio_get_return_code();
-            } while (bbioRetCode);
+            } while (bbio_payload_send(NULL, 0));
             break;
         // - exit
         case 0:
@@ -441,6 +739,15 @@ main(void)
     // }
 
 
+    if (g_isInterrupted) {
+        printf("Exiting\n");
+    }
+    if (trace_is_enabled()) {
+        trace_stop(trace_file_path());
+    }
+    capture_stop();
+    metrics_stop();
+    log_reader_stop();
     usb_close();
 
     return 0;
@@ -32,7 +32,18 @@ menu_print(void)
     printf("13) Enumerate DFU\n");
     printf("14) Enumerate FTDI\n");
     printf("15) Enumerate Hub\n");
-    printf("98) Print logs\n");
+    printf("16) Print inter-board link health\n");
+    printf("17) Retrain inter-board link\n");
+    printf("18) Set log levels mask\n");
+    printf("19) Toggle event tracing\n");
+    printf("20) Print interrupt statistics\n");
+    printf("21) Toggle firmware profiling\n");
+    printf("22) Print stack usage\n");
+    printf("23) Set supported criterion\n");
+    printf("24) Toggle capture of the ToE traffic\n");
+    printf("25) Print ToE fingerprint\n");
+    printf("26) Set emulated speeds\n");
+    printf("98) Tail logs\n");
     printf("99) Disconnect Current Device\n");
     printf("\n");
     printf("0) Exit\n");
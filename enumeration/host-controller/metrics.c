@@ -0,0 +1,307 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+
+
+/* macros */
+#define METRICS_PATH_MAX        (1024)
+
+/* structs */
+/* A series: the series of a family (same name) must follow each other */
+struct MetricSeries_t {
+    const char *name;
+    const char *labels;     // NULL if none
+    const char *type;       // "counter" or "gauge"
+    const char *help;
+};
+
+
+/* variables */
+static const struct MetricSeries_t _series[MetricCount] = {
+    [MetricDevices]                 = { "hydradancer_devices", NULL, "counter", "Devices enumerated" },
+    [MetricDevicesSupported]        = { "hydradancer_devices_supported", NULL, "counter", "Devices configured by the ToE" },
+    [MetricToeTimeouts]             = { "hydradancer_toe_timeouts", NULL, "counter", "Devices not configured by the ToE before the timeout" },
+    [MetricToeAbandons]             = { "hydradancer_toe_abandons", NULL, "counter", "Devices not configured, the ToE stopped sending requests before the timeout" },
+    [MetricBbioCommands]            = { "hydradancer_bbio_commands", NULL, "counter", "BBIO commands sent" },
+    [MetricBbioErrors]              = { "hydradancer_bbio_errors", NULL, "counter", "BBIO non zero return codes, BbioGetStatus excepted" },
+    [MetricBbioRetries]             = { "hydradancer_bbio_retries", NULL, "counter", "BBIO commands sent again after an error" },
+    [MetricTransfers]               = { "hydradancer_transfers", NULL, "counter", "EP1 bulk transfers" },
+    [MetricTransferErrors]          = { "hydradancer_transfer_errors", NULL, "counter", "EP1 bulk transfers failed" },
+    [MetricTransferTimeouts]        = { "hydradancer_transfer_timeouts", NULL, "counter", "EP1 bulk transfers timed out" },
+    [MetricTransferBytes]           = { "hydradancer_transfer_bytes", NULL, "counter", "EP1 bytes transferred" },
+    [MetricLogLinesTop]             = { "hydradancer_log_lines", "board=\"top\"", "counter", "Log lines received" },
+    [MetricLogLinesBottom]          = { "hydradancer_log_lines", "board=\"bottom\"", "counter", NULL },
+    [MetricLogDroppedBytesTop]      = { "hydradancer_log_dropped_bytes", "board=\"top\"", "counter", "Log bytes dropped by the firmware" },
+    [MetricLogDroppedBytesBottom]   = { "hydradancer_log_dropped_bytes", "board=\"bottom\"", "counter", NULL },
+    [MetricLogTransferErrorsTop]    = { "hydradancer_log_transfer_errors", "board=\"top\"", "counter", "Log transfers failed" },
+    [MetricLogTransferErrorsBottom] = { "hydradancer_log_transfer_errors", "board=\"bottom\"", "counter", NULL },
+    [MetricStartTimestamp]          = { "hydradancer_start_timestamp_seconds", NULL, "gauge", "Start of the host-controller" },
+    [MetricLastDeviceTimestamp]     = { "hydradancer_last_device_timestamp_seconds", NULL, "gauge", "End of the last enumeration, a stuck rig stops updating it" },
+};
+
+/* Updated by any thread with atomic operations, only read by the writer */
+static uint64_t _values[MetricCount];
+
+/* The writer thread, _stop is protected by _lock */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _wakeUp = PTHREAD_COND_INITIALIZER;
+static pthread_t _thread;
+static bool _running = false;
+static bool _stop = false;
+static char _path[METRICS_PATH_MAX];
+
+/* MetricDevices at each of the last METRICS_RATE_WINDOW writes, only used by
+ * the writer */
+static uint64_t _devicesHistory[METRICS_RATE_WINDOW];
+static double _secondsHistory[METRICS_RATE_WINDOW];    // CLOCK_MONOTONIC
+static int _indexHistory = 0;   // Next entry written, the oldest once full
+static int _countHistory = 0;
+
+
+/* functions implementation */
+
+/*******************************************************************************
+ * @fn      metrics_file_path
+ *
+ * @brief   Get the path of the metrics
+ *
+ * @return  METRICS_FILE_ENV if set, else METRICS_FILE
+ */
+const char *
+metrics_file_path(void)
+{
+    const char *path = getenv(METRICS_FILE_ENV);
+
+    if (path == NULL || path[0] == '\0') {
+        path = METRICS_FILE;
+    }
+    return path;
+}
+
+/*******************************************************************************
+ * @fn      metrics_add
+ *
+ * @brief   Add to a counter
+ *
+ * @return  None
+ */
+void
+metrics_add(enum Metric metric, uint64_t value)
+{
+    __atomic_fetch_add(&_values[metric], value, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * @fn      metrics_set
+ *
+ * @brief   Set a gauge
+ *
+ * @return  None
+ */
+void
+metrics_set(enum Metric metric, uint64_t value)
+{
+    __atomic_store_n(&_values[metric], value, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * @fn      metrics_devices_per_minute
+ *
+ * @brief   Record the number of devices enumerated, and compute the rate since
+ *          the oldest of the last METRICS_RATE_WINDOW writes
+ *
+ * @return  The number of devices per minute
+ */
+static double
+metrics_devices_per_minute(uint64_t devices)
+{
+    int oldest = _countHistory < METRICS_RATE_WINDOW ? 0 : _indexHistory;
+    struct timespec now;
+    double seconds;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    seconds = now.tv_sec + now.tv_nsec / 1e9;
+
+    _devicesHistory[_indexHistory] = devices;
+    _secondsHistory[_indexHistory] = seconds;
+    _indexHistory = (_indexHistory + 1) % METRICS_RATE_WINDOW;
+    if (_countHistory < METRICS_RATE_WINDOW) {
+        ++_countHistory;
+    }
+
+    if (seconds <= _secondsHistory[oldest]) {
+        return 0.0;
+    }
+    return (double)(devices - _devicesHistory[oldest]) * 60.0 / (seconds - _secondsHistory[oldest]);
+}
+
+/*******************************************************************************
+ * @fn      metrics_write
+ *
+ * @brief   Write the metrics in the OpenMetrics text format, to a temporary
+ *          file renamed over the previous one
+ *
+ * @return  0 if success, else a non zero value
+ */
+static int
+metrics_write(const char *path)
+{
+    char pathTemporary[METRICS_PATH_MAX + 8];
+    const struct MetricSeries_t *series;
+    uint64_t values[MetricCount];
+    FILE *file;
+
+    for (int i = 0; i < MetricCount; ++i) {
+        values[i] = __atomic_load_n(&_values[i], __ATOMIC_RELAXED);
+    }
+
+    snprintf(pathTemporary, sizeof(pathTemporary), "%s.tmp", path);
+    file = fopen(pathTemporary, "w");
+    if (file == NULL) {
+        return 1;
+    }
+
+    for (int i = 0; i < MetricCount; ++i) {
+        series = &_series[i];
+
+        // The first series of a family describes it
+        if (i == 0 || strcmp(series->name, _series[i - 1].name)) {
+            fprintf(file, "# TYPE %s %s\n", series->name, series->type);
+            fprintf(file, "# HELP %s %s.\n", series->name, series->help);
+        }
+        fprintf(file, "%s%s", series->name, strcmp(series->type, "counter") ? "" : "_total");
+        if (series->labels) {
+            fprintf(file, "{%s}", series->labels);
+        }
+        fprintf(file, " %llu\n", (unsigned long long)values[i]);
+    }
+
+    fprintf(file, "# TYPE hydradancer_devices_per_minute gauge\n");
+    fprintf(file, "# HELP hydradancer_devices_per_minute Devices enumerated during the last minute.\n");
+    fprintf(file, "hydradancer_devices_per_minute %.2f\n", metrics_devices_per_minute(values[MetricDevices]));
+    fprintf(file, "# EOF\n");
+
+    if (fclose(file)) {
+        remove(pathTemporary);
+        return 2;
+    }
+    // rename() does not replace an existing file on every platform
+    if (rename(pathTemporary, path)) {
+        remove(path);
+        if (rename(pathTemporary, path)) {
+            remove(pathTemporary);
+            return 3;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      metrics_thread
+ *
+ * @brief   Write the metrics every METRICS_PERIOD_US until metrics_stop() is
+ *          called
+ *
+ * @return  NULL
+ */
+static void *
+metrics_thread(void *unused)
+{
+    struct timespec deadline;
+    bool isReported = false;
+
+    (void)unused;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    pthread_mutex_lock(&_lock);
+    while (!_stop) {
+        pthread_mutex_unlock(&_lock);
+        if (metrics_write(_path) && !isReported) {
+            printf("[WARNING]\t metrics_thread(): can not write %s: %s\n", _path, strerror(errno));
+            isReported = true;
+        }
+        pthread_mutex_lock(&_lock);
+
+        deadline.tv_sec += METRICS_PERIOD_US / 1000000;
+        deadline.tv_nsec += (METRICS_PERIOD_US % 1000000) * 1000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_nsec -= 1000000000L;
+            ++deadline.tv_sec;
+        }
+        while (!_stop && pthread_cond_timedwait(&_wakeUp, &_lock, &deadline) != ETIMEDOUT) {
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+
+    return NULL;
+}
+
+/*******************************************************************************
+ * @fn      metrics_start
+ *
+ * @brief   Start writing the metrics in the background
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+metrics_start(const char *path)
+{
+    sigset_t signals;
+    sigset_t signalsPrevious;
+    int retCode;
+
+    if (_running) {
+        return 0;
+    }
+
+    snprintf(_path, sizeof(_path), "%s", path);
+    metrics_set(MetricStartTimestamp, time(NULL));
+    _stop = false;
+
+    // SIGINT is handled by the main thread
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, &signalsPrevious);
+    retCode = pthread_create(&_thread, NULL, metrics_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &signalsPrevious, NULL);
+    if (retCode) {
+        printf("[ERROR]\t metrics_start(): can not create the writer thread: %s\n", strerror(retCode));
+        return 1;
+    }
+
+    _running = true;
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      metrics_stop
+ *
+ * @brief   Write the metrics a last time and stop the background writer
+ *
+ * @return  None
+ */
+void
+metrics_stop(void)
+{
+    if (!_running) {
+        return;
+    }
+
+    pthread_mutex_lock(&_lock);
+    _stop = true;
+    pthread_cond_signal(&_wakeUp);
+    pthread_mutex_unlock(&_lock);
+
+    pthread_join(_thread, NULL);
+    _running = false;
+
+    metrics_write(_path);
+}
@@ -0,0 +1,97 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+
+/* macros */
+/* Default path of the metrics, relative to host-controller/ */
+#define METRICS_FILE            "metrics.prom"
+/* Environment variable overriding METRICS_FILE */
+#define METRICS_FILE_ENV        "HYDRADANCER_METRICS"
+
+/* The file is rewritten at this period, a file older than a few periods means
+ * the host-controller is gone */
+#define METRICS_PERIOD_US       (1000000)
+/* Window of hydradancer_devices_per_minute, in periods */
+#define METRICS_RATE_WINDOW     (60)
+
+
+/* enums */
+/* The series of the registry, see _series in metrics.c. The per board series
+ * are indexed by enum StatsBoard from their Top entry */
+enum Metric {
+    MetricDevices = 0,
+    MetricDevicesSupported,
+    MetricToeTimeouts,
+    MetricToeAbandons,
+    MetricBbioCommands,
+    MetricBbioErrors,
+    MetricBbioRetries,
+    MetricTransfers,
+    MetricTransferErrors,
+    MetricTransferTimeouts,
+    MetricTransferBytes,
+    MetricLogLinesTop,
+    MetricLogLinesBottom,
+    MetricLogDroppedBytesTop,
+    MetricLogDroppedBytesBottom,
+    MetricLogTransferErrorsTop,
+    MetricLogTransferErrorsBottom,
+    MetricStartTimestamp,
+    MetricLastDeviceTimestamp,
+    MetricCount,
+};
+
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : metrics_file_path
+ * Description    : Get the path of the metrics, METRICS_FILE_ENV if set,
+ *                  METRICS_FILE else
+ * Input          : None
+ * Return         : The path of the metrics
+ *******************************************************************************/
+const char *metrics_file_path(void);
+
+/*******************************************************************************
+ * Function Name  : metrics_add
+ * Description    : Add to a counter, lock-free: may be called from any thread
+ * Input          : - metric: The counter
+ *                  - value: The value to add
+ * Return         : None
+ *******************************************************************************/
+void metrics_add(enum Metric metric, uint64_t value);
+
+/*******************************************************************************
+ * Function Name  : metrics_set
+ * Description    : Set a gauge, lock-free: may be called from any thread
+ * Input          : - metric: The gauge
+ *                  - value: The new value
+ * Return         : None
+ *******************************************************************************/
+void metrics_set(enum Metric metric, uint64_t value);
+
+/*******************************************************************************
+ * Function Name  : metrics_start
+ * Description    : Start writing the metrics in the OpenMetrics text format
+ *                  every METRICS_PERIOD_US, in the background. The file is
+ *                  replaced atomically, it can be read at any time (e.g. by
+ *                  the textfile collector of the Prometheus node exporter)
+ * Input          : The path of the metrics, see metrics_file_path()
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int metrics_start(const char *path);
+
+/*******************************************************************************
+ * Function Name  : metrics_stop
+ * Description    : Write the metrics a last time and stop the background
+ *                  writer
+ * Input          : None
+ * Return         : None
+ *******************************************************************************/
+void metrics_stop(void);
+
+
+#endif /* METRICS_H */
@@ -0,0 +1,346 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bbio.h"
+#include "elf.h"
+#include "stats.h"
+#include "usb.h"
+
+#include "profile.h"
+
+
+/* structs */
+/* A line of a profile: a function (address is its start) or an address */
+struct ProfileEntry_t {
+    uint32_t address;
+    int function;       // Index in _functions, -1 if unknown
+    int samples;
+};
+
+
+/* variables */
+/* The samples arrive in the log reader thread, everything below is protected
+ * by _lock */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t _samples[PROFILE_BOARDS][PROFILE_SAMPLES_CAPACITY];
+static int _sizeSamples[PROFILE_BOARDS];
+static int _droppedSamples[PROFILE_BOARDS];
+static bool _collecting = false;    // Until the last records are received
+
+static bool _running = false;
+static struct ElfFunction_t _functions[PROFILE_FUNCTIONS_CAPACITY];
+static int _countFunctions = 0;
+
+
+/* functions implementation */
+
+/*******************************************************************************
+ * @fn      profile_is_running
+ *
+ * @brief   Check if the boards are sampling
+ *
+ * @return  true if running, else false
+ */
+bool
+profile_is_running(void)
+{
+    return _running;
+}
+
+/*******************************************************************************
+ * @fn      profile_samples_add
+ *
+ * @brief   Record the samples of a board, the samples are dropped when full
+ *
+ * @return  None
+ */
+void
+profile_samples_add(int board, const uint32_t *samples, int count)
+{
+    pthread_mutex_lock(&_lock);
+    if (_collecting && board >= 0 && board < PROFILE_BOARDS) {
+        for (int i = 0; i < count; ++i) {
+            if (_sizeSamples[board] < PROFILE_SAMPLES_CAPACITY) {
+                _samples[board][_sizeSamples[board]++] = samples[i];
+            } else {
+                ++_droppedSamples[board];
+            }
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+/*******************************************************************************
+ * @fn      profile_period_set
+ *
+ * @brief   Set the sampling period of both boards, each board replies with
+ *          the period it applied
+ *
+ * @return  0 if success, else a non zero value
+ */
+static int
+profile_period_set(uint32_t periodUs)
+{
+    unsigned char reply[USB20_EP1_MAX_SIZE];
+    uint32_t periodApplied;
+    struct StatsBlocks_t blocks;
+    int sizeReply;
+
+    sizeReply = bbio_command_value_reply(BbioSetProfile, periodUs, reply, sizeof(reply));
+    if (!stats_blocks_begin(&blocks, reply, sizeReply, StatsKindProfile)) {
+        printf("[ERROR]\t profile_period_set(): invalid reply\n");
+        return 1;
+    }
+
+    while (stats_block_next(&blocks)) {
+        if (blocks.sizeBlock != sizeof(periodApplied)) {
+            printf("[ERROR]\t profile_period_set(): unexpected block size %d\n", blocks.sizeBlock);
+            continue;
+        }
+
+        memcpy(&periodApplied, blocks.block, sizeof(periodApplied));
+        if (periodApplied) {
+            printf("%s Board sampling every %u us\n", blocks.board == StatsBoardTop ? "Top" : "Bottom", periodApplied);
+        }
+    }
+    if (blocks.isTruncated) {
+        printf("[ERROR]\t profile_period_set(): truncated block\n");
+        return 2;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      profile_start
+ *
+ * @brief   Discard the previous samples and start sampling both boards
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+profile_start(uint32_t periodUs)
+{
+    pthread_mutex_lock(&_lock);
+    memset(_sizeSamples, 0, sizeof(_sizeSamples));
+    memset(_droppedSamples, 0, sizeof(_droppedSamples));
+    _collecting = true;
+    pthread_mutex_unlock(&_lock);
+
+    if (profile_period_set(periodUs)) {
+        pthread_mutex_lock(&_lock);
+        _collecting = false;
+        pthread_mutex_unlock(&_lock);
+        return 1;
+    }
+
+    _running = true;
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      profile_function_find
+ *
+ * @brief   Find the function containing an address, the functions without
+ *          size are assumed to end at the next one
+ *
+ * @return  The index of the function, -1 if unknown
+ */
+static int
+profile_function_find(uint32_t address)
+{
+    int low = 0;
+    int high = _countFunctions - 1;
+    int found = -1;
+
+    // Last function starting at or before the address
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+
+        if (_functions[middle].address <= address) {
+            found = middle;
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    if (found < 0 || (_functions[found].size && address - _functions[found].address >= _functions[found].size)) {
+        return -1;
+    }
+    return found;
+}
+
+/*******************************************************************************
+ * @fn      profile_u32_compare
+ *
+ * @brief   Order the samples by address, for qsort()
+ *
+ * @return  < 0, 0 or > 0 as strcmp()
+ */
+static int
+profile_u32_compare(const void *a, const void *b)
+{
+    uint32_t valueA = *(const uint32_t *)a;
+    uint32_t valueB = *(const uint32_t *)b;
+
+    return (valueA > valueB) - (valueA < valueB);
+}
+
+/*******************************************************************************
+ * @fn      profile_entry_compare
+ *
+ * @brief   Order the entries by decreasing number of samples, for qsort()
+ *
+ * @return  < 0, 0 or > 0 as strcmp()
+ */
+static int
+profile_entry_compare(const void *a, const void *b)
+{
+    const struct ProfileEntry_t *entryA = a;
+    const struct ProfileEntry_t *entryB = b;
+
+    if (entryA->samples != entryB->samples) {
+        return entryB->samples - entryA->samples;
+    }
+    return (entryA->address > entryB->address) - (entryA->address < entryB->address);
+}
+
+/*******************************************************************************
+ * @fn      profile_entries_print
+ *
+ * @brief   Print the PROFILE_PRINT_MAX entries with the most samples
+ *
+ * @return  None
+ */
+static void
+profile_entries_print(struct ProfileEntry_t *entries, int countEntries, int countSamples, bool isAddress)
+{
+    qsort(entries, countEntries, sizeof(*entries), profile_entry_compare);
+
+    for (int i = 0; i < countEntries && i < PROFILE_PRINT_MAX; ++i) {
+        const struct ProfileEntry_t *entry = &entries[i];
+
+        printf("    %8d %6.2f%%  0x%08x  ", entry->samples, 100.0 * entry->samples / countSamples, entry->address);
+        if (entry->function < 0) {
+            printf("??\n");
+        } else if (isAddress) {
+            printf("%s+0x%x\n", _functions[entry->function].name, entry->address - _functions[entry->function].address);
+        } else {
+            printf("%s\n", _functions[entry->function].name);
+        }
+    }
+    if (countEntries > PROFILE_PRINT_MAX) {
+        printf("    (%d more)\n", countEntries - PROFILE_PRINT_MAX);
+    }
+}
+
+/*******************************************************************************
+ * @fn      profile_board_print
+ *
+ * @brief   Print the profile of a board: per function, then per address
+ *          (flat). Called with _lock held
+ *
+ * @return  0 if success, else a non zero value
+ */
+static int
+profile_board_print(int board)
+{
+    uint32_t *samples = _samples[board];
+    int countSamples = _sizeSamples[board];
+    struct ProfileEntry_t *entries;
+    int *samplesPerFunction;
+    int countEntries = 0;
+
+    printf("%s Board: %d samples", board == StatsBoardTop ? "Top" : "Bottom", countSamples);
+    if (_droppedSamples[board]) {
+        printf(" (%d dropped)", _droppedSamples[board]);
+    }
+    printf("\n");
+    if (countSamples == 0) {
+        return 0;
+    }
+
+    entries = malloc(countSamples * sizeof(*entries));
+    samplesPerFunction = calloc(_countFunctions + 1, sizeof(*samplesPerFunction));
+    if (entries == NULL || samplesPerFunction == NULL) {
+        free(entries);
+        free(samplesPerFunction);
+        return 1;
+    }
+
+    qsort(samples, countSamples, sizeof(*samples), profile_u32_compare);
+
+    // Per function, the unknown addresses are counted at index 0
+    for (int i = 0; i < countSamples; ++i) {
+        ++samplesPerFunction[profile_function_find(samples[i]) + 1];
+    }
+    for (int i = 0; i <= _countFunctions; ++i) {
+        if (samplesPerFunction[i]) {
+            entries[countEntries].address = i ? _functions[i - 1].address : 0;
+            entries[countEntries].function = i - 1;
+            entries[countEntries].samples = samplesPerFunction[i];
+            ++countEntries;
+        }
+    }
+    printf("  Per function:\n");
+    printf("     Samples       %%  Address     Function\n");
+    profile_entries_print(entries, countEntries, countSamples, false);
+
+    // Per address, the samples are sorted
+    countEntries = 0;
+    for (int i = 0; i < countSamples; ++i) {
+        if (countEntries && entries[countEntries - 1].address == samples[i]) {
+            ++entries[countEntries - 1].samples;
+            continue;
+        }
+        entries[countEntries].address = samples[i];
+        entries[countEntries].function = profile_function_find(samples[i]);
+        entries[countEntries].samples = 1;
+        ++countEntries;
+    }
+    printf("  Per address:\n");
+    printf("     Samples       %%  Address     Location\n");
+    profile_entries_print(entries, countEntries, countSamples, true);
+
+    free(entries);
+    free(samplesPerFunction);
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      profile_stop
+ *
+ * @brief   Stop sampling, then print the profile of each board
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+profile_stop(const char *elfPath)
+{
+    int retCode;
+
+    retCode = profile_period_set(0);
+    _running = false;
+
+    // The records already queued on the boards are still accepted
+    usleep(PROFILE_DRAIN_US);
+    pthread_mutex_lock(&_lock);
+    _collecting = false;
+
+    _countFunctions = elf_functions_read(elfPath, _functions, PROFILE_FUNCTIONS_CAPACITY);
+    if (_countFunctions < 0) {
+        printf("[WARNING]\t profile_stop(): no symbol table in %s, the samples are not symbolised\n", elfPath);
+        _countFunctions = 0;
+    }
+
+    for (int board = 0; board < PROFILE_BOARDS; ++board) {
+        retCode |= profile_board_print(board);
+    }
+    pthread_mutex_unlock(&_lock);
+
+    return retCode;
+}
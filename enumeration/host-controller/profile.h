@@ -0,0 +1,63 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* macros */
+/* Samples kept per board until the profile is printed */
+#define PROFILE_SAMPLES_CAPACITY    (1 << 20)
+/* Functions of the firmware ELF */
+#define PROFILE_FUNCTIONS_CAPACITY  (8192)
+/* Lines of each table */
+#define PROFILE_PRINT_MAX           (20)
+/* Default sampling period, see firmware/src/profile.h PROFILE_PERIOD_US_* */
+#define PROFILE_PERIOD_US_DEFAULT   (1000)
+/* Time for the last records to reach the host once the boards stop */
+#define PROFILE_DRAIN_US            (200000)
+/* Must match enum StatsBoard */
+#define PROFILE_BOARDS              (2)
+
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : profile_is_running
+ * Description    : Check if the boards are sampling, see profile_start()
+ * Input          : None
+ * Return         : true if running, else false
+ *******************************************************************************/
+bool profile_is_running(void);
+
+/*******************************************************************************
+ * Function Name  : profile_start
+ * Description    : Discard the previous samples and start sampling the PC of
+ *                  both boards (BbioSetProfile), the samples are received with
+ *                  the logs, see log_reader.h
+ * Input          : The sampling period in us
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int profile_start(uint32_t periodUs);
+
+/*******************************************************************************
+ * Function Name  : profile_stop
+ * Description    : Stop sampling, then print the profile of each board per
+ *                  function and per address, symbolised with the firmware ELF
+ * Input          : The path of the firmware ELF, see elf_firmware_path()
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int profile_stop(const char *elfPath);
+
+/*******************************************************************************
+ * Function Name  : profile_samples_add
+ * Description    : Record the samples of a board, thread-safe. The samples
+ *                  received while not running are dropped
+ * Input          : - board: enum StatsBoard
+ *                  - samples and count: The PCs sampled
+ * Return         : None
+ *******************************************************************************/
+void profile_samples_add(int board, const uint32_t *samples, int count);
+
+
+#endif /* PROFILE_H */
@@ -0,0 +1,669 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bbio.h"
+#include "usb.h"
+
+#include "stats.h"
+
+
+/* variables */
+static const char *_hspiNames[LINK_HSPI_SETTINGS_COUNT] = {
+    "32 bits", "16 bits", "8 bits",
+};
+static const char *_serdesNames[LINK_SERDES_SETTINGS_COUNT] = {
+    "1.20 Gbps", "1.08 Gbps", "0.96 Gbps", "0.72 Gbps", "0.60 Gbps",
+};
+static const char *_logModuleNames[LOG_MODULES_COUNT] = {
+    "main", "bbio", "usb", "link",
+};
+static const char *_logLevelNames[LOG_LEVELS_COUNT] = {
+    "error", "warn", "info", "trace",
+};
+static const char *_irqHandlerNames[IRQ_STATS_HANDLERS_COUNT] = {
+    "USB", "HSPI", "SerDes",
+};
+static const char *_progressStageNames[ProgressStageCount] = {
+    "bus reset", "device descriptor", "SET_ADDRESS", "configuration descriptor",
+    "string descriptor", "SET_CONFIGURATION", "endpoint traffic",
+};
+static const char *_setupNames[IRQ_STATS_SETUP_COUNTERS] = {
+    "GET_STATUS", "CLEAR_FEATURE", "request 2", "SET_FEATURE", "request 4",
+    "SET_ADDRESS", "GET_DESCRIPTOR", "SET_DESCRIPTOR", "GET_CONFIGURATION",
+    "SET_CONFIGURATION", "GET_INTERFACE", "SET_INTERFACE", "SYNCH_FRAME",
+    "other standard", "class", "vendor",
+};
+
+
+/* functions implementation */
+
+/*******************************************************************************
+ * @fn      stats_calibration_print
+ *
+ * @brief   Print the calibration results of one link as seen by one board
+ *
+ * @return  None
+ */
+static void
+stats_calibration_print(const char *name, const char **settingNames, const struct LinkCalibrationResult_t *results, int count, int selected)
+{
+    printf("  %s calibration:\n", name);
+    printf("    Setting      Frames  FrameErr   BitErr  Throughput\n");
+    for (int i = 0; i < count; ++i) {
+        printf("    %-10s %8u  %8u %8u %7u kB/s%s\n",
+               settingNames[i],
+               results[i].frames,
+               results[i].frameErrors,
+               results[i].bitErrors,
+               results[i].throughput,
+               i == selected ? "  (selected)" : "");
+    }
+}
+
+/*******************************************************************************
+ * @fn      stats_link_report_print
+ *
+ * @brief   Print the link report of one board
+ *
+ * @return  None
+ */
+static void
+stats_link_report_print(enum StatsBoard board, const struct LinkReport_t *report)
+{
+    // Each board only knows its own side : the receiver counts the errors,
+    // the transmitter measures the throughput
+    printf("%s Board (%s):\n",
+           board == StatsBoardTop ? "Top" : "Bottom",
+           report->calibrated ? "calibrated" : "default settings");
+    printf("  HSPI   %-9s : frames %u, CRC_ERR %u, NUM_MIS %u, FIFO_OV %u\n",
+           _hspiNames[report->hspiSetting % LINK_HSPI_SETTINGS_COUNT],
+           report->health.hspiFrames,
+           report->health.hspiCrcErrors,
+           report->health.hspiNumMismatches,
+           report->health.hspiFifoOverflows);
+    printf("  SerDes %-9s : frames %u, RX_ERR %u, FIFO_OV %u, invalid headers %u\n",
+           _serdesNames[report->serdesSetting % LINK_SERDES_SETTINGS_COUNT],
+           report->health.serdesFrames,
+           report->health.serdesRxErrors,
+           report->health.serdesFifoOverflows,
+           report->health.serdesInvalidHeaders);
+    printf("  Retrains         : %u (last %u us, max %u us), failed %u\n",
+           report->health.retrains,
+           report->health.lastRetrainUs,
+           report->health.maxRetrainUs,
+           report->health.retrainFailures);
+
+    if (report->calibrated) {
+        stats_calibration_print("HSPI", _hspiNames, report->calibrationHspi, LINK_HSPI_SETTINGS_COUNT, report->hspiSetting);
+        stats_calibration_print("SerDes", _serdesNames, report->calibrationSerdes, LINK_SERDES_SETTINGS_COUNT, report->serdesSetting);
+    }
+}
+
+/*******************************************************************************
+ * @fn      stats_blocks_begin
+ *
+ * @brief   Check the header of a reply and start iterating over its blocks
+ *
+ * @return  true if the reply is valid, false else
+ */
+bool
+stats_blocks_begin(struct StatsBlocks_t *blocks, const unsigned char *reply, int sizeReply, enum StatsKind kind)
+{
+    memset(blocks, 0, sizeof(*blocks));
+    blocks->reply = reply;
+    blocks->sizeReply = sizeReply;
+    blocks->cursor = 2;
+
+    return sizeReply >= 2 && reply[0] == 0 && reply[1] == kind;
+}
+
+/*******************************************************************************
+ * @fn      stats_block_next
+ *
+ * @brief   Move to the next block (board, size, payload) of a reply
+ *
+ * @return  true if there is a block, false at the end of the reply or if the
+ *          block is truncated
+ */
+bool
+stats_block_next(struct StatsBlocks_t *blocks)
+{
+    int cursor = blocks->cursor;
+
+    if (cursor + 2 > blocks->sizeReply) {
+        return false;
+    }
+
+    blocks->board = blocks->reply[cursor];
+    blocks->sizeBlock = blocks->reply[cursor + 1];
+    blocks->block = blocks->reply + cursor + 2;
+    if (cursor + 2 + blocks->sizeBlock > blocks->sizeReply) {
+        blocks->isTruncated = true;
+        blocks->cursor = blocks->sizeReply;
+        return false;
+    }
+
+    blocks->cursor = cursor + 2 + blocks->sizeBlock;
+    return true;
+}
+
+/*******************************************************************************
+ * @fn      stats_link_health_print
+ *
+ * @brief   Query both boards for the inter-board link health and the
+ *          calibration results, then print them
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+stats_link_health_print(void)
+{
+    unsigned char reply[USB20_EP1_MAX_SIZE];
+    struct LinkReport_t report;
+    struct StatsBlocks_t blocks;
+    int sizeReply;
+
+    sizeReply = bbio_command_reply(BbioGetLinkHealth, reply, sizeof(reply));
+    if (!stats_blocks_begin(&blocks, reply, sizeReply, StatsKindLinkHealth)) {
+        printf("[ERROR]\t stats_link_health_print(): invalid reply\n");
+        return 1;
+    }
+
+    while (stats_block_next(&blocks)) {
+        if (blocks.sizeBlock != sizeof(report)) {
+            printf("[ERROR]\t stats_link_health_print(): unexpected block size %d\n", blocks.sizeBlock);
+            continue;
+        }
+
+        memcpy(&report, blocks.block, sizeof(report));
+        stats_link_report_print(blocks.board, &report);
+    }
+    if (blocks.isTruncated) {
+        printf("[ERROR]\t stats_link_health_print(): truncated block\n");
+        return 2;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      stats_link_retrains_get
+ *
+ * @brief   Query both boards for their count of retrains and of failed
+ *          retrains, without printing anything as the link may still be
+ *          retraining
+ *
+ * @return  The mask of the boards which replied (bit per enum StatsBoard)
+ */
+static int
+stats_link_retrains_get(uint32_t retrains[StatsBoardCount], uint32_t failures[StatsBoardCount])
+{
+    unsigned char reply[USB20_EP1_MAX_SIZE];
+    struct LinkReport_t report;
+    struct StatsBlocks_t blocks;
+    int sizeReply;
+    int boards = 0;
+
+    sizeReply = bbio_command_reply(BbioGetLinkHealth, reply, sizeof(reply));
+    if (!stats_blocks_begin(&blocks, reply, sizeReply, StatsKindLinkHealth)) {
+        return 0;
+    }
+
+    while (stats_block_next(&blocks)) {
+        if (blocks.sizeBlock != sizeof(report) || blocks.board >= StatsBoardCount) {
+            continue;
+        }
+
+        memcpy(&report, blocks.block, sizeof(report));
+        retrains[blocks.board] = report.health.retrains;
+        failures[blocks.board] = report.health.retrainFailures;
+        boards |= 1 << blocks.board;
+    }
+
+    return boards;
+}
+
+/*******************************************************************************
+ * @fn      stats_link_retrain
+ *
+ * @brief   Retrain the inter-board link, then poll the link health until each
+ *          board counted the retrain, or a failed retrain, and print it
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+stats_link_retrain(void)
+{
+    uint32_t retrainsBefore[StatsBoardCount];
+    uint32_t retrains[StatsBoardCount];
+    uint32_t failuresBefore[StatsBoardCount];
+    uint32_t failures[StatsBoardCount];
+    int boards;
+    int boardsReplied;
+    int boardsRetrained = 0;
+    int boardsFailed = 0;
+
+    boards = stats_link_retrains_get(retrainsBefore, failuresBefore);
+    if (boards == 0) {
+        printf("[ERROR]\t stats_link_retrain(): link health unknown\n");
+        return 1;
+    }
+
+    do {
+        bbio_command_send(BbioLinkRetrain);
+    } while (bbio_payload_send(NULL, 0));
+
+    // Both boards resynchronise, the retrain is counted once the link is back
+    for (int elapsedUs = 0; elapsedUs < LINK_RETRAIN_TIMEOUT_US && (boardsRetrained | boardsFailed) != boards; elapsedUs += LINK_RETRAIN_POLL_US) {
+        usleep(LINK_RETRAIN_POLL_US);
+        boardsReplied = stats_link_retrains_get(retrains, failures);
+        for (int board = 0; board < StatsBoardCount; ++board) {
+            if (!(boardsReplied & boards & (1 << board))) {
+                continue;
+            }
+            if (retrains[board] != retrainsBefore[board]) {
+                boardsRetrained |= 1 << board;
+            } else if (failures[board] != failuresBefore[board]) {
+                boardsFailed |= 1 << board;
+            }
+        }
+    }
+    if (boardsFailed) {
+        // The board gave up the resynchronisation, the link is left as it was
+        printf("[ERROR]\t The inter-board link retrain failed, the other board did not join\n");
+        stats_link_health_print();
+        return 3;
+    }
+    if (boardsRetrained != boards) {
+        printf("[ERROR]\t The inter-board link did not recover within %d ms\n", LINK_RETRAIN_TIMEOUT_US / 1000);
+        return 2;
+    }
+
+    return stats_link_health_print();
+}
+
+/*******************************************************************************
+ * @fn      stats_log_mask_set
+ *
+ * @brief   Set the runtime log mask, each board replies with the mask it
+ *          applied
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+stats_log_mask_set(uint32_t mask)
+{
+    unsigned char reply[USB20_EP1_MAX_SIZE];
+    uint32_t maskApplied;
+    struct StatsBlocks_t blocks;
+    int sizeReply;
+
+    sizeReply = bbio_command_value_reply(BbioSetLogMask, mask, reply, sizeof(reply));
+    if (!stats_blocks_begin(&blocks, reply, sizeReply, StatsKindLogMask)) {
+        printf("[ERROR]\t stats_log_mask_set(): invalid reply\n");
+        return 1;
+    }
+
+    while (stats_block_next(&blocks)) {
+        if (blocks.sizeBlock != sizeof(maskApplied)) {
+            printf("[ERROR]\t stats_log_mask_set(): unexpected block size %d\n", blocks.sizeBlock);
+            continue;
+        }
+
+        memcpy(&maskApplied, blocks.block, sizeof(maskApplied));
+        printf("%s Board log mask 0x%08x:\n", blocks.board == StatsBoardTop ? "Top" : "Bottom", maskApplied);
+        for (int module = 0; module < LOG_MODULES_COUNT; ++module) {
+            printf("  %-4s :", _logModuleNames[module]);
+            for (int level = 0; level < LOG_LEVELS_COUNT; ++level) {
+                if (maskApplied & (1u << (module * LOG_LEVELS_COUNT + level))) {
+                    printf(" %s", _logLevelNames[level]);
+                }
+            }
+            printf("\n");
+        }
+    }
+    if (blocks.isTruncated) {
+        printf("[ERROR]\t stats_log_mask_set(): truncated block\n");
+        return 2;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      stats_irq_board_print
+ *
+ * @brief   Print the interrupt statistics of one board, the empty buckets
+ *          are skipped
+ *
+ * @return  None
+ */
+static void
+stats_irq_board_print(enum StatsBoard board, const struct IrqStats_t *stats)
+{
+    bool isEmpty;
+
+    printf("%s Board interrupts (since the previous query):\n", board == StatsBoardTop ? "Top" : "Bottom");
+    printf("  Time (us)  ");
+    for (int handler = 0; handler < IRQ_STATS_HANDLERS_COUNT; ++handler) {
+        printf(" %6s lat %6s dur", _irqHandlerNames[handler], _irqHandlerNames[handler]);
+    }
+    printf("\n");
+
+    for (int bucket = 0; bucket < IRQ_STATS_BUCKETS; ++bucket) {
+        isEmpty = true;
+        for (int handler = 0; handler < IRQ_STATS_HANDLERS_COUNT; ++handler) {
+            isEmpty &= stats->handlers[handler].latency[bucket] == 0 && stats->handlers[handler].duration[bucket] == 0;
+        }
+        if (isEmpty) {
+            continue;
+        }
+
+        // Upper bound of the bucket, the last one has none
+        if (bucket < IRQ_STATS_BUCKETS - 1) {
+            printf("  < %-9.2f", (double)(1u << (bucket + IRQ_STATS_BUCKET_SHIFT)) / IRQ_STATS_TICKS_PER_US);
+        } else {
+            printf("  >= %-8.2f", (double)(1u << (bucket + IRQ_STATS_BUCKET_SHIFT - 1)) / IRQ_STATS_TICKS_PER_US);
+        }
+        for (int handler = 0; handler < IRQ_STATS_HANDLERS_COUNT; ++handler) {
+            printf(" %10u %10u", stats->handlers[handler].latency[bucket], stats->handlers[handler].duration[bucket]);
+        }
+        printf("\n");
+    }
+
+    printf("  Max        ");
+    for (int handler = 0; handler < IRQ_STATS_HANDLERS_COUNT; ++handler) {
+        printf(" %10.2f %10.2f",
+               (double)stats->handlers[handler].latencyMax / IRQ_STATS_TICKS_PER_US,
+               (double)stats->handlers[handler].durationMax / IRQ_STATS_TICKS_PER_US);
+    }
+    printf("\n");
+
+    printf("  SETUP      :");
+    for (int i = 0; i < IRQ_STATS_SETUP_COUNTERS; ++i) {
+        if (stats->setupCounters[i]) {
+            printf(" %s %u", _setupNames[i], stats->setupCounters[i]);
+        }
+    }
+    printf("\n");
+}
+
+/*******************************************************************************
+ * @fn      stats_irq_print
+ *
+ * @brief   Query both boards for the interrupt statistics, then print them
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+stats_irq_print(void)
+{
+    unsigned char reply[USB20_EP1_MAX_SIZE];
+    struct IrqStats_t stats;
+    struct StatsBlocks_t blocks;
+    int sizeReply;
+
+    sizeReply = bbio_command_reply(BbioGetIrqStats, reply, sizeof(reply));
+    if (!stats_blocks_begin(&blocks, reply, sizeReply, StatsKindIrq)) {
+        printf("[ERROR]\t stats_irq_print(): invalid reply\n");
+        return 1;
+    }
+
+    while (stats_block_next(&blocks)) {
+        if (blocks.sizeBlock != sizeof(stats)) {
+            printf("[ERROR]\t stats_irq_print(): unexpected block size %d\n", blocks.sizeBlock);
+            continue;
+        }
+
+        memcpy(&stats, blocks.block, sizeof(stats));
+        stats_irq_board_print(blocks.board, &stats);
+    }
+    if (blocks.isTruncated) {
+        printf("[ERROR]\t stats_irq_print(): truncated block\n");
+        return 2;
+    }
+
+    printf("The latency is an upper bound, only known when an interrupt is held off by another one\n");
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      stats_stack_board_print
+ *
+ * @brief   Print the stack report of one board
+ *
+ * @return  None
+ */
+static void
+stats_stack_board_print(enum StatsBoard board, const struct StackReport_t *report)
+{
+    printf("%s Board stack (since boot): %u / %u bytes used at most (%.0f%%)\n",
+           board == StatsBoardTop ? "Top" : "Bottom", report->highWater, report->size,
+           report->size ? 100.0 * report->highWater / report->size : 0.0);
+    printf("  Handler  Max stack (bytes)  Max duration (us)\n");
+    for (int handler = 0; handler < IRQ_STATS_HANDLERS_COUNT; ++handler) {
+        printf("  %-7s", _irqHandlerNames[handler]);
+        if (report->handlers[handler].stackMax) {
+            printf(" %18u", report->handlers[handler].stackMax);
+        } else {
+            printf(" %18s", "-");
+        }
+        printf(" %18.2f\n", (double)report->handlers[handler].durationMax / IRQ_STATS_TICKS_PER_US);
+    }
+}
+
+/*******************************************************************************
+ * @fn      stats_stack_print
+ *
+ * @brief   Query both boards for the stack report, then print it
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+stats_stack_print(void)
+{
+    unsigned char reply[USB20_EP1_MAX_SIZE];
+    struct StackReport_t report;
+    struct StatsBlocks_t blocks;
+    int sizeReply;
+
+    sizeReply = bbio_command_reply(BbioGetStack, reply, sizeof(reply));
+    if (!stats_blocks_begin(&blocks, reply, sizeReply, StatsKindStack)) {
+        printf("[ERROR]\t stats_stack_print(): invalid reply\n");
+        return 1;
+    }
+
+    while (stats_block_next(&blocks)) {
+        if (blocks.sizeBlock != sizeof(report)) {
+            printf("[ERROR]\t stats_stack_print(): unexpected block size %d\n", blocks.sizeBlock);
+            continue;
+        }
+
+        memcpy(&report, blocks.block, sizeof(report));
+        stats_stack_board_print(blocks.board, &report);
+    }
+    if (blocks.isTruncated) {
+        printf("[ERROR]\t stats_stack_print(): truncated block\n");
+        return 2;
+    }
+
+    printf("The stack of the handlers is only measured by a firmware built with STACK_STATS=1\n");
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      stats_progress_get
+ *
+ * @brief   Query the bottom board for the enumeration milestones
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+stats_progress_get(struct Progress_t *progress)
+{
+    unsigned char reply[USB20_EP1_MAX_SIZE];
+    struct StatsBlocks_t blocks;
+    int sizeReply;
+
+    sizeReply = bbio_command_reply(BbioGetProgress, reply, sizeof(reply));
+    if (!stats_blocks_begin(&blocks, reply, sizeReply, StatsKindProgress)) {
+        printf("[ERROR]\t stats_progress_get(): invalid reply\n");
+        return 1;
+    }
+
+    // The top board does not emulate the device, its block is ignored
+    while (stats_block_next(&blocks)) {
+        if (blocks.board == StatsBoardBottom && blocks.sizeBlock == sizeof(*progress)) {
+            memcpy(progress, blocks.block, sizeof(*progress));
+            return 0;
+        }
+    }
+    if (blocks.isTruncated) {
+        printf("[ERROR]\t stats_progress_get(): truncated block\n");
+        return 2;
+    }
+
+    printf("[ERROR]\t stats_progress_get(): no block from the bottom board\n");
+    return 3;
+}
+
+/*******************************************************************************
+ * @fn      stats_progress_print
+ *
+ * @brief   Print the milestones reached, with their time from BbioConnect
+ *
+ * @return  None
+ */
+void
+stats_progress_print(const struct Progress_t *progress)
+{
+    printf("Enumeration progress: %u SETUP packets, the last one %.1f ms ago\n",
+           progress->setups, progress->sinceSetupUs / 1000.0);
+    for (int stage = 0; stage < ProgressStageCount; ++stage) {
+        if (progress->stages & (1u << stage)) {
+            printf("  %-25s +%.1f ms\n", _progressStageNames[stage], progress->stageUs[stage] / 1000.0);
+        } else {
+            printf("  %-25s -\n", _progressStageNames[stage]);
+        }
+    }
+    for (int index = 0; index < 2 * PROGRESS_ENDPOINTS; ++index) {
+        if (progress->endpoints & (1u << index)) {
+            printf("  EP%d %-21s +%.1f ms\n", index % PROGRESS_ENDPOINTS + 1,
+                   index < PROGRESS_ENDPOINTS ? "IN" : "OUT", progress->endpointUs[index] / 1000.0);
+        }
+    }
+}
+
+/*******************************************************************************
+ * @fn      stats_requests_get
+ *
+ * @brief   Query the bottom board for the first SETUP packets of the ToE
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+stats_requests_get(struct ProgressRequests_t *requests)
+{
+    unsigned char reply[USB20_EP1_MAX_SIZE];
+    struct StatsBlocks_t blocks;
+    int sizeReply;
+
+    sizeReply = bbio_command_reply(BbioGetRequests, reply, sizeof(reply));
+    if (!stats_blocks_begin(&blocks, reply, sizeReply, StatsKindRequests)) {
+        printf("[ERROR]\t stats_requests_get(): invalid reply\n");
+        return 1;
+    }
+
+    // Only the bottom board block is meaningful, see stats_progress_get()
+    while (stats_block_next(&blocks)) {
+        if (blocks.board != StatsBoardBottom || blocks.sizeBlock < (int)sizeof(requests->setups)
+            || (blocks.sizeBlock - sizeof(requests->setups)) % sizeof(*requests->requests)) {
+            continue;
+        }
+
+        memcpy(&requests->setups, blocks.block, sizeof(requests->setups));
+        requests->count = (blocks.sizeBlock - sizeof(requests->setups)) / sizeof(*requests->requests);
+        if (requests->count > PROGRESS_REQUESTS) {
+            requests->count = PROGRESS_REQUESTS;
+        }
+        memcpy(requests->requests, blocks.block + sizeof(requests->setups),
+               requests->count * sizeof(*requests->requests));
+        return 0;
+    }
+    if (blocks.isTruncated) {
+        printf("[ERROR]\t stats_requests_get(): truncated block\n");
+        return 2;
+    }
+
+    printf("[ERROR]\t stats_requests_get(): no block from the bottom board\n");
+    return 3;
+}
+
+/*******************************************************************************
+ * @fn      stats_criterion_set
+ *
+ * @brief   Select when the bottom board reports the emulated device supported,
+ *          the window is sent in the 24 upper bits
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+stats_criterion_set(enum ProgressCriterion criterion, uint32_t windowMs)
+{
+    char dummyPacket[] = "toto";
+    int dummyPacketSize = sizeof(dummyPacket);
+
+    if (windowMs > PROGRESS_WINDOW_MAX_MS) {
+        windowMs = PROGRESS_WINDOW_MAX_MS;
+    }
+
+    bbio_command_value_send(BbioSetCriterion, criterion | (windowMs << 8));
+    if (bbio_get_return_code()) {
+        printf("[ERROR]\t stats_criterion_set(): command failed\n");
+        return 1;
+    }
+    if (bbio_bulk_transfer(EP1OUT, (void *)dummyPacket, dummyPacketSize, NULL)) {
+        printf("[ERROR]\t stats_criterion_set(): bulk transfer failed\n");
+        return 2;
+    }
+    if (bbio_get_return_code()) {
+        printf("[ERROR]\t stats_criterion_set(): unknown criterion %d\n", criterion);
+        return 3;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      stats_verdict_print
+ *
+ * @brief   Print which event made the device supported and when, or how far
+ *          it went if not
+ *
+ * @return  None
+ */
+void
+stats_verdict_print(const struct Progress_t *progress, enum ProgressCriterion criterion, bool isSupported)
+{
+    int first = -1;
+
+    // The transaction the criterion fired on
+    for (int index = 0; index < 2 * PROGRESS_ENDPOINTS; ++index) {
+        if ((progress->endpoints & (1u << index))
+            && (first < 0 || progress->endpointUs[index] < progress->endpointUs[first])) {
+            first = index;
+        }
+    }
+
+    if (isSupported && criterion == ProgressCriterionEndpointTraffic && first >= 0) {
+        printf(" [EP%d %s at %.1f ms]", first % PROGRESS_ENDPOINTS + 1,
+               first < PROGRESS_ENDPOINTS ? "IN" : "OUT", progress->endpointUs[first] / 1000.0);
+    } else if (progress->stages & (1u << ProgressStageSetConfiguration)) {
+        printf(" [SET_CONFIGURATION at %.1f ms%s]", progress->stageUs[ProgressStageSetConfiguration] / 1000.0,
+               !isSupported && criterion == ProgressCriterionEndpointTraffic ? ", no endpoint traffic" : "");
+    }
+}
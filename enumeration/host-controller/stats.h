@@ -0,0 +1,299 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* macros */
+/* Must match firmware/src/link.h */
+#define LINK_HSPI_SETTINGS_COUNT    (3)
+#define LINK_SERDES_SETTINGS_COUNT  (5)
+
+/* Polling of the link health until both boards count the retrain */
+#define LINK_RETRAIN_POLL_US        (10000)
+#define LINK_RETRAIN_TIMEOUT_US     (1000000)
+
+/* enums */
+/* Must match firmware/src/stats.h */
+enum StatsKind {
+    StatsKindLinkHealth = 1,
+    StatsKindLogMask    = 2,
+    StatsKindTrace      = 3,
+    StatsKindIrq        = 4,
+    StatsKindProfile    = 5,
+    StatsKindStack      = 6,
+    StatsKindProgress   = 7,
+    StatsKindRequests   = 8,
+};
+
+enum StatsBoard {
+    StatsBoardTop    = 0,
+    StatsBoardBottom = 1,
+    StatsBoardCount,
+};
+
+/* Enumeration milestones of the emulated device, must match
+ * firmware/src/progress.h */
+enum ProgressStage {
+    ProgressStageBusReset           = 0,
+    ProgressStageDeviceDescriptor   = 1,
+    ProgressStageSetAddress         = 2,
+    ProgressStageConfigDescriptor   = 3,
+    ProgressStageStringDescriptor   = 4,
+    ProgressStageSetConfiguration   = 5,
+    ProgressStageEndpointTraffic    = 6,
+    ProgressStageCount,
+};
+
+/* When the ToE supports the emulated device, must match
+ * firmware/src/progress.h */
+enum ProgressCriterion {
+    ProgressCriterionSetConfiguration   = 0,
+    ProgressCriterionEndpointTraffic    = 1,    // Within a window after SET_CONFIGURATION
+    ProgressCriterionCount,
+};
+
+/* Must match firmware/src/log.h, 4 bits per module, one per level (ERROR is
+ * the bit 0) */
+#define LOG_LEVELS_COUNT    (4)
+#define LOG_MODULES_COUNT   (4)
+
+/* Must match firmware/src/progress.h */
+#define PROGRESS_ENDPOINTS          (7)
+#define PROGRESS_WINDOW_MAX_MS      (30000)
+#define PROGRESS_REQUESTS           (20)
+
+/* Must match firmware/src/irq.h */
+#define IRQ_STATS_HANDLERS_COUNT    (3)
+#define IRQ_STATS_BUCKETS           (16)
+#define IRQ_STATS_BUCKET_SHIFT      (5)
+#define IRQ_STATS_SETUP_COUNTERS    (16)
+#define IRQ_STATS_TICKS_PER_US      (120)
+
+/* structs */
+/* Must match firmware/src/link.h, all the fields are little endian */
+struct LinkHealth_t {
+    uint32_t hspiFrames;
+    uint32_t hspiCrcErrors;
+    uint32_t hspiNumMismatches;
+    uint32_t hspiFifoOverflows;
+    uint32_t serdesFrames;
+    uint32_t serdesRxErrors;
+    uint32_t serdesFifoOverflows;
+    uint32_t serdesInvalidHeaders;
+    uint32_t retrains;
+    uint32_t lastRetrainUs;
+    uint32_t maxRetrainUs;
+    uint32_t retrainFailures;
+};
+
+struct LinkCalibrationResult_t {
+    uint32_t frames;
+    uint32_t frameErrors;
+    uint32_t bitErrors;
+    uint32_t throughput;
+};
+
+struct LinkReport_t {
+    uint8_t hspiSetting;
+    uint8_t serdesSetting;
+    uint8_t calibrated;
+    uint8_t reserved;
+    struct LinkHealth_t health;
+    struct LinkCalibrationResult_t calibrationHspi[LINK_HSPI_SETTINGS_COUNT];
+    struct LinkCalibrationResult_t calibrationSerdes[LINK_SERDES_SETTINGS_COUNT];
+};
+
+/* Must match firmware/src/irq.h IRQ_STATS_SIZE, all the fields are little
+ * endian */
+struct IrqHandlerStats_t {
+    uint32_t latencyMax;
+    uint32_t durationMax;
+    uint16_t latency[IRQ_STATS_BUCKETS];
+    uint16_t duration[IRQ_STATS_BUCKETS];
+};
+
+struct IrqStats_t {
+    struct IrqHandlerStats_t handlers[IRQ_STATS_HANDLERS_COUNT];
+    uint16_t setupCounters[IRQ_STATS_SETUP_COUNTERS];
+};
+
+/* Must match firmware/src/stack.h and irq.h IRQ_WORST_SIZE, all the fields
+ * are little endian */
+struct IrqHandlerWorst_t {
+    uint32_t stackMax;      // 0 unless the firmware is built with STACK_STATS=1
+    uint32_t durationMax;
+};
+
+struct StackReport_t {
+    uint32_t size;
+    uint32_t highWater;
+    struct IrqHandlerWorst_t handlers[IRQ_STATS_HANDLERS_COUNT];
+};
+
+/* Must match firmware/src/progress.h PROGRESS_SIZE, all the fields are little
+ * endian */
+struct Progress_t {
+    uint32_t stages;                        // 1 << enum ProgressStage
+    uint32_t setups;                        // SETUP packets since BbioConnect
+    uint32_t sinceConnectUs;
+    uint32_t sinceSetupUs;                  // Since the last SETUP packet
+    uint32_t stageUs[ProgressStageCount];   // From BbioConnect, 0 if not reached
+    uint32_t endpoints;                     // The bit n - 1: IN n, the bit PROGRESS_ENDPOINTS + n - 1: OUT n
+    uint32_t endpointUs[2 * PROGRESS_ENDPOINTS];    // From BbioConnect to the first transaction, 0 if none
+};
+
+/* Must match firmware/src/progress.h PROGRESS_REQUEST_SIZE */
+struct ProgressRequest_t {
+    uint8_t requestType;
+    uint8_t request;
+    uint16_t value;
+    uint16_t index;
+    uint16_t length;
+    uint32_t us;                            // From BbioConnect
+};
+
+/* The request log, see firmware/src/progress.h PROGRESS_REQUESTS_SIZE */
+struct ProgressRequests_t {
+    uint32_t setups;                        // SETUP packets since BbioConnect
+    int count;                              // The first ones, at most PROGRESS_REQUESTS
+    struct ProgressRequest_t requests[PROGRESS_REQUESTS];
+};
+
+/* Iterator over the blocks of a reply (board, size, payload), see
+ * stats_blocks_begin() */
+struct StatsBlocks_t {
+    const unsigned char *reply;
+    int sizeReply;
+    int cursor;
+    bool isTruncated;       // Set when the last block overflows the reply
+    // The current block, valid when stats_block_next() returned true
+    int board;              // enum StatsBoard
+    int sizeBlock;
+    const unsigned char *block;
+};
+
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : stats_blocks_begin
+ * Description    : Check the header of a reply (return code, enum StatsKind)
+ *                  and start iterating over its blocks
+ * Input          : - blocks: The iterator
+ *                  - reply, sizeReply: The reply, see bbio_command_reply()
+ *                  - kind: The kind expected
+ * Return         : true if the reply is valid, false else
+ *******************************************************************************/
+bool stats_blocks_begin(struct StatsBlocks_t *blocks, const unsigned char *reply, int sizeReply, enum StatsKind kind);
+
+/*******************************************************************************
+ * Function Name  : stats_block_next
+ * Description    : Move to the next block of a reply, a block overflowing the
+ *                  reply ends the iteration and sets isTruncated
+ * Input          : The iterator, see stats_blocks_begin()
+ * Return         : true if there is a block, false else
+ *******************************************************************************/
+bool stats_block_next(struct StatsBlocks_t *blocks);
+
+/*******************************************************************************
+ * Function Name  : stats_link_health_print
+ * Description    : Query both boards for the inter-board link health and the
+ *                  calibration results, then print them
+ * Input          : None
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int stats_link_health_print(void);
+
+/*******************************************************************************
+ * Function Name  : stats_link_retrain
+ * Description    : Retrain the inter-board link, then poll the link health
+ *                  until each board counted the retrain and print it
+ * Input          : None
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int stats_link_retrain(void);
+
+/*******************************************************************************
+ * Function Name  : stats_log_mask_set
+ * Description    : Set the runtime log mask of both boards, then print the
+ *                  levels enabled on each board
+ * Input          : The mask, see firmware/src/log.h LOG_MASK_BIT()
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int stats_log_mask_set(uint32_t mask);
+
+/*******************************************************************************
+ * Function Name  : stats_irq_print
+ * Description    : Query both boards for the interrupt latency and duration
+ *                  histograms and the SETUP counters, then print them. The
+ *                  boards reset them, each query covers the time since the
+ *                  previous one
+ * Input          : None
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int stats_irq_print(void);
+
+/*******************************************************************************
+ * Function Name  : stats_stack_print
+ * Description    : Query both boards for the stack high-water mark and the
+ *                  worst stack depth and duration of each interrupt handler
+ *                  since boot, then print them
+ * Input          : None
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int stats_stack_print(void);
+
+/*******************************************************************************
+ * Function Name  : stats_progress_get
+ * Description    : Query the bottom board for the enumeration milestones of
+ *                  the emulated device since BbioConnect
+ * Input          : The record to fill
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int stats_progress_get(struct Progress_t *progress);
+
+/*******************************************************************************
+ * Function Name  : stats_progress_print
+ * Description    : Print the milestones reached, with their time from
+ *                  BbioConnect
+ * Input          : The record, see stats_progress_get()
+ * Return         : None
+ *******************************************************************************/
+void stats_progress_print(const struct Progress_t *progress);
+
+/*******************************************************************************
+ * Function Name  : stats_requests_get
+ * Description    : Query the bottom board for the first SETUP packets of the
+ *                  ToE since BbioConnect
+ * Input          : The log to fill
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int stats_requests_get(struct ProgressRequests_t *requests);
+
+/*******************************************************************************
+ * Function Name  : stats_criterion_set
+ * Description    : Select when the bottom board reports the emulated device
+ *                  supported (BbioGetStatus)
+ * Input          : - criterion: enum ProgressCriterion
+ *                  - windowMs: ProgressCriterionEndpointTraffic only, the
+ *                    longest time from SET_CONFIGURATION to the traffic, 0 for
+ *                    no limit, at most PROGRESS_WINDOW_MAX_MS
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int stats_criterion_set(enum ProgressCriterion criterion, uint32_t windowMs);
+
+/*******************************************************************************
+ * Function Name  : stats_verdict_print
+ * Description    : Print, without a new line, which event made the device
+ *                  supported and when, or how far it went if not
+ * Input          : - progress: The record, see stats_progress_get()
+ *                  - criterion: The criterion selected
+ *                  - isSupported: The verdict of the bottom board
+ * Return         : None
+ *******************************************************************************/
+void stats_verdict_print(const struct Progress_t *progress, enum ProgressCriterion criterion, bool isSupported);
+
+
+#endif /* STATS_H */
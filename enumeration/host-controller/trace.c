@@ -0,0 +1,494 @@
+#include <libusb-1.0/libusb.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bbio.h"
+#include "stats.h"
+#include "usb.h"
+
+#include "trace.h"
+
+
+/* macros */
+/* Must match firmware/src/trace.h enum TraceId and enum TracePhase */
+#define TRACE_BOARD_IDS_COUNT   (10)
+#define TRACE_BOARD_ID_BBIO     (9)
+#define TRACE_BOARD_PHASES_COUNT (3)
+
+
+/* structs */
+struct TraceEvent_t {
+    double timestampUs;
+    double durationUs;  // 'X' only
+    const char *name;
+    uint32_t arg;       // 'X': the transferred size
+    int32_t length;     // 'X' only
+    int16_t result;     // 'X' only, libusb_bulk_transfer()
+    uint8_t endpoint;   // 'X' only
+    uint8_t process;    // enum TraceProcess
+    uint8_t thread;     // enum TraceThread
+    char phase;
+};
+
+
+/* variables */
+static const char *_boardEventNames[TRACE_BOARD_IDS_COUNT] = {
+    "unknown",
+    "USB interrupt",
+    "HSPI interrupt",
+    "SerDes interrupt",
+    "HSPI TX done",
+    "HSPI RX",
+    "SerDes TX",
+    "SerDes RX",
+    "SETUP",
+    "BBIO command",
+};
+static const char _boardPhases[TRACE_BOARD_PHASES_COUNT] = { 'i', 'B', 'E' };
+static const char *_processNames[TraceProcessCount] = {
+    "host-controller", "Top board (Board1)", "Bottom board (Board2)",
+};
+static const char *_threadNames[TraceThreadCount] = {
+    "main", "bbio",
+};
+
+static struct TraceEvent_t _events[TRACE_EVENTS_CAPACITY];
+static int _sizeEvents = 0;
+static int _droppedEvents = 0;
+static bool _enabled = false;
+static struct timespec _origin;
+
+/* Replies of one fetch, placed on the timeline once all are received */
+static unsigned char _replies[TRACE_FETCH_EXCHANGES_MAX][USB20_EP1_MAX_SIZE];
+static int _sizeReplies[TRACE_FETCH_EXCHANGES_MAX];
+static double _roundTripUs = 0;
+
+
+/* functions implementation */
+
+/*******************************************************************************
+ * @fn      trace_file_path
+ *
+ * @brief   Get the path of the trace
+ *
+ * @return  TRACE_FILE_ENV if set, else TRACE_FILE
+ */
+const char *
+trace_file_path(void)
+{
+    const char *path = getenv(TRACE_FILE_ENV);
+
+    if (path == NULL || path[0] == '\0') {
+        path = TRACE_FILE;
+    }
+    return path;
+}
+
+/*******************************************************************************
+ * @fn      trace_is_enabled
+ *
+ * @brief   Check if the events are recorded
+ *
+ * @return  true if enabled, else false
+ */
+bool
+trace_is_enabled(void)
+{
+    return _enabled;
+}
+
+/*******************************************************************************
+ * @fn      trace_now_us
+ *
+ * @brief   Get the time of the host timeline, monotonic
+ *
+ * @return  The number of microseconds since trace_start()
+ */
+double
+trace_now_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - _origin.tv_sec) * 1e6 + (now.tv_nsec - _origin.tv_nsec) / 1e3;
+}
+
+/*******************************************************************************
+ * @fn      trace_event_reserve
+ *
+ * @brief   Reserve the next event if the trace is enabled
+ *
+ * @return  The event, NULL if the trace is disabled or full
+ */
+static struct TraceEvent_t *
+trace_event_reserve(void)
+{
+    if (!_enabled) {
+        return NULL;
+    }
+    if (_sizeEvents >= TRACE_EVENTS_CAPACITY) {
+        ++_droppedEvents;
+        return NULL;
+    }
+
+    return &_events[_sizeEvents++];
+}
+
+/*******************************************************************************
+ * @fn      trace_event_add
+ *
+ * @brief   Record an event if the trace is enabled
+ *
+ * @return  None
+ */
+void
+trace_event_add(enum TraceProcess process, enum TraceThread thread, char phase,
+                const char *name, double timestampUs, uint32_t arg)
+{
+    struct TraceEvent_t *event = trace_event_reserve();
+
+    if (event == NULL) {
+        return;
+    }
+
+    event->timestampUs = timestampUs;
+    event->name = name;
+    event->arg = arg;
+    event->process = process;
+    event->thread = thread;
+    event->phase = phase;
+}
+
+/*******************************************************************************
+ * @fn      trace_transfer_add
+ *
+ * @brief   Record a bulk transfer of the host as a complete event
+ *
+ * @return  None
+ */
+void
+trace_transfer_add(const char *name, unsigned char endpoint, int length, int transferred,
+                   int result, double submitUs, double completeUs)
+{
+    struct TraceEvent_t *event = trace_event_reserve();
+
+    if (event == NULL) {
+        return;
+    }
+
+    event->timestampUs = submitUs;
+    event->durationUs = completeUs - submitUs;
+    event->name = name;
+    event->arg = transferred;
+    event->length = length;
+    event->result = result;
+    event->endpoint = endpoint;
+    event->process = TraceProcessHost;
+    event->thread = TraceThreadBbio;
+    event->phase = 'X';
+}
+
+/*******************************************************************************
+ * @fn      trace_begin
+ *
+ * @brief   Record the beginning of a span of the host main thread
+ *
+ * @return  None
+ */
+void
+trace_begin(const char *name)
+{
+    trace_event_add(TraceProcessHost, TraceThreadMain, 'B', name, trace_now_us(), 0);
+}
+
+/*******************************************************************************
+ * @fn      trace_end
+ *
+ * @brief   Record the end of a span of the host main thread
+ *
+ * @return  None
+ */
+void
+trace_end(const char *name)
+{
+    trace_event_add(TraceProcessHost, TraceThreadMain, 'E', name, trace_now_us(), 0);
+}
+
+/*******************************************************************************
+ * @fn      trace_read_u32
+ *
+ * @brief   Read a little endian 32 bits value
+ *
+ * @return  The value read
+ */
+static uint32_t
+trace_read_u32(const unsigned char *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/*******************************************************************************
+ * @fn      trace_block_next
+ *
+ * @brief   Move to the next trace block of a reply, the blocks too short or
+ *          of an unknown board are skipped
+ *
+ * @return  true if there is a block, false else
+ */
+static bool
+trace_block_next(struct StatsBlocks_t *blocks)
+{
+    while (stats_block_next(blocks)) {
+        if (blocks->sizeBlock >= TRACE_BLOCK_HEADER_SIZE && blocks->board + 1 < TraceProcessCount) {
+            return true;
+        }
+    }
+    if (blocks->isTruncated) {
+        printf("[ERROR]\t trace_block_next(): truncated block\n");
+    }
+
+    return false;
+}
+
+/*******************************************************************************
+ * @fn      trace_block_place
+ *
+ * @brief   Place the events of a block on the host timeline. The ticks are
+ *          relative to the clock sample of the block, itself relative to the
+ *          clock sample of the board correlated with the host (the board
+ *          ticks wrap around every ~35 s, the events must be fetched before)
+ *
+ * @return  None
+ */
+static void
+trace_block_place(int board, const unsigned char *block, int sizeBlock, uint32_t ticksSync, double syncUs)
+{
+    uint32_t ticksBlock = trace_read_u32(block);
+    uint16_t dropped = block[4] | (block[5] << 8);
+    double blockUs = syncUs + (int32_t)(ticksBlock - ticksSync) / (double)TRACE_TICKS_PER_US;
+    enum TraceProcess process = board + 1;
+
+    for (int i = TRACE_BLOCK_HEADER_SIZE; i + TRACE_EVENT_SIZE <= sizeBlock; i += TRACE_EVENT_SIZE) {
+        const unsigned char *event = block + i;
+        uint32_t ticks = trace_read_u32(event);
+        uint16_t arg = event[4] | (event[5] << 8);
+        uint8_t id = event[6] < TRACE_BOARD_IDS_COUNT ? event[6] : 0;
+        uint8_t phase = event[7];
+
+        if (phase >= TRACE_BOARD_PHASES_COUNT) {
+            continue;
+        }
+        trace_event_add(process,
+                        id == TRACE_BOARD_ID_BBIO ? TraceThreadBbio : TraceThreadMain,
+                        _boardPhases[phase],
+                        _boardEventNames[id],
+                        blockUs - (ticksBlock - ticks) / (double)TRACE_TICKS_PER_US,
+                        arg);
+    }
+
+    if (dropped) {
+        trace_event_add(process, TraceThreadMain, 'i', "events dropped", blockUs, dropped);
+    }
+}
+
+/*******************************************************************************
+ * @fn      trace_boards_fetch
+ *
+ * @brief   Fetch the events of both boards and place them on the host
+ *          timeline
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+trace_boards_fetch(void)
+{
+    uint32_t ticksSync[TraceProcessCount] = { 0 };
+    double syncUs = 0;
+    double beforeUs;
+    double afterUs;
+    bool isPending = true;
+    unsigned char bbioRetCode;
+    int countReplies;
+    struct StatsBlocks_t blocks;
+
+    _roundTripUs = -1;
+    for (countReplies = 0; isPending && countReplies < TRACE_FETCH_EXCHANGES_MAX; ++countReplies) {
+        unsigned char *reply = _replies[countReplies];
+
+        bbio_command_send(BbioGetTrace);
+        bbioRetCode = bbio_get_return_code();
+
+        // The boards sample their clock between the dummy packet and the
+        // reply, the middle of the shortest exchange is the best estimate.
+        // The dummy packet is sent even if the command failed, the bottom
+        // board expects it
+        beforeUs = trace_now_us();
+        _sizeReplies[countReplies] = bbio_dummy_reply(reply, USB20_EP1_MAX_SIZE);
+        afterUs = trace_now_us();
+        if (bbioRetCode) {
+            printf("[ERROR]\t trace_boards_fetch(): BbioGetTrace failed\n");
+            return 1;
+        }
+        if (!stats_blocks_begin(&blocks, reply, _sizeReplies[countReplies], StatsKindTrace)) {
+            printf("[ERROR]\t trace_boards_fetch(): invalid reply\n");
+            return 2;
+        }
+
+        if (_roundTripUs < 0 || afterUs - beforeUs < _roundTripUs) {
+            _roundTripUs = afterUs - beforeUs;
+            syncUs = (beforeUs + afterUs) / 2;
+            while (trace_block_next(&blocks)) {
+                ticksSync[blocks.board] = trace_read_u32(blocks.block);
+            }
+        }
+
+        isPending = false;
+        stats_blocks_begin(&blocks, reply, _sizeReplies[countReplies], StatsKindTrace);
+        while (trace_block_next(&blocks)) {
+            isPending |= (blocks.block[6] | blocks.block[7]) != 0;
+        }
+    }
+
+    for (int i = 0; i < countReplies; ++i) {
+        stats_blocks_begin(&blocks, _replies[i], _sizeReplies[i], StatsKindTrace);
+        while (trace_block_next(&blocks)) {
+            trace_block_place(blocks.board, blocks.block, blocks.sizeBlock, ticksSync[blocks.board], syncUs);
+        }
+    }
+
+    if (isPending) {
+        printf("[WARNING]\t trace_boards_fetch(): events still pending after %d exchanges\n", countReplies);
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      trace_json_string_print
+ *
+ * @brief   Print a JSON string, quoted and escaped
+ *
+ * @return  None
+ */
+static void
+trace_json_string_print(FILE *file, const char *string)
+{
+    fputc('"', file);
+    for (; *string; ++string) {
+        if (*string == '"' || *string == '\\') {
+            fprintf(file, "\\%c", *string);
+        } else if ((unsigned char)*string < 0x20) {
+            fprintf(file, "\\u%04x", *string);
+        } else {
+            fputc(*string, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/*******************************************************************************
+ * @fn      trace_write
+ *
+ * @brief   Write the events in the Chrome trace event format (JSON), it is
+ *          opened by Perfetto (ui.perfetto.dev) and chrome://tracing
+ *
+ * @return  0 if success, else a non zero value
+ */
+static int
+trace_write(const char *path)
+{
+    FILE *file = fopen(path, "w");
+
+    if (file == NULL) {
+        printf("[ERROR]\t trace_write(): can not open %s\n", path);
+        return 1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for (int process = 0; process < TraceProcessCount; ++process) {
+        fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}},\n",
+                process, _processNames[process]);
+        for (int thread = 0; thread < TraceThreadCount; ++thread) {
+            fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}},\n",
+                    process, thread, _threadNames[thread]);
+        }
+    }
+
+    for (int i = 0; i < _sizeEvents; ++i) {
+        struct TraceEvent_t *event = &_events[i];
+
+        fprintf(file, "{\"name\": ");
+        trace_json_string_print(file, event->name);
+        fprintf(file, ", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d, ",
+                event->phase, event->timestampUs, event->process, event->thread);
+        if (event->phase == 'X') {
+            fprintf(file, "\"dur\": %.3f, \"cat\": \"%s\", \"args\": {\"endpoint\": \"0x%02x\", \"length\": %d, \"transferred\": %u, \"result\": \"%s\"}},\n",
+                    event->durationUs, event->endpoint & LIBUSB_ENDPOINT_IN ? "IN" : "OUT", event->endpoint,
+                    event->length, event->arg, libusb_error_name(event->result));
+        } else {
+            fprintf(file, "\"args\": {\"arg\": \"0x%x\"}%s},\n",
+                    event->arg, event->phase == 'i' ? ", \"s\": \"t\"" : "");
+        }
+    }
+
+    // The last element has no trailing comma
+    fprintf(file, "{\"name\": \"trace_end\", \"ph\": \"i\", \"ts\": %.3f, \"pid\": 0, \"tid\": 0, \"s\": \"g\"}\n]}\n", trace_now_us());
+
+    fclose(file);
+    return 0;
+}
+
+/*******************************************************************************
+ * @fn      trace_start
+ *
+ * @brief   Discard the events of the boards and start recording
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+trace_start(void)
+{
+    int retCode;
+
+    _enabled = false;
+    clock_gettime(CLOCK_MONOTONIC, &_origin);
+    retCode = trace_boards_fetch();
+
+    _sizeEvents = 0;
+    _droppedEvents = 0;
+    _enabled = true;
+
+    return retCode;
+}
+
+/*******************************************************************************
+ * @fn      trace_stop
+ *
+ * @brief   Fetch the last events of the boards, write the trace and stop
+ *          recording
+ *
+ * @return  0 if success, else a non zero value
+ */
+int
+trace_stop(const char *path)
+{
+    int retCode;
+
+    if (!_enabled) {
+        return 1;
+    }
+
+    retCode = trace_boards_fetch();
+    retCode |= trace_write(path);
+    _enabled = false;
+
+    printf("Trace of %d events written to %s, boards clocks correlated within +-%.0f us\n",
+           _sizeEvents, path, _roundTripUs / 2);
+    if (_droppedEvents) {
+        printf("[WARNING]\t trace_stop(): %d events dropped, the trace is full\n", _droppedEvents);
+    }
+
+    return retCode;
+}
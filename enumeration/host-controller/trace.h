@@ -0,0 +1,152 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* macros */
+/* Default path of the trace, relative to host-controller/ */
+#define TRACE_FILE              "trace.json"
+/* Environment variable overriding TRACE_FILE, the trace starts with the
+ * host-controller if it is set */
+#define TRACE_FILE_ENV          "HYDRADANCER_TRACE"
+
+/* Events of the host and of both boards kept until the trace is written,
+ * preallocated. An enumeration records about a hundred transfers */
+#define TRACE_EVENTS_CAPACITY   (1 << 18)
+
+/* Must match firmware/src/trace.h */
+#define TRACE_BLOCK_HEADER_SIZE (8)
+#define TRACE_EVENT_SIZE        (8)
+
+/* Must match firmware/src/timebase.h */
+#define TRACE_TICKS_PER_US      (120)
+
+/* BbioGetTrace exchanges at most per fetch, a board ring (1024 events) is
+ * emptied in 35 exchanges */
+#define TRACE_FETCH_EXCHANGES_MAX (64)
+
+
+/* enums */
+/* The processes of the trace: the host-controller and each board (enum
+ * StatsBoard + 1) */
+enum TraceProcess {
+    TraceProcessHost    = 0,
+    TraceProcessTop     = 1,
+    TraceProcessBottom  = 2,
+    TraceProcessCount,
+};
+
+/* The threads of each process: the BBIO commands span several interrupts of
+ * the boards, they have their own thread so that the spans nest. On the host
+ * it holds the EP1 transfers */
+enum TraceThread {
+    TraceThreadMain     = 0,
+    TraceThreadBbio     = 1,
+    TraceThreadCount,
+};
+
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : trace_file_path
+ * Description    : Get the path of the trace, TRACE_FILE_ENV if set, TRACE_FILE
+ *                  else
+ * Input          : None
+ * Return         : The path of the trace
+ *******************************************************************************/
+const char *trace_file_path(void);
+
+/*******************************************************************************
+ * Function Name  : trace_is_enabled
+ * Description    : Check if the events are recorded, see trace_start()
+ * Input          : None
+ * Return         : true if enabled, else false
+ *******************************************************************************/
+bool trace_is_enabled(void);
+
+/*******************************************************************************
+ * Function Name  : trace_start
+ * Description    : Start recording the events: the events previously recorded
+ *                  by the boards are discarded, the host timeline starts now
+ * Input          : None
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int trace_start(void);
+
+/*******************************************************************************
+ * Function Name  : trace_stop
+ * Description    : Fetch the last events of the boards, write the trace of the
+ *                  host and both boards, then stop recording
+ * Input          : The path of the trace, see trace_file_path()
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int trace_stop(const char *path);
+
+/*******************************************************************************
+ * Function Name  : trace_now_us
+ * Description    : Get the time of the host timeline
+ * Input          : None
+ * Return         : The number of microseconds since trace_start()
+ *******************************************************************************/
+double trace_now_us(void);
+
+/*******************************************************************************
+ * Function Name  : trace_event_add
+ * Description    : Record an event, nothing is done if the trace is not enabled
+ * Input          : - process and thread: Where the event happened
+ *                  - phase: 'B' (begin), 'E' (end) or 'i' (instant)
+ *                  - name: The name of the event, must be kept until the trace
+ *                    is written
+ *                  - timestampUs: See trace_now_us()
+ *                  - arg: Detail of the event, written as "arg"
+ * Return         : None
+ *******************************************************************************/
+void trace_event_add(enum TraceProcess process, enum TraceThread thread, char phase,
+                     const char *name, double timestampUs, uint32_t arg);
+
+/*******************************************************************************
+ * Function Name  : trace_transfer_add
+ * Description    : Record a bulk transfer of the host, nothing is done if the
+ *                  trace is not enabled
+ * Input          : - name: The BBIO command in progress, must be kept until
+ *                    the trace is written
+ *                  - endpoint: The endpoint address
+ *                  - length, transferred: Requested and transferred sizes
+ *                  - result: The return code of libusb_bulk_transfer()
+ *                  - submitUs, completeUs: See trace_now_us()
+ * Return         : None
+ *******************************************************************************/
+void trace_transfer_add(const char *name, unsigned char endpoint, int length, int transferred,
+                        int result, double submitUs, double completeUs);
+
+/*******************************************************************************
+ * Function Name  : trace_begin
+ * Description    : Record the beginning of a span of the host main thread
+ * Input          : The name of the span, see trace_event_add()
+ * Return         : None
+ *******************************************************************************/
+void trace_begin(const char *name);
+
+/*******************************************************************************
+ * Function Name  : trace_end
+ * Description    : Record the end of a span of the host main thread
+ * Input          : The name of the span, see trace_event_add()
+ * Return         : None
+ *******************************************************************************/
+void trace_end(const char *name);
+
+/*******************************************************************************
+ * Function Name  : trace_boards_fetch
+ * Description    : Fetch the events of both boards (BbioGetTrace) until none is
+ *                  pending, and place them on the host timeline. The exchange
+ *                  with the shortest round trip correlates the clocks
+ * Input          : None
+ * Return         : 0 if success, else a non zero value
+ *******************************************************************************/
+int trace_boards_fetch(void);
+
+
+#endif /* TRACE_H */
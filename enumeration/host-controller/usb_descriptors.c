@@ -1,4 +1,7 @@
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "usb_descriptors.h"
 
@@ -96,7 +99,7 @@ unsigned char _genericDescriptorConfig[] = {
 	0x00, // bInterval
 };
 
-struct Device_t g_deviceGeneric = { "Generic", _genericDescriptorDevice, _genericDescriptorConfig, NULL, NULL };
+struct Device_t g_deviceGeneric = { "Generic", _genericDescriptorDevice, _genericDescriptorConfig, NULL, NULL, NULL };
 
 
 /*******************************************************************************
@@ -250,7 +253,7 @@ unsigned char _audioDescriptorConfig[] = {
     0x00, //  wLockDelayH         Unused
 };
 
-struct Device_t g_deviceAudio = { "Audio", _audioDescriptorDevice, _audioDescriptorConfig, NULL, NULL };
+struct Device_t g_deviceAudio = { "Audio", _audioDescriptorDevice, _audioDescriptorConfig, NULL, NULL, NULL };
 
 
 /* CDC descriptors is based on
@@ -361,7 +364,18 @@ unsigned char _cdcDescriptorConfig[] = {
         0x00, // bInterval
 };
 
-struct Device_t g_deviceCdc = { "CDC (Virtual COM Port)", _cdcDescriptorDevice, _cdcDescriptorConfig, NULL, NULL };
+// 115200 bauds, 1 stop bit, no parity, 8 data bits
+const unsigned char _cdcLineCoding[] = { 0x00, 0xC2, 0x01, 0x00, 0x00, 0x00, 0x08 };
+
+const struct UsbResponse_t _cdcResponses[] = {
+    { 0xA1, 0x21, UsbResponseActionData, 0, 0, 0, 0, _cdcLineCoding, sizeof(_cdcLineCoding) },  // GET_LINE_CODING
+    { 0x21, 0x20, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_LINE_CODING
+    { 0x21, 0x22, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_CONTROL_LINE_STATE
+    { 0x21, 0x23, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SEND_BREAK
+    { 0 },
+};
+
+struct Device_t g_deviceCdc = { "CDC (Virtual COM Port)", _cdcDescriptorDevice, _cdcDescriptorConfig, NULL, NULL, _cdcResponses };
 
 
 /*******************************************************************************
@@ -444,7 +458,21 @@ unsigned char _keyboardDescriptorHidReport[] = {
 	0xC0,		    // End Collection
 };
 
-struct Device_t g_deviceKeyboard = { "Keyboard", _keyboardDescriptorDevice, _keyboardDescriptorConfig, _keyboardDescriptorHidReport, NULL };
+const unsigned char _keyboardReport[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };    // No key pressed
+const unsigned char _keyboardIdle[] = { 0x00 };     // Report only on change
+const unsigned char _keyboardProtocol[] = { 0x01 }; // Report protocol
+
+const struct UsbResponse_t _keyboardResponses[] = {
+    { 0xA1, 0x01, UsbResponseActionData, 0, 0, 0, 0, _keyboardReport, sizeof(_keyboardReport) },       // GET_REPORT
+    { 0xA1, 0x02, UsbResponseActionData, 0, 0, 0, 0, _keyboardIdle, sizeof(_keyboardIdle) },           // GET_IDLE
+    { 0xA1, 0x03, UsbResponseActionData, 0, 0, 0, 0, _keyboardProtocol, sizeof(_keyboardProtocol) },   // GET_PROTOCOL
+    { 0x21, 0x09, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_REPORT (LEDs)
+    { 0x21, 0x0A, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_IDLE
+    { 0x21, 0x0B, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_PROTOCOL
+    { 0 },
+};
+
+struct Device_t g_deviceKeyboard = { "Keyboard", _keyboardDescriptorDevice, _keyboardDescriptorConfig, _keyboardDescriptorHidReport, NULL, _keyboardResponses };
 
 /* Image descriptor is based on
  * https://www.xmos.ai/download/AN00132:-USB-Image-Device-Class(2.0.2rc1).pdf
@@ -520,7 +548,7 @@ unsigned char _imageDescriptorConfig[] = {
     0x01, // bInterval
 };
 
-struct Device_t g_deviceImage = { "Image", _imageDescriptorDevice, _imageDescriptorConfig, NULL, NULL };
+struct Device_t g_deviceImage = { "Image", _imageDescriptorDevice, _imageDescriptorConfig, NULL, NULL, NULL };
 
 
 /* Printer descriptor is based on
@@ -581,7 +609,18 @@ unsigned char _printerDescriptorConfig[] = {
     0x01, // bInterval
 };
 
-struct Device_t g_devicePrinter = { "printer", _printerDescriptorDevice, _printerDescriptorConfig, NULL, NULL };
+// IEEE 1284 device ID, its length first (big endian)
+const unsigned char _printerDeviceId[] = "\x00\x22" "MFG:Generic;MDL:Printer;CMD:PCL;";
+const unsigned char _printerPortStatus[] = { 0x18 };    // Selected, no error
+
+const struct UsbResponse_t _printerResponses[] = {
+    { 0xA1, 0x00, UsbResponseActionData, 0, 0, 0, 0, _printerDeviceId, sizeof(_printerDeviceId) - 1 },    // GET_DEVICE_ID
+    { 0xA1, 0x01, UsbResponseActionData, 0, 0, 0, 0, _printerPortStatus, sizeof(_printerPortStatus) },    // GET_PORT_STATUS
+    { 0x21, 0x02, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SOFT_RESET
+    { 0 },
+};
+
+struct Device_t g_devicePrinter = { "printer", _printerDescriptorDevice, _printerDescriptorConfig, NULL, NULL, _printerResponses };
 
 
 /* Mass Storage descriptor is based on
@@ -650,7 +689,15 @@ unsigned char _massStorageDescriptorConfig[] = {
     0x00, // bInterval
 };
 
-struct Device_t g_deviceMassStorage = { "MassStorage", _massStorageDescriptorDevice, _massStorageDescriptorConfig, NULL, NULL };
+const unsigned char _massStorageMaxLun[] = { 0x00 };    // One logical unit
+
+const struct UsbResponse_t _massStorageResponses[] = {
+    { 0xA1, 0xFE, UsbResponseActionData, 0, 0, 0, 0, _massStorageMaxLun, sizeof(_massStorageMaxLun) },  // GET_MAX_LUN
+    { 0x21, 0xFF, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // Bulk-Only Mass Storage Reset
+    { 0 },
+};
+
+struct Device_t g_deviceMassStorage = { "MassStorage", _massStorageDescriptorDevice, _massStorageDescriptorConfig, NULL, NULL, _massStorageResponses };
 
 
 /*******************************************************************************
@@ -771,7 +818,7 @@ unsigned char _smartCardDescriptorConfig[] = {
     0x00, // bInterval
 };
 
-struct Device_t g_deviceSmartCard = { "SmartCard", _smartCardDescriptorDevice, _smartCardDescriptorConfig, NULL, NULL };
+struct Device_t g_deviceSmartCard = { "SmartCard", _smartCardDescriptorDevice, _smartCardDescriptorConfig, NULL, NULL, NULL };
 
 
 /*******************************************************************************
@@ -855,7 +902,7 @@ unsigned char _personalHealthcareDescriptorConfig[] = {
     0x01, // bInterval
 };
 
-struct Device_t g_devicePersonalHealthcare = { "PersonalHealthcare", _personalHealthcareDescriptorDevice, _personalHealthcareDescriptorConfig, NULL, NULL };
+struct Device_t g_devicePersonalHealthcare = { "PersonalHealthcare", _personalHealthcareDescriptorDevice, _personalHealthcareDescriptorConfig, NULL, NULL, NULL };
 
 
 /*******************************************************************************
@@ -1077,7 +1124,7 @@ unsigned char _videoDescriptorConfig[] = {
     0x01, // bInterval
 };
 
-struct Device_t g_deviceVideo = { "Video", _videoDescriptorDevice, _videoDescriptorConfig, NULL, NULL };
+struct Device_t g_deviceVideo = { "Video", _videoDescriptorDevice, _videoDescriptorConfig, NULL, NULL, NULL };
 
 
 /*******************************************************************************
@@ -1146,7 +1193,18 @@ unsigned char _dfuDescriptorConfig[] = {
     0x13, // bcdDFUVersionH
 };
 
-struct Device_t g_deviceDFU = { "DFU", _dfuDescriptorDevice, _dfuDescriptorConfig, NULL, NULL };
+// Run-time mode: OK, no poll timeout, appIDLE
+const unsigned char _dfuStatus[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+const unsigned char _dfuState[] = { 0x00 };
+
+const struct UsbResponse_t _dfuResponses[] = {
+    { 0x21, 0x00, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // DFU_DETACH
+    { 0xA1, 0x03, UsbResponseActionData, 0, 0, 0, 0, _dfuStatus, sizeof(_dfuStatus) },  // DFU_GETSTATUS
+    { 0xA1, 0x05, UsbResponseActionData, 0, 0, 0, 0, _dfuState, sizeof(_dfuState) },    // DFU_GETSTATE
+    { 0 },
+};
+
+struct Device_t g_deviceDFU = { "DFU", _dfuDescriptorDevice, _dfuDescriptorConfig, NULL, NULL, _dfuResponses };
 
 
 /*******************************************************************************
@@ -1212,7 +1270,28 @@ unsigned char _ftdiDescriptorConfig[] = {
     0x00, // bInterval
 };
 
-struct Device_t g_deviceFTDI = { "FTDI", _ftdiDescriptorDevice, _ftdiDescriptorConfig, NULL, NULL };
+// The requests of the ftdi_sio driver of Linux and of the D2XX drivers
+const unsigned char _ftdiModemStatus[] = { 0x01, 0x60 };    // Line status: THRE and TEMT
+const unsigned char _ftdiLatency[] = { 0x10 };              // 16 ms
+const unsigned char _ftdiEeprom[] = { 0xFF, 0xFF };         // Blank EEPROM
+
+const struct UsbResponse_t _ftdiResponses[] = {
+    { 0x40, 0x00, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // RESET
+    { 0x40, 0x01, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_MODEM_CTRL
+    { 0x40, 0x02, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_FLOW_CTRL
+    { 0x40, 0x03, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_BAUD_RATE
+    { 0x40, 0x04, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_DATA
+    { 0xC0, 0x05, UsbResponseActionData, 0, 0, 0, 0, _ftdiModemStatus, sizeof(_ftdiModemStatus) },  // GET_MODEM_STATUS
+    { 0x40, 0x06, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_EVENT_CHAR
+    { 0x40, 0x07, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_ERROR_CHAR
+    { 0x40, 0x09, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_LATENCY_TIMER
+    { 0xC0, 0x0A, UsbResponseActionData, 0, 0, 0, 0, _ftdiLatency, sizeof(_ftdiLatency) },  // GET_LATENCY_TIMER
+    { 0x40, 0x0B, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_BITMODE
+    { 0xC0, 0x90, UsbResponseActionData, 0, 0, 0, 0, _ftdiEeprom, sizeof(_ftdiEeprom) },    // READ_EEPROM
+    { 0 },
+};
+
+struct Device_t g_deviceFTDI = { "FTDI", _ftdiDescriptorDevice, _ftdiDescriptorConfig, NULL, NULL, _ftdiResponses };
 
 /*******************************************************************************
  * DEVICE HUB
@@ -1286,7 +1365,20 @@ unsigned char _hubDescriptorReport[] = {
     0xFF, // bPortPwrCtrlMask
 };
 
-struct Device_t g_deviceHub = { "Hub", _hubDescriptorDevice, _hubDescriptorConfig, NULL, _hubDescriptorReport };
+// The hub descriptor is answered by the firmware (HUB_GET_DESCRIPTOR)
+const unsigned char _hubStatus[] = { 0x00, 0x00, 0x00, 0x00 };     // Local power, no change
+const unsigned char _hubPortStatus[] = { 0x00, 0x01, 0x00, 0x00 }; // Powered, nothing connected
+
+const struct UsbResponse_t _hubResponses[] = {
+    { 0xA0, 0x00, UsbResponseActionData, 0, 0, 0, 0, _hubStatus, sizeof(_hubStatus) },          // GET_STATUS (hub)
+    { 0xA3, 0x00, UsbResponseActionData, 0, 0, 0, 0, _hubPortStatus, sizeof(_hubPortStatus) },  // GET_STATUS (port)
+    { 0x20, 0x01, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // CLEAR_FEATURE (hub)
+    { 0x23, 0x01, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // CLEAR_FEATURE (port)
+    { 0x23, 0x03, UsbResponseActionAck,  0, 0, 0, 0, NULL, 0 },    // SET_FEATURE (port)
+    { 0 },
+};
+
+struct Device_t g_deviceHub = { "Hub", _hubDescriptorDevice, _hubDescriptorConfig, NULL, _hubDescriptorReport, _hubResponses };
 
 
 /*******************************************************************************
@@ -1309,3 +1401,117 @@ struct Device_t *g_devices[] = {
     NULL,   // Careful, must be null terminated
 };
 
+
+/*******************************************************************************
+ * @fn      usb_response_fill
+ *
+ * @brief   Serialize a response for BbioSubSetDescrResponder
+ *
+ * @return  The number of bytes written, 0 if it does not fit
+ */
+int
+usb_response_fill(const struct UsbResponse_t *response, unsigned char *buffer, int capacity)
+{
+    int sizeData = response->action == UsbResponseActionData ? response->sizeData : 0;
+
+    if (USB_RESPONSE_HEADER_SIZE + sizeData > capacity) {
+        return 0;
+    }
+
+    buffer[0] = response->requestType;
+    buffer[1] = response->request;
+    buffer[2] = response->action;
+    buffer[3] = 0;
+    buffer[4] = response->value & 0xFF;
+    buffer[5] = response->value >> 8;
+    buffer[6] = response->valueMask & 0xFF;
+    buffer[7] = response->valueMask >> 8;
+    buffer[8] = response->index & 0xFF;
+    buffer[9] = response->index >> 8;
+    buffer[10] = response->indexMask & 0xFF;
+    buffer[11] = response->indexMask >> 8;
+    if (sizeData) {
+        memcpy(buffer + USB_RESPONSE_HEADER_SIZE, response->data, sizeData);
+    }
+
+    return USB_RESPONSE_HEADER_SIZE + sizeData;
+}
+
+/*******************************************************************************
+ * @fn      usb_descriptors_speed_adapt
+ *
+ * @brief   Adapt descriptors written for high speed to a slower speed
+ *
+ * @return  None
+ */
+void
+usb_descriptors_speed_adapt(unsigned char *descriptorDevice, unsigned char *descriptorConfig, int sizeConfig, enum BbioSpeed speed)
+{
+    unsigned char *endpoint;
+    int maxPacket;
+    int transferType;
+    int intervalMs;
+
+    if (speed == BbioSpeedHigh) {
+        return;
+    }
+    if (speed == BbioSpeedLow) {
+        descriptorDevice[7] = 8;    // bMaxPacketSize0
+    }
+
+    for (int offset = 0; offset + 7 <= sizeConfig && descriptorConfig[offset] >= 2; offset += descriptorConfig[offset]) {
+        endpoint = descriptorConfig + offset;
+        if (endpoint[1] != DEV_DESCR_ENDP) {
+            continue;
+        }
+        maxPacket = (endpoint[4] | (endpoint[5] << 8)) & 0x07FF;
+        transferType = endpoint[3] & 0x03;
+
+        if (transferType == 0x01) {
+            // Isochronous, bInterval is an exponent of frames rather than
+            // microframes
+            maxPacket = maxPacket > 1023 ? 1023 : maxPacket;
+            endpoint[6] = endpoint[6] > 4 ? endpoint[6] - 3 : 1;
+        } else if (transferType == 0x03) {
+            // Interrupt, bInterval is in frames rather than an exponent of
+            // microframes, 10 ms at least at low speed
+            maxPacket = maxPacket > (speed == BbioSpeedLow ? 8 : 64) ? (speed == BbioSpeedLow ? 8 : 64) : maxPacket;
+            intervalMs = endpoint[6] > 4 ? 1 << ((endpoint[6] > 12 ? 12 : endpoint[6]) - 4) : 1;
+            if (speed == BbioSpeedLow && intervalMs < 10) {
+                intervalMs = 10;
+            }
+            endpoint[6] = intervalMs > 255 ? 255 : intervalMs;
+        } else if (transferType == 0x02 && speed == BbioSpeedFull) {
+            maxPacket = maxPacket > 64 ? 64 : maxPacket;
+        }
+        endpoint[4] = maxPacket & 0xFF;
+        endpoint[5] = maxPacket >> 8;
+    }
+}
+
+/*******************************************************************************
+ * @fn      usb_string_get
+ *
+ * @brief   Get a string of a device for BbioSubSetDescrString
+ *
+ * @return  The text, NULL if the index has no string
+ */
+const char *
+usb_string_get(const struct Device_t *device, int index)
+{
+    static char serial[32] = "";
+
+    switch (index) {
+    case USB_STRING_MANUFACTURER:
+        return USB_STRING_MANUFACTURER_TEXT;
+    case USB_STRING_PRODUCT:
+        return device->s_name;
+    case USB_STRING_SERIAL:
+        if (serial[0] == '\0') {
+            snprintf(serial, sizeof(serial), "HD%08X%%n", (unsigned int)time(NULL));
+        }
+        return serial;
+    default:
+        return NULL;
+    }
+}
@@ -1,14 +1,55 @@
 #ifndef USB_DESCRIPTORS_H
 #define USB_DESCRIPTORS_H
 
+#include "bbio.h"
+
+
+/* macros */
+/* Must match firmware/src/responder.h RESPONDER_RULE_HEADER_SIZE */
+#define USB_RESPONSE_HEADER_SIZE    (12)
+
+/* Indexes of the strings uploaded with every device, see usb_string_get(). The
+ * index 0 (LANGID) is synthesised by the bottom board */
+#define USB_STRING_MANUFACTURER     (1)
+#define USB_STRING_PRODUCT          (2)
+#define USB_STRING_SERIAL           (3)
+#define USB_STRINGS                 (4)
+#define USB_STRING_MANUFACTURER_TEXT "HydraDancer"
 
 /* enums */
+/* What the bottom board does with a class or vendor request, must match
+ * firmware/src/responder.h */
+enum UsbResponseAction {
+    UsbResponseActionEnd    = 0,    // Terminates the responses of a device
+    UsbResponseActionData   = 1,    // IN data stage with the response
+    UsbResponseActionAck    = 2,    // Accept, the OUT data stage if any is discarded
+    UsbResponseActionStall  = 3,
+};
+
+/* structs */
+/* A request matches when (wValue & valueMask) == (value & valueMask), same
+ * for wIndex */
+struct UsbResponse_t {
+    unsigned char requestType;
+    unsigned char request;
+    enum UsbResponseAction action;
+    unsigned short value;
+    unsigned short valueMask;
+    unsigned short index;
+    unsigned short indexMask;
+    const unsigned char *data;  // UsbResponseActionData only
+    int sizeData;
+};
+
 struct Device_t {
     char *s_name;
     unsigned char *descriptorDevice;
     unsigned char *descriptorConfig;
     unsigned char *descriptorHidReport;
     unsigned char *descriptorHubReport;
+    // The class and vendor requests answered by the bottom board, NULL or
+    // terminated by UsbResponseActionEnd
+    const struct UsbResponse_t *responses;
 };
 
 /* variables */
@@ -28,4 +69,46 @@ extern struct Device_t g_deviceHub;
 
 extern struct Device_t *g_devices[];
 
+
+/* functions declaration */
+
+/*******************************************************************************
+ * Function Name  : usb_response_fill
+ * Description    : Serialize a response for BbioSubSetDescrResponder
+ * Input          : - response: The response
+ *                  - buffer and capacity: Where to write it
+ * Return         : The number of bytes written, 0 if it does not fit
+ *******************************************************************************/
+int usb_response_fill(const struct UsbResponse_t *response, unsigned char *buffer, int capacity);
+
+/*******************************************************************************
+ * Function Name  : usb_descriptors_speed_adapt
+ * Description    : Adapt descriptors written for high speed to a slower speed,
+ *                  in place: bMaxPacketSize0 (8 at low speed), the
+ *                  wMaxPacketSize of the endpoints (64 bytes at most, 1023 for
+ *                  the isochronous endpoints, 8 for the interrupt endpoints at
+ *                  low speed) and their bInterval, from microframes to frames.
+ *                  The bulk and isochronous endpoints are left as is at low
+ *                  speed, where they do not exist: BbioConnect rejects them
+ * Input          : - descriptorDevice: The device descriptor
+ *                  - descriptorConfig and sizeConfig: The configuration
+ *                    descriptor and its size
+ *                  - speed: The speed of BbioConnect
+ * Return         : None
+ *******************************************************************************/
+void usb_descriptors_speed_adapt(unsigned char *descriptorDevice, unsigned char *descriptorConfig, int sizeConfig, enum BbioSpeed speed);
+
+/*******************************************************************************
+ * Function Name  : usb_string_get
+ * Description    : Get a string of a device for BbioSubSetDescrString, as its
+ *                  UTF-8 text. The serial number is unique to the campaign
+ *                  (time of the first call) and ends with the "%n" placeholder,
+ *                  replaced by the bottom board with a number incremented at
+ *                  each connection: the ToE can not recognise the device
+ * Input          : - device: The device
+ *                  - index: The index of the string, see USB_STRING_SERIAL
+ * Return         : The text, NULL if the index has no string
+ *******************************************************************************/
+const char *usb_string_get(const struct Device_t *device, int index);
+
 #endif /* USB_DESCRIPTORS_H */